@@ -0,0 +1,1220 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Contact: Iago Toral Quiroga <itoral@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/**
+ * SECTION:grl-net-downloader
+ * @short_description: downloader of binary payloads
+ *
+ * Sources attaching images or other binary data to their medias would
+ * rather not keep every payload in memory. #GrlNetDownloader fetches them
+ * through a #GrlNetWc, running a limited number of downloads at once.
+ * Payloads bigger than a threshold are written to disk while they are
+ * received, and kept in an on-disk store where the least recently used
+ * ones are removed when it grows over its size.
+ *
+ * Concurrent downloads of the same URL share a single transfer.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib/gstdio.h>
+
+#include <grilo.h>
+#include "grl-net-downloader.h"
+
+#define GRL_LOG_DOMAIN_DEFAULT downloader_log_domain
+GRL_LOG_DOMAIN_STATIC(downloader_log_domain);
+
+enum {
+  PROP_0,
+  PROP_WEB_CLIENT,
+  PROP_MAX_DOWNLOADS,
+  PROP_SPOOL_THRESHOLD,
+  PROP_STORE_DIR,
+  PROP_STORE_SIZE
+};
+
+#define CHUNK_SIZE (32 * 1024)
+
+/* Payloads being written to the store */
+#define PART_SUFFIX ".part"
+
+#define GRL_NET_DOWNLOADER_GET_PRIVATE(object)		\
+  (G_TYPE_INSTANCE_GET_PRIVATE((object),                \
+                               GRL_TYPE_NET_DOWNLOADER,	\
+                               GrlNetDownloaderPrivate))
+
+struct _GrlNetDownloaderPrivate {
+  GrlNetWc *wc;
+  guint max_downloads;
+  gsize spool_threshold;        /* bigger payloads go to disk, in bytes */
+  gchar *store_dir;
+  guint store_size;             /* store size in Mb */
+  GHashTable *downloads;        /* url -> running or queued download */
+  GQueue *pending;              /* downloads waiting for a free slot */
+  guint running;
+  gboolean store_loaded;
+  GHashTable *store;            /* blob name -> stored blob */
+  GQueue *store_lru;            /* stored blobs, oldest first */
+  guint64 store_used;           /* bytes in the store */
+  guint stats_downloads;        /* transfers started */
+  guint stats_shared;           /* requests joining a running transfer */
+  guint stats_store_hits;       /* requests served from the store */
+  guint64 stats_store_bytes;    /* bytes served from the store */
+};
+
+struct blob {
+  gchar *name;
+  guint64 size;
+  time_t mtime;                 /* only used when loading the store */
+  GList link;                   /* in the LRU queue */
+};
+
+struct download {
+  GrlNetDownloader *self;
+  gchar *url;
+  gchar *name;                  /* name of the blob in the store */
+  GList *waiters;
+  guint active_waiters;
+  gboolean running;
+  GCancellable *cancellable;
+  GInputStream *input;
+  gchar *chunk;                 /* read buffer */
+  GByteArray *buffer;           /* content kept in memory */
+  GOutputStream *output;        /* spool file, once over the threshold */
+  const gchar *write_data;      /* data not written to the spool yet */
+  gsize write_left;
+  gsize length;
+};
+
+struct download_waiter {
+  struct download *d;
+  GSimpleAsyncResult *result;
+  GCancellable *cancellable;
+  gulong cancel_id;
+  gboolean cancelled;
+};
+
+/* The outcome of a finished download, shared by all its waiters */
+struct download_result {
+  gint refcount;
+  gchar *content;
+  gsize length;
+  gchar *path;
+};
+
+G_DEFINE_TYPE (GrlNetDownloader, grl_net_downloader, G_TYPE_OBJECT);
+
+static void grl_net_downloader_finalize (GObject *object);
+static void grl_net_downloader_set_property (GObject *object,
+                                             guint propid,
+                                             const GValue *value,
+                                             GParamSpec *pspec);
+static void grl_net_downloader_get_property (GObject *object,
+                                             guint propid,
+                                             GValue *value,
+                                             GParamSpec *pspec);
+static void read_next (struct download *d);
+static void start_pending (GrlNetDownloader *self);
+
+static void
+grl_net_downloader_class_init (GrlNetDownloaderClass *klass)
+{
+  GObjectClass *g_klass;
+
+  g_klass = G_OBJECT_CLASS (klass);
+  g_klass->finalize = grl_net_downloader_finalize;
+  g_klass->set_property = grl_net_downloader_set_property;
+  g_klass->get_property = grl_net_downloader_get_property;
+
+  g_type_class_add_private (klass, sizeof (GrlNetDownloaderPrivate));
+
+  /**
+   * GrlNetDownloader::web-client
+   *
+   * The web client used to download. A new one is created if it is not set.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_WEB_CLIENT,
+                                   g_param_spec_object ("web-client",
+                                                        "Web client",
+                                                        "Web client used to download",
+                                                        GRL_TYPE_NET_WC,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT_ONLY |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GrlNetDownloader::max-downloads
+   *
+   * Number of downloads running at the same time. The rest wait in a queue.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_MAX_DOWNLOADS,
+                                   g_param_spec_uint ("max-downloads",
+                                                      "Max downloads",
+                                                      "Downloads running at once",
+                                                      1, G_MAXUINT, 4,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GrlNetDownloader::spool-threshold
+   *
+   * Payloads bigger than this, in bytes, are written to the store while
+   * they are downloaded instead of being kept in memory.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_SPOOL_THRESHOLD,
+                                   g_param_spec_uint ("spool-threshold",
+                                                      "Spool threshold",
+                                                      "Size of the payloads written to disk",
+                                                      0, G_MAXUINT, 64 * 1024,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GrlNetDownloader::store-dir
+   *
+   * Directory where big payloads are stored, or %NULL for the default one
+   * in the user cache directory.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_STORE_DIR,
+                                   g_param_spec_string ("store-dir",
+                                                        "Store directory",
+                                                        "Directory of the stored payloads",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GrlNetDownloader::store-size
+   *
+   * Size of the store in Mb. The least recently used payloads are removed
+   * when it is exceeded.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_STORE_SIZE,
+                                   g_param_spec_uint ("store-size",
+                                                      "Store size",
+                                                      "Size of the store in Mb",
+                                                      0, G_MAXUINT, 64,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+}
+
+static void
+free_blob (struct blob *blob)
+{
+  g_free (blob->name);
+  g_slice_free (struct blob, blob);
+}
+
+static void
+grl_net_downloader_init (GrlNetDownloader *self)
+{
+  GRL_LOG_DOMAIN_INIT (downloader_log_domain, "downloader");
+
+  self->priv = GRL_NET_DOWNLOADER_GET_PRIVATE (self);
+
+  self->priv->downloads = g_hash_table_new (g_str_hash, g_str_equal);
+  self->priv->pending = g_queue_new ();
+  self->priv->store = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             NULL,
+                                             (GDestroyNotify) free_blob);
+  self->priv->store_lru = g_queue_new ();
+}
+
+static void
+store_clear (GrlNetDownloader *self)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+
+  /* Only forget about the blobs, they stay on disk. The queue links are
+     embedded in the blobs, so just empty the queue instead of freeing them */
+  g_queue_init (priv->store_lru);
+  g_hash_table_remove_all (priv->store);
+  priv->store_used = 0;
+  priv->store_loaded = FALSE;
+}
+
+static void
+grl_net_downloader_finalize (GObject *object)
+{
+  GrlNetDownloader *self = GRL_NET_DOWNLOADER (object);
+
+  /* Every download keeps a reference to us */
+  g_warn_if_fail (g_hash_table_size (self->priv->downloads) == 0);
+
+  store_clear (self);
+  g_hash_table_unref (self->priv->store);
+  g_queue_free (self->priv->store_lru);
+  g_hash_table_unref (self->priv->downloads);
+  g_queue_free (self->priv->pending);
+  g_free (self->priv->store_dir);
+  if (self->priv->wc)
+    g_object_unref (self->priv->wc);
+
+  G_OBJECT_CLASS (grl_net_downloader_parent_class)->finalize (object);
+}
+
+static void
+grl_net_downloader_set_property (GObject *object,
+                                 guint propid,
+                                 const GValue *value,
+                                 GParamSpec *pspec)
+{
+  GrlNetDownloader *self = GRL_NET_DOWNLOADER (object);
+
+  switch (propid) {
+  case PROP_WEB_CLIENT:
+    self->priv->wc = g_value_dup_object (value);
+    if (!self->priv->wc)
+      self->priv->wc = grl_net_wc_new ();
+    break;
+  case PROP_MAX_DOWNLOADS:
+    grl_net_downloader_set_max_downloads (self, g_value_get_uint (value));
+    break;
+  case PROP_SPOOL_THRESHOLD:
+    grl_net_downloader_set_spool_threshold (self, g_value_get_uint (value));
+    break;
+  case PROP_STORE_DIR:
+    grl_net_downloader_set_store_dir (self, g_value_get_string (value));
+    break;
+  case PROP_STORE_SIZE:
+    grl_net_downloader_set_store_size (self, g_value_get_uint (value));
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (self, propid, pspec);
+  }
+}
+
+static void
+grl_net_downloader_get_property (GObject *object,
+                                 guint propid,
+                                 GValue *value,
+                                 GParamSpec *pspec)
+{
+  GrlNetDownloader *self = GRL_NET_DOWNLOADER (object);
+
+  switch (propid) {
+  case PROP_WEB_CLIENT:
+    g_value_set_object (value, self->priv->wc);
+    break;
+  case PROP_MAX_DOWNLOADS:
+    g_value_set_uint (value, self->priv->max_downloads);
+    break;
+  case PROP_SPOOL_THRESHOLD:
+    g_value_set_uint (value, (guint) MIN (self->priv->spool_threshold, G_MAXUINT));
+    break;
+  case PROP_STORE_DIR:
+    g_value_set_string (value, self->priv->store_dir);
+    break;
+  case PROP_STORE_SIZE:
+    g_value_set_uint (value, self->priv->store_size);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (self, propid, pspec);
+  }
+}
+
+/* Store */
+
+static gchar *
+get_blob_path (GrlNetDownloader *self,
+               const gchar *name)
+{
+  return g_build_filename (self->priv->store_dir, name, NULL);
+}
+
+static gchar *
+get_part_path (GrlNetDownloader *self,
+               const gchar *name)
+{
+  gchar *part;
+  gchar *path;
+
+  part = g_strconcat (name, PART_SUFFIX, NULL);
+  path = get_blob_path (self, part);
+  g_free (part);
+
+  return path;
+}
+
+static void
+store_remove (GrlNetDownloader *self,
+              struct blob *blob,
+              gboolean unlink)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+  gchar *path;
+
+  if (unlink) {
+    path = get_blob_path (self, blob->name);
+    g_unlink (path);
+    g_free (path);
+  }
+
+  g_queue_unlink (priv->store_lru, &blob->link);
+  priv->store_used -= blob->size;
+  g_hash_table_remove (priv->store, blob->name);
+}
+
+/* Removes the least recently used blobs to make room for @size bytes */
+static void
+store_make_room (GrlNetDownloader *self,
+                 guint64 size)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+  guint64 max = (guint64) priv->store_size * 1024 * 1024;
+
+  while (priv->store_used + size > max &&
+         !g_queue_is_empty (priv->store_lru)) {
+    store_remove (self, g_queue_peek_head (priv->store_lru), TRUE);
+  }
+}
+
+static void
+store_add (GrlNetDownloader *self,
+           const gchar *name,
+           guint64 size)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+  struct blob *blob;
+
+  blob = g_slice_new0 (struct blob);
+  blob->name = g_strdup (name);
+  blob->size = size;
+  blob->link.data = blob;
+
+  g_hash_table_insert (priv->store, blob->name, blob);
+  g_queue_push_tail_link (priv->store_lru, &blob->link);
+  priv->store_used += size;
+}
+
+static gint
+compare_mtime (gconstpointer a,
+               gconstpointer b)
+{
+  const struct blob *blob_a = a;
+  const struct blob *blob_b = b;
+
+  if (blob_a->mtime < blob_b->mtime)
+    return -1;
+  if (blob_a->mtime > blob_b->mtime)
+    return 1;
+  return 0;
+}
+
+/* Reads the blobs left in the store by previous runs */
+static void
+store_load (GrlNetDownloader *self)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+  struct blob *blob;
+  GStatBuf st;
+  GSList *blobs = NULL;
+  GSList *b;
+  const gchar *name;
+  gchar *path;
+  GDir *dir;
+
+  if (priv->store_loaded)
+    return;
+
+  priv->store_loaded = TRUE;
+
+  if (g_mkdir_with_parents (priv->store_dir, 0700) < 0) {
+    GRL_WARNING ("Failed to create download store '%s'", priv->store_dir);
+    return;
+  }
+
+  dir = g_dir_open (priv->store_dir, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name (dir))) {
+    path = get_blob_path (self, name);
+
+    if (g_str_has_suffix (name, PART_SUFFIX)) {
+      /* Interrupted download */
+      g_unlink (path);
+    } else if (g_stat (path, &st) == 0 && S_ISREG (st.st_mode)) {
+      blob = g_slice_new0 (struct blob);
+      blob->name = g_strdup (name);
+      blob->size = st.st_size;
+      blob->mtime = st.st_mtime;
+      blobs = g_slist_prepend (blobs, blob);
+    }
+
+    g_free (path);
+  }
+  g_dir_close (dir);
+
+  blobs = g_slist_sort (blobs, compare_mtime);
+  for (b = blobs; b; b = g_slist_next (b)) {
+    blob = b->data;
+    blob->link.data = blob;
+    g_hash_table_insert (priv->store, blob->name, blob);
+    g_queue_push_tail_link (priv->store_lru, &blob->link);
+    priv->store_used += blob->size;
+  }
+  g_slist_free (blobs);
+
+  GRL_DEBUG ("%u blobs (%" G_GUINT64_FORMAT " bytes) in download store '%s'",
+             g_hash_table_size (priv->store), priv->store_used,
+             priv->store_dir);
+
+  store_make_room (self, 0);
+}
+
+/* Returns the path of the blob @name if it is in the store, and marks it
+   as the most recently used */
+static gchar *
+store_lookup (GrlNetDownloader *self,
+              const gchar *name)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+  struct blob *blob;
+  gchar *path;
+
+  blob = g_hash_table_lookup (priv->store, name);
+  if (!blob)
+    return NULL;
+
+  path = get_blob_path (self, name);
+
+  /* Someone else may have cleaned up the directory */
+  if (!g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+    store_remove (self, blob, FALSE);
+    g_free (path);
+    return NULL;
+  }
+
+  /* Keep the order for the next runs too */
+  g_utime (path, NULL);
+
+  g_queue_unlink (priv->store_lru, &blob->link);
+  g_queue_push_tail_link (priv->store_lru, &blob->link);
+
+  priv->stats_store_hits++;
+  priv->stats_store_bytes += blob->size;
+
+  return path;
+}
+
+/* Downloads */
+
+static struct download_result *
+download_result_ref (struct download_result *r)
+{
+  r->refcount++;
+  return r;
+}
+
+static void
+download_result_unref (struct download_result *r)
+{
+  if (--r->refcount > 0)
+    return;
+
+  g_free (r->content);
+  g_free (r->path);
+  g_slice_free (struct download_result, r);
+}
+
+static void
+free_download_waiter (struct download_waiter *w)
+{
+  /* Not from the "cancelled" handler, so g_cancellable_disconnect() is not
+     needed */
+  if (w->cancel_id)
+    g_signal_handler_disconnect (w->cancellable, w->cancel_id);
+  if (w->cancellable)
+    g_object_unref (w->cancellable);
+  g_object_unref (w->result);
+  g_slice_free (struct download_waiter, w);
+}
+
+static void
+free_download (struct download *d)
+{
+  gchar *path;
+
+  g_list_foreach (d->waiters, (GFunc) free_download_waiter, NULL);
+  g_list_free (d->waiters);
+
+  if (d->output) {
+    /* Unfinished spool file */
+    g_output_stream_close (d->output, NULL, NULL);
+    g_object_unref (d->output);
+    path = get_part_path (d->self, d->name);
+    g_unlink (path);
+    g_free (path);
+  }
+
+  if (d->input)
+    g_object_unref (d->input);
+  if (d->buffer)
+    g_byte_array_free (d->buffer, TRUE);
+  g_object_unref (d->cancellable);
+  g_free (d->chunk);
+  g_free (d->name);
+  g_free (d->url);
+  g_object_unref (d->self);
+  g_slice_free (struct download, d);
+}
+
+/* Completes the waiters of @d, and frees it */
+static void
+download_done (struct download *d,
+               struct download_result *r,
+               GError *error)
+{
+  GrlNetDownloaderPrivate *priv = d->self->priv;
+  GrlNetDownloader *self = g_object_ref (d->self);
+  struct download_waiter *w;
+  GList *waiter;
+
+  if (d->running)
+    priv->running--;
+  g_hash_table_remove (priv->downloads, d->url);
+
+  for (waiter = d->waiters; waiter; waiter = g_list_next (waiter)) {
+    w = waiter->data;
+
+    /* Cancelled waiters were already completed */
+    if (w->cancelled)
+      continue;
+
+    if (error) {
+      g_simple_async_result_set_from_error (w->result, error);
+    } else {
+      g_simple_async_result_set_op_res_gpointer (w->result,
+                                                 download_result_ref (r),
+                                                 (GDestroyNotify) download_result_unref);
+    }
+    g_simple_async_result_complete (w->result);
+  }
+
+  free_download (d);
+  start_pending (self);
+  g_object_unref (self);
+}
+
+static void
+download_failed (struct download *d,
+                 GError *error)
+{
+  GError *wc_error;
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    wc_error = g_error_new (GRL_NET_WC_ERROR,
+                            GRL_NET_WC_ERROR_CANCELLED,
+                            "Operation was cancelled");
+  } else if (error->domain != GRL_NET_WC_ERROR) {
+    wc_error = g_error_new (GRL_NET_WC_ERROR,
+                            GRL_NET_WC_ERROR_NETWORK_ERROR,
+                            "Failed to download '%s': %s",
+                            d->url, error->message);
+  } else {
+    wc_error = g_error_copy (error);
+  }
+
+  download_done (d, NULL, wc_error);
+  g_error_free (wc_error);
+}
+
+static void
+download_finished (struct download *d)
+{
+  struct download_result *r;
+  GError *error = NULL;
+  gchar *part;
+
+  r = g_slice_new0 (struct download_result);
+  r->refcount = 1;
+  r->length = d->length;
+
+  if (d->output) {
+    r->path = get_blob_path (d->self, d->name);
+    part = get_part_path (d->self, d->name);
+
+    g_output_stream_close (d->output, NULL, &error);
+    g_object_unref (d->output);
+    d->output = NULL;
+
+    if (!error && g_rename (part, r->path) < 0)
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "cannot move it to the store");
+
+    if (error) {
+      g_unlink (part);
+      g_free (part);
+      download_result_unref (r);
+      download_failed (d, error);
+      g_error_free (error);
+      return;
+    }
+
+    g_free (part);
+
+    /* Never removes the new blob, even if it is bigger than the store */
+    store_make_room (d->self, d->length);
+    store_add (d->self, d->name, d->length);
+  } else {
+    r->content = (gchar *) g_byte_array_free (d->buffer, FALSE);
+    d->buffer = NULL;
+  }
+
+  GRL_DEBUG ("downloaded '%s' (%" G_GSIZE_FORMAT " bytes%s)",
+             d->url, d->length, r->path? ", stored": "");
+
+  download_done (d, r, NULL);
+  download_result_unref (r);
+}
+
+static void
+write_cb (GObject *source,
+          GAsyncResult *result,
+          gpointer user_data)
+{
+  struct download *d = user_data;
+  GError *error = NULL;
+  gssize written;
+
+  written = g_output_stream_write_finish (G_OUTPUT_STREAM (source),
+                                          result, &error);
+  if (written < 0) {
+    download_failed (d, error);
+    g_error_free (error);
+    return;
+  }
+
+  d->write_data += written;
+  d->write_left -= written;
+
+  if (d->write_left > 0) {
+    g_output_stream_write_async (d->output, d->write_data, d->write_left,
+                                 G_PRIORITY_DEFAULT, d->cancellable,
+                                 write_cb, d);
+    return;
+  }
+
+  /* The content read so far is on disk now */
+  if (d->buffer) {
+    g_byte_array_free (d->buffer, TRUE);
+    d->buffer = NULL;
+  }
+
+  read_next (d);
+}
+
+static void
+spool (struct download *d,
+       const gchar *data,
+       gsize length)
+{
+  d->write_data = data;
+  d->write_left = length;
+  g_output_stream_write_async (d->output, data, length,
+                               G_PRIORITY_DEFAULT, d->cancellable,
+                               write_cb, d);
+}
+
+/* Opens the spool file, or returns FALSE to keep the content in memory */
+static gboolean
+start_spooling (struct download *d)
+{
+  GrlNetDownloader *self = d->self;
+  GFileOutputStream *output;
+  GError *error = NULL;
+  GFile *file;
+  gchar *path;
+
+  if (g_mkdir_with_parents (self->priv->store_dir, 0700) < 0)
+    return FALSE;
+
+  path = get_part_path (self, d->name);
+  file = g_file_new_for_path (path);
+  output = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE,
+                           NULL, &error);
+  g_object_unref (file);
+
+  if (!output) {
+    GRL_WARNING ("Failed to spool download to '%s': %s", path, error->message);
+    g_error_free (error);
+    g_free (path);
+    return FALSE;
+  }
+
+  GRL_DEBUG ("spooling '%s' to '%s'", d->url, path);
+  g_free (path);
+
+  d->output = G_OUTPUT_STREAM (output);
+
+  return TRUE;
+}
+
+static void
+read_cb (GObject *source,
+         GAsyncResult *result,
+         gpointer user_data)
+{
+  struct download *d = user_data;
+  GrlNetDownloaderPrivate *priv = d->self->priv;
+  GError *error = NULL;
+  gssize n;
+
+  n = g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error);
+  if (n < 0) {
+    download_failed (d, error);
+    g_error_free (error);
+    return;
+  }
+
+  if (n == 0) {
+    download_finished (d);
+    return;
+  }
+
+  d->length += n;
+
+  if (d->output) {
+    spool (d, d->chunk, n);
+    return;
+  }
+
+  g_byte_array_append (d->buffer, (const guint8 *) d->chunk, n);
+
+  if (d->length > priv->spool_threshold && start_spooling (d)) {
+    spool (d, (const gchar *) d->buffer->data, d->buffer->len);
+    return;
+  }
+
+  read_next (d);
+}
+
+static void
+read_next (struct download *d)
+{
+  g_input_stream_read_async (d->input, d->chunk, CHUNK_SIZE,
+                             G_PRIORITY_DEFAULT, d->cancellable,
+                             read_cb, d);
+}
+
+static void
+stream_cb (GObject *source,
+           GAsyncResult *result,
+           gpointer user_data)
+{
+  struct download *d = user_data;
+  GError *error = NULL;
+
+  d->input = grl_net_wc_request_stream_finish (GRL_NET_WC (source),
+                                               result, &error);
+  if (!d->input) {
+    download_failed (d, error);
+    g_error_free (error);
+    return;
+  }
+
+  d->chunk = g_malloc (CHUNK_SIZE);
+  d->buffer = g_byte_array_new ();
+  read_next (d);
+}
+
+static void
+start_pending (GrlNetDownloader *self)
+{
+  GrlNetDownloaderPrivate *priv = self->priv;
+  struct download *d;
+
+  while (priv->running < priv->max_downloads &&
+         !g_queue_is_empty (priv->pending)) {
+    d = g_queue_pop_head (priv->pending);
+    d->running = TRUE;
+    priv->running++;
+    priv->stats_downloads++;
+
+    GRL_DEBUG ("downloading '%s'", d->url);
+    grl_net_wc_request_stream_async (priv->wc, d->url, d->cancellable,
+                                     stream_cb, d);
+  }
+}
+
+static void
+waiter_cancelled_cb (GCancellable *cancellable,
+                     gpointer user_data)
+{
+  struct download_waiter *w = user_data;
+  struct download *d = w->d;
+  GrlNetDownloaderPrivate *priv = d->self->priv;
+
+  if (w->cancelled)
+    return;
+
+  /* Do not make the caller wait for a download that others may still need */
+  w->cancelled = TRUE;
+  g_simple_async_result_set_error (w->result,
+                                   GRL_NET_WC_ERROR,
+                                   GRL_NET_WC_ERROR_CANCELLED,
+                                   "Operation was cancelled");
+  g_simple_async_result_complete_in_idle (w->result);
+
+  if (--d->active_waiters > 0)
+    return;
+
+  if (d->running) {
+    /* Finishes with an error in a callback */
+    g_cancellable_cancel (d->cancellable);
+  } else {
+    g_queue_remove (priv->pending, d);
+    g_hash_table_remove (priv->downloads, d->url);
+    free_download (d);
+  }
+}
+
+static void
+add_download_waiter (struct download *d,
+                     GSimpleAsyncResult *result,
+                     GCancellable *cancellable)
+{
+  struct download_waiter *w;
+
+  w = g_slice_new0 (struct download_waiter);
+  w->d = d;
+  w->result = result;
+
+  d->waiters = g_list_append (d->waiters, w);
+  d->active_waiters++;
+
+  if (cancellable) {
+    w->cancellable = g_object_ref (cancellable);
+    w->cancel_id = g_cancellable_connect (cancellable,
+                                          G_CALLBACK (waiter_cancelled_cb),
+                                          w, NULL);
+  }
+}
+
+/* Public API */
+
+/**
+ * grl_net_downloader_new:
+ * @wc: (allow-none): the #GrlNetWc used to download, or %NULL to create a
+ * new one
+ *
+ * Creates a new #GrlNetDownloader.
+ *
+ * Returns: a new allocated instance of #GrlNetDownloader. Do g_object_unref()
+ * after use it.
+ *
+ * Since: 0.1.21
+ */
+GrlNetDownloader *
+grl_net_downloader_new (GrlNetWc *wc)
+{
+  return g_object_new (GRL_TYPE_NET_DOWNLOADER,
+                       "web-client", wc,
+                       NULL);
+}
+
+/**
+ * grl_net_downloader_download_async:
+ * @self: a #GrlNetDownloader instance
+ * @uri: The URI of the payload to download
+ * @cancellable: (allow-none): a #GCancellable instance or %NULL to ignore
+ * @callback: The callback when the result is ready
+ * @user_data: User data set for the @callback
+ *
+ * Downloads the payload at @uri, or gets it from the store if it was
+ * downloaded before. The download waits in a queue if
+ * #GrlNetDownloader::max-downloads downloads are already running.
+ *
+ * Concurrent downloads of the same @uri share a single transfer. Cancelling
+ * @cancellable only stops the transfer when all the other downloads sharing
+ * it have been cancelled too.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_downloader_download_async (GrlNetDownloader *self,
+                                   const char *uri,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data)
+{
+  GrlNetDownloaderPrivate *priv;
+  GSimpleAsyncResult *result;
+  struct download_result *r;
+  struct download *d;
+  gchar *name;
+  gchar *path;
+
+  g_return_if_fail (GRL_IS_NET_DOWNLOADER (self));
+  g_return_if_fail (uri);
+
+  priv = self->priv;
+
+  result = g_simple_async_result_new (G_OBJECT (self),
+                                      callback,
+                                      user_data,
+                                      grl_net_downloader_download_async);
+
+  if (g_cancellable_is_cancelled (cancellable)) {
+    g_simple_async_result_set_error (result,
+                                     GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_CANCELLED,
+                                     "Operation was cancelled");
+    g_simple_async_result_complete_in_idle (result);
+    g_object_unref (result);
+    return;
+  }
+
+  store_load (self);
+
+  name = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+
+  path = store_lookup (self, name);
+  if (path) {
+    GRL_DEBUG ("'%s' found in download store", uri);
+    r = g_slice_new0 (struct download_result);
+    r->refcount = 1;
+    r->path = path;
+    r->length = ((struct blob *) g_hash_table_lookup (priv->store, name))->size;
+    g_simple_async_result_set_op_res_gpointer (result, r,
+                                               (GDestroyNotify) download_result_unref);
+    g_simple_async_result_complete_in_idle (result);
+    g_object_unref (result);
+    g_free (name);
+    return;
+  }
+
+  /* Join the download of the same payload if any */
+  d = g_hash_table_lookup (priv->downloads, uri);
+  if (d) {
+    GRL_DEBUG ("sharing download of '%s'", uri);
+    priv->stats_shared++;
+    add_download_waiter (d, result, cancellable);
+    g_free (name);
+    return;
+  }
+
+  d = g_slice_new0 (struct download);
+  d->self = g_object_ref (self);
+  d->url = g_strdup (uri);
+  d->name = name;
+  d->cancellable = g_cancellable_new ();
+
+  g_hash_table_insert (priv->downloads, d->url, d);
+  add_download_waiter (d, result, cancellable);
+
+  g_queue_push_tail (priv->pending, d);
+  start_pending (self);
+}
+
+/**
+ * grl_net_downloader_download_finish:
+ * @self: a #GrlNetDownloader instance
+ * @result: The result of the request
+ * @content: (out) (allow-none) (transfer full): the payload, or %NULL if it
+ * is in the store
+ * @length: (out) (allow-none): the size of the payload
+ * @path: (out) (allow-none) (transfer full): the file with the payload, or
+ * %NULL if it is in @content
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes a download started with grl_net_downloader_download_async().
+ * Small payloads are returned in @content, and the rest in a file of the
+ * store. As the store removes the least recently used files when it is full,
+ * @path should be opened right away. Free @content and @path with g_free().
+ *
+ * Returns: TRUE if the payload was downloaded successfully
+ *
+ * Since: 0.1.21
+ */
+gboolean
+grl_net_downloader_download_finish (GrlNetDownloader *self,
+                                    GAsyncResult *result,
+                                    gchar **content,
+                                    gsize *length,
+                                    gchar **path,
+                                    GError **error)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+  struct download_result *r;
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (res) ==
+                  grl_net_downloader_download_async);
+
+  if (g_simple_async_result_propagate_error (res, error) == TRUE)
+    return FALSE;
+
+  r = g_simple_async_result_get_op_res_gpointer (res);
+
+  if (content)
+    *content = r->content? g_memdup (r->content, r->length): NULL;
+  if (length)
+    *length = r->length;
+  if (path)
+    *path = g_strdup (r->path);
+
+  return TRUE;
+}
+
+/**
+ * grl_net_downloader_set_max_downloads:
+ * @self: a #GrlNetDownloader instance
+ * @max_downloads: number of downloads running at the same time
+ *
+ * Sets how many downloads run at the same time.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_downloader_set_max_downloads (GrlNetDownloader *self,
+                                      guint max_downloads)
+{
+  g_return_if_fail (GRL_IS_NET_DOWNLOADER (self));
+  g_return_if_fail (max_downloads > 0);
+
+  self->priv->max_downloads = max_downloads;
+  start_pending (self);
+}
+
+/**
+ * grl_net_downloader_set_spool_threshold:
+ * @self: a #GrlNetDownloader instance
+ * @threshold: size in bytes
+ *
+ * Sets the size over which payloads are written to the store instead of
+ * being kept in memory.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_downloader_set_spool_threshold (GrlNetDownloader *self,
+                                        gsize threshold)
+{
+  g_return_if_fail (GRL_IS_NET_DOWNLOADER (self));
+
+  self->priv->spool_threshold = threshold;
+}
+
+/**
+ * grl_net_downloader_set_store_dir:
+ * @self: a #GrlNetDownloader instance
+ * @store_dir: (allow-none): the directory of the store, or %NULL for the
+ * default one
+ *
+ * Sets the directory where big payloads are stored. Payloads already in the
+ * previous directory are kept there, but are not used anymore.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_downloader_set_store_dir (GrlNetDownloader *self,
+                                  const gchar *store_dir)
+{
+  g_return_if_fail (GRL_IS_NET_DOWNLOADER (self));
+
+  g_free (self->priv->store_dir);
+  if (store_dir)
+    self->priv->store_dir = g_strdup (store_dir);
+  else
+    self->priv->store_dir = g_build_filename (g_get_user_cache_dir (),
+                                              "grilo", "downloads", NULL);
+
+  store_clear (self);
+}
+
+/**
+ * grl_net_downloader_set_store_size:
+ * @self: a #GrlNetDownloader instance
+ * @size: size of the store in Mb
+ *
+ * Sets the size of the store. The least recently used payloads are removed
+ * when it is exceeded. A payload bigger than the whole store is kept until
+ * the next one is stored.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_downloader_set_store_size (GrlNetDownloader *self,
+                                   guint size)
+{
+  g_return_if_fail (GRL_IS_NET_DOWNLOADER (self));
+
+  self->priv->store_size = size;
+
+  if (self->priv->store_loaded)
+    store_make_room (self, 0);
+}
+
+/**
+ * grl_net_downloader_get_stats:
+ * @self: a #GrlNetDownloader instance
+ * @downloads: (out) (allow-none): number of transfers started
+ * @shared: (out) (allow-none): number of downloads that joined a transfer
+ * already running
+ * @store_hits: (out) (allow-none): number of downloads served from the store
+ * @store_bytes: (out) (allow-none): bytes served from the store
+ *
+ * Gets the statistics of @self.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_downloader_get_stats (GrlNetDownloader *self,
+                              guint *downloads,
+                              guint *shared,
+                              guint *store_hits,
+                              guint64 *store_bytes)
+{
+  g_return_if_fail (GRL_IS_NET_DOWNLOADER (self));
+
+  if (downloads)
+    *downloads = self->priv->stats_downloads;
+  if (shared)
+    *shared = self->priv->stats_shared;
+  if (store_hits)
+    *store_hits = self->priv->stats_store_hits;
+  if (store_bytes)
+    *store_bytes = self->priv->stats_store_bytes;
+}
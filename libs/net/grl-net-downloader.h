@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Contact: Iago Toral Quiroga <itoral@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef _GRL_NET_DOWNLOADER_H_
+#define _GRL_NET_DOWNLOADER_H_
+
+#include <gio/gio.h>
+#include "grl-net-wc.h"
+
+G_BEGIN_DECLS
+
+#define GRL_TYPE_NET_DOWNLOADER			\
+  (grl_net_downloader_get_type ())
+
+#define GRL_NET_DOWNLOADER(obj)						\
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GRL_TYPE_NET_DOWNLOADER, GrlNetDownloader))
+
+#define GRL_IS_NET_DOWNLOADER(obj)				\
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GRL_TYPE_NET_DOWNLOADER))
+
+#define GRL_NET_DOWNLOADER_CLASS(klass)					\
+  (G_TYPE_CHECK_CLASS_CAST((klass), GRL_TYPE_NET_DOWNLOADER, GrlNetDownloaderClass))
+
+#define GRL_IS_NET_DOWNLOADER_CLASS(klass)			\
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GRL_TYPE_NET_DOWNLOADER))
+
+#define GRL_NET_DOWNLOADER_GET_CLASS(obj)				\
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GRL_TYPE_NET_DOWNLOADER, GrlNetDownloaderClass))
+
+typedef struct _GrlNetDownloader        GrlNetDownloader;
+typedef struct _GrlNetDownloaderClass   GrlNetDownloaderClass;
+typedef struct _GrlNetDownloaderPrivate GrlNetDownloaderPrivate;
+
+/**
+ * GrlNetDownloader:
+ * @parent: the parent object struct
+ *
+ * Since: 0.1.21
+ */
+struct _GrlNetDownloader
+{
+  GObject parent;
+
+  /*< private >*/
+  GrlNetDownloaderPrivate *priv;
+};
+
+/**
+ * GrlNetDownloaderClass:
+ * @parent_class: the parent class structure
+ *
+ * Downloader of binary payloads, like images, on top of #GrlNetWc.
+ *
+ * Since: 0.1.21
+ */
+struct _GrlNetDownloaderClass
+{
+  GObjectClass parent_class;
+};
+
+GType grl_net_downloader_get_type (void) G_GNUC_CONST;
+
+GrlNetDownloader *grl_net_downloader_new (GrlNetWc *wc);
+
+void grl_net_downloader_download_async (GrlNetDownloader *self,
+                                        const char *uri,
+                                        GCancellable *cancellable,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data);
+
+gboolean grl_net_downloader_download_finish (GrlNetDownloader *self,
+                                             GAsyncResult *result,
+                                             gchar **content,
+                                             gsize *length,
+                                             gchar **path,
+                                             GError **error);
+
+void grl_net_downloader_set_max_downloads (GrlNetDownloader *self,
+                                           guint max_downloads);
+
+void grl_net_downloader_set_spool_threshold (GrlNetDownloader *self,
+                                             gsize threshold);
+
+void grl_net_downloader_set_store_dir (GrlNetDownloader *self,
+                                       const gchar *store_dir);
+
+void grl_net_downloader_set_store_size (GrlNetDownloader *self,
+                                        guint size);
+
+void grl_net_downloader_get_stats (GrlNetDownloader *self,
+                                   guint *downloads,
+                                   guint *shared,
+                                   guint *store_hits,
+                                   guint64 *store_bytes);
+
+G_END_DECLS
+
+#endif /* _GRL_NET_DOWNLOADER_H_ */
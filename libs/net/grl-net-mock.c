@@ -0,0 +1,528 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Contact: Iago Toral Quiroga <itoral@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * Record and replay of web requests.
+ *
+ * An archive is a directory with an index.ini key file and a file with the
+ * body of each recorded response:
+ *
+ *   [archive]
+ *   version=1
+ *   requests=1
+ *
+ *   [request-1]
+ *   url=http://example.com/api?q=foo
+ *   status=200
+ *   headers=Content-Type: application/json;ETag: "1234";
+ *   body=request-1.data
+ *
+ * When replaying, repeated requests of the same URL get the recorded
+ * responses in order, and the last one again once they are exhausted.
+ *
+ * While recording, the index is kept in memory, shared by all the instances
+ * recording in the same archive, and saved shortly after each new request
+ * and when the last instance stops recording.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "grl-net-private.h"
+
+#define GRL_LOG_DOMAIN_DEFAULT wc_log_domain
+GRL_LOG_DOMAIN_EXTERN(wc_log_domain);
+
+#define MOCK_INDEX "index.ini"
+#define MOCK_VERSION 1
+
+/* Seconds to wait before saving the index of the archive being recorded */
+#define MOCK_SAVE_DELAY 1
+
+struct mock_archive {
+  gchar *dir;
+  GKeyFile *index;
+  GHashTable *urls;             /* url -> queue of request groups */
+};
+
+/* An archive being recorded */
+struct mock_recorder {
+  gint refcount;
+  gchar *dir;
+  GKeyFile *index;
+  gint requests;
+  guint save_id;                /* timeout saving the index */
+};
+
+/* Archive directory -> recorder, shared by all the instances */
+static GHashTable *recorders = NULL;
+G_LOCK_DEFINE_STATIC (recorders);
+
+struct mock_reply {
+  GrlNetWc *self;
+  SoupMessage *msg;             /* NULL if not in the archive */
+  GSimpleAsyncResult *result;
+  GCancellable *cancellable;
+  gboolean stream;
+};
+
+static void
+free_group_queue (GQueue *groups)
+{
+  g_queue_foreach (groups, (GFunc) g_free, NULL);
+  g_queue_free (groups);
+}
+
+void
+mock_unload (GrlNetWc *self)
+{
+  struct mock_archive *archive = self->priv->mock;
+
+  if (!archive)
+    return;
+
+  g_hash_table_unref (archive->urls);
+  g_key_file_free (archive->index);
+  g_free (archive->dir);
+  g_slice_free (struct mock_archive, archive);
+
+  self->priv->mock = NULL;
+}
+
+gboolean
+mock_load (GrlNetWc *self,
+           const gchar *dir)
+{
+  struct mock_archive *archive;
+  GError *error = NULL;
+  gchar **groups;
+  gchar *path;
+  gchar *url;
+  GQueue *queue;
+  guint i;
+
+  mock_unload (self);
+
+  archive = g_slice_new0 (struct mock_archive);
+  archive->dir = g_strdup (dir);
+  archive->index = g_key_file_new ();
+  archive->urls = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free,
+                                         (GDestroyNotify) free_group_queue);
+
+  path = g_build_filename (dir, MOCK_INDEX, NULL);
+  g_key_file_load_from_file (archive->index, path, G_KEY_FILE_NONE, &error);
+  g_free (path);
+
+  if (error) {
+    GRL_WARNING ("Failed to load web archive from '%s': %s",
+                 dir, error->message);
+    g_error_free (error);
+    g_key_file_free (archive->index);
+    g_hash_table_unref (archive->urls);
+    g_free (archive->dir);
+    g_slice_free (struct mock_archive, archive);
+    return FALSE;
+  }
+
+  /* Groups come in file order, which is the recording order */
+  groups = g_key_file_get_groups (archive->index, NULL);
+  for (i = 0; groups[i]; i++) {
+    url = g_key_file_get_string (archive->index, groups[i], "url", NULL);
+    if (!url)
+      continue;
+
+    queue = g_hash_table_lookup (archive->urls, url);
+    if (!queue) {
+      queue = g_queue_new ();
+      g_hash_table_insert (archive->urls, url, queue);
+    } else {
+      g_free (url);
+    }
+    g_queue_push_tail (queue, g_strdup (groups[i]));
+  }
+  g_strfreev (groups);
+
+  GRL_DEBUG ("replaying web requests from '%s'", dir);
+
+  self->priv->mock = archive;
+
+  return TRUE;
+}
+
+gboolean
+is_mocked (GrlNetWc *self)
+{
+  return self->priv->mock != NULL;
+}
+
+/* Builds the message recorded for @url, or returns NULL */
+static SoupMessage *
+mock_lookup (GrlNetWc *self,
+             const char *url)
+{
+  struct mock_archive *archive = self->priv->mock;
+  SoupMessage *msg;
+  GQueue *groups;
+  gchar *group;
+  gchar **headers;
+  gchar *value;
+  gchar *file;
+  gchar *path;
+  gchar *body = NULL;
+  gsize length = 0;
+  guint i;
+
+  groups = g_hash_table_lookup (archive->urls, url);
+  if (!groups)
+    return NULL;
+
+  msg = soup_message_new (SOUP_METHOD_GET, url);
+  if (!msg)
+    return NULL;
+
+  if (g_queue_get_length (groups) > 1)
+    group = g_queue_pop_head (groups);
+  else
+    group = g_strdup (g_queue_peek_head (groups));
+
+  soup_message_set_status (msg,
+                           g_key_file_get_integer (archive->index, group,
+                                                   "status", NULL));
+
+  headers = g_key_file_get_string_list (archive->index, group, "headers",
+                                        NULL, NULL);
+  for (i = 0; headers && headers[i]; i++) {
+    value = strchr (headers[i], ':');
+    if (!value)
+      continue;
+
+    *value++ = '\0';
+    soup_message_headers_append (msg->response_headers,
+                                 g_strstrip (headers[i]),
+                                 g_strstrip (value));
+  }
+  g_strfreev (headers);
+
+  file = g_key_file_get_string (archive->index, group, "body", NULL);
+  if (file) {
+    path = g_build_filename (archive->dir, file, NULL);
+    if (!g_file_get_contents (path, &body, &length, NULL))
+      GRL_WARNING ("Missing body of recorded web request '%s'", url);
+    g_free (path);
+    g_free (file);
+  }
+
+  if (body)
+    soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE,
+                              body, length);
+  soup_buffer_free (soup_message_body_flatten (msg->response_body));
+
+  g_free (group);
+
+  return msg;
+}
+
+static gboolean
+mock_reply_cb (gpointer user_data)
+{
+  struct mock_reply *reply = user_data;
+  SoupMessage *msg = reply->msg;
+  GInputStream *stream;
+
+  if (g_cancellable_is_cancelled (reply->cancellable)) {
+    g_simple_async_result_set_error (reply->result, GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_CANCELLED,
+                                     "Operation was cancelled");
+  } else if (!msg) {
+    /* Just like being offline */
+    g_simple_async_result_set_error (reply->result, GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_NETWORK_ERROR,
+                                     "Cannot connect to the server");
+  } else if (reply->stream) {
+    if (msg->status_code == SOUP_STATUS_OK) {
+      stream =
+        g_memory_input_stream_new_from_data (msg->response_body->data,
+                                             msg->response_body->length,
+                                             NULL);
+      g_object_set_data_full (G_OBJECT (stream),
+                              "message",
+                              g_object_ref (msg),
+                              g_object_unref);
+      g_simple_async_result_set_op_res_gpointer (reply->result,
+                                                 stream,
+                                                 g_object_unref);
+    } else {
+      parse_error (msg->status_code, msg->reason_phrase, NULL, reply->result);
+    }
+  } else {
+    set_op_from_message (reply->self, G_ASYNC_RESULT (reply->result), msg);
+    if (msg->status_code != SOUP_STATUS_OK)
+      parse_error (msg->status_code,
+                   msg->reason_phrase,
+                   msg->response_body->data,
+                   reply->result);
+  }
+
+  g_simple_async_result_complete (reply->result);
+  g_object_unref (reply->result);
+
+  if (reply->cancellable)
+    g_object_unref (reply->cancellable);
+  if (msg)
+    g_object_unref (msg);
+  g_slice_free (struct mock_reply, reply);
+
+  return FALSE;
+}
+
+static void
+mock_reply (GrlNetWc *self,
+            const char *url,
+            gboolean stream,
+            GAsyncResult *result,
+            GCancellable *cancellable)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  struct mock_reply *reply;
+  guint64 delay;
+
+  reply = g_slice_new0 (struct mock_reply);
+  reply->self = self;
+  reply->msg = mock_lookup (self, url);
+  reply->result = G_SIMPLE_ASYNC_RESULT (result);
+  reply->stream = stream;
+  if (cancellable)
+    reply->cancellable = g_object_ref (cancellable);
+
+  if (!reply->msg)
+    GRL_DEBUG ("web request to '%s' not found in archive", url);
+
+  /* Simulated network */
+  delay = priv->replay_latency;
+  if (reply->msg && priv->replay_bandwidth > 0)
+    delay += (guint64) reply->msg->response_body->length * 1000 /
+      priv->replay_bandwidth;
+
+  g_timeout_add ((guint) MIN (delay, G_MAXUINT), mock_reply_cb, reply);
+}
+
+void
+get_url_mocked (GrlNetWc *self,
+                const char *url,
+                GAsyncResult *result,
+                GCancellable *cancellable)
+{
+  mock_reply (self, url, FALSE, result, cancellable);
+}
+
+void
+get_stream_mocked (GrlNetWc *self,
+                   const char *url,
+                   GAsyncResult *result,
+                   GCancellable *cancellable)
+{
+  mock_reply (self, url, TRUE, result, cancellable);
+}
+
+static void
+add_header (const char *name,
+            const char *value,
+            gpointer user_data)
+{
+  /* The content is recorded decoded */
+  if (g_ascii_strcasecmp (name, "Content-Encoding") == 0 ||
+      g_ascii_strcasecmp (name, "Content-Length") == 0)
+    return;
+
+  g_ptr_array_add ((GPtrArray *) user_data,
+                   g_strdup_printf ("%s: %s", name, value));
+}
+
+/* Called with the recorders lock held */
+static void
+recorder_save (struct mock_recorder *recorder)
+{
+  GError *error = NULL;
+  gchar *index_path;
+  gchar *data;
+  gsize length;
+
+  index_path = g_build_filename (recorder->dir, MOCK_INDEX, NULL);
+  data = g_key_file_to_data (recorder->index, &length, NULL);
+
+  if (!g_file_set_contents (index_path, data, length, &error)) {
+    GRL_WARNING ("Failed to save web archive '%s': %s",
+                 recorder->dir, error->message);
+    g_error_free (error);
+  }
+
+  g_free (data);
+  g_free (index_path);
+}
+
+static gboolean
+recorder_save_cb (gpointer user_data)
+{
+  struct mock_recorder *recorder = user_data;
+
+  G_LOCK (recorders);
+  recorder->save_id = 0;
+  recorder_save (recorder);
+  G_UNLOCK (recorders);
+
+  return FALSE;
+}
+
+static struct mock_recorder *
+recorder_get (const gchar *dir)
+{
+  struct mock_recorder *recorder;
+  gchar *index_path;
+
+  G_LOCK (recorders);
+
+  if (!recorders)
+    recorders = g_hash_table_new (g_str_hash, g_str_equal);
+
+  recorder = g_hash_table_lookup (recorders, dir);
+  if (!recorder) {
+    if (g_mkdir_with_parents (dir, 0755) < 0) {
+      GRL_WARNING ("Failed to create web archive '%s'", dir);
+      G_UNLOCK (recorders);
+      return NULL;
+    }
+
+    recorder = g_slice_new0 (struct mock_recorder);
+    recorder->dir = g_strdup (dir);
+    recorder->index = g_key_file_new ();
+
+    /* New requests are added to those already recorded */
+    index_path = g_build_filename (dir, MOCK_INDEX, NULL);
+    g_key_file_load_from_file (recorder->index, index_path,
+                               G_KEY_FILE_KEEP_COMMENTS, NULL);
+    g_free (index_path);
+
+    recorder->requests = g_key_file_get_integer (recorder->index, "archive",
+                                                 "requests", NULL);
+    g_key_file_set_integer (recorder->index, "archive", "version",
+                            MOCK_VERSION);
+
+    g_hash_table_insert (recorders, recorder->dir, recorder);
+  }
+
+  recorder->refcount++;
+
+  G_UNLOCK (recorders);
+
+  return recorder;
+}
+
+void
+mock_record_stop (GrlNetWc *self)
+{
+  struct mock_recorder *recorder = self->priv->recorder;
+
+  if (!recorder)
+    return;
+
+  self->priv->recorder = NULL;
+
+  G_LOCK (recorders);
+
+  if (--recorder->refcount == 0) {
+    if (recorder->save_id)
+      g_source_remove (recorder->save_id);
+    recorder_save (recorder);
+
+    g_hash_table_remove (recorders, recorder->dir);
+    g_key_file_free (recorder->index);
+    g_free (recorder->dir);
+    g_slice_free (struct mock_recorder, recorder);
+  }
+
+  G_UNLOCK (recorders);
+}
+
+void
+mock_record (GrlNetWc *self,
+             const char *url,
+             SoupMessage *msg,
+             const gchar *content,
+             gsize length)
+{
+  struct mock_recorder *recorder;
+  GError *error = NULL;
+  GPtrArray *headers;
+  gchar *group;
+  gchar *body;
+  gchar *body_path;
+  gint n;
+
+  if (!self->priv->recorder)
+    self->priv->recorder = recorder_get (self->priv->record_dir);
+
+  recorder = self->priv->recorder;
+  if (!recorder)
+    return;
+
+  headers = g_ptr_array_new_with_free_func (g_free);
+  soup_message_headers_foreach (msg->response_headers, add_header, headers);
+
+  G_LOCK (recorders);
+
+  n = ++recorder->requests;
+  g_key_file_set_integer (recorder->index, "archive", "requests", n);
+
+  group = g_strdup_printf ("request-%d", n);
+  body = g_strdup_printf ("request-%d.data", n);
+
+  g_key_file_set_string (recorder->index, group, "url", url);
+  g_key_file_set_integer (recorder->index, group, "status", msg->status_code);
+  g_key_file_set_string_list (recorder->index, group, "headers",
+                              (const gchar * const *) headers->pdata,
+                              headers->len);
+  g_key_file_set_string (recorder->index, group, "body", body);
+
+  if (!recorder->save_id)
+    recorder->save_id = g_timeout_add_seconds (MOCK_SAVE_DELAY,
+                                               recorder_save_cb,
+                                               recorder);
+
+  body_path = g_build_filename (recorder->dir, body, NULL);
+
+  G_UNLOCK (recorders);
+
+  if (!g_file_set_contents (body_path, content? content: "", length, &error)) {
+    GRL_WARNING ("Failed to record web request '%s': %s", url, error->message);
+    g_clear_error (&error);
+  }
+
+  g_ptr_array_unref (headers);
+  g_free (body_path);
+  g_free (body);
+  g_free (group);
+}
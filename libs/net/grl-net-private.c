@@ -29,6 +29,106 @@
 
 #include "grl-net-private.h"
 
+#if GLIB_CHECK_VERSION(2,24,0)
+/* Returns a decoder for the Content-Encoding of the response, or NULL if it
+   is not encoded or the encoding is not supported. Only the encodings GIO can
+   decode are supported: there is no brotli decoder, so "br" is never
+   advertised in Accept-Encoding */
+GConverter *
+get_decoder (SoupMessage *msg)
+{
+  const gchar *encoding;
+
+  encoding = soup_message_headers_get_one (msg->response_headers,
+                                           "Content-Encoding");
+  if (!encoding)
+    return NULL;
+
+  if (g_ascii_strcasecmp (encoding, "gzip") == 0 ||
+      g_ascii_strcasecmp (encoding, "x-gzip") == 0)
+    return G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+
+  if (g_ascii_strcasecmp (encoding, "deflate") == 0)
+    return G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+
+  return NULL;
+}
+
+/* Decodes all of @data at once, returning a new NULL-terminated buffer */
+gchar *
+decode_data (GConverter *decoder,
+             const gchar *data,
+             gsize length,
+             gsize *decoded_length,
+             GError **error)
+{
+  GConverterResult res;
+  GByteArray *out;
+  gsize bytes_read;
+  gsize bytes_written;
+  gsize size;
+
+  out = g_byte_array_new ();
+  size = MAX (length * 4, 1024);
+  *decoded_length = 0;
+
+  do {
+    g_byte_array_set_size (out, *decoded_length + size);
+    res = g_converter_convert (decoder,
+                               data, length,
+                               out->data + *decoded_length, size,
+                               G_CONVERTER_INPUT_AT_END,
+                               &bytes_read, &bytes_written,
+                               error);
+    if (res == G_CONVERTER_ERROR) {
+      g_byte_array_free (out, TRUE);
+      return NULL;
+    }
+
+    data += bytes_read;
+    length -= bytes_read;
+    *decoded_length += bytes_written;
+  } while (res != G_CONVERTER_FINISHED);
+
+  g_byte_array_set_size (out, *decoded_length);
+
+  /* Put the end of string */
+  g_byte_array_append (out, (const guint8 *) "", 1);
+
+  return (gchar *) g_byte_array_free (out, FALSE);
+}
+#endif
+
+/* Returns the directory of the disk cache of @self */
+gchar *
+get_cache_dir (GrlNetWc *self)
+{
+  if (self->priv->cache_dir)
+    return g_strdup (self->priv->cache_dir);
+
+  return g_build_filename (g_get_user_cache_dir (),
+                           g_get_prgname (),
+                           "grilo",
+                           NULL);
+}
+
+/* Adds the name -> value pairs in @headers, if any, to the request */
+void
+add_request_headers (SoupMessage *msg,
+                     GHashTable *headers)
+{
+  GHashTableIter iter;
+  const gchar *name;
+  const gchar *value;
+
+  if (!headers)
+    return;
+
+  g_hash_table_iter_init (&iter, headers);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &name, (gpointer *) &value))
+    soup_message_headers_replace (msg->request_headers, name, value);
+}
+
 void
 parse_error (guint status,
              const gchar *reason,
@@ -80,6 +180,17 @@ parse_error (guint status,
                                      "The entry has been modified since it was downloaded: %s",
                                      response);
     return;
+  case SOUP_STATUS_NOT_MODIFIED: /* 304, answer to a conditional request */
+    return;
+  case 429: /* Too Many Requests */
+  case SOUP_STATUS_BAD_GATEWAY: /* 502 */
+  case SOUP_STATUS_SERVICE_UNAVAILABLE: /* 503 */
+  case SOUP_STATUS_GATEWAY_TIMEOUT: /* 504 */
+    g_simple_async_result_set_error (result, GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_UNAVAILABLE,
+                                     "Service temporarily unavailable: %s",
+                                     response);
+    return;
   case SOUP_STATUS_CANCELLED:
     g_simple_async_result_set_error (result, GRL_NET_WC_ERROR,
                                      GRL_NET_WC_ERROR_CANCELLED,
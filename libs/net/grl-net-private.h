@@ -33,15 +33,55 @@
 
 G_BEGIN_DECLS
 
+struct request_response;
+
 struct _GrlNetWcPrivate {
   SoupSession *session;
   SoupLoggerLogLevel log_level;
   guint throttling;             /* throttling in secs */
-  GTimeVal last_request;        /* last request time  */
-  GQueue *pending;              /* closure queue for delayed requests */
+  gdouble rate_limit;           /* default requests per second per host */
+  guint burst;                  /* default requests sent at once per host */
+  guint max_conns_per_host;
+  guint max_conns;
+  guint idle_timeout;           /* idle connection timeout in secs */
+  gboolean keep_alive;
+  guint connections;            /* connections opened */
+  guint connection_reuses;      /* requests sent on an already used connection */
+  guint max_attempts;           /* tries of each request, 1 means no retries */
+  guint retry_delay;            /* first retry delay in ms */
+  guint max_retry_delay;        /* longest retry delay in ms */
+  GArray *retry_statuses;       /* status codes worth retrying */
+  gchar *record_dir;            /* archive where requests are recorded */
+  gchar *replay_dir;            /* archive requests are replayed from */
+  void *mock;                   /* loaded replay archive */
+  void *recorder;               /* archive being recorded */
+  guint replay_latency;         /* simulated latency in ms */
+  guint replay_bandwidth;       /* simulated bandwidth in bytes/s */
+  guint histograms[GRL_NET_WC_METRIC_TOTAL + 1][GRL_NET_WC_HISTOGRAM_BUCKETS];
+  GHashTable *hosts;            /* host name -> request queue */
+  GHashTable *transfers;        /* request key -> running transfer */
+  struct request_response *previous_response; /* last finished request */
   guint cache_size;             /* cache size in Mb */
+  gchar *cache_dir;             /* cache directory, NULL for the default */
+  void *cache;                  /* backend cache, may be shared */
+  gboolean use_cache;
+  guint cache_hits;             /* requests served from the disk cache */
+  guint cache_misses;           /* requests not in any cache */
+  guint memory_hits;            /* requests served from the memory cache */
+  guint64 cache_bytes;          /* bytes served from any cache */
+  guint memory_cache_size;      /* memory cache size in Kb */
+  gsize memory_used;            /* bytes in the memory cache */
+  GHashTable *memory_cache;     /* request key -> memory cache entry */
+  GQueue *memory_lru;           /* memory cache entries, oldest first */
+  gchar *validated_dir;         /* bodies too big for memory, to revalidate */
+  gsize validated_used;         /* bytes kept in validated_dir */
+  GQueue *validated_lru;        /* entries kept on disk, oldest first */
+  GSList *buffer_pool;          /* spare read buffers */
+  guint buffer_pool_length;
   void *requester;
-  gchar *previous_data;
+  gboolean compression;         /* whether compressed responses are accepted */
+  guint64 wire_bytes;           /* response bytes received, as sent */
+  guint64 decoded_bytes;        /* response bytes received, once decoded */
 };
 
 void parse_error (guint status,
@@ -49,11 +89,32 @@ void parse_error (guint status,
 		  const gchar *response,
 		  GSimpleAsyncResult *result);
 
+void add_request_headers (SoupMessage *msg,
+                          GHashTable *headers);
+
+gchar *get_cache_dir (GrlNetWc *self);
+
+#if GLIB_CHECK_VERSION(2,24,0)
+GConverter *get_decoder (SoupMessage *msg);
+
+gchar *decode_data (GConverter *decoder,
+                    const gchar *data,
+                    gsize length,
+                    gsize *decoded_length,
+                    GError **error);
+#endif
+
 void get_url_now (GrlNetWc *self,
                   const char *url,
+                  GHashTable *headers,
                   GAsyncResult *result,
                   GCancellable *cancellable);
 
+void get_stream_now (GrlNetWc *self,
+                     const char *url,
+                     GAsyncResult *result,
+                     GCancellable *cancellable);
+
 void get_content (GrlNetWc *self,
                   void *op,
                   gchar **content,
@@ -75,6 +136,42 @@ guint cache_get_size (GrlNetWc *self);
 
 void free_op_res (void *op);
 
+SoupMessage *get_message (void *op);
+
+gboolean is_from_cache (void *op);
+
+gsize get_wire_length (void *op);
+
+void set_op_from_message (GrlNetWc *self,
+                          GAsyncResult *result,
+                          SoupMessage *msg);
+
+/* grl-net-mock.c */
+
+gboolean mock_load (GrlNetWc *self, const gchar *dir);
+
+void mock_unload (GrlNetWc *self);
+
+gboolean is_mocked (GrlNetWc *self);
+
+void get_url_mocked (GrlNetWc *self,
+                     const char *url,
+                     GAsyncResult *result,
+                     GCancellable *cancellable);
+
+void get_stream_mocked (GrlNetWc *self,
+                        const char *url,
+                        GAsyncResult *result,
+                        GCancellable *cancellable);
+
+void mock_record (GrlNetWc *self,
+                  const char *url,
+                  SoupMessage *msg,
+                  const gchar *content,
+                  gsize length);
+
+void mock_record_stop (GrlNetWc *self);
+
 G_END_DECLS
 
 #endif /* _GRL_NET_PRIVATE_H_ */
@@ -31,6 +31,45 @@
 
 #include "grl-net-private.h"
 
+/* Replaces a compressed body with its decoded content; the whole body is
+   already there, so it is decoded at once */
+static gboolean
+decode_body (SoupMessage *msg)
+{
+#if GLIB_CHECK_VERSION(2,24,0)
+  GConverter *decoder;
+  gchar *decoded;
+  gsize decoded_length;
+
+  decoder = get_decoder (msg);
+  if (!decoder)
+    return TRUE;
+
+  decoded = decode_data (decoder,
+                         msg->response_body->data,
+                         msg->response_body->length,
+                         &decoded_length,
+                         NULL);
+  g_object_unref (decoder);
+
+  if (!decoded)
+    return FALSE;
+
+  g_object_set_data (G_OBJECT (msg),
+                     "grl-net-wire-length",
+                     GSIZE_TO_POINTER (msg->response_body->length));
+  soup_message_headers_remove (msg->response_headers, "Content-Encoding");
+  soup_message_body_truncate (msg->response_body);
+  soup_message_body_append (msg->response_body,
+                            SOUP_MEMORY_TAKE,
+                            decoded,
+                            decoded_length);
+  soup_buffer_free (soup_message_body_flatten (msg->response_body));
+#endif
+
+  return TRUE;
+}
+
 static void
 reply_cb (SoupSession *session,
           SoupMessage *msg,
@@ -50,7 +89,11 @@ reply_cb (SoupSession *session,
 
   result = G_SIMPLE_ASYNC_RESULT (user_data);
 
-  if (msg->status_code != SOUP_STATUS_OK) {
+  if (!decode_body (msg)) {
+    g_simple_async_result_set_error (result, GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_UNAVAILABLE,
+                                     "Data not available");
+  } else if (msg->status_code != SOUP_STATUS_OK) {
     parse_error (msg->status_code,
                  msg->reason_phrase,
                  msg->response_body->data,
@@ -71,11 +114,13 @@ message_cancel_cb (GCancellable *cancellable,
 
 }
 
-void
-get_url_now (GrlNetWc *self,
-	     const char *url,
-	     GAsyncResult *result,
-	     GCancellable *cancellable)
+static SoupMessage *
+queue_message (GrlNetWc *self,
+               const char *url,
+               GHashTable *headers,
+               GAsyncResult *result,
+               GCancellable *cancellable,
+               SoupSessionCallback callback)
 {
   SoupMessage *msg;
   gulong cancel_signal;
@@ -90,11 +135,10 @@ get_url_now (GrlNetWc *self,
     g_simple_async_result_complete_in_idle (G_SIMPLE_ASYNC_RESULT (result));
     g_object_unref (result);
 
-    return;
+    return NULL;
   }
 
-  g_simple_async_result_set_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result),
-                                             msg, NULL);
+  add_request_headers (msg, headers);
 
   cancel_signal = 0;
   if (cancellable) {
@@ -117,8 +161,62 @@ get_url_now (GrlNetWc *self,
 
   soup_session_queue_message (self->priv->session,
                               msg,
-                              reply_cb,
+                              callback,
                               result);
+
+  return msg;
+}
+
+void
+get_url_now (GrlNetWc *self,
+	     const char *url,
+	     GHashTable *headers,
+	     GAsyncResult *result,
+	     GCancellable *cancellable)
+{
+  SoupMessage *msg;
+
+  msg = queue_message (self, url, headers, result, cancellable, reply_cb);
+
+  /* The session drops its reference when the message is finished, but the
+     content has to outlive it */
+  if (msg)
+    g_simple_async_result_set_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result),
+                                               g_object_ref (msg), NULL);
+}
+
+static void
+stream_reply_cb (SoupSession *session,
+                 SoupMessage *msg,
+                 gpointer user_data)
+{
+  GInputStream *stream;
+
+  if (msg->status_code == SOUP_STATUS_OK && decode_body (msg)) {
+    /* There is no streaming without the requester API: wrap the body */
+    stream =
+      g_memory_input_stream_new_from_data (msg->response_body->data,
+                                           msg->response_body->length,
+                                           NULL);
+    g_object_set_data_full (G_OBJECT (stream),
+                            "message",
+                            g_object_ref (msg),
+                            g_object_unref);
+    g_simple_async_result_set_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (user_data),
+                                               stream,
+                                               g_object_unref);
+  }
+
+  reply_cb (session, msg, user_data);
+}
+
+void
+get_stream_now (GrlNetWc *self,
+                const char *url,
+                GAsyncResult *result,
+                GCancellable *cancellable)
+{
+  queue_message (self, url, NULL, result, cancellable, stream_reply_cb);
 }
 
 void
@@ -182,5 +280,38 @@ cache_get_size (GrlNetWc *self)
 void
 free_op_res (void *op)
 {
-  /* noop */
+  g_object_unref (op);
+}
+
+SoupMessage *
+get_message (void *op)
+{
+  return SOUP_MESSAGE (op);
+}
+
+gboolean
+is_from_cache (void *op)
+{
+  return FALSE;
+}
+
+gsize
+get_wire_length (void *op)
+{
+  gpointer wire_length;
+
+  wire_length = g_object_get_data (G_OBJECT (op), "grl-net-wire-length");
+  if (wire_length)
+    return GPOINTER_TO_SIZE (wire_length);
+
+  return SOUP_MESSAGE (op)->response_body->length;
+}
+
+void
+set_op_from_message (GrlNetWc *self,
+                     GAsyncResult *result,
+                     SoupMessage *msg)
+{
+  g_simple_async_result_set_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result),
+                                             g_object_ref (msg), NULL);
 }
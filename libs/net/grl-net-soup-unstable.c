@@ -30,6 +30,8 @@
 /* Using the cache feature requires to use the unstable API */
 #define LIBSOUP_USE_UNSTABLE_REQUEST_API
 
+#include <string.h>
+
 #include <libsoup/soup-cache.h>
 #include <libsoup/soup-requester.h>
 #include <libsoup/soup-request-http.h>
@@ -39,8 +41,34 @@
 #define GRL_LOG_DOMAIN_DEFAULT wc_log_domain
 GRL_LOG_DOMAIN_EXTERN(wc_log_domain);
 
-SoupCache *cache;
-guint cache_size;
+/* Size of the buffers used when the content length is unknown */
+#define CHUNK_SIZE (32 * 1024)
+
+/* Spare buffers kept around for the next requests */
+#define BUFFER_POOL_MAX 8
+
+/* Two caches must not use the same directory at the same time, so the
+   instances using the same directory share its SoupCache, added to each of
+   their sessions. The last user dumps the index and releases it */
+struct shared_cache {
+  SoupCache *cache;
+  gchar *dir;
+  guint refcount;
+};
+
+/* Directory -> shared cache */
+static GHashTable *caches = NULL;
+G_LOCK_DEFINE_STATIC (caches);
+
+static void
+request_started_cb (SoupSession *session,
+                    SoupMessage *msg,
+                    SoupSocket *socket,
+                    gpointer user_data)
+{
+  /* Messages served from the cache never reach the network */
+  g_object_set_data (G_OBJECT (msg), "grl-net-sent", GINT_TO_POINTER (TRUE));
+}
 
 void
 init_requester (GrlNetWc *self)
@@ -50,6 +78,8 @@ init_requester (GrlNetWc *self)
   priv->requester = soup_requester_new ();
   soup_session_add_feature (priv->session,
                             SOUP_SESSION_FEATURE (priv->requester));
+  g_signal_connect (priv->session, "request-started",
+                    G_CALLBACK (request_started_cb), NULL);
 }
 
 void
@@ -58,105 +88,290 @@ finalize_requester (GrlNetWc *self)
   GrlNetWcPrivate *priv = self->priv;
 
   cache_down (self);
-  g_free (priv->previous_data);
   g_object_unref (priv->requester);
+
+  g_slist_foreach (priv->buffer_pool, (GFunc) g_free, NULL);
+  g_slist_free (priv->buffer_pool);
+  priv->buffer_pool = NULL;
+  priv->buffer_pool_length = 0;
 }
 
 void
 cache_down (GrlNetWc *self)
 {
   GrlNetWcPrivate *priv = self->priv;
-  GRL_DEBUG ("cache down: %p", cache);
+  struct shared_cache *sc = priv->cache;
+
+  GRL_DEBUG ("cache down: %p", sc);
 
-  if (!cache)
+  if (!sc)
     return;
 
-  soup_session_remove_feature (priv->session, SOUP_SESSION_FEATURE (cache));
-  g_object_unref (cache);
-  cache = NULL;
+  soup_session_remove_feature (priv->session, SOUP_SESSION_FEATURE (sc->cache));
+  priv->cache = NULL;
+
+  G_LOCK (caches);
+  if (--sc->refcount > 0) {
+    G_UNLOCK (caches);
+    return;
+  }
+  g_hash_table_remove (caches, sc->dir);
+  G_UNLOCK (caches);
+
+  /* Keep the index for the next user of the directory */
+  soup_cache_dump (sc->cache);
+  g_object_unref (sc->cache);
+  g_free (sc->dir);
+  g_slice_free (struct shared_cache, sc);
 }
 
 void
 cache_up (GrlNetWc *self)
 {
   GrlNetWcPrivate *priv = self->priv;
+  struct shared_cache *sc = priv->cache;
   gchar *dir;
 
-  GRL_DEBUG ("cache up: %p", cache);
+  GRL_DEBUG ("cache up: %p", sc);
 
-  if (cache)
+  if (sc)
     return;
 
-  dir = g_build_filename (g_get_user_cache_dir (),
-                          g_get_prgname (),
-                          "grilo",
-                          NULL);
-  cache = soup_cache_new (dir, SOUP_CACHE_SINGLE_USER);
-  g_free (dir);
+  dir = get_cache_dir (self);
+
+  G_LOCK (caches);
+  if (!caches)
+    caches = g_hash_table_new (g_str_hash, g_str_equal);
+
+  sc = g_hash_table_lookup (caches, dir);
+  if (sc) {
+    g_free (dir);
+    sc->refcount++;
+  } else {
+    GRL_DEBUG ("using cache directory '%s'", dir);
+
+    sc = g_slice_new0 (struct shared_cache);
+    sc->dir = dir;
+    sc->refcount = 1;
+    sc->cache = soup_cache_new (dir, SOUP_CACHE_SINGLE_USER);
+    soup_cache_load (sc->cache);
+    g_hash_table_insert (caches, sc->dir, sc);
+  }
+  G_UNLOCK (caches);
 
-  soup_cache_set_max_size (cache, cache_size);
+  /* The last size set wins */
+  soup_cache_set_max_size (sc->cache, priv->cache_size * 1024 * 1024);
+  priv->cache = sc;
 
   soup_session_add_feature (priv->session,
-                            SOUP_SESSION_FEATURE (cache));
+                            SOUP_SESSION_FEATURE (sc->cache));
 }
 
 gboolean
 cache_is_available (GrlNetWc *self)
 {
-  return cache != NULL;
+  return self->priv->cache != NULL;
 }
 
 void
 cache_set_size (GrlNetWc *self, guint size)
 {
-  if (!cache || size == cache_size)
+  GrlNetWcPrivate *priv = self->priv;
+  struct shared_cache *sc = priv->cache;
+
+  if (size == priv->cache_size)
     return;
 
-  cache_size = size;
-  soup_cache_set_max_size (cache, cache_size);
+  priv->cache_size = size;
+
+  /* Shared with the other instances using the same directory */
+  if (sc)
+    soup_cache_set_max_size (sc->cache, priv->cache_size * 1024 * 1024);
 }
 
 guint
 cache_get_size (GrlNetWc *self)
 {
-  return cache_size;
+  return self->priv->cache_size;
 }
 
+struct chunk {
+  gchar *data;
+  gsize size;
+  gsize offset;
+  gboolean pooled;
+};
+
 struct request_res {
+  GrlNetWc *self;
   SoupRequest *request;
+  SoupMessage *msg;
+  gboolean from_cache;
   gchar *buffer;
-  gsize length;
   gsize offset;
+  GQueue *chunks;               /* filled chunks, while reading */
+  struct chunk *current;        /* chunk being filled */
+  GConverter *decoder;          /* decoder of compressed content */
+  struct chunk *raw;            /* compressed data being decoded */
+  gsize wire_length;            /* bytes read from the network */
 };
 
+static struct chunk *
+chunk_new (GrlNetWc *self, gsize size)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  struct chunk *ch = g_slice_new0 (struct chunk);
+
+  if (size) {
+    /* Exact size known in advance: the chunk becomes the content */
+    ch->data = g_malloc (size);
+    ch->size = size;
+    return ch;
+  }
+
+  ch->size = CHUNK_SIZE;
+  ch->pooled = TRUE;
+  if (priv->buffer_pool) {
+    ch->data = priv->buffer_pool->data;
+    priv->buffer_pool = g_slist_delete_link (priv->buffer_pool,
+                                             priv->buffer_pool);
+    priv->buffer_pool_length--;
+  } else {
+    ch->data = g_malloc (CHUNK_SIZE);
+  }
+
+  return ch;
+}
+
 static void
-read_async_cb (GObject *source,
-               GAsyncResult *res,
-               gpointer user_data)
+chunk_free (GrlNetWc *self, struct chunk *ch)
 {
-  GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
-  struct request_res *rr = g_simple_async_result_get_op_res_gpointer (result);;
+  GrlNetWcPrivate *priv = self->priv;
 
-  GError *error = NULL;
-  gssize s = g_input_stream_read_finish (G_INPUT_STREAM (source), res, &error);
+  if (ch->pooled && ch->data && priv->buffer_pool_length < BUFFER_POOL_MAX) {
+    priv->buffer_pool = g_slist_prepend (priv->buffer_pool, ch->data);
+    priv->buffer_pool_length++;
+  } else {
+    g_free (ch->data);
+  }
 
-  gsize to_read;
+  g_slice_free (struct chunk, ch);
+}
 
-  if (s > 0) {
-    /* Continue reading */
-    rr->offset += s;
-    to_read = rr->length - rr->offset;
-
-    if (!to_read) {
-      /* Buffer is not enough; we need to assign more space */
-      rr->length *= 2;
-      rr->buffer = g_renew (gchar, rr->buffer, rr->length);
-      to_read = rr->length - rr->offset;
+static void
+release_chunks (struct request_res *rr)
+{
+  struct chunk *ch;
+
+  if (!rr->chunks)
+    return;
+
+  while ((ch = g_queue_pop_head (rr->chunks)))
+    chunk_free (rr->self, ch);
+  g_queue_free (rr->chunks);
+  rr->chunks = NULL;
+
+  if (rr->current) {
+    chunk_free (rr->self, rr->current);
+    rr->current = NULL;
+  }
+
+  if (rr->raw) {
+    chunk_free (rr->self, rr->raw);
+    rr->raw = NULL;
+  }
+}
+
+/* Builds the final buffer, copying the data at most once */
+static void
+join_chunks (struct request_res *rr)
+{
+  struct chunk *cur = rr->current;
+  GList *l;
+  gsize pos = 0;
+
+  if (g_queue_is_empty (rr->chunks) && !cur->pooled && cur->offset < cur->size) {
+    /* The announced length was right: hand the buffer over */
+    rr->buffer = cur->data;
+    cur->data = NULL;
+  } else {
+    rr->buffer = g_malloc (rr->offset + 1);
+    for (l = rr->chunks->head; l; l = l->next) {
+      struct chunk *ch = l->data;
+      memcpy (rr->buffer + pos, ch->data, ch->offset);
+      pos += ch->offset;
     }
+    memcpy (rr->buffer + pos, cur->data, cur->offset);
+  }
+
+  /* Put the end of string */
+  rr->buffer[rr->offset] = '\0';
 
-    g_input_stream_read_async (G_INPUT_STREAM (source),
-                               rr->buffer + rr->offset,
-                               to_read,
+  release_chunks (rr);
+}
+
+/* Decodes @length bytes of @data into the chunks; with @at_end the decoder
+   is also flushed */
+static gboolean
+decode_chunk (struct request_res *rr,
+              const gchar *data,
+              gsize length,
+              gboolean at_end,
+              GError **error)
+{
+  GConverterResult res;
+  gsize bytes_read;
+  gsize bytes_written;
+  struct chunk *cur;
+
+  do {
+    cur = rr->current;
+    if (cur->offset == cur->size) {
+      g_queue_push_tail (rr->chunks, cur);
+      rr->current = cur = chunk_new (rr->self, 0);
+    }
+
+    res = g_converter_convert (rr->decoder,
+                               data, length,
+                               cur->data + cur->offset,
+                               cur->size - cur->offset,
+                               at_end? G_CONVERTER_INPUT_AT_END: G_CONVERTER_NO_FLAGS,
+                               &bytes_read, &bytes_written,
+                               error);
+    if (res == G_CONVERTER_ERROR) {
+      if (!g_error_matches (*error, G_IO_ERROR, G_IO_ERROR_NO_SPACE) ||
+          cur->offset == 0)
+        return FALSE;
+
+      /* Not enough room left in this chunk; go on in a new one */
+      g_clear_error (error);
+      cur->size = cur->offset;
+      continue;
+    }
+
+    data += bytes_read;
+    length -= bytes_read;
+    cur->offset += bytes_written;
+    rr->offset += bytes_written;
+  } while (res != G_CONVERTER_FINISHED && (length > 0 || at_end));
+
+  return TRUE;
+}
+
+static void read_async_cb (GObject *source,
+                           GAsyncResult *res,
+                           gpointer user_data);
+
+static void
+read_next (GInputStream *in,
+           struct request_res *rr,
+           gpointer user_data)
+{
+  if (rr->decoder) {
+    /* Compressed data is decoded into the chunks as it arrives */
+    g_input_stream_read_async (in,
+                               rr->raw->data,
+                               rr->raw->size,
                                G_PRIORITY_DEFAULT,
                                NULL,
                                read_async_cb,
@@ -164,12 +379,54 @@ read_async_cb (GObject *source,
     return;
   }
 
-  /* Put the end of string */
-  rr->buffer[rr->offset] = '\0';
+  if (rr->current->offset == rr->current->size) {
+    /* Chunk is full; keep it and continue in a new one */
+    g_queue_push_tail (rr->chunks, rr->current);
+    rr->current = chunk_new (rr->self, 0);
+  }
+
+  g_input_stream_read_async (in,
+                             rr->current->data + rr->current->offset,
+                             rr->current->size - rr->current->offset,
+                             G_PRIORITY_DEFAULT,
+                             NULL,
+                             read_async_cb,
+                             user_data);
+}
+
+static void
+read_async_cb (GObject *source,
+               GAsyncResult *res,
+               gpointer user_data)
+{
+  GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+  struct request_res *rr = g_simple_async_result_get_op_res_gpointer (result);
+
+  GError *error = NULL;
+  gssize s = g_input_stream_read_finish (G_INPUT_STREAM (source), res, &error);
+
+  if (s > 0) {
+    rr->wire_length += s;
+    if (!rr->decoder) {
+      rr->current->offset += s;
+      rr->offset += s;
+    }
+
+    if (!rr->decoder || decode_chunk (rr, rr->raw->data, s, FALSE, &error)) {
+      /* Continue reading */
+      read_next (G_INPUT_STREAM (source), rr, user_data);
+      return;
+    }
+  } else if (s == 0 && rr->decoder) {
+    decode_chunk (rr, NULL, 0, TRUE, &error);
+  }
 
   g_input_stream_close (G_INPUT_STREAM (source), NULL, NULL);
+  g_object_unref (source);
 
   if (error) {
+    release_chunks (rr);
+
     if (error->code == G_IO_ERROR_CANCELLED) {
       g_simple_async_result_set_error (result, GRL_NET_WC_ERROR,
                                        GRL_NET_WC_ERROR_CANCELLED,
@@ -187,17 +444,13 @@ read_async_cb (GObject *source,
     return;
   }
 
-  {
-    SoupMessage *msg =
-      soup_request_http_get_message (SOUP_REQUEST_HTTP (rr->request));
+  join_chunks (rr);
 
-    if (msg && msg->status_code != SOUP_STATUS_OK) {
-        parse_error (msg->status_code,
-                     msg->reason_phrase,
-                     msg->response_body->data,
-                     G_SIMPLE_ASYNC_RESULT (user_data));
-        g_object_unref (msg);
-    }
+  if (rr->msg && rr->msg->status_code != SOUP_STATUS_OK) {
+    parse_error (rr->msg->status_code,
+                 rr->msg->reason_phrase,
+                 rr->msg->response_body->data,
+                 G_SIMPLE_ASYNC_RESULT (user_data));
   }
 
   g_simple_async_result_complete (result);
@@ -212,6 +465,7 @@ reply_cb (GObject *source,
 {
   GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
   struct request_res *rr = g_simple_async_result_get_op_res_gpointer (result);
+  goffset length;
 
   GError *error = NULL;
   GInputStream *in = soup_request_send_finish (rr->request, res, &error);
@@ -227,59 +481,155 @@ reply_cb (GObject *source,
     return;
   }
 
-  rr->length = soup_request_get_content_length (rr->request) + 1;
-  if (rr->length == 1)
-    rr->length = 50 * 1024;
-
-  rr->buffer = g_new (gchar, rr->length);
+  rr->msg = soup_request_http_get_message (SOUP_REQUEST_HTTP (rr->request));
+  rr->from_cache =
+    rr->msg && !g_object_get_data (G_OBJECT (rr->msg), "grl-net-sent");
+
+  /* With a known length the content is read in place; otherwise it is
+     gathered in pooled chunks and joined once at the end. The decoded length
+     of compressed content is never known */
+  length = soup_request_get_content_length (rr->request);
+  rr->chunks = g_queue_new ();
+  if (rr->msg)
+    rr->decoder = get_decoder (rr->msg);
+  if (rr->decoder) {
+    rr->raw = chunk_new (rr->self, 0);
+    rr->current = chunk_new (rr->self, 0);
+  } else {
+    rr->current = chunk_new (rr->self, length > 0? length + 1: 0);
+  }
 
-  g_input_stream_read_async (in,
-                             rr->buffer,
-                             rr->length,
-                             G_PRIORITY_DEFAULT,
-                             NULL,
-                             read_async_cb,
-                             user_data);
+  read_next (in, rr, user_data);
 }
 
 void
 get_url_now (GrlNetWc *self,
              const char *url,
+             GHashTable *headers,
              GAsyncResult *result,
              GCancellable *cancellable)
 {
   GrlNetWcPrivate *priv = self->priv;
   struct request_res *rr = g_slice_new0 (struct request_res);
+  SoupMessage *msg;
 
   g_simple_async_result_set_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result),
                                              rr,
                                              NULL);
 
+  rr->self = self;
   rr->request = soup_requester_request (priv->requester, url, NULL);
+  if (!rr->request) {
+    g_simple_async_result_set_error (G_SIMPLE_ASYNC_RESULT (result),
+                                     GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_UNAVAILABLE,
+                                     "Malformed URL: %s", url);
+    g_simple_async_result_complete_in_idle (G_SIMPLE_ASYNC_RESULT (result));
+    g_object_unref (result);
+    return;
+  }
+
+  if (headers) {
+    msg = soup_request_http_get_message (SOUP_REQUEST_HTTP (rr->request));
+    add_request_headers (msg, headers);
+    g_object_unref (msg);
+  }
+
   soup_request_send_async (rr->request, cancellable, reply_cb, result);
 }
 
+static void
+stream_reply_cb (GObject *source,
+                 GAsyncResult *res,
+                 gpointer user_data)
+{
+  GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+  SoupRequest *request = SOUP_REQUEST (source);
+  SoupMessage *msg;
+  GInputStream *in;
+  GConverter *decoder;
+  GInputStream *decoded;
+  GError *error = NULL;
+
+  in = soup_request_send_finish (request, res, &error);
+
+  if (error) {
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_simple_async_result_set_error (result, GRL_NET_WC_ERROR,
+                                       GRL_NET_WC_ERROR_CANCELLED,
+                                       "Operation was cancelled");
+    } else {
+      g_simple_async_result_set_error (result, GRL_NET_WC_ERROR,
+                                       GRL_NET_WC_ERROR_UNAVAILABLE,
+                                       "Data not available");
+    }
+    g_error_free (error);
+  } else {
+    msg = soup_request_http_get_message (SOUP_REQUEST_HTTP (request));
+
+    if (msg && msg->status_code != SOUP_STATUS_OK) {
+      parse_error (msg->status_code, msg->reason_phrase, NULL, result);
+      g_object_unref (in);
+    } else {
+      decoder = msg? get_decoder (msg): NULL;
+      if (decoder) {
+        /* Hand over the content already decoded */
+        decoded = g_converter_input_stream_new (in, decoder);
+        g_object_unref (decoder);
+        g_object_unref (in);
+        in = decoded;
+      }
+
+      /* Keep the request alive while the stream is read */
+      g_object_set_data_full (G_OBJECT (in),
+                              "request",
+                              g_object_ref (request),
+                              g_object_unref);
+      g_simple_async_result_set_op_res_gpointer (result, in, g_object_unref);
+    }
+
+    if (msg)
+      g_object_unref (msg);
+  }
+
+  g_simple_async_result_complete (result);
+  g_object_unref (result);
+  g_object_unref (request);
+}
+
+void
+get_stream_now (GrlNetWc *self,
+                const char *url,
+                GAsyncResult *result,
+                GCancellable *cancellable)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  SoupRequest *request;
+
+  request = soup_requester_request (priv->requester, url, NULL);
+  if (!request) {
+    g_simple_async_result_set_error (G_SIMPLE_ASYNC_RESULT (result),
+                                     GRL_NET_WC_ERROR,
+                                     GRL_NET_WC_ERROR_PROTOCOL_ERROR,
+                                     "Malformed URL: %s", url);
+    g_simple_async_result_complete_in_idle (G_SIMPLE_ASYNC_RESULT (result));
+    g_object_unref (result);
+    return;
+  }
+
+  soup_request_send_async (request, cancellable, stream_reply_cb, result);
+}
+
 void
 get_content (GrlNetWc *self,
              void *op,
              gchar **content,
              gsize *length)
 {
-  GrlNetWcPrivate *priv = self->priv;
   struct request_res *rr = op;
 
-  if (priv->previous_data)
-    g_free (priv->previous_data);
-
-  priv->previous_data = rr->buffer;
-
   if (content)
-    *content = self->priv->previous_data;
-  else {
-    g_free (rr->buffer);
-    self->priv->previous_data = NULL;
-    rr->buffer = NULL;
-  }
+    *content = rr->buffer;
 
   if (length)
     *length = rr->offset;
@@ -290,6 +640,60 @@ free_op_res (void *op)
 {
   struct request_res *rr = op;
 
-  g_object_unref (rr->request);
+  if (rr->request)
+    g_object_unref (rr->request);
+  if (rr->msg)
+    g_object_unref (rr->msg);
+  if (rr->decoder)
+    g_object_unref (rr->decoder);
+  g_free (rr->buffer);
   g_slice_free (struct request_res, rr);
 }
+
+SoupMessage *
+get_message (void *op)
+{
+  struct request_res *rr = op;
+
+  return rr->msg;
+}
+
+gboolean
+is_from_cache (void *op)
+{
+  struct request_res *rr = op;
+
+  return rr->from_cache;
+}
+
+gsize
+get_wire_length (void *op)
+{
+  struct request_res *rr = op;
+
+  return rr->wire_length;
+}
+
+void
+set_op_from_message (GrlNetWc *self,
+                     GAsyncResult *result,
+                     SoupMessage *msg)
+{
+  struct request_res *rr = g_slice_new0 (struct request_res);
+  SoupBuffer *body;
+
+  rr->self = self;
+  rr->msg = g_object_ref (msg);
+
+  body = soup_message_body_flatten (msg->response_body);
+  rr->offset = body->length;
+  rr->wire_length = body->length;
+  rr->buffer = g_malloc (body->length + 1);
+  memcpy (rr->buffer, body->data, body->length);
+  rr->buffer[rr->offset] = '\0';
+  soup_buffer_free (body);
+
+  g_simple_async_result_set_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result),
+                                             rr,
+                                             NULL);
+}
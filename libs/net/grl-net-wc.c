@@ -37,6 +37,7 @@
 #endif
 
 #include <string.h>
+#include <glib/gstdio.h>
 #include <libsoup/soup.h>
 
 #include <grilo.h>
@@ -50,11 +51,64 @@ enum {
   PROP_0,
   PROP_LOG_LEVEL,
   PROP_THROTTLING,
+  PROP_RATE_LIMIT,
+  PROP_BURST,
   PROP_CACHE,
   PROP_CACHE_SIZE,
+  PROP_CACHE_DIR,
+  PROP_MEMORY_CACHE_SIZE,
+  PROP_MAX_CONNS_PER_HOST,
+  PROP_MAX_CONNS,
+  PROP_IDLE_TIMEOUT,
+  PROP_KEEP_ALIVE,
+  PROP_MAX_ATTEMPTS,
+  PROP_RETRY_DELAY,
+  PROP_MAX_RETRY_DELAY,
+  PROP_RECORD_DIR,
+  PROP_REPLAY_DIR,
+  PROP_REPLAY_LATENCY,
+  PROP_REPLAY_BANDWIDTH,
+  PROP_COMPRESSION,
   PROP_USER_AGENT
 };
 
+enum {
+  SIG_REQUEST_FINISHED,
+  SIG_LAST
+};
+
+static gint wc_signals[SIG_LAST];
+
+/* Upper bounds of the histogram buckets, in ms */
+static const gdouble histogram_bounds[GRL_NET_WC_HISTOGRAM_BUCKETS - 1] = {
+  5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+/* Statuses retried by default: transport errors and temporary failures */
+static const guint default_retry_statuses[] = {
+  SOUP_STATUS_CANT_RESOLVE,
+  SOUP_STATUS_CANT_CONNECT,
+  SOUP_STATUS_IO_ERROR,
+  SOUP_STATUS_REQUEST_TIMEOUT,          /* 408 */
+  429,                                  /* Too Many Requests */
+  SOUP_STATUS_INTERNAL_SERVER_ERROR,    /* 500 */
+  SOUP_STATUS_BAD_GATEWAY,              /* 502 */
+  SOUP_STATUS_SERVICE_UNAVAILABLE,      /* 503 */
+  SOUP_STATUS_GATEWAY_TIMEOUT           /* 504 */
+};
+
+/* Queued requests gain PRIORITY_AGING_STEP every PRIORITY_AGING_INTERVAL ms
+   they wait, so low priority ones are not starved */
+#define PRIORITY_AGING_INTERVAL 100
+#define PRIORITY_AGING_STEP 10
+
+/* Only small responses are kept in the memory cache */
+#define MEMORY_CACHE_MAX_ENTRY (16 * 1024)
+
+/* Bigger ones with validators are kept on disk, up to this size in total, so
+   they can still be revalidated */
+#define VALIDATED_CACHE_SIZE (8 * 1024 * 1024)
+
 #define GRL_NET_WC_GET_PRIVATE(object)			\
   (G_TYPE_INSTANCE_GET_PRIVATE((object),                \
                                GRL_TYPE_NET_WC,		\
@@ -68,6 +122,15 @@ grl_net_wc_error_quark (void)
 
 G_DEFINE_TYPE (GrlNetWc, grl_net_wc, G_TYPE_OBJECT);
 
+struct host_queue;
+struct memory_entry;
+
+static void free_host_queue (struct host_queue *hq);
+static void free_memory_entry (struct memory_entry *entry);
+static void memory_cache_clear (GrlNetWc *self);
+static void request_response_unref (struct request_response *response);
+static gint64 get_current_time_us (void);
+
 static void grl_net_wc_finalize (GObject *object);
 static void grl_net_wc_set_property (GObject *object,
                                      guint propid,
@@ -118,6 +181,38 @@ grl_net_wc_class_init (GrlNetWcClass *klass)
                                                       0, G_MAXUINT, 0,
                                                       G_PARAM_READWRITE |
                                                       G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::rate-limit
+   *
+   * The maximum number of requests per second, in average. Requests above
+   * this rate are queued until they can be sent. 0 means no limit.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_RATE_LIMIT,
+                                   g_param_spec_double ("rate-limit",
+                                                        "Rate limit",
+                                                        "Maximum number of requests per second",
+                                                        0, G_MAXDOUBLE, 0,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::burst
+   *
+   * The number of requests that can be sent at once, without waiting, when
+   * a #GrlNetWc:rate-limit is set.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_BURST,
+                                   g_param_spec_uint ("burst",
+                                                      "Burst",
+                                                      "Number of requests that can be sent at once",
+                                                      1, G_MAXUINT, 1,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
   /**
    * GrlNetWc::cache
    *
@@ -146,6 +241,270 @@ grl_net_wc_class_init (GrlNetWcClass *klass)
                                                       G_PARAM_READWRITE |
                                                       G_PARAM_CONSTRUCT |
                                                       G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::cache-dir
+   *
+   * Directory where the cache is stored, or %NULL to use the default one.
+   * Instances using the same directory share its cache.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_CACHE_DIR,
+                                   g_param_spec_string ("cache-dir",
+                                                        "Cache directory",
+                                                        "Directory where the cache is stored",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::memory-cache-size
+   *
+   * Maximum size of the in-memory cache kept in front of the disk cache,
+   * in Kb. Only small responses that can be cached according to their
+   * Cache-Control header are kept. 0 disables it. Bigger responses with an
+   * ETag or Last-Modified header are kept on disk instead, so they can still
+   * be revalidated.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_MEMORY_CACHE_SIZE,
+                                   g_param_spec_uint ("memory-cache-size",
+                                                      "Memory cache size",
+                                                      "Size of memory cache in Kb",
+                                                      0, G_MAXUINT, 512,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::max-conns-per-host
+   *
+   * Maximum number of requests running at the same time to each host,
+   * unless set with grl_net_wc_set_host_limits(). Requests above it wait in
+   * the host queue for another one to finish. A #GrlNetWc:rate-limit only
+   * paces when requests start, so they can still overlap up to this limit.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_MAX_CONNS_PER_HOST,
+                                   g_param_spec_uint ("max-conns-per-host",
+                                                      "Max connections per host",
+                                                      "Maximum number of connections to each host",
+                                                      1, G_MAXUINT, 4,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::max-conns
+   *
+   * Maximum number of connections open at the same time to all hosts.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_MAX_CONNS,
+                                   g_param_spec_uint ("max-conns",
+                                                      "Max connections",
+                                                      "Maximum number of connections",
+                                                      1, G_MAXUINT, 16,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::idle-timeout
+   *
+   * Time in seconds an unused connection is kept open, waiting to be
+   * reused. 0 keeps them open until the server closes them.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_IDLE_TIMEOUT,
+                                   g_param_spec_uint ("idle-timeout",
+                                                      "Idle timeout",
+                                                      "Time to keep unused connections open",
+                                                      0, G_MAXUINT, 30,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::keep-alive
+   *
+   * %TRUE if connections are kept open to send further requests. %FALSE
+   * closes each connection after its request.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_KEEP_ALIVE,
+                                   g_param_spec_boolean ("keep-alive",
+                                                         "Keep alive",
+                                                         "Reuse connections",
+                                                         TRUE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::max-attempts
+   *
+   * Maximum number of times a request is tried before failing. Requests are
+   * retried only when they fail with one of the statuses set with
+   * grl_net_wc_set_retry_statuses(). 1 disables retries.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_MAX_ATTEMPTS,
+                                   g_param_spec_uint ("max-attempts",
+                                                      "Max attempts",
+                                                      "Maximum number of tries of each request",
+                                                      1, G_MAXUINT, 1,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::retry-delay
+   *
+   * Time in milliseconds before the first retry. It doubles with each
+   * further retry, up to #GrlNetWc:max-retry-delay, and a random jitter is
+   * applied.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_RETRY_DELAY,
+                                   g_param_spec_uint ("retry-delay",
+                                                      "Retry delay",
+                                                      "Time before the first retry in ms",
+                                                      0, G_MAXUINT, 500,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::max-retry-delay
+   *
+   * Longest time in milliseconds to wait before a retry. Requests whose
+   * server asks with Retry-After to wait longer than this fail right away.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_MAX_RETRY_DELAY,
+                                   g_param_spec_uint ("max-retry-delay",
+                                                      "Max retry delay",
+                                                      "Longest time to wait before a retry in ms",
+                                                      0, G_MAXUINT, 30000,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::record-dir
+   *
+   * Directory of an archive where all the requests and their responses are
+   * recorded, or %NULL to not record them. The GRL_NET_RECORD_DIR
+   * environment variable sets it for all the instances.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_RECORD_DIR,
+                                   g_param_spec_string ("record-dir",
+                                                        "Record directory",
+                                                        "Archive where requests are recorded",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::replay-dir
+   *
+   * Directory of an archive recorded with #GrlNetWc:record-dir. When set,
+   * requests are served from the archive instead of the network, and those
+   * not found fail with %GRL_NET_WC_ERROR_NETWORK_ERROR. The
+   * GRL_NET_REPLAY_DIR environment variable sets it for all the instances.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_REPLAY_DIR,
+                                   g_param_spec_string ("replay-dir",
+                                                        "Replay directory",
+                                                        "Archive requests are replayed from",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::replay-latency
+   *
+   * Time in milliseconds each replayed response takes to arrive. The
+   * GRL_NET_REPLAY_LATENCY environment variable sets it for all the
+   * instances.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_REPLAY_LATENCY,
+                                   g_param_spec_uint ("replay-latency",
+                                                      "Replay latency",
+                                                      "Simulated latency in ms",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::replay-bandwidth
+   *
+   * Simulated bandwidth, in bytes per second, to transfer the replayed
+   * responses, or 0 for no limit. The GRL_NET_REPLAY_BANDWIDTH environment
+   * variable sets it for all the instances.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_REPLAY_BANDWIDTH,
+                                   g_param_spec_uint ("replay-bandwidth",
+                                                      "Replay bandwidth",
+                                                      "Simulated bandwidth in bytes per second",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::compression
+   *
+   * %TRUE if compressed responses are accepted. They are decoded before
+   * being handed over, so this is transparent to the callers.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (g_klass,
+                                   PROP_COMPRESSION,
+                                   g_param_spec_boolean ("compression",
+                                                         "Compression",
+                                                         "Accept compressed responses",
+                                                         TRUE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlNetWc::request-finished:
+   * @wc: the web client
+   * @metrics: (type gpointer): the #GrlNetWcMetrics of the request
+   *
+   * Signals that a request finished, successfully or not, with its
+   * metrics. @metrics is only valid during the emission.
+   *
+   * Since: 0.1.21
+   */
+  wc_signals[SIG_REQUEST_FINISHED] =
+    g_signal_new ("request-finished",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL,
+                  NULL,
+                  g_cclosure_marshal_VOID__POINTER,
+                  G_TYPE_NONE, 1, G_TYPE_POINTER);
+
   /**
    * GrlNetWc::user-agent
    *
@@ -177,6 +536,148 @@ set_thread_context (GrlNetWc *self)
       g_object_set (priv->session, "use-thread-context", TRUE, NULL);
 }
 
+/* Timestamps of a message, in usecs */
+struct msg_timing {
+  gint64 resolving;
+  gint64 resolved;
+  gint64 connecting;
+  gint64 connected;
+  gint64 sent;
+  gint64 got_headers;
+  guint64 bytes;
+};
+
+static void
+free_msg_timing (struct msg_timing *timing)
+{
+  g_slice_free (struct msg_timing, timing);
+}
+
+#if GLIB_CHECK_VERSION(2,32,0)
+static void
+network_event_cb (SoupMessage *msg,
+                  GSocketClientEvent event,
+                  GIOStream *connection,
+                  struct msg_timing *timing)
+{
+  switch (event) {
+  case G_SOCKET_CLIENT_RESOLVING:
+    timing->resolving = get_current_time_us ();
+    break;
+  case G_SOCKET_CLIENT_RESOLVED:
+    timing->resolved = get_current_time_us ();
+    break;
+  case G_SOCKET_CLIENT_CONNECTING:
+    timing->connecting = get_current_time_us ();
+    break;
+  case G_SOCKET_CLIENT_CONNECTED:
+    timing->connected = get_current_time_us ();
+    break;
+  default:
+    break;
+  }
+}
+#endif
+
+static void
+got_headers_cb (SoupMessage *msg,
+                struct msg_timing *timing)
+{
+  /* Informational responses come before the final ones */
+  if (!timing->got_headers)
+    timing->got_headers = get_current_time_us ();
+}
+
+static void
+got_chunk_cb (SoupMessage *msg,
+              SoupBuffer *chunk,
+              struct msg_timing *timing)
+{
+  timing->bytes += chunk->length;
+}
+
+static void
+request_queued_cb (SoupSession *session,
+                   SoupMessage *msg,
+                   gpointer user_data)
+{
+  GrlNetWc *self = user_data;
+  struct msg_timing *timing;
+
+  if (!self->priv->keep_alive)
+    soup_message_headers_replace (msg->request_headers, "Connection", "close");
+
+  /* The backends decode the content themselves. Callers setting their own
+     encodings get the content as sent */
+#if GLIB_CHECK_VERSION(2,24,0)
+  if (self->priv->compression &&
+      !soup_message_headers_get_one (msg->request_headers, "Accept-Encoding"))
+    soup_message_headers_replace (msg->request_headers,
+                                  "Accept-Encoding", "gzip, deflate");
+#endif
+
+  timing = g_slice_new0 (struct msg_timing);
+  g_object_set_data_full (G_OBJECT (msg), "grl-net-timing", timing,
+                          (GDestroyNotify) free_msg_timing);
+
+  /* network-event is available for libsoup-2.4 >= 2.38.0 */
+#if GLIB_CHECK_VERSION(2,32,0)
+  if (g_signal_lookup ("network-event", SOUP_TYPE_MESSAGE))
+    g_signal_connect (msg, "network-event",
+                      G_CALLBACK (network_event_cb), timing);
+#endif
+  g_signal_connect (msg, "got-headers", G_CALLBACK (got_headers_cb), timing);
+  g_signal_connect (msg, "got-chunk", G_CALLBACK (got_chunk_cb), timing);
+}
+
+static void
+connection_used_cb (SoupSession *session,
+                    SoupMessage *msg,
+                    SoupSocket *socket,
+                    gpointer user_data)
+{
+  GrlNetWc *self = user_data;
+  struct msg_timing *timing;
+
+  timing = g_object_get_data (G_OBJECT (msg), "grl-net-timing");
+  if (timing)
+    timing->sent = get_current_time_us ();
+
+  if (!socket)
+    return;
+
+  if (g_object_get_data (G_OBJECT (socket), "grl-net-used")) {
+    self->priv->connection_reuses++;
+  } else {
+    g_object_set_data (G_OBJECT (socket), "grl-net-used", GINT_TO_POINTER (TRUE));
+    self->priv->connections++;
+  }
+}
+
+/* Record and replay can be set up for all the instances from the
+   environment */
+static void
+init_mock (GrlNetWc *self)
+{
+  const gchar *env;
+
+  env = g_getenv ("GRL_NET_REPLAY_LATENCY");
+  if (env)
+    grl_net_wc_set_replay_latency (self, (guint) g_ascii_strtoull (env, NULL, 10));
+
+  env = g_getenv ("GRL_NET_REPLAY_BANDWIDTH");
+  if (env)
+    grl_net_wc_set_replay_bandwidth (self, (guint) g_ascii_strtoull (env, NULL, 10));
+
+  env = g_getenv ("GRL_NET_REPLAY_DIR");
+  if (env)
+    grl_net_wc_set_replay_dir (self, env);
+
+  env = g_getenv ("GRL_NET_RECORD_DIR");
+  if (env)
+    grl_net_wc_set_record_dir (self, env);
+}
+
 static void
 grl_net_wc_init (GrlNetWc *wc)
 {
@@ -185,10 +686,29 @@ grl_net_wc_init (GrlNetWc *wc)
   wc->priv = GRL_NET_WC_GET_PRIVATE (wc);
 
   wc->priv->session = soup_session_async_new ();
-  wc->priv->pending = g_queue_new ();
+  wc->priv->hosts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           NULL,
+                                           (GDestroyNotify) free_host_queue);
+  wc->priv->transfers = g_hash_table_new (g_str_hash, g_str_equal);
+  wc->priv->memory_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) free_memory_entry);
+  wc->priv->memory_lru = g_queue_new ();
+  wc->priv->validated_lru = g_queue_new ();
+  wc->priv->burst = 1;
+  wc->priv->retry_statuses = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_array_append_vals (wc->priv->retry_statuses,
+                       default_retry_statuses,
+                       G_N_ELEMENTS (default_retry_statuses));
+
+  g_signal_connect (wc->priv->session, "request-queued",
+                    G_CALLBACK (request_queued_cb), wc);
+  g_signal_connect (wc->priv->session, "request-started",
+                    G_CALLBACK (connection_used_cb), wc);
 
   set_thread_context (wc);
   init_requester (wc);
+  init_mock (wc);
 }
 
 static void
@@ -202,7 +722,27 @@ grl_net_wc_finalize (GObject *object)
   cache_down (wc);
   finalize_requester (wc);
 
-  g_queue_free (wc->priv->pending);
+  /* Entries embed their LRU links, so unlink them before freeing them */
+  memory_cache_clear (wc);
+
+  g_hash_table_unref (wc->priv->hosts);
+  g_hash_table_unref (wc->priv->transfers);
+  g_hash_table_unref (wc->priv->memory_cache);
+  g_queue_free (wc->priv->memory_lru);
+  g_queue_free (wc->priv->validated_lru);
+  if (wc->priv->validated_dir) {
+    g_rmdir (wc->priv->validated_dir);
+    g_free (wc->priv->validated_dir);
+  }
+  g_array_free (wc->priv->retry_statuses, TRUE);
+  mock_unload (wc);
+  mock_record_stop (wc);
+  g_free (wc->priv->record_dir);
+  g_free (wc->priv->replay_dir);
+  g_free (wc->priv->cache_dir);
+
+  if (wc->priv->previous_response)
+    request_response_unref (wc->priv->previous_response);
   g_object_unref (wc->priv->session);
 
   G_OBJECT_CLASS (grl_net_wc_parent_class)->finalize (object);
@@ -225,12 +765,60 @@ grl_net_wc_set_property (GObject *object,
   case PROP_THROTTLING:
     grl_net_wc_set_throttling (wc, g_value_get_uint (value));
     break;
+  case PROP_RATE_LIMIT:
+    grl_net_wc_set_rate_limit (wc, g_value_get_double (value));
+    break;
+  case PROP_BURST:
+    grl_net_wc_set_burst (wc, g_value_get_uint (value));
+    break;
   case PROP_CACHE:
     grl_net_wc_set_cache (wc, g_value_get_boolean (value));
     break;
   case PROP_CACHE_SIZE:
     grl_net_wc_set_cache_size (wc, g_value_get_uint (value));
     break;
+  case PROP_CACHE_DIR:
+    grl_net_wc_set_cache_dir (wc, g_value_get_string (value));
+    break;
+  case PROP_MEMORY_CACHE_SIZE:
+    grl_net_wc_set_memory_cache_size (wc, g_value_get_uint (value));
+    break;
+  case PROP_MAX_CONNS_PER_HOST:
+    grl_net_wc_set_max_conns_per_host (wc, g_value_get_uint (value));
+    break;
+  case PROP_MAX_CONNS:
+    grl_net_wc_set_max_conns (wc, g_value_get_uint (value));
+    break;
+  case PROP_IDLE_TIMEOUT:
+    grl_net_wc_set_idle_timeout (wc, g_value_get_uint (value));
+    break;
+  case PROP_KEEP_ALIVE:
+    grl_net_wc_set_keep_alive (wc, g_value_get_boolean (value));
+    break;
+  case PROP_MAX_ATTEMPTS:
+    grl_net_wc_set_max_attempts (wc, g_value_get_uint (value));
+    break;
+  case PROP_RETRY_DELAY:
+    grl_net_wc_set_retry_delay (wc, g_value_get_uint (value));
+    break;
+  case PROP_MAX_RETRY_DELAY:
+    grl_net_wc_set_max_retry_delay (wc, g_value_get_uint (value));
+    break;
+  case PROP_RECORD_DIR:
+    grl_net_wc_set_record_dir (wc, g_value_get_string (value));
+    break;
+  case PROP_REPLAY_DIR:
+    grl_net_wc_set_replay_dir (wc, g_value_get_string (value));
+    break;
+  case PROP_REPLAY_LATENCY:
+    grl_net_wc_set_replay_latency (wc, g_value_get_uint (value));
+    break;
+  case PROP_REPLAY_BANDWIDTH:
+    grl_net_wc_set_replay_bandwidth (wc, g_value_get_uint (value));
+    break;
+  case PROP_COMPRESSION:
+    grl_net_wc_set_compression (wc, g_value_get_boolean (value));
+    break;
   case PROP_USER_AGENT:
     g_object_set (G_OBJECT (wc->priv->session),
                   "user-agent", g_value_get_string (value),
@@ -258,12 +846,60 @@ grl_net_wc_get_property (GObject *object,
   case PROP_THROTTLING:
     g_value_set_uint (value, wc->priv->throttling);
     break;
+  case PROP_RATE_LIMIT:
+    g_value_set_double (value, wc->priv->rate_limit);
+    break;
+  case PROP_BURST:
+    g_value_set_uint (value, wc->priv->burst);
+    break;
   case PROP_CACHE:
     g_value_set_boolean(value, cache_is_available (wc));
     break;
   case PROP_CACHE_SIZE:
     g_value_set_uint (value, cache_get_size (wc));
     break;
+  case PROP_CACHE_DIR:
+    g_value_set_string (value, wc->priv->cache_dir);
+    break;
+  case PROP_MEMORY_CACHE_SIZE:
+    g_value_set_uint (value, wc->priv->memory_cache_size);
+    break;
+  case PROP_MAX_CONNS_PER_HOST:
+    g_value_set_uint (value, wc->priv->max_conns_per_host);
+    break;
+  case PROP_MAX_CONNS:
+    g_value_set_uint (value, wc->priv->max_conns);
+    break;
+  case PROP_IDLE_TIMEOUT:
+    g_value_set_uint (value, wc->priv->idle_timeout);
+    break;
+  case PROP_KEEP_ALIVE:
+    g_value_set_boolean (value, wc->priv->keep_alive);
+    break;
+  case PROP_MAX_ATTEMPTS:
+    g_value_set_uint (value, wc->priv->max_attempts);
+    break;
+  case PROP_RETRY_DELAY:
+    g_value_set_uint (value, wc->priv->retry_delay);
+    break;
+  case PROP_MAX_RETRY_DELAY:
+    g_value_set_uint (value, wc->priv->max_retry_delay);
+    break;
+  case PROP_RECORD_DIR:
+    g_value_set_string (value, wc->priv->record_dir);
+    break;
+  case PROP_REPLAY_DIR:
+    g_value_set_string (value, wc->priv->replay_dir);
+    break;
+  case PROP_REPLAY_LATENCY:
+    g_value_set_uint (value, wc->priv->replay_latency);
+    break;
+  case PROP_REPLAY_BANDWIDTH:
+    g_value_set_uint (value, wc->priv->replay_bandwidth);
+    break;
+  case PROP_COMPRESSION:
+    g_value_set_boolean (value, wc->priv->compression);
+    break;
   case PROP_USER_AGENT:
     g_object_get_property (G_OBJECT (wc->priv->session), "user_agent", value);
     break;
@@ -272,263 +908,2344 @@ grl_net_wc_get_property (GObject *object,
   }
 }
 
+/* Requests to each host are queued and limited independently */
+struct host_queue {
+  GrlNetWc *self;
+  gchar *host;
+  gboolean custom;              /* limits set with grl_net_wc_set_host_limits() */
+  gdouble rate_limit;           /* requests per second, 0 means no limit */
+  guint burst;                  /* requests that can be sent at once */
+  guint max_running;            /* concurrent requests, 0 means no limit */
+  gdouble tokens;               /* requests that can be sent now */
+  gint64 last_refill;           /* last time tokens were added, in usecs */
+  guint dispatch_id;            /* timeout dispatching delayed requests */
+  gint64 retry_after;           /* nothing is sent before, in usecs */
+  GQueue *pending;              /* closure queue for delayed requests, in
+                                   arrival order */
+  guint running;
+  /* statistics */
+  guint requests;
+  guint delayed;
+  gint64 total_wait;
+  guint retries;
+};
+
+/* A transfer, shared by all the callers requesting the same resource at
+   the same time */
 struct request_clos {
   GrlNetWc *self;
+  struct host_queue *hq;
   char *url;
+  gchar *key;
   GAsyncResult *result;
   GCancellable *cancellable;
-  guint source_id;
+  GList *waiters;
+  guint active_waiters;
+  gint64 queued;
+  gint64 started;               /* when it was last sent, in usecs */
+  gint priority;                /* lower values go first */
+  gboolean sent;
+  gboolean stream;
+  guint attempts;               /* times sent */
+  guint retry_id;               /* timeout before the next attempt */
+  GHashTable *headers;          /* extra request headers, or NULL */
+  struct request_response *stored; /* content being revalidated */
+  struct prewarm *prewarm;      /* set for a HEAD opening a connection */
+  gint64 created;
+  GrlNetWcMetrics metrics;
 };
 
-static gboolean
-get_url_delayed (gpointer user_data)
-{
-  struct request_clos *c = (struct request_clos *) user_data;
+/* A caller of grl_net_wc_request_async() */
+struct request_waiter {
+  struct request_clos *c;
+  GSimpleAsyncResult *result;
+  GCancellable *cancellable;
+  gulong cancel_id;
+  gboolean cancelled;
+};
 
-  /* validation */
-  {
-    GrlNetWcPrivate *priv = c->self->priv;
-    struct request_clos *d = g_queue_pop_tail (priv->pending);
-    g_assert (c == d);
-  }
+/* The content of a finished transfer, shared by all its waiters */
+struct request_response {
+  gint refcount;
+  void *op;
+  gchar *content;
+  gsize length;
+  gchar *data;                  /* content read from disk, or NULL */
+  SoupMessageHeaders *headers;  /* headers of a response read from disk */
+};
 
-  get_url_now (c->self, c->url, c->result, c->cancellable);
+static gint64
+get_current_time_us (void)
+{
+  GTimeVal now;
 
-  g_free (c->url);
-  g_free (c);
+  g_get_current_time (&now);
 
-  return FALSE;
+  return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
 }
 
 static void
-get_url (GrlNetWc *self,
-         const char *url,
-         GAsyncResult *result,
-         GCancellable *cancellable)
+free_host_queue (struct host_queue *hq)
+{
+  /* Requests keep a reference on the GrlNetWc, so there can not be pending
+     ones at this point */
+  g_warn_if_fail (g_queue_is_empty (hq->pending));
+
+  if (hq->dispatch_id)
+    g_source_remove (hq->dispatch_id);
+  g_queue_free (hq->pending);
+  g_free (hq->host);
+  g_slice_free (struct host_queue, hq);
+}
+
+static struct host_queue *
+get_host_queue (GrlNetWc *self,
+                const gchar *host)
 {
-  guint id;
-  GTimeVal now;
-  struct request_clos *c;
   GrlNetWcPrivate *priv = self->priv;
+  struct host_queue *hq;
 
-  g_get_current_time (&now);
+  hq = g_hash_table_lookup (priv->hosts, host);
+  if (hq)
+    return hq;
 
-  if ((now.tv_sec - priv->last_request.tv_sec) > priv->throttling) {
-    get_url_now (self, url, result, cancellable);
-    g_get_current_time (&priv->last_request);
+  hq = g_slice_new0 (struct host_queue);
+  hq->self = self;
+  hq->host = g_strdup (host);
+  hq->rate_limit = priv->rate_limit;
+  hq->burst = priv->burst;
+  hq->tokens = priv->burst;
+  hq->max_running = priv->max_conns_per_host;
+  hq->pending = g_queue_new ();
 
-    return;
-  }
+  g_hash_table_insert (priv->hosts, hq->host, hq);
 
-  GRL_DEBUG ("delaying web request");
+  return hq;
+}
+
+static struct host_queue *
+get_host_queue_for_url (GrlNetWc *self,
+                        const char *url)
+{
+  SoupURI *uri;
+  struct host_queue *hq;
+
+  uri = soup_uri_new (url);
+  /* Malformed URLs are reported by the backend */
+  hq = get_host_queue (self, (uri && uri->host)? uri->host: "");
+  if (uri)
+    soup_uri_free (uri);
+
+  return hq;
+}
+
+/* Token bucket: tokens are added at rate_limit per second, up to burst, and
+   each request takes one */
+static void
+refill_tokens (struct host_queue *hq)
+{
+  gint64 now = get_current_time_us ();
+
+  /* The wall clock may go backwards */
+  if (now > hq->last_refill) {
+    hq->tokens += (now - hq->last_refill) * hq->rate_limit / G_USEC_PER_SEC;
+    hq->tokens = MIN (hq->tokens, hq->burst);
+  }
+
+  hq->last_refill = now;
+}
+
+static gboolean
+can_send (struct host_queue *hq)
+{
+  if (hq->max_running > 0 && hq->running >= hq->max_running)
+    return FALSE;
+
+  /* The server asked to wait */
+  if (hq->retry_after > get_current_time_us ())
+    return FALSE;
+
+  if (hq->rate_limit <= 0)
+    return TRUE;
+
+  refill_tokens (hq);
+
+  if (hq->tokens < 1)
+    return FALSE;
+
+  hq->tokens -= 1;
+
+  return TRUE;
+}
+
+static void send_prewarm (struct request_clos *c);
+
+static void
+send_request (struct request_clos *c)
+{
+  struct host_queue *hq = c->hq;
+
+  c->sent = TRUE;
+  c->attempts++;
+  hq->running++;
+  hq->requests++;
+  c->started = get_current_time_us ();
+  hq->total_wait += c->started - c->queued;
+  c->metrics.queue_wait += (c->started - c->queued) / 1000.0;
+
+  if (c->prewarm) {
+    send_prewarm (c);
+  } else if (is_mocked (c->self)) {
+    if (c->stream)
+      get_stream_mocked (c->self, c->url, c->result, c->cancellable);
+    else
+      get_url_mocked (c->self, c->url, c->result, c->cancellable);
+  } else if (c->stream) {
+    get_stream_now (c->self, c->url, c->result, c->cancellable);
+  } else {
+    get_url_now (c->self, c->url, c->headers, c->result, c->cancellable);
+  }
+}
+
+static gint64
+get_effective_priority (struct request_clos *c,
+                        gint64 now)
+{
+  return c->priority -
+    (now - c->queued) / (PRIORITY_AGING_INTERVAL * 1000) * PRIORITY_AGING_STEP;
+}
+
+/* Takes the most urgent queued request; the oldest one among equals */
+static struct request_clos *
+pop_next_request (struct host_queue *hq)
+{
+  GList *l, *next = NULL;
+  gint64 now = get_current_time_us ();
+  gint64 priority, next_priority = 0;
+  struct request_clos *c;
+
+  for (l = hq->pending->head; l; l = l->next) {
+    priority = get_effective_priority (l->data, now);
+    if (!next || priority < next_priority) {
+      next = l;
+      next_priority = priority;
+    }
+  }
+
+  c = next->data;
+  g_queue_delete_link (hq->pending, next);
+
+  return c;
+}
+
+static gboolean dispatch_delayed (gpointer user_data);
+
+static void
+schedule_dispatch (struct host_queue *hq)
+{
+  guint delay;
+  gint64 now;
+
+  if (hq->dispatch_id || g_queue_is_empty (hq->pending))
+    return;
+
+  /* Requests finishing will dispatch the next ones */
+  if (hq->max_running > 0 && hq->running >= hq->max_running)
+    return;
+
+  /* Wait until the next token is available */
+  if (hq->rate_limit > 0 && hq->tokens < 1)
+    delay = (guint) ((1 - hq->tokens) * 1000 / hq->rate_limit) + 1;
+  else
+    delay = 0;
+
+  now = get_current_time_us ();
+  if (hq->retry_after > now)
+    delay = MAX (delay, (guint) ((hq->retry_after - now) / 1000) + 1);
+
+  GRL_DEBUG ("dispatching delayed web request to '%s' in %u ms",
+             hq->host, delay);
+
+  hq->dispatch_id = g_timeout_add (delay, dispatch_delayed, hq);
+}
+
+static gboolean
+dispatch_delayed (gpointer user_data)
+{
+  struct host_queue *hq = (struct host_queue *) user_data;
+
+  hq->dispatch_id = 0;
+
+  while (!g_queue_is_empty (hq->pending) && can_send (hq)) {
+    send_request (pop_next_request (hq));
+  }
+
+  schedule_dispatch (hq);
+
+  return FALSE;
+}
+
+static struct request_response *
+request_response_ref (struct request_response *response)
+{
+  g_atomic_int_inc (&response->refcount);
+  return response;
+}
+
+static void
+request_response_unref (struct request_response *response)
+{
+  if (g_atomic_int_dec_and_test (&response->refcount)) {
+    if (response->op)
+      free_op_res (response->op);
+    if (response->headers)
+      soup_message_headers_free (response->headers);
+    g_free (response->data);
+    g_slice_free (struct request_response, response);
+  }
+}
+
+/* In-memory cache of small responses, in front of the disk cache. Bigger
+   responses that can be revalidated only keep their body on disk */
+struct memory_entry {
+  gchar *key;
+  struct request_response *response; /* body kept in memory, or NULL */
+  gchar *path;                  /* body kept on disk, or NULL */
+  SoupMessageHeaders *headers;  /* headers of the response kept on disk */
+  gsize length;
+  gint64 expires;
+  gchar *etag;                  /* validators to revalidate it once expired */
+  gchar *last_modified;
+  GList link;
+};
+
+static void
+free_memory_entry (struct memory_entry *entry)
+{
+  if (entry->response)
+    request_response_unref (entry->response);
+  if (entry->path) {
+    g_unlink (entry->path);
+    g_free (entry->path);
+  }
+  if (entry->headers)
+    soup_message_headers_free (entry->headers);
+  g_free (entry->key);
+  g_free (entry->etag);
+  g_free (entry->last_modified);
+  g_slice_free (struct memory_entry, entry);
+}
+
+static void
+memory_cache_remove (GrlNetWc *self,
+                     struct memory_entry *entry)
+{
+  GrlNetWcPrivate *priv = self->priv;
+
+  if (entry->response) {
+    g_queue_unlink (priv->memory_lru, &entry->link);
+    priv->memory_used -= entry->length;
+  } else {
+    g_queue_unlink (priv->validated_lru, &entry->link);
+    priv->validated_used -= entry->length;
+  }
+  g_hash_table_remove (priv->memory_cache, entry->key);
+}
+
+static void
+memory_cache_trim (GrlNetWc *self)
+{
+  GrlNetWcPrivate *priv = self->priv;
+
+  while (priv->memory_used > (gsize) priv->memory_cache_size * 1024 &&
+         !g_queue_is_empty (priv->memory_lru)) {
+    memory_cache_remove (self, g_queue_peek_head (priv->memory_lru));
+  }
+
+  while (priv->validated_used > VALIDATED_CACHE_SIZE &&
+         !g_queue_is_empty (priv->validated_lru)) {
+    memory_cache_remove (self, g_queue_peek_head (priv->validated_lru));
+  }
+}
+
+static struct request_response *
+memory_cache_lookup (GrlNetWc *self,
+                     const gchar *key)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  struct memory_entry *entry;
+
+  entry = g_hash_table_lookup (priv->memory_cache, key);
+  if (!entry)
+    return NULL;
+
+  /* Bodies on disk are only used to revalidate them */
+  if (!entry->response)
+    return NULL;
+
+  if (entry->expires <= get_current_time_us ()) {
+    /* Kept to be revalidated */
+    if (!entry->etag && !entry->last_modified)
+      memory_cache_remove (self, entry);
+    return NULL;
+  }
+
+  /* Most recently used go last */
+  g_queue_unlink (priv->memory_lru, &entry->link);
+  g_queue_push_tail_link (priv->memory_lru, &entry->link);
+
+  return entry->response;
+}
+
+/* Returns for how long, in seconds, the response can be used without
+   revalidating it. @store is set to whether it can be kept at all */
+static guint
+get_max_age (SoupMessage *msg,
+             gboolean *store)
+{
+  const gchar *cache_control;
+  GHashTable *params;
+  const gchar *max_age;
+  guint seconds = 0;
+
+  *store = TRUE;
+
+  cache_control = soup_message_headers_get_one (msg->response_headers,
+                                                "Cache-Control");
+  if (!cache_control)
+    return 0;
+
+  params = soup_header_parse_param_list (cache_control);
+  *store = !g_hash_table_lookup_extended (params, "no-store", NULL, NULL);
+  if (*store &&
+      !g_hash_table_lookup_extended (params, "no-cache", NULL, NULL)) {
+    max_age = g_hash_table_lookup (params, "max-age");
+    if (max_age)
+      seconds = (guint) g_ascii_strtoull (max_age, NULL, 10);
+  }
+  soup_header_free_param_list (params);
+
+  return seconds;
+}
+
+static void
+copy_message_header (const char *name,
+                     const char *value,
+                     gpointer user_data)
+{
+  soup_message_headers_append ((SoupMessageHeaders *) user_data, name, value);
+}
+
+static SoupMessageHeaders *
+copy_message_headers (SoupMessageHeaders *headers)
+{
+  SoupMessageHeaders *copy;
+
+  copy = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  soup_message_headers_foreach (headers, copy_message_header, copy);
+
+  return copy;
+}
+
+/* Writes the body of a response too big for the memory cache to disk, so it
+   can still be revalidated. Returns the file, or NULL */
+static gchar *
+memory_cache_write (GrlNetWc *self,
+                    const gchar *key,
+                    struct request_response *response)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  gchar *checksum;
+  gchar *cache_dir;
+  gchar *name;
+  gchar *path;
+
+  /* Kept apart from the other instances sharing the cache directory, and
+     removed with the instance */
+  if (!priv->validated_dir) {
+    cache_dir = get_cache_dir (self);
+    name = g_strdup_printf ("validated-%p-%08x", self, g_random_int ());
+    priv->validated_dir = g_build_filename (cache_dir, name, NULL);
+    g_free (cache_dir);
+    g_free (name);
+
+    if (g_mkdir_with_parents (priv->validated_dir, 0700) != 0) {
+      GRL_WARNING ("Could not create directory '%s'", priv->validated_dir);
+      g_free (priv->validated_dir);
+      priv->validated_dir = NULL;
+      return NULL;
+    }
+  }
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  path = g_build_filename (priv->validated_dir, checksum, NULL);
+  g_free (checksum);
+
+  if (!g_file_set_contents (path, response->content, response->length, NULL)) {
+    g_free (path);
+    return NULL;
+  }
+
+  return path;
+}
+
+static void
+memory_cache_store (GrlNetWc *self,
+                    const gchar *key,
+                    struct request_response *response)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  struct memory_entry *entry;
+  SoupMessage *msg;
+  const gchar *etag;
+  const gchar *last_modified;
+  gboolean in_memory;
+  gboolean store;
+  guint max_age;
+  gchar *path = NULL;
+
+  if (!priv->use_cache)
+    return;
+
+  /* Responses read back from disk are already stored */
+  msg = response->op? get_message (response->op): NULL;
+  if (!msg || msg->status_code != SOUP_STATUS_OK)
+    return;
+
+  max_age = get_max_age (msg, &store);
+  etag = soup_message_headers_get_one (msg->response_headers, "ETag");
+  last_modified = soup_message_headers_get_one (msg->response_headers,
+                                                "Last-Modified");
+
+  /* Responses that can not be used right away are kept only if they can be
+     revalidated */
+  if (!store || (max_age == 0 && !etag && !last_modified))
+    return;
+
+  in_memory = response->length <= MEMORY_CACHE_MAX_ENTRY &&
+    response->length <= (gsize) priv->memory_cache_size * 1024;
+
+  /* Too big for memory: keep it only to revalidate it */
+  if (!in_memory) {
+    if ((!etag && !last_modified) || response->length > VALIDATED_CACHE_SIZE)
+      return;
+
+    path = memory_cache_write (self, key, response);
+    if (!path)
+      return;
+  }
+
+  entry = g_hash_table_lookup (priv->memory_cache, key);
+  if (entry)
+    memory_cache_remove (self, entry);
+
+  entry = g_slice_new0 (struct memory_entry);
+  entry->key = g_strdup (key);
+  entry->length = response->length;
+  entry->expires = get_current_time_us () + (gint64) max_age * G_USEC_PER_SEC;
+  entry->etag = g_strdup (etag);
+  entry->last_modified = g_strdup (last_modified);
+  entry->link.data = entry;
+
+  g_hash_table_insert (priv->memory_cache, entry->key, entry);
+
+  if (in_memory) {
+    entry->response = request_response_ref (response);
+    g_queue_push_tail_link (priv->memory_lru, &entry->link);
+    priv->memory_used += entry->length;
+  } else {
+    entry->path = path;
+    entry->headers = copy_message_headers (msg->response_headers);
+    g_queue_push_tail_link (priv->validated_lru, &entry->link);
+    priv->validated_used += entry->length;
+  }
+
+  memory_cache_trim (self);
+}
+
+/* Reads back a body kept on disk */
+static struct request_response *
+memory_cache_read (struct memory_entry *entry)
+{
+  struct request_response *response;
+  gchar *data;
+  gsize length;
+
+  if (!g_file_get_contents (entry->path, &data, &length, NULL))
+    return NULL;
+
+  response = g_slice_new0 (struct request_response);
+  response->refcount = 1;
+  response->data = data;
+  response->content = data;
+  response->length = length;
+  response->headers = copy_message_headers (entry->headers);
+
+  return response;
+}
+
+/* Returns the headers of a conditional request if a stale copy of @url can
+   be revalidated, and sets @stored to that copy */
+static GHashTable *
+memory_cache_revalidate (GrlNetWc *self,
+                         const char *url,
+                         struct request_response **stored)
+{
+  struct memory_entry *entry;
+  GHashTable *headers;
+
+  entry = g_hash_table_lookup (self->priv->memory_cache, url);
+  if (!entry || (!entry->etag && !entry->last_modified))
+    return NULL;
+
+  if (entry->response) {
+    *stored = request_response_ref (entry->response);
+  } else {
+    *stored = memory_cache_read (entry);
+    if (!*stored) {
+      memory_cache_remove (self, entry);
+      return NULL;
+    }
+  }
+
+  headers = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+  if (entry->etag)
+    g_hash_table_insert (headers, "If-None-Match",
+                         g_strdup (entry->etag));
+
+  if (entry->last_modified)
+    g_hash_table_insert (headers, "If-Modified-Since",
+                         g_strdup (entry->last_modified));
+
+  return headers;
+}
+
+static void
+memory_cache_clear (GrlNetWc *self)
+{
+  GrlNetWcPrivate *priv = self->priv;
+
+  while (!g_queue_is_empty (priv->memory_lru))
+    memory_cache_remove (self, g_queue_peek_head (priv->memory_lru));
+
+  while (!g_queue_is_empty (priv->validated_lru))
+    memory_cache_remove (self, g_queue_peek_head (priv->validated_lru));
+}
+
+static void
+free_request_clos (struct request_clos *c)
+{
+  g_object_unref (c->cancellable);
+  if (c->headers)
+    g_hash_table_unref (c->headers);
+  if (c->stored)
+    request_response_unref (c->stored);
+  g_list_free (c->waiters);
+  g_free (c->url);
+  g_free (c->key);
+  g_slice_free (struct request_clos, c);
+}
+
+static void
+free_request_waiter (struct request_waiter *w)
+{
+  /* Not from the "cancelled" handler, so g_cancellable_disconnect() is not
+     needed */
+  if (w->cancel_id)
+    g_signal_handler_disconnect (w->cancellable, w->cancel_id);
+  if (w->cancellable)
+    g_object_unref (w->cancellable);
+  g_object_unref (w->result);
+  g_slice_free (struct request_waiter, w);
+}
+
+static void get_url (struct request_clos *c);
+
+static void
+set_response_flags (GSimpleAsyncResult *result,
+                    GrlNetWcResponseFlags flags)
+{
+  g_object_set_data (G_OBJECT (result), "grl-net-flags",
+                     GUINT_TO_POINTER (flags));
+}
+
+static gboolean
+is_retry_status (GrlNetWc *self,
+                 guint status)
+{
+  GArray *statuses = self->priv->retry_statuses;
+  guint i;
+
+  for (i = 0; i < statuses->len; i++) {
+    if (g_array_index (statuses, guint, i) == status)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Returns the Retry-After delay in ms, or -1 if not set */
+static gint64
+get_retry_after (SoupMessage *msg)
+{
+  const gchar *header;
+  gchar *end;
+  guint64 seconds;
+  SoupDate *date;
+  gint64 delay = -1;
+
+  header = soup_message_headers_get_one (msg->response_headers, "Retry-After");
+  if (!header)
+    return -1;
+
+  /* Either a number of seconds or an HTTP date */
+  seconds = g_ascii_strtoull (header, &end, 10);
+  if (end != header && *end == '\0')
+    return seconds * 1000;
+
+  date = soup_date_new_from_string (header);
+  if (date) {
+    delay = ((gint64) soup_date_to_time_t (date) * G_USEC_PER_SEC -
+             get_current_time_us ()) / 1000;
+    delay = MAX (delay, 0);
+    soup_date_free (date);
+  }
+
+  return delay;
+}
+
+static gboolean
+retry_cb (gpointer user_data)
+{
+  struct request_clos *c = (struct request_clos *) user_data;
+
+  c->retry_id = 0;
+
+  GRL_DEBUG ("retrying web request to '%s'", c->url);
+
+  /* Back to the host queue, so retries respect the rate limits too */
+  get_url (c);
+
+  return FALSE;
+}
+
+/* Checks whether the finished attempt must be retried, and schedules it */
+static gboolean
+retry_request (struct request_clos *c,
+               GSimpleAsyncResult *res)
+{
+  GrlNetWcPrivate *priv = c->self->priv;
+  struct host_queue *hq = c->hq;
+  GError *error = NULL;
+  SoupMessage *msg = NULL;
+  void *op;
+  guint status;
+  gint64 delay, retry_after = -1;
+
+  if (c->attempts >= priv->max_attempts || c->active_waiters == 0)
+    return FALSE;
+
+  if (!g_simple_async_result_propagate_error (res, &error))
+    return FALSE;
+
+  if (g_error_matches (error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_CANCELLED)) {
+    g_error_free (error);
+    return FALSE;
+  }
+  g_error_free (error);
+
+  op = g_simple_async_result_get_op_res_gpointer (res);
+  if (!c->stream && op)
+    msg = get_message (op);
+
+  /* Failures without an HTTP status are network errors */
+  status = (msg && msg->status_code)? msg->status_code: SOUP_STATUS_IO_ERROR;
+  if (!is_retry_status (c->self, status))
+    return FALSE;
+
+  /* Exponential backoff, with jitter so clients do not retry in lockstep */
+  delay = (gint64) priv->retry_delay << MIN (c->attempts - 1, 30);
+  delay = MIN (delay, priv->max_retry_delay);
+  delay -= (gint64) (g_random_double () * (delay / 2));
+
+  if (msg)
+    retry_after = get_retry_after (msg);
+
+  if (retry_after >= 0) {
+    /* Better fail now than retry too early */
+    if (retry_after > priv->max_retry_delay)
+      return FALSE;
+
+    delay = MAX (delay, retry_after);
+
+    /* The whole host is paused, not only this request */
+    hq->retry_after = MAX (hq->retry_after,
+                           get_current_time_us () + retry_after * 1000);
+  }
+
+  GRL_DEBUG ("web request to '%s' failed with status %u, retrying in %"
+             G_GINT64_FORMAT " ms (attempt %u of %u)",
+             c->url, status, delay, c->attempts + 1, priv->max_attempts);
+
+  if (!c->stream && op)
+    free_op_res (op);
+
+  /* A new result for the next attempt */
+  c->sent = FALSE;
+  c->result = G_ASYNC_RESULT (g_simple_async_result_new (G_OBJECT (c->self),
+                                                         request_done_cb,
+                                                         c,
+                                                         get_url));
+  c->retry_id = g_timeout_add ((guint) delay, retry_cb, c);
+  hq->retries++;
+
+  return TRUE;
+}
+
+/* Saves what the server answered, before any retry or revalidation */
+static void
+record_request (struct request_clos *c,
+                GSimpleAsyncResult *res)
+{
+  void *op = g_simple_async_result_get_op_res_gpointer (res);
+  SoupMessage *msg;
+  gchar *content = NULL;
+  gsize length = 0;
+
+  /* Network errors have no response to replay */
+  if (!op || is_mocked (c->self))
+    return;
+
+  msg = get_message (op);
+  if (!msg || msg->status_code == SOUP_STATUS_NONE ||
+      SOUP_STATUS_IS_TRANSPORT_ERROR (msg->status_code))
+    return;
+
+  get_content (c->self, op, &content, &length);
+  mock_record (c->self, c->url, msg, content, length);
+}
+
+static void
+add_to_histogram (GrlNetWc *self,
+                  GrlNetWcMetric metric,
+                  gdouble value)
+{
+  guint i;
+
+  /* Not measured */
+  if (value < 0)
+    return;
+
+  for (i = 0; i < G_N_ELEMENTS (histogram_bounds); i++) {
+    if (value <= histogram_bounds[i])
+      break;
+  }
+
+  self->priv->histograms[metric][i]++;
+}
+
+static void
+emit_metrics (GrlNetWc *self,
+              GrlNetWcMetrics *metrics)
+{
+  add_to_histogram (self, GRL_NET_WC_METRIC_QUEUE_WAIT, metrics->queue_wait);
+  add_to_histogram (self, GRL_NET_WC_METRIC_DNS, metrics->dns);
+  add_to_histogram (self, GRL_NET_WC_METRIC_CONNECT, metrics->connect);
+  add_to_histogram (self, GRL_NET_WC_METRIC_TTFB, metrics->ttfb);
+  add_to_histogram (self, GRL_NET_WC_METRIC_TOTAL, metrics->total);
+
+  g_signal_emit (self, wc_signals[SIG_REQUEST_FINISHED], 0, metrics);
+}
+
+/* Gets the network timings of the attempt that just finished, and returns
+ * the bytes of the body seen on the wire, if any */
+static guint64
+collect_metrics (struct request_clos *c,
+                 GSimpleAsyncResult *res)
+{
+  void *op = g_simple_async_result_get_op_res_gpointer (res);
+  struct msg_timing *timing = NULL;
+  SoupMessage *msg = NULL;
+
+  c->metrics.dns = -1;
+  c->metrics.connect = -1;
+  c->metrics.ttfb = -1;
+
+  if (!c->stream && op)
+    msg = get_message (op);
+
+  if (!msg)
+    return 0;
+
+  c->metrics.status = msg->status_code;
+
+  timing = g_object_get_data (G_OBJECT (msg), "grl-net-timing");
+  if (!timing)
+    return 0;
+
+  if (timing->resolving && timing->resolved)
+    c->metrics.dns = (timing->resolved - timing->resolving) / 1000.0;
+  if (timing->connecting && timing->connected)
+    c->metrics.connect = (timing->connected - timing->connecting) / 1000.0;
+  if (timing->sent && timing->got_headers)
+    c->metrics.ttfb = (timing->got_headers - timing->sent) / 1000.0;
+  c->metrics.bytes_in += timing->bytes;
+
+  return timing->bytes;
+}
+
+static void
+request_done_cb (GObject *source,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+  struct request_clos *c = (struct request_clos *) user_data;
+  struct host_queue *hq = c->hq;
+  GrlNetWcPrivate *priv = c->self->priv;
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+  struct request_response *response = NULL;
+  struct request_waiter *w;
+  GError *error = NULL;
+  GList *waiter;
+  SoupMessage *msg;
+  GrlNetWcResponseFlags flags = GRL_NET_WC_RESPONSE_NONE;
+  guint64 wire_bytes = 0;
+  void *op;
+
+  if (c->sent) {
+    hq->running--;
+    schedule_dispatch (hq);
+    wire_bytes = collect_metrics (c, res);
+  }
+
+  if (priv->record_dir && !c->stream)
+    record_request (c, res);
+
+  /* Waiters, including new ones, keep waiting for the retry */
+  if (retry_request (c, res))
+    return;
+
+  /* New requests for the same resource need a new transfer from now on */
+  if (c->key && g_hash_table_lookup (priv->transfers, c->key) == c)
+    g_hash_table_remove (priv->transfers, c->key);
+
+  op = g_simple_async_result_get_op_res_gpointer (res);
+
+  if (c->stream) {
+    /* Streams are not shared: the only waiter gets it below */
+    g_simple_async_result_propagate_error (res, &error);
+  } else if (!g_simple_async_result_propagate_error (res, &error)) {
+    msg = get_message (op);
+
+    if (c->stored && msg && msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+      /* Our copy is still valid */
+      GRL_DEBUG ("web request to '%s' revalidated", c->url);
+      free_op_res (op);
+      response = request_response_ref (c->stored);
+      flags = GRL_NET_WC_RESPONSE_REVALIDATED;
+      priv->cache_bytes += response->length;
+      memory_cache_store (c->self, c->url, response);
+    } else {
+      response = g_slice_new0 (struct request_response);
+      response->refcount = 1;
+      response->op = op;
+      get_content (c->self, op, &response->content, &response->length);
+
+      if (!is_from_cache (op)) {
+        /* Bodies read through a stream do not emit got-chunk */
+        if (!wire_bytes)
+          c->metrics.bytes_in += get_wire_length (op);
+        c->metrics.bytes_decoded += response->length;
+        priv->wire_bytes += get_wire_length (op);
+        priv->decoded_bytes += response->length;
+      }
+
+      if (priv->use_cache) {
+        if (is_from_cache (op)) {
+          flags = GRL_NET_WC_RESPONSE_CACHED;
+          priv->cache_hits++;
+          priv->cache_bytes += response->length;
+        } else {
+          priv->cache_misses++;
+        }
+        memory_cache_store (c->self, c->url, response);
+      }
+    }
+  } else if (op) {
+    free_op_res (op);
+  }
+
+  for (waiter = c->waiters; waiter; waiter = g_list_next (waiter)) {
+    w = (struct request_waiter *) waiter->data;
+
+    /* Cancelled waiters were already completed */
+    if (!w->cancelled) {
+      if (error) {
+        g_simple_async_result_set_from_error (w->result, error);
+      } else if (c->stream) {
+        g_simple_async_result_set_op_res_gpointer (w->result,
+                                                   g_object_ref (op),
+                                                   g_object_unref);
+      } else {
+        g_simple_async_result_set_op_res_gpointer (w->result,
+                                                   request_response_ref (response),
+                                                   (GDestroyNotify) request_response_unref);
+        set_response_flags (w->result, flags);
+      }
+      g_simple_async_result_complete (w->result);
+    }
+
+    free_request_waiter (w);
+  }
+
+  if (flags & GRL_NET_WC_RESPONSE_REVALIDATED)
+    c->metrics.cache_status = GRL_NET_WC_CACHE_REVALIDATED;
+  else if (flags & GRL_NET_WC_RESPONSE_CACHED)
+    c->metrics.cache_status = GRL_NET_WC_CACHE_HIT;
+  else if (response && priv->use_cache)
+    c->metrics.cache_status = GRL_NET_WC_CACHE_MISS;
+
+  c->metrics.url = c->url;
+  c->metrics.retries = c->attempts > 0? c->attempts - 1: 0;
+  c->metrics.total = (get_current_time_us () - c->created) / 1000.0;
+  emit_metrics (c->self, &c->metrics);
+
+  if (response)
+    request_response_unref (response);
+  if (error)
+    g_error_free (error);
+
+  free_request_clos (c);
+}
+
+/* Completes a transfer not sent yet, and already out of the queue */
+static void
+cancel_queued_request (struct request_clos *c)
+{
+  GrlNetWcPrivate *priv = c->self->priv;
+
+  /* New requests for the same resource must not join it */
+  if (c->key && g_hash_table_lookup (priv->transfers, c->key) == c)
+    g_hash_table_remove (priv->transfers, c->key);
+
+  g_simple_async_result_set_error (G_SIMPLE_ASYNC_RESULT (c->result),
+                                   GRL_NET_WC_ERROR,
+                                   GRL_NET_WC_ERROR_CANCELLED,
+                                   "Operation was cancelled");
+  g_simple_async_result_complete_in_idle (G_SIMPLE_ASYNC_RESULT (c->result));
+  g_object_unref (c->result);
+}
+
+/* Stops a transfer nobody waits for anymore */
+static void
+abort_request (struct request_clos *c)
+{
+  GrlNetWcPrivate *priv = c->self->priv;
+
+  GRL_DEBUG ("cancelling web request to '%s'", c->url);
+
+  /* New requests for the same resource must not join it */
+  if (c->key && g_hash_table_lookup (priv->transfers, c->key) == c)
+    g_hash_table_remove (priv->transfers, c->key);
+
+  if (c->sent) {
+    g_cancellable_cancel (c->cancellable);
+    return;
+  }
+
+  /* Waiting for a retry */
+  if (c->retry_id) {
+    g_source_remove (c->retry_id);
+    c->retry_id = 0;
+  }
+
+  /* Still queued, so the backend does not know about it */
+  g_queue_remove (c->hq->pending, c);
+  cancel_queued_request (c);
+}
+
+static void
+waiter_cancelled_cb (GCancellable *cancellable,
+                     gpointer user_data)
+{
+  struct request_waiter *w = (struct request_waiter *) user_data;
+  struct request_clos *c = w->c;
+
+  if (w->cancelled)
+    return;
+
+  /* Do not make the caller wait for a transfer that others may still need */
+  w->cancelled = TRUE;
+  g_simple_async_result_set_error (w->result,
+                                   GRL_NET_WC_ERROR,
+                                   GRL_NET_WC_ERROR_CANCELLED,
+                                   "Operation was cancelled");
+  g_simple_async_result_complete_in_idle (w->result);
+
+  /* Stop the transfer when nobody is interested anymore */
+  if (--c->active_waiters == 0)
+    abort_request (c);
+}
+
+static void
+add_request_waiter (struct request_clos *c,
+                    GSimpleAsyncResult *result,
+                    GCancellable *cancellable)
+{
+  struct request_waiter *w;
+
+  w = g_slice_new0 (struct request_waiter);
+  w->c = c;
+  w->result = result;
+
+  c->waiters = g_list_append (c->waiters, w);
+  c->active_waiters++;
+
+  if (cancellable) {
+    w->cancellable = g_object_ref (cancellable);
+    /* The handler is run right away if it is already cancelled */
+    w->cancel_id = g_cancellable_connect (cancellable,
+                                          G_CALLBACK (waiter_cancelled_cb),
+                                          w, NULL);
+  }
+}
+
+/* Request headers changing the response, so requests only share a transfer
+   if they agree on them */
+static const gchar *key_headers[] = {
+  "Range",
+  "If-Range",
+  "If-Match",
+  "If-None-Match",
+  "If-Modified-Since",
+  "If-Unmodified-Since",
+};
+
+/* Requests with the same key share the transfer */
+static gchar *
+get_request_key (const gchar *method,
+                 const char *url,
+                 GHashTable *headers,
+                 gboolean use_cache)
+{
+  GString *key;
+  const gchar *value;
+  guint i;
+
+  key = g_string_new (method);
+  g_string_append_printf (key, " %s %s", use_cache? "cache": "no-cache", url);
+
+  for (i = 0; headers && i < G_N_ELEMENTS (key_headers); i++) {
+    value = g_hash_table_lookup (headers, key_headers[i]);
+    if (value)
+      g_string_append_printf (key, "\n%s: %s", key_headers[i], value);
+  }
+
+  return g_string_free (key, FALSE);
+}
+
+static void
+get_url (struct request_clos *c)
+{
+  struct host_queue *hq = c->hq;
+
+  c->queued = get_current_time_us ();
+
+  /* Keep the order: do not overtake requests already waiting */
+  if (g_queue_is_empty (hq->pending) && can_send (hq)) {
+    send_request (c);
+    return;
+  }
+
+  GRL_DEBUG ("delaying web request to '%s'", hq->host);
+
+  hq->delayed++;
+  g_queue_push_tail (hq->pending, c);
+  schedule_dispatch (hq);
+}
+
+static void
+update_host_limits (struct host_queue *hq)
+{
+  refill_tokens (hq);
+  hq->tokens = MIN (hq->tokens, hq->burst);
+
+  /* Pending requests may be sent earlier now */
+  if (hq->dispatch_id) {
+    g_source_remove (hq->dispatch_id);
+    hq->dispatch_id = 0;
+  }
+  schedule_dispatch (hq);
+}
+
+static void
+update_connection_limits (GrlNetWc *self)
+{
+  GrlNetWcPrivate *priv = self->priv;
+
+  /* The host queues limit the requests to each host, so the session must
+     not hold back the hosts allowed to run more */
+  g_object_set (priv->session,
+                SOUP_SESSION_MAX_CONNS_PER_HOST,
+                MAX (priv->max_conns, 1),
+                SOUP_SESSION_MAX_CONNS,
+                MAX (priv->max_conns, 1),
+                NULL);
+}
+
+/* Called when the default rate limit changes */
+static void
+update_rate_limit (GrlNetWc *self)
+{
+  GrlNetWcPrivate *priv = self->priv;
+  GHashTableIter iter;
+  struct host_queue *hq;
+
+  g_hash_table_iter_init (&iter, priv->hosts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &hq)) {
+    if (!hq->custom) {
+      hq->rate_limit = priv->rate_limit;
+      hq->burst = priv->burst;
+      update_host_limits (hq);
+    }
+  }
+}
+
+/**
+ * grl_net_wc_new:
+ *
+ * Creates a new #GrlNetWc.
+ *
+ * Returns: a new allocated instance of #GrlNetWc. Do g_object_unref() after
+ * use it.
+ */
+GrlNetWc *
+grl_net_wc_new ()
+{
+  return g_object_new (GRL_TYPE_NET_WC,
+                       NULL);
+}
+
+/**
+ * grl_net_wc_request_async:
+ * @self: a #GrlNetWc instance
+ * @uri: The URI of the resource to request
+ * @cancellable: (allow-none): a #GCancellable instance or %NULL to ignore
+ * @callback: The callback when the result is ready
+ * @user_data: User data set for the @callback
+ *
+ * Request the fetching of a web resource given the @uri. This request is
+ * asynchronous, thus the result will be returned within the @callback.
+ *
+ * Concurrent requests of the same resource share a single transfer, as long as
+ * they have the same cache setting. The shared transfer takes the priority of
+ * its most urgent request. Cancelling @cancellable only stops the transfer when
+ * all the other requests sharing it have been cancelled too.
+ */
+void
+grl_net_wc_request_async (GrlNetWc *self,
+                          const char *uri,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+  grl_net_wc_request_with_priority_async (self,
+                                          uri,
+                                          G_PRIORITY_DEFAULT,
+                                          cancellable,
+                                          callback,
+                                          user_data);
+}
+
+/**
+ * grl_net_wc_request_with_priority_async:
+ * @self: a #GrlNetWc instance
+ * @uri: The URI of the resource to request
+ * @priority: the priority of the request, like %G_PRIORITY_DEFAULT. Lower
+ * values are more urgent
+ * @cancellable: (allow-none): a #GCancellable instance or %NULL to ignore
+ * @callback: The callback when the result is ready
+ * @user_data: User data set for the @callback
+ *
+ * Like grl_net_wc_request_async(), but with a @priority. When requests have
+ * to wait because of the rate limits, the most urgent ones are sent first.
+ * Waiting requests slowly gain priority, so the least urgent ones are
+ * eventually sent too.
+ *
+ * Use grl_net_wc_request_finish() to get the result. Queued requests with a
+ * low priority can be cancelled at once with
+ * grl_net_wc_cancel_queued_requests().
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_request_with_priority_async (GrlNetWc *self,
+                                        const char *uri,
+                                        gint priority,
+                                        GCancellable *cancellable,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data)
+{
+  GSimpleAsyncResult *result;
+  struct request_response *response;
+  struct request_response *stored = NULL;
+  struct request_clos *c;
+  GrlNetWcMetrics metrics;
+  GHashTable *headers = NULL;
+  gchar *key;
+
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  result = g_simple_async_result_new (G_OBJECT (self),
+                                      callback,
+                                      user_data,
+                                      grl_net_wc_request_async);
+
+  response = self->priv->use_cache? memory_cache_lookup (self, uri): NULL;
+  if (response) {
+    GRL_DEBUG ("web request to '%s' found in memory cache", uri);
+    self->priv->memory_hits++;
+    self->priv->cache_bytes += response->length;
+    g_simple_async_result_set_op_res_gpointer (result,
+                                               request_response_ref (response),
+                                               (GDestroyNotify) request_response_unref);
+    set_response_flags (result, GRL_NET_WC_RESPONSE_CACHED);
+    g_simple_async_result_complete_in_idle (result);
+    g_object_unref (result);
+
+    memset (&metrics, 0, sizeof (metrics));
+    metrics.url = uri;
+    metrics.status = SOUP_STATUS_OK;
+    metrics.dns = metrics.connect = metrics.ttfb = -1;
+    metrics.cache_status = GRL_NET_WC_CACHE_HIT;
+    emit_metrics (self, &metrics);
+    return;
+  }
+
+  if (self->priv->use_cache)
+    headers = memory_cache_revalidate (self, uri, &stored);
+
+  key = get_request_key (SOUP_METHOD_GET, uri, headers,
+                         self->priv->use_cache);
+
+  /* Join the transfer of the same request if any */
+  c = g_hash_table_lookup (self->priv->transfers, key);
+  if (c) {
+    GRL_DEBUG ("sharing web request to '%s'", uri);
+    g_free (key);
+    /* The shared transfer is as urgent as its most urgent waiter */
+    c->priority = MIN (c->priority, priority);
+    if (headers)
+      g_hash_table_unref (headers);
+    if (stored)
+      request_response_unref (stored);
+    add_request_waiter (c, result, cancellable);
+    return;
+  }
+
+  c = g_slice_new0 (struct request_clos);
+  c->self = self;
+  c->hq = get_host_queue_for_url (self, uri);
+  c->url = g_strdup (uri);
+  c->created = get_current_time_us ();
+  c->metrics.dns = c->metrics.connect = c->metrics.ttfb = -1;
+  c->key = key;
+  c->priority = priority;
+  c->headers = headers;
+  c->stored = stored;
+  /* Only cancelled when all the waiters are */
+  c->cancellable = g_cancellable_new ();
+
+  /* The transfer result, completed by the backend */
+  c->result = G_ASYNC_RESULT (g_simple_async_result_new (G_OBJECT (self),
+                                                         request_done_cb,
+                                                         c,
+                                                         get_url));
+
+  g_hash_table_insert (self->priv->transfers, c->key, c);
+  add_request_waiter (c, result, cancellable);
+
+  /* It could have been cancelled already, and so aborted */
+  if (c->active_waiters > 0)
+    get_url (c);
+}
+
+/**
+ * grl_net_wc_request_finish:
+ * @self: a #GrlNetWc instance
+ * @result: The result of the request
+ * @content: The contents of the resource
+ * @length: (allow-none): The length of the contents or %NULL if it is not
+ * needed
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an asynchronous load of the file's contents.
+ * The contents are placed in contents, and length is set to the size of the
+ * contents string.
+ *
+ * The content address will be invalidated at the next request. So if you
+ * want to keep it, please copy it into another address.
+ *
+ * Returns: %TRUE if the request was successfull. If %FALSE an error occurred.
+ */
+gboolean
+grl_net_wc_request_finish (GrlNetWc *self,
+                           GAsyncResult *result,
+                           gchar **content,
+                           gsize *length,
+                           GError **error)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+  struct request_response *response;
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (res) ==
+                  grl_net_wc_request_async);
+
+  if (g_simple_async_result_propagate_error (res, error) == TRUE)
+    return FALSE;
+
+  response = g_simple_async_result_get_op_res_gpointer (res);
+
+  /* Keep the content alive until the next request is finished */
+  if (self->priv->previous_response)
+    request_response_unref (self->priv->previous_response);
+  self->priv->previous_response = request_response_ref (response);
+
+  if (content)
+    *content = response->content;
+
+  if (length)
+    *length = response->length;
+
+  return TRUE;
+}
+
+static void
+copy_header (const char *name,
+             const char *value,
+             gpointer user_data)
+{
+  g_hash_table_insert ((GHashTable *) user_data,
+                       g_strdup (name),
+                       g_strdup (value));
+}
+
+/**
+ * grl_net_wc_request_finish_full:
+ * @self: a #GrlNetWc instance
+ * @result: The result of the request
+ * @content: (allow-none): The contents of the resource
+ * @length: (allow-none): The length of the contents or %NULL if it is not
+ * needed
+ * @flags: (out) (allow-none): where the response comes from
+ * @headers: (out) (allow-none) (transfer full) (element-type utf8 utf8):
+ * the response headers
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an asynchronous load of the file's contents, like
+ * grl_net_wc_request_finish(), also returning metadata about the response.
+ *
+ * @flags tells whether the content was served from a cache
+ * (%GRL_NET_WC_RESPONSE_CACHED), or from a stored copy the server confirmed
+ * to be still valid (%GRL_NET_WC_RESPONSE_REVALIDATED). Stored copies are
+ * revalidated with If-None-Match and If-Modified-Since when the response
+ * had an ETag or Last-Modified header.
+ *
+ * @headers is a new #GHashTable mapping each header name to its value. For
+ * revalidated responses they are the headers of the stored response. Use
+ * g_hash_table_unref() when done.
+ *
+ * Returns: %TRUE if the request was successfull. If %FALSE an error occurred.
+ *
+ * Since: 0.1.21
+ */
+gboolean
+grl_net_wc_request_finish_full (GrlNetWc *self,
+                                GAsyncResult *result,
+                                gchar **content,
+                                gsize *length,
+                                GrlNetWcResponseFlags *flags,
+                                GHashTable **headers,
+                                GError **error)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+  struct request_response *response;
+  SoupMessage *msg;
+
+  if (!grl_net_wc_request_finish (self, result, content, length, error))
+    return FALSE;
+
+  response = g_simple_async_result_get_op_res_gpointer (res);
+
+  if (flags)
+    *flags = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (result),
+                                                  "grl-net-flags"));
+
+  if (headers) {
+    *headers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    if (response->headers)
+      soup_message_headers_foreach (response->headers, copy_header, *headers);
+    else if ((msg = get_message (response->op)))
+      soup_message_headers_foreach (msg->response_headers,
+                                    copy_header,
+                                    *headers);
+  }
+
+  return TRUE;
+}
+
+#if GLIB_CHECK_VERSION(2,32,0)
+/**
+ * grl_net_wc_request_finish_bytes:
+ * @self: a #GrlNetWc instance
+ * @result: The result of the request
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an asynchronous load of the file's contents, like
+ * grl_net_wc_request_finish(), but returning the contents in a #GBytes that
+ * the caller owns. The contents are not copied, and remain valid until the
+ * #GBytes is unreferenced, regardless of further requests.
+ *
+ * Returns: (transfer full): the contents of the resource, or %NULL if an
+ * error occurred. Use g_bytes_unref() when done.
+ *
+ * Since: 0.1.21
+ */
+GBytes *
+grl_net_wc_request_finish_bytes (GrlNetWc *self,
+                                 GAsyncResult *result,
+                                 GError **error)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+  struct request_response *response;
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (res) ==
+                  grl_net_wc_request_async);
+
+  if (g_simple_async_result_propagate_error (res, error) == TRUE)
+    return NULL;
+
+  response = g_simple_async_result_get_op_res_gpointer (res);
+
+  return g_bytes_new_with_free_func (response->content,
+                                     response->length,
+                                     (GDestroyNotify) request_response_unref,
+                                     request_response_ref (response));
+}
+#endif
+
+/**
+ * grl_net_wc_request_stream_async:
+ * @self: a #GrlNetWc instance
+ * @uri: The URI of the resource to request
+ * @cancellable: (allow-none): a #GCancellable instance or %NULL to ignore
+ * @callback: The callback when the stream is ready
+ * @user_data: User data set for the @callback
+ *
+ * Request the fetching of a web resource given the @uri, like
+ * grl_net_wc_request_async(), but handing out the contents as a
+ * #GInputStream as soon as the response headers are received, so they can be
+ * parsed while they are downloaded. Use grl_net_wc_request_stream_finish() in
+ * the @callback to get it.
+ *
+ * The request is subject to the same limits as the other requests, but is
+ * never shared with other requests of the same resource.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_request_stream_async (GrlNetWc *self,
+                                 const char *uri,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+  GSimpleAsyncResult *result;
+  struct request_clos *c;
+
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  result = g_simple_async_result_new (G_OBJECT (self),
+                                      callback,
+                                      user_data,
+                                      grl_net_wc_request_stream_async);
 
-  /* closure */
-  c = g_new (struct request_clos, 1);
+  c = g_slice_new0 (struct request_clos);
   c->self = self;
-  c->url = g_strdup (url);
-  c->result = result;
-  c->cancellable = cancellable;
+  c->hq = get_host_queue_for_url (self, uri);
+  c->url = g_strdup (uri);
+  c->created = get_current_time_us ();
+  c->metrics.dns = c->metrics.connect = c->metrics.ttfb = -1;
+  c->stream = TRUE;
+  c->cancellable = g_cancellable_new ();
+  c->result = G_ASYNC_RESULT (g_simple_async_result_new (G_OBJECT (self),
+                                                         request_done_cb,
+                                                         c,
+                                                         get_url));
+
+  add_request_waiter (c, result, cancellable);
+
+  /* It could have been cancelled already, and so aborted */
+  if (c->active_waiters > 0)
+    get_url (c);
+}
+
+/**
+ * grl_net_wc_request_stream_finish:
+ * @self: a #GrlNetWc instance
+ * @result: The result of the request
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes a request started with grl_net_wc_request_stream_async().
+ *
+ * Returns: (transfer full): a #GInputStream to read the contents of the
+ * resource from, or %NULL if an error occurred. Use g_object_unref() when
+ * done.
+ *
+ * Since: 0.1.21
+ */
+GInputStream *
+grl_net_wc_request_stream_finish (GrlNetWc *self,
+                                  GAsyncResult *result,
+                                  GError **error)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (res) ==
+                  grl_net_wc_request_stream_async);
+
+  if (g_simple_async_result_propagate_error (res, error) == TRUE)
+    return NULL;
+
+  return g_object_ref (g_simple_async_result_get_op_res_gpointer (res));
+}
+
+/**
+ * grl_net_wc_set_log_level:
+ * @self: a #GrlNetWc instance
+ * @log_level: the libsoup log level to set [0,3]
+ *
+ * Setting the log level the logger feature is added into
+ * the libsoup session.
+ */
+void
+grl_net_wc_set_log_level (GrlNetWc *self,
+                          guint log_level)
+{
+  SoupLogger *logger;
+
+  g_return_if_fail (log_level <= 3);
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  if (self->priv->log_level == log_level)
+    return;
+
+  soup_session_remove_feature_by_type (self->priv->session, SOUP_TYPE_LOGGER);
+
+  logger = soup_logger_new ((SoupLoggerLogLevel) log_level, -1);
+  soup_session_add_feature (self->priv->session, SOUP_SESSION_FEATURE (logger));
+  g_object_unref (logger);
+
+  self->priv->log_level = (SoupLoggerLogLevel) log_level;
+}
+
+/**
+ * grl_net_wc_set_throttling:
+ * @self: a #GrlNetWc instance
+ * @throttling: the number of seconds to wait between requests
+ *
+ * Setting this property, the #GrlNetWc will queue all the requests and
+ * will dispatch them with a pause between them of this value.
+ *
+ * This is a shortcut for a #GrlNetWc:rate-limit of one request every
+ * @throttling seconds, with a #GrlNetWc:burst of 1.
+ */
+void
+grl_net_wc_set_throttling (GrlNetWc *self,
+                           guint throttling)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  self->priv->throttling = throttling;
+  self->priv->rate_limit = throttling > 0? 1.0 / throttling: 0;
+  self->priv->burst = 1;
+
+  update_rate_limit (self);
+}
+
+/**
+ * grl_net_wc_set_rate_limit:
+ * @self: a #GrlNetWc instance
+ * @rate_limit: the maximum number of requests per second, or 0 for no limit
+ *
+ * Limits the average number of requests per second. Requests exceeding the
+ * limit are queued and dispatched as soon as allowed, while up to
+ * #GrlNetWc:burst requests can be sent at once.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_rate_limit (GrlNetWc *self,
+                           gdouble rate_limit)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (rate_limit >= 0);
+
+  self->priv->rate_limit = rate_limit;
+  self->priv->throttling = 0;
+
+  update_rate_limit (self);
+}
+
+/**
+ * grl_net_wc_set_burst:
+ * @self: a #GrlNetWc instance
+ * @burst: the number of requests that can be sent at once
+ *
+ * Sets how many requests can be sent without waiting when a rate limit is
+ * set with grl_net_wc_set_rate_limit().
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_burst (GrlNetWc *self,
+                      guint burst)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (burst > 0);
+
+  self->priv->burst = burst;
+
+  update_rate_limit (self);
+}
+
+/**
+ * grl_net_wc_set_cache:
+ * @self: a #GrlNetWc instance
+ * @use_cache: if cache must be used or not
+ *
+ * Sets if cache must be used. Note that this will only work if caching is
+ * supporting.  If sets %TRUE, a new cache will be created. If sets to %FALSE,
+ * current cache is clean and removed.
+ *
+ * Since: 0.1.12
+ **/
+void
+grl_net_wc_set_cache (GrlNetWc *self,
+                      gboolean use_cache)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  self->priv->use_cache = use_cache;
+
+  if (use_cache) {
+    cache_up (self);
+  } else {
+    cache_down (self);
+    memory_cache_clear (self);
+  }
+}
+
+/**
+ * grl_net_wc_set_cache_size:
+ * @self: a #GrlNetWc instance
+ * @cache_size: size of cache (in Mb)
+ *
+ * Sets the new maximum size of cache, in Megabytes. Default value is 10. Using
+ * 0 means no cache will be done.
+ *
+ * Since: 0.1.12
+ **/
+void
+grl_net_wc_set_cache_size (GrlNetWc *self,
+                           guint size)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  cache_set_size (self, size);
+}
+
+/**
+ * grl_net_wc_set_cache_dir:
+ * @self: a #GrlNetWc instance
+ * @cache_dir: (allow-none): the cache directory, or %NULL for the default one
+ *
+ * Sets the directory where the cache is stored.
+ *
+ * The #GrlNetWc instances using the same directory share a single cache, so
+ * what one of them downloads can be served to the others. The size of that
+ * cache is the last one set by any of them. Use different directories to
+ * keep the caches apart.
+ *
+ * Since: 0.1.21
+ **/
+void
+grl_net_wc_set_cache_dir (GrlNetWc *self,
+                          const gchar *cache_dir)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  if (g_strcmp0 (self->priv->cache_dir, cache_dir) == 0)
+    return;
+
+  g_free (self->priv->cache_dir);
+  self->priv->cache_dir = g_strdup (cache_dir);
+
+  /* Move to the new cache */
+  if (cache_is_available (self)) {
+    cache_down (self);
+    cache_up (self);
+  }
+}
+
+/**
+ * grl_net_wc_set_memory_cache_size:
+ * @self: a #GrlNetWc instance
+ * @size: size of the memory cache (in Kb)
+ *
+ * Sets the maximum size of the in-memory cache, in Kilobytes. Using 0
+ * disables it.
+ *
+ * Since: 0.1.21
+ **/
+void
+grl_net_wc_set_memory_cache_size (GrlNetWc *self,
+                                  guint size)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  self->priv->memory_cache_size = size;
+  memory_cache_trim (self);
+}
+
+/**
+ * grl_net_wc_get_cache_stats:
+ * @self: a #GrlNetWc instance
+ * @hits: (out) (allow-none): number of requests served from the disk cache
+ * @memory_hits: (out) (allow-none): number of requests served from the memory
+ * cache
+ * @misses: (out) (allow-none): number of requests not found in any cache
+ * @bytes: (out) (allow-none): number of bytes served from any cache
+ *
+ * Gets the statistics of the caches used by @self. Requests are only
+ * accounted while the cache is in use.
+ *
+ * Since: 0.1.21
+ **/
+void
+grl_net_wc_get_cache_stats (GrlNetWc *self,
+                            guint *hits,
+                            guint *memory_hits,
+                            guint *misses,
+                            guint64 *bytes)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  if (hits)
+    *hits = self->priv->cache_hits;
+  if (memory_hits)
+    *memory_hits = self->priv->memory_hits;
+  if (misses)
+    *misses = self->priv->cache_misses;
+  if (bytes)
+    *bytes = self->priv->cache_bytes;
+}
+
+/**
+ * grl_net_wc_set_host_limits:
+ * @self: a #GrlNetWc instance
+ * @host: the host name
+ * @rate_limit: the maximum number of requests per second to @host, or 0 for
+ * no limit
+ * @burst: the number of requests to @host that can be sent at once
+ * @max_running: the maximum number of concurrent requests to @host, or 0 for
+ * no limit
+ *
+ * Sets the limits for the requests to @host, overriding the
+ * #GrlNetWc:rate-limit, #GrlNetWc:burst and #GrlNetWc:max-conns-per-host of
+ * @self. Requests to each host are queued independently, so a slow or
+ * throttled host does not delay the requests to other hosts.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_host_limits (GrlNetWc *self,
+                            const gchar *host,
+                            gdouble rate_limit,
+                            guint burst,
+                            guint max_running)
+{
+  struct host_queue *hq;
+
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (host != NULL);
+  g_return_if_fail (rate_limit >= 0);
+  g_return_if_fail (burst > 0);
+
+  hq = get_host_queue (self, host);
+  hq->custom = TRUE;
+  hq->rate_limit = rate_limit;
+  hq->burst = burst;
+  hq->max_running = max_running;
+
+  update_host_limits (hq);
+}
+
+/**
+ * grl_net_wc_get_host_stats:
+ * @self: a #GrlNetWc instance
+ * @host: the host name
+ * @requests: (out) (allow-none): number of requests sent to @host
+ * @delayed: (out) (allow-none): number of requests to @host that had to wait
+ * in the queue
+ * @pending: (out) (allow-none): number of requests to @host currently queued
+ * @running: (out) (allow-none): number of requests to @host currently running
+ * @average_wait: (out) (allow-none): average time, in milliseconds, the
+ * requests to @host spent in the queue
+ *
+ * Gets the statistics of the requests sent to @host by @self.
+ *
+ * Returns: %TRUE if @self sent or queued any request to @host
+ *
+ * Since: 0.1.21
+ */
+gboolean
+grl_net_wc_get_host_stats (GrlNetWc *self,
+                           const gchar *host,
+                           guint *requests,
+                           guint *delayed,
+                           guint *pending,
+                           guint *running,
+                           gdouble *average_wait)
+{
+  struct host_queue *hq;
+
+  g_return_val_if_fail (GRL_IS_NET_WC (self), FALSE);
+  g_return_val_if_fail (host != NULL, FALSE);
+
+  hq = g_hash_table_lookup (self->priv->hosts, host);
+
+  if (requests)
+    *requests = hq? hq->requests: 0;
+  if (delayed)
+    *delayed = hq? hq->delayed: 0;
+  if (pending)
+    *pending = hq? g_queue_get_length (hq->pending): 0;
+  if (running)
+    *running = hq? hq->running: 0;
+  if (average_wait)
+    *average_wait = (hq && hq->requests)?
+      (gdouble) hq->total_wait / hq->requests / 1000: 0;
+
+  return hq != NULL;
+}
+
+/**
+ * grl_net_wc_set_max_conns_per_host:
+ * @self: a #GrlNetWc instance
+ * @max_conns: maximum number of connections to each host
+ *
+ * Sets the maximum number of requests running at the same time to each
+ * host. Hosts with limits set with grl_net_wc_set_host_limits() keep them.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_max_conns_per_host (GrlNetWc *self,
+                                   guint max_conns)
+{
+  GHashTableIter iter;
+  struct host_queue *hq;
+
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (max_conns > 0);
+
+  self->priv->max_conns_per_host = max_conns;
+
+  g_hash_table_iter_init (&iter, self->priv->hosts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &hq)) {
+    if (!hq->custom) {
+      hq->max_running = max_conns;
+      update_host_limits (hq);
+    }
+  }
+}
+
+/**
+ * grl_net_wc_set_max_conns:
+ * @self: a #GrlNetWc instance
+ * @max_conns: maximum number of connections to all hosts
+ *
+ * Sets the maximum number of connections open at the same time.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_max_conns (GrlNetWc *self,
+                          guint max_conns)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (max_conns > 0);
+
+  self->priv->max_conns = max_conns;
+  update_connection_limits (self);
+}
+
+/**
+ * grl_net_wc_set_idle_timeout:
+ * @self: a #GrlNetWc instance
+ * @timeout: time in seconds, or 0 for no timeout
+ *
+ * Sets how long an unused connection is kept open waiting for new
+ * requests.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_idle_timeout (GrlNetWc *self,
+                             guint timeout)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
 
-  priv->last_request.tv_sec += priv->throttling;
-  id = g_timeout_add_seconds (priv->last_request.tv_sec - now.tv_sec,
-                              get_url_delayed, c);
-  c->source_id = id;
+  self->priv->idle_timeout = timeout;
+  g_object_set (self->priv->session,
+                SOUP_SESSION_IDLE_TIMEOUT, timeout,
+                NULL);
+}
+
+/**
+ * grl_net_wc_set_keep_alive:
+ * @self: a #GrlNetWc instance
+ * @keep_alive: %TRUE to reuse connections
+ *
+ * Sets whether connections are kept open after a request to send further
+ * requests, avoiding a new connection handshake for each of them.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_keep_alive (GrlNetWc *self,
+                           gboolean keep_alive)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  self->priv->keep_alive = keep_alive;
+}
+
+/**
+ * grl_net_wc_set_compression:
+ * @self: a #GrlNetWc instance
+ * @compression: %TRUE to accept compressed responses
+ *
+ * Sets whether servers may send the responses compressed, with gzip or
+ * deflate, saving bandwidth. The content is always handed over decoded.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_compression (GrlNetWc *self,
+                            gboolean compression)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
 
-  g_queue_push_head (self->priv->pending, c);
+  self->priv->compression = compression;
 }
 
 /**
- * grl_net_wc_new:
+ * grl_net_wc_get_transfer_stats:
+ * @self: a #GrlNetWc instance
+ * @wire_bytes: (out) (allow-none): bytes of the response bodies received
+ * from the network, as sent by the servers
+ * @decoded_bytes: (out) (allow-none): bytes of the same response bodies once
+ * decoded
  *
- * Creates a new #GrlNetWc.
+ * Gets how much the compression of the responses saved. Responses served
+ * from a cache are not counted.
  *
- * Returns: a new allocated instance of #GrlNetWc. Do g_object_unref() after
- * use it.
+ * Since: 0.1.21
  */
-GrlNetWc *
-grl_net_wc_new ()
+void
+grl_net_wc_get_transfer_stats (GrlNetWc *self,
+                               guint64 *wire_bytes,
+                               guint64 *decoded_bytes)
 {
-  return g_object_new (GRL_TYPE_NET_WC,
-                       NULL);
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  if (wire_bytes)
+    *wire_bytes = self->priv->wire_bytes;
+
+  if (decoded_bytes)
+    *decoded_bytes = self->priv->decoded_bytes;
 }
 
 /**
- * grl_net_wc_request_async:
+ * grl_net_wc_get_connection_stats:
  * @self: a #GrlNetWc instance
- * @uri: The URI of the resource to request
- * @cancellable: (allow-none): a #GCancellable instance or %NULL to ignore
- * @callback: The callback when the result is ready
- * @user_data: User data set for the @callback
+ * @connections: (out) (allow-none): number of connections opened
+ * @reuses: (out) (allow-none): number of requests sent on a connection
+ * already used by a previous request
  *
- * Request the fetching of a web resource given the @uri. This request is
- * asynchronous, thus the result will be returned within the @callback.
+ * Gets the connection statistics of @self. Requests served from a cache
+ * are not counted.
+ *
+ * Since: 0.1.21
  */
 void
-grl_net_wc_request_async (GrlNetWc *self,
-                          const char *uri,
-                          GCancellable *cancellable,
-                          GAsyncReadyCallback callback,
-                          gpointer user_data)
+grl_net_wc_get_connection_stats (GrlNetWc *self,
+                                 guint *connections,
+                                 guint *reuses)
 {
-  GSimpleAsyncResult *result;
+  g_return_if_fail (GRL_IS_NET_WC (self));
 
-  result = g_simple_async_result_new (G_OBJECT (self),
-                                      callback,
-                                      user_data,
-                                      grl_net_wc_request_async);
+  if (connections)
+    *connections = self->priv->connections;
 
-  get_url (self, uri, G_ASYNC_RESULT (result), cancellable);
+  if (reuses)
+    *reuses = self->priv->connection_reuses;
 }
 
 /**
- * grl_net_wc_request_finish:
+ * grl_net_wc_set_max_attempts:
  * @self: a #GrlNetWc instance
- * @result: The result of the request
- * @content: The contents of the resource
- * @length: (allow-none): The length of the contents or %NULL if it is not
- * needed
- * @error: return location for a #GError, or %NULL
- *
- * Finishes an asynchronous load of the file's contents.
- * The contents are placed in contents, and length is set to the size of the
- * contents string.
+ * @max_attempts: maximum number of tries of each request
  *
- * The content address will be invalidated at the next request. So if you
- * want to keep it, please copy it into another address.
+ * Sets how many times a request failing with a retryable status is tried
+ * before reporting the error. Retries go through the same queue as new
+ * requests, so they are throttled too. 1 disables retries.
  *
- * Returns: %TRUE if the request was successfull. If %FALSE an error occurred.
+ * Since: 0.1.21
  */
-gboolean
-grl_net_wc_request_finish (GrlNetWc *self,
-                           GAsyncResult *result,
-                           gchar **content,
-                           gsize *length,
-                           GError **error)
+void
+grl_net_wc_set_max_attempts (GrlNetWc *self,
+                             guint max_attempts)
 {
-  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
-  gboolean ret = TRUE;
-
-  g_warn_if_fail (g_simple_async_result_get_source_tag (res) ==
-                  grl_net_wc_request_async);
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (max_attempts > 0);
 
-  void *op = g_simple_async_result_get_op_res_gpointer (res);
+  self->priv->max_attempts = max_attempts;
+}
 
-  if (g_simple_async_result_propagate_error (res, error) == TRUE) {
-    ret = FALSE;
-    goto end_func;
-  }
+/**
+ * grl_net_wc_set_retry_delay:
+ * @self: a #GrlNetWc instance
+ * @delay: time before the first retry, in milliseconds
+ *
+ * Sets the time to wait before the first retry. Each further retry waits
+ * twice as much as the previous one, up to #GrlNetWc:max-retry-delay, and
+ * a random jitter of up to half the delay is applied.
+ *
+ * A Retry-After header sent by the server overrides a shorter delay, and
+ * holds all the requests to that host.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_retry_delay (GrlNetWc *self,
+                            guint delay)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
 
-  get_content(self, op, content, length);
+  self->priv->retry_delay = delay;
+}
 
-end_func:
-  free_op_res (op);
+/**
+ * grl_net_wc_set_max_retry_delay:
+ * @self: a #GrlNetWc instance
+ * @delay: longest time before a retry, in milliseconds
+ *
+ * Sets the longest time to wait before a retry. Requests the server asks to
+ * retry later than this fail right away.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_max_retry_delay (GrlNetWc *self,
+                                guint delay)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
 
-  return ret;
+  self->priv->max_retry_delay = delay;
 }
 
 /**
- * grl_net_wc_set_log_level:
+ * grl_net_wc_set_retry_statuses:
  * @self: a #GrlNetWc instance
- * @log_level: the libsoup log level to set [0,3]
+ * @statuses: (array length=n_statuses): HTTP status codes
+ * @n_statuses: number of elements in @statuses
  *
- * Setting the log level the logger feature is added into
- * the libsoup session.
+ * Sets the statuses of the failed requests that are retried. Besides HTTP
+ * status codes, libsoup transport errors such as %SOUP_STATUS_IO_ERROR or
+ * %SOUP_STATUS_CANT_CONNECT can be used; failures without any status are
+ * handled as %SOUP_STATUS_IO_ERROR.
+ *
+ * By default network errors and the 408, 429, 500, 502, 503 and 504 status
+ * codes are retried.
+ *
+ * Since: 0.1.21
  */
 void
-grl_net_wc_set_log_level (GrlNetWc *self,
-                          guint log_level)
+grl_net_wc_set_retry_statuses (GrlNetWc *self,
+                               const guint *statuses,
+                               guint n_statuses)
 {
-  SoupLogger *logger;
-
-  g_return_if_fail (log_level <= 3);
   g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (statuses != NULL || n_statuses == 0);
 
-  if (self->priv->log_level == log_level)
-    return;
+  g_array_set_size (self->priv->retry_statuses, 0);
+  g_array_append_vals (self->priv->retry_statuses, statuses, n_statuses);
+}
 
-  soup_session_remove_feature_by_type (self->priv->session, SOUP_TYPE_LOGGER);
+/**
+ * grl_net_wc_set_record_dir:
+ * @self: a #GrlNetWc instance
+ * @dir: (allow-none): the archive directory, or %NULL to stop recording
+ *
+ * Records every request sent by @self, with the status, headers and body of
+ * its response, in the archive at @dir. The directory is created if needed,
+ * and new requests are added to those already there. Streams are not
+ * recorded. The archive index is saved shortly after each request, and when
+ * recording stops.
+ *
+ * Archives can be served back, without network, with
+ * grl_net_wc_set_replay_dir().
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_set_record_dir (GrlNetWc *self,
+                           const gchar *dir)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
 
-  logger = soup_logger_new ((SoupLoggerLogLevel) log_level, -1);
-  soup_session_add_feature (self->priv->session, SOUP_SESSION_FEATURE (logger));
-  g_object_unref (logger);
+  mock_record_stop (self);
 
-  self->priv->log_level = (SoupLoggerLogLevel) log_level;
+  g_free (self->priv->record_dir);
+  self->priv->record_dir = g_strdup (dir);
 }
 
 /**
- * grl_net_wc_set_throttling:
+ * grl_net_wc_set_replay_dir:
  * @self: a #GrlNetWc instance
- * @throttling: the number of seconds to wait between requests
+ * @dir: (allow-none): the archive directory, or %NULL to use the network
  *
- * Setting this property, the #GrlNetWc will queue all the requests and
- * will dispatch them with a pause between them of this value.
+ * Serves the requests from an archive recorded with
+ * grl_net_wc_set_record_dir(), instead of the network. Requests not found
+ * in the archive fail with %GRL_NET_WC_ERROR_NETWORK_ERROR. When the same
+ * URL was recorded several times, the responses are served in the same
+ * order.
+ *
+ * Responses are delayed according to #GrlNetWc:replay-latency and
+ * #GrlNetWc:replay-bandwidth. All the other features, like rate limits or
+ * retries, work as with the network.
+ *
+ * Since: 0.1.21
  */
 void
-grl_net_wc_set_throttling (GrlNetWc *self,
-                           guint throttling)
+grl_net_wc_set_replay_dir (GrlNetWc *self,
+                           const gchar *dir)
 {
   g_return_if_fail (GRL_IS_NET_WC (self));
 
-  if (throttling > 0) {
-    /* max conns per host = 1 */
-    g_object_set (self->priv->session,
-                  SOUP_SESSION_MAX_CONNS_PER_HOST, 1, NULL);
-  } else {
-    /* default value */
-    g_object_set (self->priv->session,
-                  SOUP_SESSION_MAX_CONNS_PER_HOST, 2, NULL);
-  }
+  g_free (self->priv->replay_dir);
+  self->priv->replay_dir = g_strdup (dir);
 
-  self->priv->throttling = throttling;
+  if (dir)
+    mock_load (self, dir);
+  else
+    mock_unload (self);
 }
 
 /**
- * grl_net_wc_set_cache:
+ * grl_net_wc_set_replay_latency:
  * @self: a #GrlNetWc instance
- * @use_cache: if cache must be used or not
+ * @latency: the simulated latency, in milliseconds
  *
- * Sets if cache must be used. Note that this will only work if caching is
- * supporting.  If sets %TRUE, a new cache will be created. If sets to %FALSE,
- * current cache is clean and removed.
+ * Sets the time each response served from the replay archive takes to
+ * arrive.
  *
- * Since: 0.1.12
- **/
+ * Since: 0.1.21
+ */
 void
-grl_net_wc_set_cache (GrlNetWc *self,
-                      gboolean use_cache)
+grl_net_wc_set_replay_latency (GrlNetWc *self,
+                               guint latency)
 {
   g_return_if_fail (GRL_IS_NET_WC (self));
 
-  if (use_cache)
-    cache_up (self);
-  else
-    cache_down (self);
+  self->priv->replay_latency = latency;
 }
 
 /**
- * grl_net_wc_set_cache_size:
+ * grl_net_wc_set_replay_bandwidth:
  * @self: a #GrlNetWc instance
- * @cache_size: size of cache (in Mb)
+ * @bandwidth: the simulated bandwidth in bytes per second, or 0 for no limit
  *
- * Sets the new maximum size of cache, in Megabytes. Default value is 10. Using
- * 0 means no cache will be done.
+ * Sets the speed responses served from the replay archive are transferred
+ * at, adding to #GrlNetWc:replay-latency.
  *
- * Since: 0.1.12
- **/
+ * Since: 0.1.21
+ */
 void
-grl_net_wc_set_cache_size (GrlNetWc *self,
-                           guint size)
+grl_net_wc_set_replay_bandwidth (GrlNetWc *self,
+                                 guint bandwidth)
 {
   g_return_if_fail (GRL_IS_NET_WC (self));
 
-  cache_set_size (self, size);
+  self->priv->replay_bandwidth = bandwidth;
+}
+
+/**
+ * grl_net_wc_cancel_queued_requests:
+ * @self: a #GrlNetWc instance
+ * @priority: the priority of the most urgent requests to cancel
+ *
+ * Cancels the requests waiting in the queue with @priority or a less urgent
+ * one, that is, a higher value. This is useful to drop prefetches and other
+ * background requests that are not needed anymore, for instance when the
+ * user navigates away. Their callbacks are invoked with a
+ * %GRL_NET_WC_ERROR_CANCELLED error.
+ *
+ * Requests already sent are not affected.
+ *
+ * Returns: the number of requests cancelled
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_net_wc_cancel_queued_requests (GrlNetWc *self,
+                                   gint priority)
+{
+  GHashTableIter iter;
+  struct host_queue *hq;
+  struct request_clos *c;
+  GList *l, *next;
+  guint cancelled = 0;
+
+  g_return_val_if_fail (GRL_IS_NET_WC (self), 0);
+
+  g_hash_table_iter_init (&iter, self->priv->hosts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &hq)) {
+    for (l = hq->pending->head; l; l = next) {
+      next = l->next;
+      c = l->data;
+
+      if (c->priority >= priority) {
+        g_queue_delete_link (hq->pending, l);
+        cancel_queued_request (c);
+        cancelled++;
+      }
+    }
+  }
+
+  return cancelled;
 }
 
 /**
  * grl_net_wc_flush_delayed_requests:
  * @self: a #GrlNetWc instance
  *
- * This method will flush all the pending request in the queue.
+ * This method will flush all the pending request in the queue. Their
+ * callbacks are invoked with a %GRL_NET_WC_ERROR_CANCELLED error.
  */
 void
 grl_net_wc_flush_delayed_requests (GrlNetWc *self)
@@ -536,14 +3253,248 @@ grl_net_wc_flush_delayed_requests (GrlNetWc *self)
   g_return_if_fail (GRL_IS_NET_WC (self));
 
   GrlNetWcPrivate *priv = self->priv;
+  GHashTableIter iter;
+  struct host_queue *hq;
+  struct request_clos *c;
+
+  g_hash_table_iter_init (&iter, priv->hosts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &hq)) {
+    if (hq->dispatch_id) {
+      g_source_remove (hq->dispatch_id);
+      hq->dispatch_id = 0;
+    }
+
+    while ((c = g_queue_pop_head (hq->pending)))
+      cancel_queued_request (c);
+
+    /* Start again with a full bucket */
+    hq->tokens = hq->burst;
+    hq->retry_after = 0;
+  }
+}
+
+/**
+ * grl_net_wc_get_histogram:
+ * @self: a #GrlNetWc instance
+ * @metric: the metric to get the histogram of
+ * @counts: (out caller-allocates) (array fixed-size=12): where to store the
+ * counts of each bucket
+ *
+ * Gets how many finished requests fall in each bucket of @metric, as
+ * reported by #GrlNetWc::request-finished. Buckets go up to 5, 10, 25, 50,
+ * 100, 250, 500, 1000, 2500, 5000 and 10000 milliseconds, and the last one
+ * counts the slower requests. Requests where @metric was not measured are
+ * not counted.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_get_histogram (GrlNetWc *self,
+                          GrlNetWcMetric metric,
+                          guint *counts)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+  g_return_if_fail (metric <= GRL_NET_WC_METRIC_TOTAL);
+  g_return_if_fail (counts);
+
+  memcpy (counts, self->priv->histograms[metric],
+          sizeof (self->priv->histograms[metric]));
+}
+
+/**
+ * grl_net_wc_reset_metrics:
+ * @self: a #GrlNetWc instance
+ *
+ * Empties the histograms of @self.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_reset_metrics (GrlNetWc *self)
+{
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  memset (self->priv->histograms, 0, sizeof (self->priv->histograms));
+}
+
+struct prewarm {
+  GSimpleAsyncResult *result;
+  guint pending;
+};
+
+static void
+prewarm_done (struct prewarm *p)
+{
+  if (--p->pending > 0)
+    return;
+
+  g_simple_async_result_complete_in_idle (p->result);
+  g_object_unref (p->result);
+  g_slice_free (struct prewarm, p);
+}
+
+static void
+prewarm_cb (SoupSession *session,
+            SoupMessage *msg,
+            gpointer user_data)
+{
+  struct request_clos *c = user_data;
+
+  GRL_DEBUG ("prewarmed connection to '%s': %u",
+             c->hq->host, msg->status_code);
+
+  g_simple_async_result_complete (G_SIMPLE_ASYNC_RESULT (c->result));
+  g_object_unref (c->result);
+}
+
+/* Sends the HEAD request once the host queue allows it */
+static void
+send_prewarm (struct request_clos *c)
+{
+  SoupMessage *msg;
+
+  /* The connection stays idle once the response is read */
+  msg = soup_message_new (SOUP_METHOD_HEAD, c->url);
+  soup_session_queue_message (c->self->priv->session, msg, prewarm_cb, c);
+}
+
+/* Called when the HEAD request finished, or was cancelled while queued */
+static void
+prewarm_request_done_cb (GObject *source,
+                         GAsyncResult *res,
+                         gpointer user_data)
+{
+  struct request_clos *c = user_data;
+
+  if (c->sent) {
+    c->hq->running--;
+    schedule_dispatch (c->hq);
+  }
+
+  prewarm_done (c->prewarm);
+  free_request_clos (c);
+}
+
+static void
+prewarm_request (GrlNetWc *self,
+                 struct prewarm *p,
+                 SoupURI *uri)
+{
   struct request_clos *c;
 
-  while ((c = g_queue_pop_head (priv->pending))) {
-    g_source_remove (c->source_id);
-    g_object_unref (c->cancellable);
-    g_free (c->url);
-    g_free (c);
+  c = g_slice_new0 (struct request_clos);
+  c->self = self;
+  c->hq = get_host_queue (self, uri->host);
+  c->url = soup_uri_to_string (uri, FALSE);
+  c->created = get_current_time_us ();
+  c->priority = G_PRIORITY_DEFAULT;
+  c->prewarm = p;
+  c->cancellable = g_cancellable_new ();
+  c->result = G_ASYNC_RESULT (g_simple_async_result_new (G_OBJECT (self),
+                                                         prewarm_request_done_cb,
+                                                         c,
+                                                         prewarm_request));
+
+  p->pending++;
+
+  /* Subject to the limits of the host, like any other request */
+  get_url (c);
+}
+
+/**
+ * grl_net_wc_prewarm:
+ * @self: a #GrlNetWc instance
+ * @hosts: (array zero-terminated=1) (allow-none): host names, or base URIs
+ * like "https://api.example.com" to use other schemes or ports
+ * @callback: (allow-none): The callback when the connections are ready
+ * @user_data: User data set for the @callback
+ *
+ * Resolves the names of @hosts and opens a connection to each of them, so
+ * the first requests do not have to wait for it. The connections are opened
+ * with a HEAD request, queued and limited like any other request to the
+ * host, and kept idle for up to #GrlNetWc::idle-timeout seconds, to be
+ * reused by the next requests. If #GrlNetWc::keep-alive is disabled, only
+ * the names are resolved.
+ *
+ * Web-backed plugins can call it with the hosts of
+ * #GrlPluginRegistry::prewarm-hosts.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_net_wc_prewarm (GrlNetWc *self,
+                    const gchar * const *hosts,
+                    GAsyncReadyCallback callback,
+                    gpointer user_data)
+{
+  GrlNetWcPrivate *priv;
+  struct prewarm *p;
+  SoupURI *uri;
+  gchar *url;
+  guint i;
+
+  g_return_if_fail (GRL_IS_NET_WC (self));
+
+  priv = self->priv;
+
+  p = g_slice_new0 (struct prewarm);
+  p->result = g_simple_async_result_new (G_OBJECT (self),
+                                         callback,
+                                         user_data,
+                                         grl_net_wc_prewarm);
+  /* Released below, once all the connections are requested */
+  p->pending = 1;
+
+  for (i = 0; hosts && hosts[i] && !is_mocked (self); i++) {
+    if (strstr (hosts[i], "://"))
+      url = g_strdup (hosts[i]);
+    else
+      url = g_strdup_printf ("http://%s/", hosts[i]);
+
+    uri = soup_uri_new (url);
+    g_free (url);
+
+    if (!uri || !uri->host) {
+      GRL_WARNING ("Invalid host to prewarm: '%s'", hosts[i]);
+      if (uri)
+        soup_uri_free (uri);
+      continue;
+    }
+
+    /* Resolve the name right away, even if the request has to wait */
+    soup_session_prepare_for_uri (priv->session, uri);
+
+    if (priv->keep_alive)
+      prewarm_request (self, p, uri);
+
+    soup_uri_free (uri);
   }
 
-  g_get_current_time (&priv->last_request);
+  prewarm_done (p);
+}
+
+/**
+ * grl_net_wc_prewarm_finish:
+ * @self: a #GrlNetWc instance
+ * @result: The result of the prewarm
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes a prewarm started with grl_net_wc_prewarm(). Failing to connect
+ * to a host is not an error: the requests to it will fail as usual.
+ *
+ * Returns: TRUE when the connections are ready
+ *
+ * Since: 0.1.21
+ */
+gboolean
+grl_net_wc_prewarm_finish (GrlNetWc *self,
+                           GAsyncResult *result,
+                           GError **error)
+{
+  GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (result);
+
+  g_warn_if_fail (g_simple_async_result_get_source_tag (res) ==
+                  grl_net_wc_prewarm);
+
+  return !g_simple_async_result_propagate_error (res, error);
 }
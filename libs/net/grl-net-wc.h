@@ -57,6 +57,115 @@ typedef enum {
 	GRL_NET_WC_ERROR_CANCELLED
 } GrlNetWcError;
 
+/**
+ * GrlNetWcResponseFlags:
+ * @GRL_NET_WC_RESPONSE_NONE: The response was received from the server
+ * @GRL_NET_WC_RESPONSE_CACHED: The response was served from a cache,
+ * without contacting the server
+ * @GRL_NET_WC_RESPONSE_REVALIDATED: The server confirmed that the stored
+ * response was still valid, and it was served without downloading it again
+ *
+ * These flags tell where the content of a finished request comes from.
+ *
+ * Since: 0.1.21
+ */
+typedef enum {
+	GRL_NET_WC_RESPONSE_NONE        = 0,
+	GRL_NET_WC_RESPONSE_CACHED      = 1 << 0,
+	GRL_NET_WC_RESPONSE_REVALIDATED = 1 << 1
+} GrlNetWcResponseFlags;
+
+/**
+ * GrlNetWcCacheStatus:
+ * @GRL_NET_WC_CACHE_NONE: Caching was not used
+ * @GRL_NET_WC_CACHE_MISS: The response was not in any cache
+ * @GRL_NET_WC_CACHE_HIT: The response was served from a cache
+ * @GRL_NET_WC_CACHE_REVALIDATED: A stored response was revalidated with the
+ * server and served
+ *
+ * How a request was served with regard to the caches.
+ *
+ * Since: 0.1.21
+ */
+typedef enum {
+	GRL_NET_WC_CACHE_NONE,
+	GRL_NET_WC_CACHE_MISS,
+	GRL_NET_WC_CACHE_HIT,
+	GRL_NET_WC_CACHE_REVALIDATED
+} GrlNetWcCacheStatus;
+
+/**
+ * GrlNetWcMetrics:
+ * @url: the requested URL
+ * @status: the HTTP status of the last attempt, or 0 if there was none
+ * @queue_wait: time spent waiting in the queue because of the rate limits,
+ * in milliseconds
+ * @dns: time to resolve the host name, in milliseconds, or -1 if no new
+ * connection was made
+ * @connect: time to connect to the server, in milliseconds, or -1 if no new
+ * connection was made
+ * @ttfb: time from sending the request to receiving the response headers,
+ * in milliseconds, or -1 if unknown
+ * @total: time from the request to its completion, in milliseconds
+ * @bytes_in: bytes of the response bodies received from the network
+ * @bytes_decoded: bytes of the response body once decoded, which is more
+ * than @bytes_in for compressed responses
+ * @cache_status: how the request was served with regard to the caches
+ * @retries: number of times the request was retried
+ *
+ * Metrics of a finished request, emitted with the
+ * #GrlNetWc::request-finished signal. Concurrent requests sharing a
+ * transfer are reported once. Timings of retried requests are those of the
+ * last attempt, except @queue_wait and @total, which add up all of them.
+ *
+ * Since: 0.1.21
+ */
+typedef struct {
+	const gchar *url;
+	guint status;
+	gdouble queue_wait;
+	gdouble dns;
+	gdouble connect;
+	gdouble ttfb;
+	gdouble total;
+	guint64 bytes_in;
+	guint64 bytes_decoded;
+	GrlNetWcCacheStatus cache_status;
+	guint retries;
+} GrlNetWcMetrics;
+
+/**
+ * GrlNetWcMetric:
+ * @GRL_NET_WC_METRIC_QUEUE_WAIT: #GrlNetWcMetrics.queue_wait
+ * @GRL_NET_WC_METRIC_DNS: #GrlNetWcMetrics.dns
+ * @GRL_NET_WC_METRIC_CONNECT: #GrlNetWcMetrics.connect
+ * @GRL_NET_WC_METRIC_TTFB: #GrlNetWcMetrics.ttfb
+ * @GRL_NET_WC_METRIC_TOTAL: #GrlNetWcMetrics.total
+ *
+ * The timings aggregated in histograms, see grl_net_wc_get_histogram().
+ *
+ * Since: 0.1.21
+ */
+typedef enum {
+	GRL_NET_WC_METRIC_QUEUE_WAIT,
+	GRL_NET_WC_METRIC_DNS,
+	GRL_NET_WC_METRIC_CONNECT,
+	GRL_NET_WC_METRIC_TTFB,
+	GRL_NET_WC_METRIC_TOTAL
+} GrlNetWcMetric;
+
+/**
+ * GRL_NET_WC_HISTOGRAM_BUCKETS:
+ *
+ * Number of buckets of the histograms returned by
+ * grl_net_wc_get_histogram(). Their upper bounds, in milliseconds, are 5,
+ * 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 and 10000; the last bucket
+ * counts the longer times.
+ *
+ * Since: 0.1.21
+ */
+#define GRL_NET_WC_HISTOGRAM_BUCKETS 12
+
 #define GRL_TYPE_NET_WC				\
   (grl_net_wc_get_type ())
 
@@ -120,24 +229,153 @@ void grl_net_wc_request_async (GrlNetWc *self,
 			       GAsyncReadyCallback callback,
 			       gpointer user_data);
 
+void grl_net_wc_request_with_priority_async (GrlNetWc *self,
+                                             const char *uri,
+                                             gint priority,
+                                             GCancellable *cancellable,
+                                             GAsyncReadyCallback callback,
+                                             gpointer user_data);
+
 gboolean grl_net_wc_request_finish (GrlNetWc *self,
 				    GAsyncResult *result,
 				    gchar **content,
 				    gsize *length,
 				    GError **error);
 
+gboolean grl_net_wc_request_finish_full (GrlNetWc *self,
+                                         GAsyncResult *result,
+                                         gchar **content,
+                                         gsize *length,
+                                         GrlNetWcResponseFlags *flags,
+                                         GHashTable **headers,
+                                         GError **error);
+
+#if GLIB_CHECK_VERSION(2,32,0)
+GBytes *grl_net_wc_request_finish_bytes (GrlNetWc *self,
+                                         GAsyncResult *result,
+                                         GError **error);
+#endif
+
+void grl_net_wc_request_stream_async (GrlNetWc *self,
+                                      const char *uri,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data);
+
+GInputStream *grl_net_wc_request_stream_finish (GrlNetWc *self,
+                                                GAsyncResult *result,
+                                                GError **error);
+
 void grl_net_wc_set_log_level (GrlNetWc *self,
 			       guint log_level);
 
 void grl_net_wc_set_throttling (GrlNetWc *self,
 				guint throttling);
 
+void grl_net_wc_set_rate_limit (GrlNetWc *self,
+                                gdouble rate_limit);
+
+void grl_net_wc_set_burst (GrlNetWc *self,
+                           guint burst);
+
 void grl_net_wc_set_cache (GrlNetWc *self,
                            gboolean use_cache);
 
 void grl_net_wc_set_cache_size (GrlNetWc *self,
                                 guint cache_size);
 
+void grl_net_wc_set_cache_dir (GrlNetWc *self,
+                               const gchar *cache_dir);
+
+void grl_net_wc_set_memory_cache_size (GrlNetWc *self,
+                                       guint size);
+
+void grl_net_wc_get_cache_stats (GrlNetWc *self,
+                                 guint *hits,
+                                 guint *memory_hits,
+                                 guint *misses,
+                                 guint64 *bytes);
+
+void grl_net_wc_set_host_limits (GrlNetWc *self,
+                                 const gchar *host,
+                                 gdouble rate_limit,
+                                 guint burst,
+                                 guint max_running);
+
+gboolean grl_net_wc_get_host_stats (GrlNetWc *self,
+                                    const gchar *host,
+                                    guint *requests,
+                                    guint *delayed,
+                                    guint *pending,
+                                    guint *running,
+                                    gdouble *average_wait);
+
+void grl_net_wc_set_max_conns_per_host (GrlNetWc *self,
+                                        guint max_conns);
+
+void grl_net_wc_set_max_conns (GrlNetWc *self,
+                               guint max_conns);
+
+void grl_net_wc_set_idle_timeout (GrlNetWc *self,
+                                  guint timeout);
+
+void grl_net_wc_set_keep_alive (GrlNetWc *self,
+                                gboolean keep_alive);
+
+void grl_net_wc_get_connection_stats (GrlNetWc *self,
+                                      guint *connections,
+                                      guint *reuses);
+
+void grl_net_wc_set_compression (GrlNetWc *self,
+                                 gboolean compression);
+
+void grl_net_wc_get_transfer_stats (GrlNetWc *self,
+                                    guint64 *wire_bytes,
+                                    guint64 *decoded_bytes);
+
+void grl_net_wc_set_max_attempts (GrlNetWc *self,
+                                  guint max_attempts);
+
+void grl_net_wc_set_retry_delay (GrlNetWc *self,
+                                 guint delay);
+
+void grl_net_wc_set_max_retry_delay (GrlNetWc *self,
+                                     guint delay);
+
+void grl_net_wc_set_retry_statuses (GrlNetWc *self,
+                                    const guint *statuses,
+                                    guint n_statuses);
+
+void grl_net_wc_set_record_dir (GrlNetWc *self,
+                                const gchar *dir);
+
+void grl_net_wc_set_replay_dir (GrlNetWc *self,
+                                const gchar *dir);
+
+void grl_net_wc_set_replay_latency (GrlNetWc *self,
+                                    guint latency);
+
+void grl_net_wc_set_replay_bandwidth (GrlNetWc *self,
+                                      guint bandwidth);
+
+guint grl_net_wc_cancel_queued_requests (GrlNetWc *self,
+                                         gint priority);
+
+void grl_net_wc_get_histogram (GrlNetWc *self,
+                               GrlNetWcMetric metric,
+                               guint *counts);
+
+void grl_net_wc_reset_metrics (GrlNetWc *self);
+
+void grl_net_wc_prewarm (GrlNetWc *self,
+                         const gchar * const *hosts,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data);
+
+gboolean grl_net_wc_prewarm_finish (GrlNetWc *self,
+                                    GAsyncResult *result,
+                                    GError **error);
+
 void grl_net_wc_flush_delayed_requests (GrlNetWc *self);
 
 G_END_DECLS
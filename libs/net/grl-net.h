@@ -24,5 +24,6 @@
 #define _GRL_NET_H_
 
 #include <net/grl-net-wc.h>
+#include <net/grl-net-downloader.h>
 
 #endif /* _GRL_NET_H_ */
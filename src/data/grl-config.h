@@ -71,6 +71,8 @@ G_BEGIN_DECLS
 #define GRL_CONFIG_KEY_APISECRET   "api-secret"
 #define GRL_CONFIG_KEY_USERNAME    "username"
 #define GRL_CONFIG_KEY_PASSWORD    "password"
+#define GRL_CONFIG_KEY_MAX_THREADS "max-threads"
+#define GRL_CONFIG_KEY_PREWARM_HOSTS "prewarm-hosts"
 
 typedef struct _GrlConfig        GrlConfig;
 typedef struct _GrlConfigPrivate GrlConfigPrivate;
@@ -89,6 +89,14 @@ grl_init (gint *argc,
     return;
   }
 
+  /* Sources may run their operations in worker threads. Before GLib 2.24
+     this must be the very first GLib call; since 2.32 it is done by GLib */
+#if !GLIB_CHECK_VERSION(2,32,0)
+  if (!g_thread_supported ()) {
+    g_thread_init (NULL);
+  }
+#endif
+
   g_type_init ();
 
   /* Initialize operations */
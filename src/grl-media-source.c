@@ -339,6 +339,41 @@ free_query_operation_spec (GrlMediaSourceQuerySpec *spec)
   g_free (spec);
 }
 
+static void
+browse_run (gpointer spec, gpointer user_data)
+{
+  GrlMediaSourceBrowseSpec *bs = (GrlMediaSourceBrowseSpec *) spec;
+  GRL_MEDIA_SOURCE_GET_CLASS (bs->source)->browse (bs->source, bs);
+}
+
+static void
+search_run (gpointer spec, gpointer user_data)
+{
+  GrlMediaSourceSearchSpec *ss = (GrlMediaSourceSearchSpec *) spec;
+  GRL_MEDIA_SOURCE_GET_CLASS (ss->source)->search (ss->source, ss);
+}
+
+static void
+query_run (gpointer spec, gpointer user_data)
+{
+  GrlMediaSourceQuerySpec *qs = (GrlMediaSourceQuerySpec *) spec;
+  GRL_MEDIA_SOURCE_GET_CLASS (qs->source)->query (qs->source, qs);
+}
+
+static void
+metadata_run (gpointer spec, gpointer user_data)
+{
+  GrlMediaSourceMetadataSpec *ms = (GrlMediaSourceMetadataSpec *) spec;
+  GRL_MEDIA_SOURCE_GET_CLASS (ms->source)->metadata (ms->source, ms);
+}
+
+static void
+media_from_uri_run (gpointer spec, gpointer user_data)
+{
+  GrlMediaSourceMediaFromUriSpec *mfus = (GrlMediaSourceMediaFromUriSpec *) spec;
+  GRL_MEDIA_SOURCE_GET_CLASS (mfus->source)->media_from_uri (mfus->source, mfus);
+}
+
 static gboolean
 browse_idle (gpointer user_data)
 {
@@ -347,7 +382,15 @@ browse_idle (gpointer user_data)
   /* Check if operation was cancelled even before the idle kicked in */
   if (!grl_metadata_source_operation_is_cancelled (GRL_METADATA_SOURCE (bs->source),
                                                    bs->browse_id)) {
-    GRL_MEDIA_SOURCE_GET_CLASS (bs->source)->browse (bs->source, bs);
+    if (!grl_metadata_source_run_threaded (GRL_METADATA_SOURCE (bs->source),
+                                           bs->browse_id,
+                                           FALSE,
+                                           browse_run,
+                                           bs,
+                                           (gpointer *) &bs->callback,
+                                           &bs->user_data)) {
+      browse_run (bs, NULL);
+    }
   } else {
     GError *error;
     GRL_DEBUG ("  operation was cancelled");
@@ -369,7 +412,15 @@ search_idle (gpointer user_data)
   /* Check if operation was cancelled even before the idle kicked in */
   if (!grl_metadata_source_operation_is_cancelled (GRL_METADATA_SOURCE (ss->source),
                                                    ss->search_id)) {
-    GRL_MEDIA_SOURCE_GET_CLASS (ss->source)->search (ss->source, ss);
+    if (!grl_metadata_source_run_threaded (GRL_METADATA_SOURCE (ss->source),
+                                           ss->search_id,
+                                           FALSE,
+                                           search_run,
+                                           ss,
+                                           (gpointer *) &ss->callback,
+                                           &ss->user_data)) {
+      search_run (ss, NULL);
+    }
   } else {
     GError *error;
     GRL_DEBUG ("  operation was cancelled");
@@ -388,7 +439,15 @@ query_idle (gpointer user_data)
   GrlMediaSourceQuerySpec *qs = (GrlMediaSourceQuerySpec *) user_data;
   if (!grl_metadata_source_operation_is_cancelled (GRL_METADATA_SOURCE (qs->source),
                                                    qs->query_id)) {
-    GRL_MEDIA_SOURCE_GET_CLASS (qs->source)->query (qs->source, qs);
+    if (!grl_metadata_source_run_threaded (GRL_METADATA_SOURCE (qs->source),
+                                           qs->query_id,
+                                           FALSE,
+                                           query_run,
+                                           qs,
+                                           (gpointer *) &qs->callback,
+                                           &qs->user_data)) {
+      query_run (qs, NULL);
+    }
   } else {
     GError *error;
     GRL_DEBUG ("  operation was cancelled");
@@ -407,7 +466,15 @@ metadata_idle (gpointer user_data)
   GrlMediaSourceMetadataSpec *ms = (GrlMediaSourceMetadataSpec *) user_data;
   if (!grl_metadata_source_operation_is_cancelled (GRL_METADATA_SOURCE (ms->source),
                                                    ms->metadata_id)) {
-    GRL_MEDIA_SOURCE_GET_CLASS (ms->source)->metadata (ms->source, ms);
+    if (!grl_metadata_source_run_threaded (GRL_METADATA_SOURCE (ms->source),
+                                           ms->metadata_id,
+                                           TRUE,
+                                           metadata_run,
+                                           ms,
+                                           (gpointer *) &ms->callback,
+                                           &ms->user_data)) {
+      metadata_run (ms, NULL);
+    }
   } else {
     GError *error;
     GRL_DEBUG ("  operation was cancelled");
@@ -515,8 +582,15 @@ media_from_uri_idle (gpointer user_data)
     (GrlMediaSourceMediaFromUriSpec *) user_data;
   if (!grl_metadata_source_operation_is_cancelled (GRL_METADATA_SOURCE (mfus->source),
                                                    mfus->media_from_uri_id)) {
-    GRL_MEDIA_SOURCE_GET_CLASS (mfus->source)->media_from_uri (mfus->source,
-                                                               mfus);
+    if (!grl_metadata_source_run_threaded (GRL_METADATA_SOURCE (mfus->source),
+                                           mfus->media_from_uri_id,
+                                           TRUE,
+                                           media_from_uri_run,
+                                           mfus,
+                                           (gpointer *) &mfus->callback,
+                                           &mfus->user_data)) {
+      media_from_uri_run (mfus, NULL);
+    }
   } else {
     GError *error;
     GRL_DEBUG ("  operation was cancelled");
@@ -80,6 +80,14 @@ void grl_metadata_source_set_operation_ongoing (GrlMetadataSource *source,
 gboolean grl_metadata_source_operation_is_ongoing (GrlMetadataSource *source,
                                                    guint operation_id);
 
+gboolean grl_metadata_source_run_threaded (GrlMetadataSource *source,
+                                           guint operation_id,
+                                           gboolean single_result,
+                                           GFunc run,
+                                           gpointer spec,
+                                           gpointer *callback,
+                                           gpointer *user_data);
+
 G_END_DECLS
 
 #endif /* _GRL_METADATA_SOURCE_PRIV_H_ */
@@ -67,13 +67,60 @@ enum {
   PROP_0,
   PROP_ID,
   PROP_NAME,
-  PROP_DESC
+  PROP_DESC,
+  PROP_MAX_THREADS
 };
 
 struct _GrlMetadataSourcePrivate {
   gchar *id;
   gchar *name;
   gchar *desc;
+  guint max_threads;
+  GThreadPool *pool;
+};
+
+/* Signature shared by GrlMediaSourceResultCb and friends */
+typedef void (*ThreadedListCb) (gpointer source,
+                                guint operation_id,
+                                GrlMedia *media,
+                                guint remaining,
+                                gpointer user_data,
+                                const GError *error);
+
+/* Signature shared by GrlMetadataSourceResolveCb and
+   GrlMediaSourceMetadataCb */
+typedef void (*ThreadedSingleCb) (gpointer source,
+                                  guint operation_id,
+                                  GrlMedia *media,
+                                  gpointer user_data,
+                                  const GError *error);
+
+struct ThreadedResult {
+  GrlMedia *media;
+  guint remaining;
+  GError *error;
+};
+
+/* Shared by the worker running the plugin and the main context relaying its
+   results, each holding a reference */
+struct ThreadedOperation {
+  volatile gint refcount;
+  GrlMetadataSource *source;
+  guint operation_id;
+  gboolean single_result;
+  GFunc run;
+  gpointer spec;
+  gpointer *callback;
+  gpointer *user_data;
+  gpointer real_callback;
+  gpointer real_user_data;
+  GMainContext *context;
+  GMutex *lock;
+  GQueue *results;
+  struct ThreadedResult *last;
+  gboolean running;
+  gboolean finished;
+  gboolean flush_scheduled;
 };
 
 struct ResolveRelayCb {
@@ -177,6 +224,22 @@ grl_metadata_source_class_init (GrlMetadataSourceClass *metadata_source_class)
 							G_PARAM_READWRITE |
 							G_PARAM_CONSTRUCT |
 							G_PARAM_STATIC_STRINGS));
+  /**
+   * GrlMetadataSource:max-threads
+   *
+   * Maximum number of worker threads used to run the operations of the
+   * source. When 0, operations run in the main loop.
+   *
+   * Since: 0.1.21
+   */
+  g_object_class_install_property (gobject_class,
+				   PROP_MAX_THREADS,
+				   g_param_spec_uint ("max-threads",
+						      "Maximum threads",
+						      "Maximum number of threads running operations",
+						      0, G_MAXINT, 0,
+						      G_PARAM_READWRITE |
+						      G_PARAM_STATIC_STRINGS));
 
   g_type_class_add_private (metadata_source_class,
                             sizeof (GrlMetadataSourcePrivate));
@@ -197,6 +260,10 @@ grl_metadata_source_finalize (GObject *object)
 
   source = GRL_METADATA_SOURCE (object);
 
+  if (source->priv->pool) {
+    g_thread_pool_free (source->priv->pool, FALSE, TRUE);
+  }
+
   g_free (source->priv->id);
   g_free (source->priv->name);
   g_free (source->priv->desc);
@@ -233,6 +300,9 @@ grl_metadata_source_set_property (GObject *object,
   case PROP_DESC:
     set_string_property (&source->priv->desc, value);
     break;
+  case PROP_MAX_THREADS:
+    grl_metadata_source_set_max_threads (source, g_value_get_uint (value));
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (source, prop_id, pspec);
     break;
@@ -259,6 +329,9 @@ grl_metadata_source_get_property (GObject *object,
   case PROP_DESC:
     g_value_set_string (value, source->priv->desc);
     break;
+  case PROP_MAX_THREADS:
+    g_value_set_uint (value, source->priv->max_threads);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (source, prop_id, pspec);
     break;
@@ -345,6 +418,223 @@ set_metadata_ctl_cb (GrlMetadataSource *source,
   }
 }
 
+static void
+free_threaded_result (struct ThreadedResult *result,
+                      gboolean single_result)
+{
+  if (result->media && !single_result) {
+    g_object_unref (result->media);
+  }
+  if (result->error) {
+    g_error_free (result->error);
+  }
+  g_slice_free (struct ThreadedResult, result);
+}
+
+static struct ThreadedOperation *
+threaded_operation_ref (struct ThreadedOperation *to)
+{
+  g_atomic_int_inc (&to->refcount);
+  return to;
+}
+
+static void
+threaded_operation_unref (struct ThreadedOperation *to)
+{
+  struct ThreadedResult *result;
+
+  if (!g_atomic_int_dec_and_test (&to->refcount)) {
+    return;
+  }
+
+  while ((result = g_queue_pop_head (to->results)) != NULL) {
+    free_threaded_result (result, to->single_result);
+  }
+  g_queue_free (to->results);
+  g_mutex_free (to->lock);
+  g_main_context_unref (to->context);
+  g_free (to);
+}
+
+static gboolean threaded_operation_flush (gpointer user_data);
+
+/* Must be called with the lock held */
+static void
+threaded_operation_schedule_flush (struct ThreadedOperation *to)
+{
+  GSource *idle;
+
+  /* Results pushed until the idle runs are relayed in the same batch */
+  if (!to->flush_scheduled) {
+    to->flush_scheduled = TRUE;
+    idle = g_idle_source_new ();
+    g_source_set_callback (idle, threaded_operation_flush, to, NULL);
+    g_source_attach (idle, to->context);
+    g_source_unref (idle);
+  }
+}
+
+static void
+threaded_operation_relay (struct ThreadedOperation *to,
+                          struct ThreadedResult *result)
+{
+  if (to->single_result) {
+    ((ThreadedSingleCb) to->real_callback) (to->source,
+                                            to->operation_id,
+                                            result->media,
+                                            to->real_user_data,
+                                            result->error);
+  } else {
+    ((ThreadedListCb) to->real_callback) (to->source,
+                                          to->operation_id,
+                                          result->media,
+                                          result->remaining,
+                                          to->real_user_data,
+                                          result->error);
+  }
+}
+
+static gboolean
+threaded_operation_flush (gpointer user_data)
+{
+  struct ThreadedOperation *to = (struct ThreadedOperation *) user_data;
+  struct ThreadedResult *result, *last = NULL;
+  GQueue *results;
+
+  g_mutex_lock (to->lock);
+  results = to->results;
+  to->results = g_queue_new ();
+  to->flush_scheduled = FALSE;
+  /* The relay callback frees the spec with the last result, so it is held
+     back until the plugin returns */
+  if (!to->running) {
+    last = to->last;
+    to->last = NULL;
+  }
+  g_mutex_unlock (to->lock);
+
+  GRL_DEBUG ("threaded_operation_flush: relaying %u results of operation %u",
+             g_queue_get_length (results) + (last? 1: 0), to->operation_id);
+
+  while ((result = g_queue_pop_head (results)) != NULL) {
+    threaded_operation_relay (to, result);
+    g_slice_free (struct ThreadedResult, result);
+  }
+  g_queue_free (results);
+
+  if (last) {
+    /* Hand the spec back: the relay callback may free it, or reuse it to
+       request the next chunk */
+    *to->callback = to->real_callback;
+    *to->user_data = to->real_user_data;
+
+    threaded_operation_relay (to, last);
+    if (last->error) {
+      g_error_free (last->error);
+    }
+    g_slice_free (struct ThreadedResult, last);
+
+    /* Drop the reference of the relaying side */
+    threaded_operation_unref (to);
+  }
+
+  return FALSE;
+}
+
+/* Runs in the thread the plugin emits results from */
+static void
+threaded_operation_push (struct ThreadedOperation *to,
+                         GrlMedia *media,
+                         guint remaining,
+                         const GError *error)
+{
+  struct ThreadedResult *result;
+
+  result = g_slice_new (struct ThreadedResult);
+  result->media = media;
+  result->remaining = remaining;
+  result->error = error? g_error_copy (error): NULL;
+
+  g_mutex_lock (to->lock);
+  if (to->finished) {
+    g_mutex_unlock (to->lock);
+    GRL_WARNING ("Source '%s' emitted results after finishing operation %u",
+                 grl_metadata_source_get_name (to->source),
+                 to->operation_id);
+    free_threaded_result (result, to->single_result);
+    return;
+  }
+
+  if (to->single_result || remaining == 0) {
+    to->finished = TRUE;
+    to->last = result;
+  } else {
+    g_queue_push_tail (to->results, result);
+  }
+  threaded_operation_schedule_flush (to);
+  g_mutex_unlock (to->lock);
+}
+
+static void
+threaded_list_result_cb (gpointer source,
+                         guint operation_id,
+                         GrlMedia *media,
+                         guint remaining,
+                         gpointer user_data,
+                         const GError *error)
+{
+  threaded_operation_push ((struct ThreadedOperation *) user_data,
+                           media, remaining, error);
+}
+
+static void
+threaded_single_result_cb (gpointer source,
+                           guint operation_id,
+                           GrlMedia *media,
+                           gpointer user_data,
+                           const GError *error)
+{
+  threaded_operation_push ((struct ThreadedOperation *) user_data,
+                           media, 0, error);
+}
+
+static void
+threaded_operation_run (gpointer data, gpointer pool_data)
+{
+  struct ThreadedOperation *to = (struct ThreadedOperation *) data;
+  struct ThreadedResult *result;
+
+  GRL_DEBUG ("threaded_operation_run: operation %u", to->operation_id);
+
+  to->run (to->spec, to->source);
+
+  g_mutex_lock (to->lock);
+  to->running = FALSE;
+  if (!to->finished) {
+    /* Nobody else would finish the operation, since the plugin must not
+       keep using the spec once it returns */
+    GRL_WARNING ("Source '%s' returned without finishing operation %u",
+                 grl_metadata_source_get_name (to->source),
+                 to->operation_id);
+    result = g_slice_new0 (struct ThreadedResult);
+    to->finished = TRUE;
+    to->last = result;
+  }
+  /* Release the last result, held back until now */
+  threaded_operation_schedule_flush (to);
+  g_mutex_unlock (to->lock);
+
+  /* Drop the reference of the worker */
+  threaded_operation_unref (to);
+}
+
+static void
+resolve_run (gpointer spec, gpointer user_data)
+{
+  GrlMetadataSourceResolveSpec *rs = (GrlMetadataSourceResolveSpec *) spec;
+  GRL_METADATA_SOURCE_GET_CLASS (rs->source)->resolve (rs->source, rs);
+}
+
 static void
 resolve_result_relay_cb (GrlMetadataSource *source,
                          guint resolve_id,
@@ -394,7 +684,15 @@ resolve_idle (gpointer user_data)
   GRL_DEBUG ("resolve_idle");
   GrlMetadataSourceResolveSpec *rs =
     (GrlMetadataSourceResolveSpec *) user_data;
-  GRL_METADATA_SOURCE_GET_CLASS (rs->source)->resolve (rs->source, rs);
+  if (!grl_metadata_source_run_threaded (rs->source,
+                                         rs->resolve_id,
+                                         TRUE,
+                                         resolve_run,
+                                         rs,
+                                         (gpointer *) &rs->callback,
+                                         &rs->user_data)) {
+    resolve_run (rs, NULL);
+  }
   return FALSE;
 }
 
@@ -471,9 +769,9 @@ analyze_keys_to_write (GrlMetadataSource *source,
 {
   GList *maps = NULL;
   struct SourceKeyMap *map;
-  GrlPluginRegistry *registry;
-  GList *sources = NULL;
-  GList *sources_iter;
+  GrlPluginRegistrySnapshot *snapshot;
+  const GList *sources = NULL;
+  const GList *sources_iter;
 
   /* 'key_list' holds keys that can be written by this source
      'unsupportedy_keys' holds those that must be handled by other sources */
@@ -498,12 +796,13 @@ analyze_keys_to_write (GrlMetadataSource *source,
     goto done;
   }
 
-  /* Check if other sources can write the missing keys */
-  registry = grl_plugin_registry_get_default ();
+  /* Check if other sources can write the missing keys; the maps keep the
+     sources they use */
+  snapshot =
+    grl_plugin_registry_get_snapshot (grl_plugin_registry_get_default ());
   sources =
-    grl_plugin_registry_get_sources_by_operations (registry,
-                                                   GRL_OP_SET_METADATA,
-                                                   TRUE);
+    grl_plugin_registry_snapshot_get_sources_by_operations (snapshot,
+                                                            GRL_OP_SET_METADATA);
   for (sources_iter = sources; unsupported_keys && sources_iter;
       sources_iter = g_list_next (sources_iter)) {
     GrlMetadataSource *_source;
@@ -525,10 +824,10 @@ analyze_keys_to_write (GrlMetadataSource *source,
     map->keys = key_list;
     maps = g_list_prepend (maps, map);
   }
+  grl_plugin_registry_snapshot_unref (snapshot);
 
  done:
   *failed_keys = unsupported_keys;
-  g_list_free (sources);
   return maps;
 }
 
@@ -677,13 +976,13 @@ may_directly_resolve (GrlMetadataSource *source,
  */
 static GrlMetadataSource *
 get_additional_source_for_key (GrlMetadataSource *source,
-                               GList *sources,
+                               const GList *sources,
                                GrlMedia *media,
                                GrlKeyID key,
                                GList **additional_keys,
                                gboolean main_source_is_only_resolver)
 {
-  GList *iter;
+  const GList *iter;
 
   g_return_val_if_fail (source || !main_source_is_only_resolver, NULL);
   g_return_val_if_fail (additional_keys || !main_source_is_only_resolver, NULL);
@@ -1225,17 +1524,20 @@ grl_metadata_source_get_additional_sources (GrlMetadataSource *source,
                                             GList **additional_keys,
                                             gboolean main_source_is_only_resolver)
 {
-  GList *missing_keys, *iter, *result = NULL, *sources;
-  GrlPluginRegistry *registry;
+  GList *missing_keys, *iter, *result = NULL;
+  const GList *sources;
+  GrlPluginRegistrySnapshot *snapshot;
 
   missing_keys = missing_in_data (GRL_DATA (media), keys);
   if (!missing_keys)
     return NULL;
 
-  registry = grl_plugin_registry_get_default ();
-  sources = grl_plugin_registry_get_sources_by_operations (registry,
-                                                           GRL_OP_RESOLVE,
-                                                           TRUE);
+  /* It may run in the threads of @source */
+  snapshot =
+    grl_plugin_registry_get_snapshot (grl_plugin_registry_get_default ());
+  sources =
+    grl_plugin_registry_snapshot_get_sources_by_operations (snapshot,
+                                                            GRL_OP_RESOLVE);
 
   for (iter = missing_keys; iter; iter = g_list_next (iter)) {
     GrlKeyID key = (GrlKeyID) iter->data;
@@ -1261,6 +1563,7 @@ grl_metadata_source_get_additional_sources (GrlMetadataSource *source,
                  GRL_METADATA_KEY_GET_NAME (key));
     }
   }
+  grl_plugin_registry_snapshot_unref (snapshot);
 
   /* list_union() is used to remove doubles */
   return list_union (NULL, result, NULL);
@@ -1314,6 +1617,61 @@ grl_metadata_source_get_description (GrlMetadataSource *source)
   return source->priv->desc;
 }
 
+/**
+ * grl_metadata_source_get_max_threads:
+ * @source: a metadata source
+ *
+ * Returns: the maximum number of threads used to run the operations of
+ * @source, or 0 if they run in the main loop
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_metadata_source_get_max_threads (GrlMetadataSource *source)
+{
+  g_return_val_if_fail (GRL_IS_METADATA_SOURCE (source), 0);
+
+  return source->priv->max_threads;
+}
+
+/**
+ * grl_metadata_source_set_max_threads:
+ * @source: a metadata source
+ * @max_threads: maximum number of threads, or 0 to run in the main loop
+ *
+ * Sets the number of worker threads used to run the operations of @source.
+ *
+ * Sources doing blocking I/O (local databases, filesystem scanning, ...)
+ * can set this so their browse(), search(), query(), metadata(),
+ * media_from_uri() and resolve() implementations run in a pool of worker
+ * threads instead of blocking the main loop. Results emitted from the
+ * workers are relayed in batches from the main context that started the
+ * operation. Operations already running are not affected.
+ *
+ * Note that those implementations must not use the main loop nor the
+ * operation API (grl_operation_get_data(), ...) when run in a thread, and
+ * that the cancel() implementation is still run in the main loop. To look up
+ * other sources there, they use grl_plugin_registry_get_snapshot() rather
+ * than the rest of the registry. They must also emit their last result
+ * before returning: the operation spec is only released once they return,
+ * and an operation left unfinished is finished with an empty result.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_metadata_source_set_max_threads (GrlMetadataSource *source,
+                                     guint max_threads)
+{
+  g_return_if_fail (GRL_IS_METADATA_SOURCE (source));
+
+  source->priv->max_threads = max_threads;
+
+  /* Keep the previous limit for pending work when disabling threads */
+  if (source->priv->pool && max_threads > 0) {
+    g_thread_pool_set_max_threads (source->priv->pool, max_threads, NULL);
+  }
+}
+
 /**
  * grl_metadata_source_set_metadata:
  * @source: a metadata source
@@ -1753,3 +2111,71 @@ grl_metadata_source_operation_is_ongoing (GrlMetadataSource *source,
 
   return op_state && !op_state->cancelled;
 }
+
+gboolean
+grl_metadata_source_run_threaded (GrlMetadataSource *source,
+                                  guint operation_id,
+                                  gboolean single_result,
+                                  GFunc run,
+                                  gpointer spec,
+                                  gpointer *callback,
+                                  gpointer *user_data)
+{
+  struct ThreadedOperation *to;
+  GMainContext *context;
+  GError *error = NULL;
+
+  if (source->priv->max_threads == 0) {
+    return FALSE;
+  }
+
+  if (!source->priv->pool) {
+    source->priv->pool = g_thread_pool_new (threaded_operation_run,
+                                            source,
+                                            source->priv->max_threads,
+                                            FALSE,
+                                            &error);
+    if (!source->priv->pool) {
+      GRL_WARNING ("Unable to create thread pool for source '%s': %s",
+                   grl_metadata_source_get_name (source), error->message);
+      g_error_free (error);
+      source->priv->max_threads = 0;
+      return FALSE;
+    }
+  }
+
+  context = g_main_context_get_thread_default ();
+  if (!context) {
+    context = g_main_context_default ();
+  }
+
+  to = g_new0 (struct ThreadedOperation, 1);
+  to->refcount = 1;
+  to->source = source;
+  to->operation_id = operation_id;
+  to->single_result = single_result;
+  to->run = run;
+  to->spec = spec;
+  to->callback = callback;
+  to->user_data = user_data;
+  to->real_callback = *callback;
+  to->real_user_data = *user_data;
+  to->context = g_main_context_ref (context);
+  to->lock = g_mutex_new ();
+  to->results = g_queue_new ();
+  to->running = TRUE;
+
+  /* Results from the plugin go through us, so they can be relayed in the
+     right thread */
+  *callback = single_result?
+    (gpointer) threaded_single_result_cb: (gpointer) threaded_list_result_cb;
+  *user_data = to;
+
+  GRL_DEBUG ("Running operation %u of '%s' in a thread",
+             operation_id, grl_metadata_source_get_name (source));
+
+  /* One reference for the worker, one for the relaying side */
+  g_thread_pool_push (source->priv->pool, threaded_operation_ref (to), NULL);
+
+  return TRUE;
+}
@@ -359,6 +359,11 @@ const gchar *grl_metadata_source_get_name (GrlMetadataSource *source);
 
 const gchar *grl_metadata_source_get_description (GrlMetadataSource *source);
 
+guint grl_metadata_source_get_max_threads (GrlMetadataSource *source);
+
+void grl_metadata_source_set_max_threads (GrlMetadataSource *source,
+                                          guint max_threads);
+
 G_END_DECLS
 
 #endif /* _GRL_METADATA_SOURCE_H_ */
@@ -22,7 +22,7 @@
 
 /**
  * SECTION:grl-multiple
- * @short_description: Search in multiple loaded sources
+ * @short_description: Search, browse and query in multiple loaded sources
  * @see_also: #GrlMediaPlugin, #GrlMetadataSource, #GrlMediaSource
  *
  * These helper functions are due to ease the search in multiple sources.
@@ -31,6 +31,10 @@
  *
  * Also you can set %NULL that sources list, so the function will use all
  * the available sources with the search capability.
+ *
+ * The same applies to browsing the root containers, querying and getting
+ * the root metadata of several sources at once, with the browse, query and
+ * metadata capabilities respectively.
  */
 
 #include "grl-multiple.h"
@@ -41,16 +45,33 @@
 #include "grl-error.h"
 #include "grl-log.h"
 
+#include <string.h>
+
 #define GRL_LOG_DOMAIN_DEFAULT  multiple_log_domain
 GRL_LOG_DOMAIN(multiple_log_domain);
 
-struct MultipleSearchData {
+typedef enum {
+  MULTIPLE_OP_SEARCH,
+  MULTIPLE_OP_BROWSE,
+  MULTIPLE_OP_QUERY,
+  MULTIPLE_OP_METADATA
+} MultipleOperationType;
+
+typedef void (*MultipleSourceErrorCb) (GrlMediaSource *source,
+                                       const GError *error,
+                                       gpointer user_data);
+
+struct MultipleOperationData {
+  MultipleOperationType type;
   GHashTable *table;
   guint remaining;
-  GList *search_ids;
+  GList *operation_ids;
   GList *sources;
+  GQueue *queued;
+  guint running;
+  guint max_running;
   GList *keys;
-  guint search_id;
+  guint operation_id;
   gboolean cancelled;
   guint pending;
   guint sources_done;
@@ -60,6 +81,28 @@ struct MultipleSearchData {
   GrlMetadataResolutionFlags flags;
   GrlMediaSourceResultCb user_callback;
   gpointer user_data;
+  struct MultipleMergeData *merge;
+  MultipleSourceErrorCb source_error_cb;
+};
+
+struct MultipleMergeData {
+  GList *identity_keys;
+  guint window;
+  GrlMultipleScoreFunc score_func;
+  gpointer score_data;
+  GHashTable *seen;
+  GList *entries;
+  GList *pending;
+  guint pending_count;
+  guint seq;
+  guint duplicates;
+};
+
+struct MergeEntry {
+  GrlMediaSource *source;
+  GrlMedia *media;
+  gdouble score;
+  guint seq;
 };
 
 struct ResultCount {
@@ -70,23 +113,63 @@ struct ResultCount {
 };
 
 struct CallbackData {
+  MultipleOperationType type;
+  guint operation_id;
   GrlMediaSourceResultCb user_callback;
   gpointer user_data;
 };
 
+struct MultipleSyncData {
+  GrlDataSync ds;
+  GHashTable *source_errors;
+  GrlMultipleFilterFunc filter;
+  gpointer filter_data;
+  guint limit;
+  guint received;
+  gboolean stopped;
+};
+
 struct MediaFromUriCallbackData {
   gchar *uri;
   GrlMediaSourceMetadataCb user_callback;
   gpointer user_data;
 };
 
-static void multiple_search_cb (GrlMediaSource *source,
-				guint search_id,
+struct MediaFromUriParallelData {
+  guint operation_id;
+  gchar *uri;
+  GList *keys;
+  GrlMetadataResolutionFlags flags;
+  GList *candidates;
+  GrlPluginRegistrySnapshot *snapshot; /* keeps the candidates alive */
+  GList *probes;
+  guint hedge_delay;
+  guint hedge_source_id;
+  guint finish_source_id;
+  gboolean done;
+  gboolean cancelled;
+  gboolean cancelling;
+  gboolean launching;
+  GError *error;
+  GrlMediaSourceMetadataCb user_callback;
+  gpointer user_data;
+};
+
+struct MediaFromUriProbe {
+  struct MediaFromUriParallelData *mfupd;
+  GrlMediaSource *source;
+  guint operation_id;
+  gboolean launching;
+  gboolean finished;
+};
+
+static void multiple_result_cb (GrlMediaSource *source,
+				guint operation_id,
 				GrlMedia *media,
 				guint remaining,
 				gpointer user_data,
 				const GError *error);
-static void multiple_search_cancel_cb (struct MultipleSearchData *msd);
+static void multiple_operation_cancel_cb (struct MultipleOperationData *mod);
 
 
 /* ================= Globals ================= */
@@ -94,34 +177,98 @@ static void multiple_search_cancel_cb (struct MultipleSearchData *msd);
 /* ================ Utitilies ================ */
 
 static void
-free_multiple_search_data (struct MultipleSearchData *msd)
+free_merge_entry (struct MergeEntry *entry)
+{
+  if (entry->media) {
+    g_object_unref (entry->media);
+  }
+  g_slice_free (struct MergeEntry, entry);
+}
+
+static void
+free_multiple_merge_data (struct MultipleMergeData *mmd)
+{
+  GRL_DEBUG ("free_multiple_merge_data");
+  g_hash_table_unref (mmd->seen);
+  g_list_free_full (mmd->entries, (GDestroyNotify) free_merge_entry);
+  g_list_free (mmd->pending);
+  g_list_free (mmd->identity_keys);
+  g_slice_free (struct MultipleMergeData, mmd);
+}
+
+static void
+free_multiple_operation_data (struct MultipleOperationData *mod)
 {
-  GRL_DEBUG ("free_multiple_search_data");
-  g_hash_table_unref (msd->table);
-  g_list_free (msd->search_ids);
-  g_list_free (msd->sources);
-  g_list_free (msd->sources_more);
-  g_list_free (msd->keys);
-  g_free (msd->text);
-  g_free (msd);
+  GRL_DEBUG ("free_multiple_operation_data");
+  if (mod->merge) {
+    free_multiple_merge_data (mod->merge);
+  }
+  g_hash_table_unref (mod->table);
+  g_list_free (mod->operation_ids);
+  g_list_free (mod->sources);
+  g_list_free (mod->sources_more);
+  g_queue_free (mod->queued);
+  g_list_free (mod->keys);
+  g_free (mod->text);
+  g_free (mod);
 }
 
 static gboolean
 confirm_cancel_idle (gpointer user_data)
 {
-  struct MultipleSearchData *msd = (struct MultipleSearchData *) user_data;
-  msd->user_callback (NULL, msd->search_id, NULL, 0, msd->user_data, NULL);
+  struct CallbackData *callback_data = (struct CallbackData *) user_data;
+
+  /* Do not use the operation data here: it may be already freed if all
+     the sources finished before this idle is run */
+  callback_data->user_callback (NULL, callback_data->operation_id, NULL, 0,
+                                callback_data->user_data, NULL);
+  g_free (callback_data);
+
   return FALSE;
 }
 
+static GrlSupportedOps
+multiple_operation_get_supported_op (MultipleOperationType type)
+{
+  switch (type) {
+  case MULTIPLE_OP_BROWSE:
+    return GRL_OP_BROWSE;
+  case MULTIPLE_OP_QUERY:
+    return GRL_OP_QUERY;
+  case MULTIPLE_OP_METADATA:
+    return GRL_OP_METADATA;
+  case MULTIPLE_OP_SEARCH:
+  default:
+    return GRL_OP_SEARCH;
+  }
+}
+
 static gboolean
-handle_no_searchable_sources_idle (gpointer user_data)
+handle_no_available_sources_idle (gpointer user_data)
 {
   GError *error;
   struct CallbackData *callback_data = (struct CallbackData *) user_data;
 
-  error = g_error_new (GRL_CORE_ERROR, GRL_CORE_ERROR_SEARCH_FAILED,
-                       "No searchable sources available");
+  switch (callback_data->type) {
+  case MULTIPLE_OP_BROWSE:
+    error = g_error_new (GRL_CORE_ERROR, GRL_CORE_ERROR_BROWSE_FAILED,
+                         "No browsable sources available");
+    break;
+  case MULTIPLE_OP_QUERY:
+    error = g_error_new (GRL_CORE_ERROR, GRL_CORE_ERROR_QUERY_FAILED,
+                         "No queryable sources available");
+    break;
+  case MULTIPLE_OP_METADATA:
+    error = g_error_new (GRL_CORE_ERROR, GRL_CORE_ERROR_METADATA_FAILED,
+                         "No sources with metadata support available");
+    break;
+  case MULTIPLE_OP_SEARCH:
+  default:
+    error = g_error_new (GRL_CORE_ERROR, GRL_CORE_ERROR_SEARCH_FAILED,
+                         "No searchable sources available");
+    break;
+  }
+
   callback_data->user_callback (NULL, 0, NULL, 0, callback_data->user_data, error);
 
   g_error_free (error);
@@ -131,57 +278,150 @@ handle_no_searchable_sources_idle (gpointer user_data)
 }
 
 static void
-handle_no_searchable_sources (GrlMediaSourceResultCb callback, gpointer user_data)
+handle_no_available_sources (MultipleOperationType type,
+                             GrlMediaSourceResultCb callback,
+                             gpointer user_data)
 {
   struct CallbackData *callback_data = g_new0 (struct CallbackData, 1);
+  callback_data->type = type;
   callback_data->user_callback = callback;
   callback_data->user_data = user_data;
-  g_idle_add (handle_no_searchable_sources_idle, callback_data);
+  g_idle_add (handle_no_available_sources_idle, callback_data);
 }
 
-static struct MultipleSearchData *
-start_multiple_search_operation (guint search_id,
-				 const GList *sources,
-				 const gchar *text,
-				 const GList *keys,
-				 const GList *skip_counts,
-				 guint count,
-				 GrlMetadataResolutionFlags flags,
-				 GrlMediaSourceResultCb user_callback,
-				 gpointer user_data)
+static void
+multiple_metadata_cb (GrlMediaSource *source,
+                      guint metadata_id,
+                      GrlMedia *media,
+                      gpointer user_data,
+                      const GError *error)
+{
+  /* Metadata operations provide a single result per source */
+  multiple_result_cb (source, metadata_id, media, 0, user_data, error);
+}
+
+static guint
+multiple_operation_issue (struct MultipleOperationData *mod,
+                          GrlMediaSource *source,
+                          guint skip,
+                          guint count)
+{
+  switch (mod->type) {
+  case MULTIPLE_OP_BROWSE:
+    /* NULL container means the root container of the source */
+    return grl_media_source_browse (source,
+                                    NULL,
+                                    mod->keys,
+                                    skip, count,
+                                    mod->flags,
+                                    multiple_result_cb,
+                                    mod);
+  case MULTIPLE_OP_QUERY:
+    return grl_media_source_query (source,
+                                   mod->text,
+                                   mod->keys,
+                                   skip, count,
+                                   mod->flags,
+                                   multiple_result_cb,
+                                   mod);
+  case MULTIPLE_OP_METADATA:
+    /* NULL media means the root container of the source */
+    return grl_media_source_metadata (source,
+                                      NULL,
+                                      mod->keys,
+                                      mod->flags,
+                                      multiple_metadata_cb,
+                                      mod);
+  case MULTIPLE_OP_SEARCH:
+  default:
+    return grl_media_source_search (source,
+                                    mod->text,
+                                    mod->keys,
+                                    skip, count,
+                                    mod->flags,
+                                    multiple_result_cb,
+                                    mod);
+  }
+}
+
+static void
+multiple_operation_launch_queued (struct MultipleOperationData *mod)
+{
+  GrlMediaSource *source;
+  struct ResultCount *rc;
+  guint id;
+
+  /* The concurrency limit is shared by all the sources involved */
+  while (!g_queue_is_empty (mod->queued) &&
+         (mod->max_running == 0 || mod->running < mod->max_running)) {
+    source = GRL_MEDIA_SOURCE (g_queue_pop_head (mod->queued));
+    rc = (struct ResultCount *)
+      g_hash_table_lookup (mod->table, (gpointer) source);
+
+    mod->running++;
+    id = multiple_operation_issue (mod, source, rc->skip, rc->count);
+
+    GRL_DEBUG ("Operation %s:%u: Requesting %u items from offset %u",
+               grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)),
+               id, rc->count, rc->skip);
+
+    /* Keep track of this operation and this source */
+    mod->operation_ids = g_list_prepend (mod->operation_ids, GINT_TO_POINTER (id));
+    mod->sources = g_list_prepend (mod->sources, source);
+  }
+}
+
+static struct MultipleOperationData *
+start_multiple_operation (MultipleOperationType type,
+                          guint operation_id,
+                          const GList *sources,
+                          const gchar *text,
+                          const GList *keys,
+                          const GList *skip_counts,
+                          guint count,
+                          guint max_running,
+                          GrlMetadataResolutionFlags flags,
+                          struct MultipleMergeData *merge,
+                          MultipleSourceErrorCb source_error_cb,
+                          GrlMediaSourceResultCb user_callback,
+                          gpointer user_data)
 {
-  GRL_DEBUG ("start_multiple_search_operation");
+  GRL_DEBUG ("start_multiple_operation");
 
-  struct MultipleSearchData *msd;
+  struct MultipleOperationData *mod;
   GList *iter_sources, *iter_skips;
   guint n, first_count, individual_count;
 
   /* Prepare data required to execute the operation */
-  msd = g_new0 (struct MultipleSearchData, 1);
-  msd->table = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+  mod = g_new0 (struct MultipleOperationData, 1);
+  mod->type = type;
+  mod->table = g_hash_table_new_full (g_direct_hash, g_direct_equal,
 				      NULL, g_free);
-  msd->remaining = count - 1;
-  msd->search_id = search_id;
-  msd->text = g_strdup (text);
-  msd->keys = g_list_copy ((GList *) keys);
-  msd->flags = flags;
-  msd->user_callback = user_callback;
-  msd->user_data = user_data;
+  mod->queued = g_queue_new ();
+  mod->max_running = max_running;
+  mod->remaining = count - 1;
+  mod->operation_id = operation_id;
+  mod->text = g_strdup (text);
+  mod->keys = g_list_copy ((GList *) keys);
+  mod->flags = flags;
+  mod->user_callback = user_callback;
+  mod->user_data = user_data;
+  mod->merge = merge;
+  mod->source_error_cb = source_error_cb;
 
   /* Compute the # of items to request by each source */
   n = g_list_length ((GList *) sources);
   individual_count = count / n;
   first_count = individual_count + count % n;
 
-  /* Issue search operations on each source */
+  /* Queue operations on each source */
   iter_sources = (GList *) sources;
   iter_skips = (GList *) skip_counts;
   n = 0;
   while (iter_sources) {
     GrlMediaSource *source;
-    guint c, id;
+    guint c;
     struct ResultCount *rc;
-    guint skip;
 
     source = GRL_MEDIA_SOURCE (iter_sources->data);
 
@@ -194,33 +434,18 @@ start_multiple_search_operation (guint search_id,
       /* We use ResultCount to keep track of results emitted by this source */
       rc = g_new0 (struct ResultCount, 1);
       rc->count = c;
-      g_hash_table_insert (msd->table, source, rc);
 
       /* Check if we have to apply a "skip" parameter to this source
 	 (useful when we are chaining queries to complete the result count) */
       if (iter_skips) {
-	skip = GPOINTER_TO_INT (iter_skips->data);
+	rc->skip = GPOINTER_TO_INT (iter_skips->data);
       } else {
-	skip = 0;
+	rc->skip = 0;
       }
 
-      /* Execute the search on this source */
-      id = grl_media_source_search (source,
-				    msd->text,
-				    msd->keys,
-				    skip, rc->count,
-				    flags,
-				    multiple_search_cb,
-				    msd);
-
-      GRL_DEBUG ("Operation %s:%u: Searching %u items from offset %u",
-                 grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)),
-                 id, rc->count, skip);
-
-      /* Keep track of this operation and this source */
-      msd->search_ids = g_list_prepend (msd->search_ids, GINT_TO_POINTER (id));
-      msd->sources = g_list_prepend (msd->sources, source);
-      msd->sources_count++;
+      g_hash_table_insert (mod->table, source, rc);
+      g_queue_push_tail (mod->queued, source);
+      mod->sources_count++;
     }
 
     /* Move to the next source */
@@ -228,52 +453,275 @@ start_multiple_search_operation (guint search_id,
     iter_skips = g_list_next (iter_skips);
   }
 
-  /* This frees the previous msd structure (if this operation is chained) */
-  grl_operation_set_private_data (msd->search_id,
-                                  msd,
-                                  (GrlOperationCancelCb) multiple_search_cancel_cb,
-                                  (GDestroyNotify) free_multiple_search_data);
+  /* This frees the previous mod structure (if this operation is chained) */
+  grl_operation_set_private_data (mod->operation_id,
+                                  mod,
+                                  (GrlOperationCancelCb) multiple_operation_cancel_cb,
+                                  (GDestroyNotify) free_multiple_operation_data);
+
+  /* Execute the operation on as many sources as allowed */
+  multiple_operation_launch_queued (mod);
 
-  return msd;
+  return mod;
 }
 
-static struct MultipleSearchData *
-chain_multiple_search_operation (struct MultipleSearchData *old_msd)
+static struct MultipleOperationData *
+chain_multiple_operation (struct MultipleOperationData *old_mod)
 {
   GList *skip_list = NULL;
   GList *source_iter;
   struct ResultCount *rc;
   GrlMediaSource *source;
-  struct MultipleSearchData *msd;
+  struct MultipleOperationData *mod;
+  struct MultipleMergeData *merge;
 
   /* Compute skip parameter for each of the sources that can still
      provide more results */
-  source_iter = old_msd->sources_more;
+  source_iter = old_mod->sources_more;
   while (source_iter) {
     source = GRL_MEDIA_SOURCE (source_iter->data);
     rc = (struct ResultCount *)
-      g_hash_table_lookup (old_msd->table, (gpointer) source);
+      g_hash_table_lookup (old_mod->table, (gpointer) source);
     skip_list = g_list_prepend (skip_list,
 				GINT_TO_POINTER (rc->count + rc->skip));
     source_iter = g_list_next (source_iter);
   }
 
   /* Reverse the sources list so that they match the skip list */
-  old_msd->sources_more = g_list_reverse (old_msd->sources_more);
-
-  /* Continue the search process with the same search_id */
-  msd = start_multiple_search_operation (old_msd->search_id,
-					 old_msd->sources_more,
-					 old_msd->text,
-					 old_msd->keys,
-					 skip_list,
-					 old_msd->pending,
-					 old_msd->flags,
-					 old_msd->user_callback,
-					 old_msd->user_data);
+  old_mod->sources_more = g_list_reverse (old_mod->sources_more);
+
+  /* The merge state (if any) outlives the chunk, so hand it over to the
+     new operation data before the old one is freed */
+  merge = old_mod->merge;
+  old_mod->merge = NULL;
+
+  /* Continue the operation with the same operation_id */
+  mod = start_multiple_operation (old_mod->type,
+                                  old_mod->operation_id,
+                                  old_mod->sources_more,
+                                  old_mod->text,
+                                  old_mod->keys,
+                                  skip_list,
+                                  old_mod->pending,
+                                  old_mod->max_running,
+                                  old_mod->flags,
+                                  merge,
+                                  old_mod->source_error_cb,
+                                  old_mod->user_callback,
+                                  old_mod->user_data);
   g_list_free (skip_list);
 
-  return msd;
+  return mod;
+}
+
+static gint
+compare_merge_entries (gconstpointer a,
+                       gconstpointer b)
+{
+  const struct MergeEntry *entry_a = a;
+  const struct MergeEntry *entry_b = b;
+
+  /* Higher score first; on ties, keep arrival order */
+  if (entry_a->score != entry_b->score) {
+    return (entry_a->score < entry_b->score) ? 1 : -1;
+  }
+
+  return (entry_a->seq > entry_b->seq) - (entry_a->seq < entry_b->seq);
+}
+
+static GList *
+merge_get_identities (struct MultipleMergeData *mmd,
+                      GrlMedia *media)
+{
+  GList *identities = NULL;
+  GList *iter;
+
+  for (iter = mmd->identity_keys; iter; iter = g_list_next (iter)) {
+    GrlKeyID key = iter->data;
+    const GValue *value;
+    gchar *contents;
+
+    value = grl_data_get (GRL_DATA (media), key);
+    if (!value) {
+      continue;
+    }
+
+    if (G_VALUE_HOLDS_STRING (value)) {
+      if (!g_value_get_string (value) || *g_value_get_string (value) == '\0') {
+        continue;
+      }
+      contents = g_value_dup_string (value);
+    } else {
+      contents = g_strdup_value_contents (value);
+    }
+
+    identities = g_list_prepend (identities,
+                                 g_strconcat (GRL_METADATA_KEY_GET_NAME (key),
+                                              ":", contents, NULL));
+    g_free (contents);
+  }
+
+  return identities;
+}
+
+static void
+merge_media_metadata (GrlMedia *target,
+                      GrlMedia *duplicate)
+{
+  GList *keys, *iter;
+
+  /* Only fill the gaps: values already present in target win */
+  keys = grl_data_get_keys (GRL_DATA (duplicate));
+  for (iter = keys; iter; iter = g_list_next (iter)) {
+    const GValue *value;
+
+    if (grl_data_has_key (GRL_DATA (target), iter->data)) {
+      continue;
+    }
+
+    value = grl_data_get (GRL_DATA (duplicate), iter->data);
+    if (value) {
+      grl_data_set (GRL_DATA (target), iter->data, value);
+    }
+  }
+  g_list_free (keys);
+}
+
+static gdouble
+merge_compute_score (struct MultipleMergeData *mmd,
+                     GrlMediaSource *source,
+                     GrlMedia *media)
+{
+  if (mmd->score_func) {
+    return mmd->score_func (source, media, mmd->score_data);
+  }
+
+  return grl_multiple_score_by_rank (source, media, NULL);
+}
+
+static void
+merge_emit_best (struct MultipleOperationData *mod,
+                 guint remaining)
+{
+  struct MultipleMergeData *mmd = mod->merge;
+  struct MergeEntry *entry;
+  GrlMedia *media;
+
+  entry = (struct MergeEntry *) mmd->pending->data;
+  mmd->pending = g_list_delete_link (mmd->pending, mmd->pending);
+  mmd->pending_count--;
+
+  /* The entry stays in the identity table (without media) so later
+     duplicates of an already emitted item are dropped */
+  media = entry->media;
+  entry->media = NULL;
+
+  mod->user_callback (entry->source,
+                      mod->operation_id,
+                      media,
+                      remaining,
+                      mod->user_data,
+                      NULL);
+}
+
+/* Returns FALSE if media was a duplicate, so it does not count towards the
+   number of results requested by the user */
+static gboolean
+merge_relay_result (struct MultipleOperationData *mod,
+                    GrlMediaSource *source,
+                    GrlMedia *media,
+                    guint remaining)
+{
+  struct MultipleMergeData *mmd = mod->merge;
+  struct MergeEntry *entry = NULL;
+  GList *identities, *iter;
+  gboolean duplicate = FALSE;
+
+  if (media) {
+    identities = merge_get_identities (mmd, media);
+
+    for (iter = identities; iter && !entry; iter = g_list_next (iter)) {
+      entry = g_hash_table_lookup (mmd->seen, iter->data);
+    }
+
+    if (entry) {
+      duplicate = TRUE;
+      mmd->duplicates++;
+      if (entry->media) {
+        gdouble score;
+
+        GRL_DEBUG ("Merging duplicate result from '%s'",
+                   grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)));
+        merge_media_metadata (entry->media, media);
+
+        score = merge_compute_score (mmd, source, media);
+        if (score > entry->score) {
+          entry->score = score;
+          mmd->pending = g_list_remove (mmd->pending, entry);
+          mmd->pending = g_list_insert_sorted (mmd->pending,
+                                               entry,
+                                               compare_merge_entries);
+        }
+      } else {
+        GRL_DEBUG ("Dropping duplicate of an already emitted result from '%s'",
+                   grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)));
+      }
+      g_object_unref (media);
+    } else {
+      entry = g_slice_new0 (struct MergeEntry);
+      entry->source = source;
+      entry->media = media;
+      entry->score = merge_compute_score (mmd, source, media);
+      entry->seq = mmd->seq++;
+
+      mmd->entries = g_list_prepend (mmd->entries, entry);
+      mmd->pending = g_list_insert_sorted (mmd->pending,
+                                           entry,
+                                           compare_merge_entries);
+      mmd->pending_count++;
+    }
+
+    /* Register every identity of this result, so a later duplicate
+       matching on any of them is merged too */
+    for (iter = identities; iter; iter = g_list_next (iter)) {
+      if (g_hash_table_lookup (mmd->seen, iter->data)) {
+        g_free (iter->data);
+      } else {
+        g_hash_table_insert (mmd->seen, iter->data, entry);
+      }
+    }
+    g_list_free (identities);
+
+    if (duplicate) {
+      return FALSE;
+    }
+  }
+
+  if (remaining > 0) {
+    while (mmd->pending_count > mmd->window) {
+      merge_emit_best (mod, remaining + mmd->pending_count - 1);
+    }
+    return TRUE;
+  }
+
+  /* Last result: flush the reorder window */
+  if (!mmd->pending) {
+    mod->user_callback (source,
+                        mod->operation_id,
+                        NULL,
+                        0,
+                        mod->user_data,
+                        NULL);
+    return TRUE;
+  }
+
+  while (mmd->pending) {
+    merge_emit_best (mod, mmd->pending_count - 1);
+  }
+
+  GRL_DEBUG ("Merged %u duplicated results", mmd->duplicates);
+
+  return TRUE;
 }
 
 static void
@@ -310,31 +758,84 @@ multiple_result_async_cb (GrlMediaSource *source,
 }
 
 static void
-multiple_search_cb (GrlMediaSource *source,
-		    guint search_id,
+multiple_sync_source_error_cb (GrlMediaSource *source,
+                               const GError *error,
+                               gpointer user_data)
+{
+  struct MultipleSyncData *msd = (struct MultipleSyncData *) user_data;
+
+  GRL_DEBUG ("multiple_sync_source_error_cb");
+
+  if (!msd->source_errors || g_hash_table_lookup (msd->source_errors, source)) {
+    return;
+  }
+
+  g_hash_table_insert (msd->source_errors, source, g_error_copy (error));
+}
+
+static void
+multiple_sync_result_cb (GrlMediaSource *source,
+                         guint op_id,
+                         GrlMedia *media,
+                         guint remaining,
+                         gpointer user_data,
+                         const GError *error)
+{
+  struct MultipleSyncData *msd = (struct MultipleSyncData *) user_data;
+
+  GRL_DEBUG ("multiple_sync_result_cb");
+
+  if (media) {
+    if (msd->stopped ||
+        (msd->filter && !msd->filter (source, media, msd->filter_data))) {
+      g_object_unref (media);
+    } else {
+      msd->ds.data = g_list_prepend (msd->ds.data, media);
+      msd->received++;
+    }
+  }
+
+  if (remaining == 0) {
+    /* Keep whatever we got so far, even on failure */
+    if (error) {
+      msd->ds.error = g_error_copy (error);
+    }
+    msd->ds.data = g_list_reverse (msd->ds.data);
+    msd->ds.complete = TRUE;
+  } else if (!msd->stopped && msd->limit > 0 && msd->received >= msd->limit) {
+    /* We have enough results: stop the sources still running */
+    GRL_DEBUG ("Got %u results, stopping multiple search", msd->received);
+    msd->stopped = TRUE;
+    grl_operation_cancel (op_id);
+  }
+}
+
+static void
+multiple_result_cb (GrlMediaSource *source,
+		    guint operation_id,
 		    GrlMedia *media,
 		    guint remaining,
 		    gpointer user_data,
 		    const GError *error)
 {
-  GRL_DEBUG ("multiple_search_cb");
+  GRL_DEBUG ("multiple_result_cb");
 
-  struct MultipleSearchData *msd;
+  struct MultipleOperationData *mod;
   gboolean emit;
   gboolean operation_done = FALSE;
   struct ResultCount *rc;
 
-  msd = (struct MultipleSearchData *) user_data;
+  mod = (struct MultipleOperationData *) user_data;
 
   GRL_DEBUG ("multiple:remaining == %u, source:remaining = %u (%s)",
-             msd->remaining, remaining,
+             mod->remaining, remaining,
              grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)));
 
   /* Check if operation is done, that is, if all the sources involved
      in the multiple operation have emitted remaining=0 */
   if (remaining == 0) {
-    msd->sources_done++;
-    if (msd->sources_done == msd->sources_count) {
+    mod->sources_done++;
+    if (mod->sources_done == mod->sources_count) {
       operation_done = TRUE;
       GRL_DEBUG ("multiple operation chunk done");
     }
@@ -342,7 +843,7 @@ multiple_search_cb (GrlMediaSource *source,
 
   /* --- Cancellation management --- */
 
-  if (msd->cancelled) {
+  if (mod->cancelled) {
     GRL_DEBUG ("operation is cancelled or already finished, skipping result!");
     if (media) {
       g_object_unref (media);
@@ -359,10 +860,16 @@ multiple_search_cb (GrlMediaSource *source,
     return;
   }
 
+  /* --- Source failures --- */
+
+  if (error && mod->source_error_cb) {
+    mod->source_error_cb (source, error, mod->user_data);
+  }
+
   /* --- Update remaining count --- */
 
   rc = (struct ResultCount *)
-    g_hash_table_lookup (msd->table, (gpointer) source);
+    g_hash_table_lookup (mod->table, (gpointer) source);
 
   if (media) {
     rc->received++;
@@ -374,18 +881,24 @@ multiple_search_cb (GrlMediaSource *source,
     /* This source failed to provide as many results as we requested,
        we will have to check if other sources can provide the missing
        results */
-    msd->pending += rc->count - rc->received;
+    mod->pending += rc->count - rc->received;
   } else if (remaining == 0) {
     /* This source provided all requested results, if others did not
        we can use this to request more */
-    msd->sources_more = g_list_prepend (msd->sources_more, source);
+    mod->sources_more = g_list_prepend (mod->sources_more, source);
     GRL_DEBUG ("Source %s provided all requested results",
                grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)));
   }
 
+  /* This source is done, so there is room for one of the queued ones */
+  if (remaining == 0) {
+    mod->running--;
+    multiple_operation_launch_queued (mod);
+  }
+
   /* --- Manage NULL results --- */
 
-  if (remaining == 0 && media == NULL && msd->remaining > 0) {
+  if (remaining == 0 && media == NULL && mod->remaining > 0) {
     /* A source emitted a NULL result to finish its search operation
        we don't want to relay this to the client (unless this is the
        last one in the multiple search) */
@@ -397,32 +910,51 @@ multiple_search_cb (GrlMediaSource *source,
 
   /* --- Result emission --- */
 
-  if (emit) {
-    msd->user_callback (source,
-  		        msd->search_id,
+  if (emit && mod->merge) {
+    if (merge_relay_result (mod, source, media, mod->remaining)) {
+      mod->remaining--;
+    } else {
+      /* Duplicates do not count: ask for one more result instead */
+      mod->pending++;
+    }
+  } else if (emit) {
+    mod->user_callback (source,
+  		        mod->operation_id,
  		        media,
-		        msd->remaining--,
-		        msd->user_data,
+		        mod->remaining--,
+		        mod->user_data,
 		        NULL);
   }
 
   /* --- Manage pending results --- */
 
-  if (operation_done && msd->pending > 0 && msd->sources_more) {
+  if (mod->cancelled) {
+    /* The user cancelled the operation from the callback, so do not ask
+       for more results; the cancellation is confirmed in idle */
+    if (operation_done) {
+      goto operation_done;
+    }
+    return;
+  } else if (operation_done && mod->pending > 0 && mod->sources_more &&
+      mod->type != MULTIPLE_OP_METADATA) {
     /* We did not get all the requested results and have sources
        that can still provide more */
     GRL_DEBUG ("Requesting next chunk");
-    chain_multiple_search_operation (msd);
+    chain_multiple_operation (mod);
     return;
-  } else if (operation_done && msd->pending > 0) {
+  } else if (operation_done && mod->pending > 0) {
     /* We don't have sources capable of providing more results,
        finish operation now */
-    msd->user_callback (source,
-			msd->search_id,
-			NULL,
-			0,
-			msd->user_data,
-			NULL);
+    if (mod->merge) {
+      merge_relay_result (mod, source, NULL, 0);
+    } else {
+      mod->user_callback (source,
+                          mod->operation_id,
+                          NULL,
+                          0,
+                          mod->user_data,
+                          NULL);
+    }
     goto operation_done;
   } else if (operation_done) {
     /* We provided all the results */
@@ -433,9 +965,9 @@ multiple_search_cb (GrlMediaSource *source,
   }
 
  operation_done:
-  GRL_DEBUG ("Multiple operation finished (%u)", msd->search_id);
+  GRL_DEBUG ("Multiple operation finished (%u)", mod->operation_id);
 
-  grl_operation_remove (msd->search_id);
+  grl_operation_remove (mod->operation_id);
 }
 
 static void
@@ -473,64 +1005,37 @@ media_from_uri_cb (GrlMediaSource *source,
   free_media_from_uri_data (mfucd);
 }
 
-/* ================ API ================ */
-
-/**
- * grl_multiple_search:
- * @sources: (element-type Grl.MediaSource) (allow-none):
- * a #GList of #GrlMediaSource<!-- -->s to search from (%NULL for all
- * searchable sources)
- * @text: the text to search for
- * @keys: (element-type GObject.ParamSpec): the #GList of
- * #GrlKeyID to retrieve
- * @count: the maximum number of elements to retrieve
- * @flags: the operation flags
- * @callback: (scope notified): the user defined callback
- * @user_data: the user data to pass to the user callback
- *
- * Search for @text in all the sources specified in @sources.
- *
- * If @text is @NULL then NULL-text searchs will be used for each searchable
- * plugin (see #grl_media_source_search for more details).
- *
- * This method is asynchronous.
- *
- * Returns: the operation identifier
- *
- * Since: 0.1.6
- */
-guint
-grl_multiple_search (const GList *sources,
-		     const gchar *text,
-		     const GList *keys,
-		     guint count,
-		     GrlMetadataResolutionFlags flags,
-		     GrlMediaSourceResultCb callback,
-		     gpointer user_data)
+static guint
+multiple_operation_start (MultipleOperationType type,
+                          const GList *sources,
+                          const gchar *text,
+                          const GList *keys,
+                          guint count,
+                          guint max_running,
+                          GrlMetadataResolutionFlags flags,
+                          struct MultipleMergeData *merge,
+                          MultipleSourceErrorCb source_error_cb,
+                          GrlMediaSourceResultCb callback,
+                          gpointer user_data)
 {
   GrlPluginRegistry *registry;
   GList *sources_list;
-  struct MultipleSearchData *msd;
+  struct MultipleOperationData *mod;
   gboolean allocated_sources_list = FALSE;
   guint operation_id;
 
-  GRL_DEBUG ("grl_multiple_search");
-
-  g_return_val_if_fail (count > 0, 0);
-  g_return_val_if_fail (callback != NULL, 0);
-
   /* If no sources have been provided then get the list of all
-     searchable sources from the registry */
+     sources supporting the operation from the registry */
   if (!sources) {
     registry = grl_plugin_registry_get_default ();
     sources_list =
       grl_plugin_registry_get_sources_by_operations (registry,
-						     GRL_OP_SEARCH,
-						     TRUE);
+                                                     multiple_operation_get_supported_op (type),
+                                                     TRUE);
     if (sources_list == NULL) {
-      /* No searchable sources? Raise error and bail out */
+      /* No suitable sources? Raise error and bail out */
       g_list_free (sources_list);
-      handle_no_searchable_sources (callback, user_data);
+      handle_no_available_sources (type, callback, user_data);
       return 0;
     } else {
       sources = sources_list;
@@ -538,51 +1043,791 @@ grl_multiple_search (const GList *sources,
     }
   }
 
-  /* Start multiple search operation */
+  /* Metadata operations get exactly one result from each source */
+  if (type == MULTIPLE_OP_METADATA) {
+    count = g_list_length ((GList *) sources);
+  }
+
+  /* Start multiple operation */
   operation_id = grl_operation_generate_id ();
-  msd = start_multiple_search_operation (operation_id,
-					 sources,
-					 text,
-					 keys,
-					 NULL,
-					 count,
-					 flags,
-					 callback,
-					 user_data);
+  mod = start_multiple_operation (type,
+                                  operation_id,
+                                  sources,
+                                  text,
+                                  keys,
+                                  NULL,
+                                  count,
+                                  max_running,
+                                  flags,
+                                  merge,
+                                  source_error_cb,
+                                  callback,
+                                  user_data);
   if  (allocated_sources_list) {
     g_list_free ((GList *) sources);
   }
 
-  return msd->search_id;
+  return mod->operation_id;
 }
 
 static void
-multiple_search_cancel_cb (struct MultipleSearchData *msd)
+probe_cache_clear (GrlPluginRegistry *registry,
+                   GrlMediaPlugin *source,
+                   GHashTable *probe_cache)
 {
-  GList *sources, *ids;
+  GRL_DEBUG ("Sources changed, clearing media_from_uri probe cache");
+  g_hash_table_remove_all (probe_cache);
+}
 
-  /* Go through all the sources involved in that operation and issue
-     cancel() operations for each one */
-  sources = msd->sources;
-  ids = msd->search_ids;
-  while (sources) {
-    GRL_DEBUG ("cancelling operation %s:%u",
-               grl_metadata_source_get_name (GRL_METADATA_SOURCE (sources->data)),
-               GPOINTER_TO_UINT (ids->data));
-    grl_operation_cancel (GPOINTER_TO_INT (ids->data));
-    sources = g_list_next (sources);
-    ids = g_list_next (ids);
+/* Sources known to handle some URIs of a scheme/prefix, keyed by source and
+   URI scheme/prefix. It lives as long as the registry whose sources it
+   describes */
+static GHashTable *
+probe_cache_get (void)
+{
+  GrlPluginRegistry *registry;
+  GHashTable *probe_cache;
+
+  registry = grl_plugin_registry_get_default ();
+  probe_cache = g_object_get_data (G_OBJECT (registry), "grl-probe-cache");
+  if (!probe_cache) {
+    probe_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_object_set_data_full (G_OBJECT (registry), "grl-probe-cache",
+                            probe_cache, (GDestroyNotify) g_hash_table_unref);
+    g_signal_connect (registry, "source-added",
+                      G_CALLBACK (probe_cache_clear), probe_cache);
+    g_signal_connect (registry, "source-removed",
+                      G_CALLBACK (probe_cache_clear), probe_cache);
   }
 
-  msd->cancelled = TRUE;
+  return probe_cache;
+}
 
-  /* Send operation finished message now to client (remaining == 0) */
-  g_idle_add (confirm_cancel_idle, msd);
+static gchar *
+probe_cache_get_uri_key (const gchar *uri,
+                         GrlMultipleProbeCache cache)
+{
+  gchar *scheme;
+  const gchar *authority, *path;
+  gsize length;
+
+  scheme = g_uri_parse_scheme (uri);
+  if (!scheme || cache == GRL_MULTIPLE_PROBE_CACHE_SCHEME) {
+    return scheme;
+  }
+
+  /* Prefix is "scheme:" plus the authority, if any */
+  length = strlen (scheme) + 1;
+  authority = uri + length;
+  if (g_str_has_prefix (authority, "//")) {
+    path = strchr (authority + 2, '/');
+    length = path ? (gsize) (path - uri) : strlen (uri);
+  }
+  g_free (scheme);
+
+  return g_strndup (uri, length);
 }
 
-/**
- * grl_multiple_cancel:
- * @search_id: the identifier of the multiple operation to cancel
+static gboolean
+probe_test_media_from_uri (GrlMediaSource *source,
+                           const gchar *uri,
+                           GrlMultipleProbeCache cache)
+{
+  GHashTable *probe_cache;
+  gchar *uri_key, *cache_key;
+  gboolean result;
+
+  if (cache == GRL_MULTIPLE_PROBE_CACHE_NONE) {
+    return grl_media_source_test_media_from_uri (source, uri);
+  }
+
+  uri_key = probe_cache_get_uri_key (uri, cache);
+  if (!uri_key) {
+    return grl_media_source_test_media_from_uri (source, uri);
+  }
+
+  probe_cache = probe_cache_get ();
+  cache_key =
+    g_strconcat (grl_metadata_source_get_id (GRL_METADATA_SOURCE (source)),
+                 "\n", uri_key, NULL);
+  g_free (uri_key);
+
+  if (g_hash_table_lookup (probe_cache, cache_key)) {
+    g_free (cache_key);
+    return TRUE;
+  }
+
+  /* A source rejecting a URI may still accept others with the same scheme
+     or prefix, so only positive answers are cached. A wrong positive just
+     costs a failed request, after which the next candidate is tried */
+  result = grl_media_source_test_media_from_uri (source, uri);
+  if (result) {
+    g_hash_table_insert (probe_cache, cache_key, GINT_TO_POINTER (TRUE));
+  } else {
+    g_free (cache_key);
+  }
+
+  return result;
+}
+
+static void
+free_media_from_uri_parallel_data (struct MediaFromUriParallelData *mfupd)
+{
+  GRL_DEBUG ("free_media_from_uri_parallel_data");
+  if (mfupd->hedge_source_id) {
+    g_source_remove (mfupd->hedge_source_id);
+  }
+  if (mfupd->finish_source_id) {
+    g_source_remove (mfupd->finish_source_id);
+  }
+  if (mfupd->error) {
+    g_error_free (mfupd->error);
+  }
+  g_list_free (mfupd->candidates);
+  grl_plugin_registry_snapshot_unref (mfupd->snapshot);
+  g_list_free (mfupd->keys);
+  g_free (mfupd->uri);
+  g_slice_free (struct MediaFromUriParallelData, mfupd);
+}
+
+static void
+media_from_uri_parallel_cancel_probes (struct MediaFromUriParallelData *mfupd)
+{
+  GList *operation_ids = NULL;
+  GList *iter;
+
+  if (mfupd->hedge_source_id) {
+    g_source_remove (mfupd->hedge_source_id);
+    mfupd->hedge_source_id = 0;
+  }
+
+  /* Sources may finish a probe as soon as it is cancelled, removing it from
+     the list, so work on a copy of the operation ids */
+  for (iter = mfupd->probes; iter; iter = g_list_next (iter)) {
+    struct MediaFromUriProbe *probe = iter->data;
+    /* Probes still being launched are cancelled once they are started */
+    if (probe->launching) {
+      continue;
+    }
+    GRL_DEBUG ("cancelling media_from_uri probe %s:%u",
+               grl_metadata_source_get_name (GRL_METADATA_SOURCE (probe->source)),
+               probe->operation_id);
+    operation_ids = g_list_prepend (operation_ids,
+                                    GUINT_TO_POINTER (probe->operation_id));
+  }
+
+  mfupd->cancelling = TRUE;
+  for (iter = operation_ids; iter; iter = g_list_next (iter)) {
+    grl_operation_cancel (GPOINTER_TO_UINT (iter->data));
+  }
+  mfupd->cancelling = FALSE;
+
+  g_list_free (operation_ids);
+}
+
+static void
+media_from_uri_parallel_finish (struct MediaFromUriParallelData *mfupd)
+{
+  if (!mfupd->done || mfupd->cancelled) {
+    GError *_error;
+
+    if (mfupd->cancelled) {
+      _error = g_error_new (GRL_CORE_ERROR,
+                            GRL_CORE_ERROR_OPERATION_CANCELLED,
+                            "Operation was cancelled");
+    } else if (mfupd->error) {
+      _error = g_error_copy (mfupd->error);
+    } else {
+      _error = g_error_new (GRL_CORE_ERROR,
+                            GRL_CORE_ERROR_MEDIA_FROM_URI_FAILED,
+                            "Could not resolve media for URI '%s'",
+                            mfupd->uri);
+    }
+
+    mfupd->done = TRUE;
+    mfupd->user_callback (NULL, mfupd->operation_id, NULL,
+                          mfupd->user_data, _error);
+    g_error_free (_error);
+  }
+
+  grl_operation_remove (mfupd->operation_id);
+}
+
+static gboolean
+media_from_uri_parallel_finish_idle (gpointer user_data)
+{
+  struct MediaFromUriParallelData *mfupd =
+    (struct MediaFromUriParallelData *) user_data;
+
+  mfupd->finish_source_id = 0;
+  media_from_uri_parallel_finish (mfupd);
+
+  return FALSE;
+}
+
+/* Finishes the operation once no probe is running. While probes are being
+   launched it is done in an idle, as media_from_uri_parallel_launch() still
+   uses @mfupd */
+static void
+media_from_uri_parallel_check_finish (struct MediaFromUriParallelData *mfupd)
+{
+  /* Probes finished while cancelling the others are accounted for by
+     whoever is cancelling them */
+  if (mfupd->probes || mfupd->cancelling || mfupd->finish_source_id) {
+    return;
+  }
+
+  /* More candidates are coming */
+  if (mfupd->candidates && !mfupd->done) {
+    return;
+  }
+
+  if (mfupd->launching) {
+    mfupd->finish_source_id =
+      g_idle_add (media_from_uri_parallel_finish_idle, mfupd);
+  } else {
+    media_from_uri_parallel_finish (mfupd);
+  }
+}
+
+static void media_from_uri_parallel_launch (struct MediaFromUriParallelData *mfupd);
+
+static gboolean
+media_from_uri_parallel_hedge_timeout (gpointer user_data)
+{
+  struct MediaFromUriParallelData *mfupd =
+    (struct MediaFromUriParallelData *) user_data;
+
+  GRL_DEBUG ("media_from_uri_parallel_hedge_timeout");
+
+  mfupd->hedge_source_id = 0;
+  media_from_uri_parallel_launch (mfupd);
+
+  return FALSE;
+}
+
+static void
+media_from_uri_parallel_probe_cb (GrlMediaSource *source,
+                                  guint operation_id,
+                                  GrlMedia *media,
+                                  gpointer user_data,
+                                  const GError *error)
+{
+  struct MediaFromUriProbe *probe = (struct MediaFromUriProbe *) user_data;
+  struct MediaFromUriParallelData *mfupd = probe->mfupd;
+
+  GRL_DEBUG ("media_from_uri_parallel_probe_cb: %s",
+             grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)));
+
+  mfupd->probes = g_list_remove (mfupd->probes, probe);
+  /* Sources answering right away do it before the probe is launched; it is
+     freed then */
+  if (probe->launching) {
+    probe->finished = TRUE;
+  } else {
+    g_slice_free (struct MediaFromUriProbe, probe);
+  }
+
+  if (mfupd->done) {
+    /* A winner was already chosen or the operation was cancelled */
+    if (media) {
+      g_object_unref (media);
+    }
+  } else if (media && !error) {
+    /* First successful answer wins */
+    GRL_DEBUG ("media_from_uri resolved by '%s'",
+               grl_metadata_source_get_name (GRL_METADATA_SOURCE (source)));
+    mfupd->done = TRUE;
+    media_from_uri_parallel_cancel_probes (mfupd);
+    mfupd->user_callback (source, mfupd->operation_id, media,
+                          mfupd->user_data, NULL);
+  } else {
+    if (media) {
+      g_object_unref (media);
+    }
+    if (error) {
+      g_clear_error (&mfupd->error);
+      mfupd->error = g_error_copy (error);
+    }
+
+    /* Do not wait for the hedge timeout to try the next candidate; when
+       launching, the launch loop does it */
+    if (mfupd->candidates && !mfupd->probes && !mfupd->launching) {
+      media_from_uri_parallel_launch (mfupd);
+    }
+  }
+
+  media_from_uri_parallel_check_finish (mfupd);
+}
+
+static void
+media_from_uri_parallel_launch (struct MediaFromUriParallelData *mfupd)
+{
+  struct MediaFromUriProbe *probe;
+  guint operation_id;
+
+  /* Probe callbacks run from here must neither free @mfupd nor launch */
+  mfupd->launching = TRUE;
+
+  while (mfupd->candidates && !mfupd->done) {
+    probe = g_slice_new0 (struct MediaFromUriProbe);
+    probe->mfupd = mfupd;
+    probe->source = GRL_MEDIA_SOURCE (mfupd->candidates->data);
+    probe->launching = TRUE;
+    mfupd->candidates = g_list_delete_link (mfupd->candidates,
+                                            mfupd->candidates);
+    mfupd->probes = g_list_prepend (mfupd->probes, probe);
+
+    GRL_DEBUG ("Probing media_from_uri in '%s'",
+               grl_metadata_source_get_name (GRL_METADATA_SOURCE (probe->source)));
+
+    operation_id =
+      grl_media_source_get_media_from_uri (probe->source,
+                                           mfupd->uri,
+                                           mfupd->keys,
+                                           mfupd->flags,
+                                           media_from_uri_parallel_probe_cb,
+                                           probe);
+
+    if (probe->finished) {
+      g_slice_free (struct MediaFromUriProbe, probe);
+      continue;
+    }
+
+    probe->launching = FALSE;
+    probe->operation_id = operation_id;
+    if (mfupd->done) {
+      /* The operation was cancelled while launching */
+      mfupd->cancelling = TRUE;
+      grl_operation_cancel (operation_id);
+      mfupd->cancelling = FALSE;
+      break;
+    }
+
+    /* Hedged mode: give this candidate some time before the next one */
+    if (mfupd->hedge_delay > 0) {
+      if (mfupd->candidates && !mfupd->hedge_source_id) {
+        mfupd->hedge_source_id =
+          g_timeout_add (mfupd->hedge_delay,
+                         media_from_uri_parallel_hedge_timeout,
+                         mfupd);
+      }
+      break;
+    }
+  }
+
+  /* All the probes launched may have finished already */
+  media_from_uri_parallel_check_finish (mfupd);
+  mfupd->launching = FALSE;
+}
+
+static void
+media_from_uri_parallel_cancel_cb (struct MediaFromUriParallelData *mfupd)
+{
+  if (mfupd->done) {
+    return;
+  }
+
+  /* User is notified once all the running probes are finished */
+  mfupd->done = TRUE;
+  mfupd->cancelled = TRUE;
+  g_list_free (mfupd->candidates);
+  mfupd->candidates = NULL;
+  media_from_uri_parallel_cancel_probes (mfupd);
+
+  media_from_uri_parallel_check_finish (mfupd);
+}
+
+/* Like grl_multiple_search(), also reporting the failure of each source to
+   @source_error_cb, if any */
+static guint
+grl_multiple_search_full (const GList *sources,
+                          const gchar *text,
+                          const GList *keys,
+                          guint count,
+                          GrlMetadataResolutionFlags flags,
+                          MultipleSourceErrorCb source_error_cb,
+                          GrlMediaSourceResultCb callback,
+                          gpointer user_data)
+{
+  return multiple_operation_start (MULTIPLE_OP_SEARCH, sources, text, keys,
+                                   count, 0, flags, NULL, source_error_cb,
+                                   callback, user_data);
+}
+
+/* ================ API ================ */
+
+/**
+ * grl_multiple_search:
+ * @sources: (element-type Grl.MediaSource) (allow-none):
+ * a #GList of #GrlMediaSource<!-- -->s to search from (%NULL for all
+ * searchable sources)
+ * @text: the text to search for
+ * @keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID to retrieve
+ * @count: the maximum number of elements to retrieve
+ * @flags: the operation flags
+ * @callback: (scope notified): the user defined callback
+ * @user_data: the user data to pass to the user callback
+ *
+ * Search for @text in all the sources specified in @sources.
+ *
+ * If @text is @NULL then NULL-text searchs will be used for each searchable
+ * plugin (see #grl_media_source_search for more details).
+ *
+ * This method is asynchronous.
+ *
+ * Returns: the operation identifier
+ *
+ * Since: 0.1.6
+ */
+guint
+grl_multiple_search (const GList *sources,
+		     const gchar *text,
+		     const GList *keys,
+		     guint count,
+		     GrlMetadataResolutionFlags flags,
+		     GrlMediaSourceResultCb callback,
+		     gpointer user_data)
+{
+  GRL_DEBUG ("grl_multiple_search");
+
+  g_return_val_if_fail (count > 0, 0);
+  g_return_val_if_fail (callback != NULL, 0);
+
+  return grl_multiple_search_full (sources, text, keys, count, flags, NULL,
+                                   callback, user_data);
+}
+
+/**
+ * grl_multiple_search_merged:
+ * @sources: (element-type Grl.MediaSource) (allow-none):
+ * a #GList of #GrlMediaSource<!-- -->s to search from (%NULL for all
+ * searchable sources)
+ * @text: the text to search for
+ * @keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID to retrieve
+ * @identity_keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID used to identify the same item coming from several sources,
+ * like #GRL_METADATA_KEY_URL or #GRL_METADATA_KEY_EXTERNAL_URL
+ * @count: the maximum number of elements to retrieve
+ * @window: the maximum number of results held back for reordering
+ * @flags: the operation flags
+ * @score_func: (allow-none) (scope notified): function used to rank the
+ * results, or %NULL to rank them by source rank
+ * @score_data: user data passed to @score_func
+ * @callback: (scope notified): the user defined callback
+ * @user_data: the user data to pass to the user callback
+ *
+ * Like grl_multiple_search(), but results from the different sources are
+ * merged instead of relayed in arrival order.
+ *
+ * Two results are considered the same item if they share the value of any
+ * of the @identity_keys. Only the first one is relayed, and the metadata of
+ * the duplicates that arrive while it is still held back is merged into it.
+ *
+ * Up to @window results are held back and relayed highest score first, so
+ * the output is sorted by @score_func within that window. A @window of 0
+ * just removes duplicates, relaying results as soon as they arrive.
+ *
+ * Duplicates do not count towards @count: more results are requested from
+ * the sources until @count different items are relayed or the sources run
+ * out of results. The last result is always signaled with remaining 0.
+ *
+ * This method is asynchronous.
+ *
+ * Returns: the operation identifier
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_multiple_search_merged (const GList *sources,
+                            const gchar *text,
+                            const GList *keys,
+                            const GList *identity_keys,
+                            guint count,
+                            guint window,
+                            GrlMetadataResolutionFlags flags,
+                            GrlMultipleScoreFunc score_func,
+                            gpointer score_data,
+                            GrlMediaSourceResultCb callback,
+                            gpointer user_data)
+{
+  struct MultipleMergeData *mmd;
+  GList *all_keys, *iter;
+  guint operation_id;
+
+  GRL_DEBUG ("grl_multiple_search_merged");
+
+  g_return_val_if_fail (count > 0, 0);
+  g_return_val_if_fail (identity_keys != NULL, 0);
+  g_return_val_if_fail (callback != NULL, 0);
+
+  mmd = g_slice_new0 (struct MultipleMergeData);
+  mmd->identity_keys = g_list_copy ((GList *) identity_keys);
+  mmd->window = window;
+  mmd->score_func = score_func;
+  mmd->score_data = score_data;
+  mmd->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* Identity keys are needed to detect duplicates, so request them too */
+  all_keys = g_list_copy ((GList *) keys);
+  for (iter = (GList *) identity_keys; iter; iter = g_list_next (iter)) {
+    if (!g_list_find (all_keys, iter->data)) {
+      all_keys = g_list_append (all_keys, iter->data);
+    }
+  }
+
+  operation_id = multiple_operation_start (MULTIPLE_OP_SEARCH, sources, text,
+                                           all_keys, count, 0, flags, mmd,
+                                           NULL, callback, user_data);
+  g_list_free (all_keys);
+
+  if (operation_id == 0) {
+    free_multiple_merge_data (mmd);
+  }
+
+  return operation_id;
+}
+
+/**
+ * grl_multiple_score_by_rank:
+ * @source: the source which provided @media
+ * @media: a result
+ * @user_data: unused
+ *
+ * A #GrlMultipleScoreFunc which scores results with the rank of the source
+ * that provided them.
+ *
+ * Returns: the score of @media
+ *
+ * Since: 0.1.21
+ */
+gdouble
+grl_multiple_score_by_rank (GrlMediaSource *source,
+                            GrlMedia *media,
+                            gpointer user_data)
+{
+  return (gdouble) grl_media_plugin_get_rank (GRL_MEDIA_PLUGIN (source));
+}
+
+/**
+ * grl_multiple_score_by_key:
+ * @source: the source which provided @media
+ * @media: a result
+ * @user_data: the #GrlKeyID holding the relevance of @media
+ *
+ * A #GrlMultipleScoreFunc which scores results with the numeric value of the
+ * key passed as @user_data, like #GRL_METADATA_KEY_RATING. Results without
+ * that key get a score of 0.
+ *
+ * Returns: the score of @media
+ *
+ * Since: 0.1.21
+ */
+gdouble
+grl_multiple_score_by_key (GrlMediaSource *source,
+                           GrlMedia *media,
+                           gpointer user_data)
+{
+  const GValue *value;
+  GValue score = { 0, };
+  gdouble result = 0.0;
+
+  g_return_val_if_fail (user_data != NULL, 0.0);
+
+  value = grl_data_get (GRL_DATA (media), (GrlKeyID) user_data);
+  if (!value) {
+    return 0.0;
+  }
+
+  g_value_init (&score, G_TYPE_DOUBLE);
+  if (g_value_transform (value, &score)) {
+    result = g_value_get_double (&score);
+  }
+  g_value_unset (&score);
+
+  return result;
+}
+
+/**
+ * grl_multiple_browse:
+ * @sources: (element-type Grl.MediaSource) (allow-none):
+ * a #GList of #GrlMediaSource<!-- -->s to browse (%NULL for all
+ * browsable sources)
+ * @keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID to retrieve
+ * @count: the maximum number of elements to retrieve
+ * @max_concurrent: the maximum number of sources browsed at the same time,
+ * or 0 for no limit
+ * @flags: the operation flags
+ * @callback: (scope notified): the user defined callback
+ * @user_data: the user data to pass to the user callback
+ *
+ * Browse the root container of all the sources specified in @sources.
+ *
+ * Like in grl_multiple_search(), the @count elements are split among the
+ * sources, and those providing all the requested elements are asked for
+ * more if others fall short.
+ *
+ * If @max_concurrent is not 0, the rest of sources are queued and browsed
+ * as soon as the running ones finish.
+ *
+ * This method is asynchronous.
+ *
+ * Returns: the operation identifier
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_multiple_browse (const GList *sources,
+                     const GList *keys,
+                     guint count,
+                     guint max_concurrent,
+                     GrlMetadataResolutionFlags flags,
+                     GrlMediaSourceResultCb callback,
+                     gpointer user_data)
+{
+  GRL_DEBUG ("grl_multiple_browse");
+
+  g_return_val_if_fail (count > 0, 0);
+  g_return_val_if_fail (callback != NULL, 0);
+
+  return multiple_operation_start (MULTIPLE_OP_BROWSE, sources, NULL, keys,
+                                   count, max_concurrent, flags, NULL,
+                                   NULL, callback, user_data);
+}
+
+/**
+ * grl_multiple_query:
+ * @sources: (element-type Grl.MediaSource) (allow-none):
+ * a #GList of #GrlMediaSource<!-- -->s to query (%NULL for all
+ * queryable sources)
+ * @query: the query to process
+ * @keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID to retrieve
+ * @count: the maximum number of elements to retrieve
+ * @max_concurrent: the maximum number of sources queried at the same time,
+ * or 0 for no limit
+ * @flags: the operation flags
+ * @callback: (scope notified): the user defined callback
+ * @user_data: the user data to pass to the user callback
+ *
+ * Execute @query in all the sources specified in @sources.
+ *
+ * Notice that queries are source specific, so all the sources in @sources
+ * are expected to understand @query.
+ *
+ * If @max_concurrent is not 0, the rest of sources are queued and queried
+ * as soon as the running ones finish.
+ *
+ * This method is asynchronous.
+ *
+ * Returns: the operation identifier
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_multiple_query (const GList *sources,
+                    const gchar *query,
+                    const GList *keys,
+                    guint count,
+                    guint max_concurrent,
+                    GrlMetadataResolutionFlags flags,
+                    GrlMediaSourceResultCb callback,
+                    gpointer user_data)
+{
+  GRL_DEBUG ("grl_multiple_query");
+
+  g_return_val_if_fail (query != NULL, 0);
+  g_return_val_if_fail (count > 0, 0);
+  g_return_val_if_fail (callback != NULL, 0);
+
+  return multiple_operation_start (MULTIPLE_OP_QUERY, sources, query, keys,
+                                   count, max_concurrent, flags, NULL,
+                                   NULL, callback, user_data);
+}
+
+/**
+ * grl_multiple_metadata:
+ * @sources: (element-type Grl.MediaSource) (allow-none):
+ * a #GList of #GrlMediaSource<!-- -->s (%NULL for all sources supporting
+ * metadata)
+ * @keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID to retrieve
+ * @max_concurrent: the maximum number of sources asked at the same time,
+ * or 0 for no limit
+ * @flags: the operation flags
+ * @callback: (scope notified): the user defined callback
+ * @user_data: the user data to pass to the user callback
+ *
+ * Get the metadata of the root container of all the sources specified in
+ * @sources. @callback is invoked once per source, with @remaining telling
+ * how many sources are still to answer.
+ *
+ * If @max_concurrent is not 0, the rest of sources are queued and asked as
+ * soon as the running ones finish.
+ *
+ * This method is asynchronous.
+ *
+ * Returns: the operation identifier
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_multiple_metadata (const GList *sources,
+                       const GList *keys,
+                       guint max_concurrent,
+                       GrlMetadataResolutionFlags flags,
+                       GrlMediaSourceResultCb callback,
+                       gpointer user_data)
+{
+  GRL_DEBUG ("grl_multiple_metadata");
+
+  g_return_val_if_fail (keys != NULL, 0);
+  g_return_val_if_fail (callback != NULL, 0);
+
+  return multiple_operation_start (MULTIPLE_OP_METADATA, sources, NULL, keys,
+                                   0, max_concurrent, flags, NULL,
+                                   NULL, callback, user_data);
+}
+
+static void
+multiple_operation_cancel_cb (struct MultipleOperationData *mod)
+{
+  GList *sources, *ids;
+  struct CallbackData *callback_data;
+
+  /* Go through all the sources involved in that operation and issue
+     cancel() operations for each one */
+  sources = mod->sources;
+  ids = mod->operation_ids;
+  while (sources) {
+    GRL_DEBUG ("cancelling operation %s:%u",
+               grl_metadata_source_get_name (GRL_METADATA_SOURCE (sources->data)),
+               GPOINTER_TO_UINT (ids->data));
+    grl_operation_cancel (GPOINTER_TO_INT (ids->data));
+    sources = g_list_next (sources);
+    ids = g_list_next (ids);
+  }
+
+  /* Sources still waiting for their turn will never report back */
+  mod->sources_count -= g_queue_get_length (mod->queued);
+  g_queue_clear (mod->queued);
+
+  mod->cancelled = TRUE;
+
+  /* Send operation finished message now to client (remaining == 0) */
+  callback_data = g_new0 (struct CallbackData, 1);
+  callback_data->operation_id = mod->operation_id;
+  callback_data->user_callback = mod->user_callback;
+  callback_data->user_data = mod->user_data;
+  g_idle_add (confirm_cancel_idle, callback_data);
+}
+
+/**
+ * grl_multiple_cancel:
+ * @search_id: the identifier of the multiple operation to cancel
  *
  * Cancel a running multiple search by issuing a cancel operation on each
  * source involved involved in the operation.
@@ -658,6 +1903,97 @@ grl_multiple_search_sync (const GList *sources,
   return result;
 }
 
+/**
+ * grl_multiple_search_sync_full:
+ * @sources: (element-type Grl.MediaSource) (allow-none):
+ * a #GList of #GrlMediaSource<!-- -->s where to search from (%NULL for all
+ * available sources with search capability)
+ * @text: the text to search for
+ * @keys: (element-type GObject.ParamSpec): the #GList of
+ * #GrlKeyID to retrieve
+ * @count: the maximum number of elements to retrieve
+ * @flags: the operation flags
+ * @filter: (allow-none) (scope call): a function to decide which results are
+ * kept, or %NULL to keep all of them
+ * @filter_data: user data passed to @filter
+ * @limit: stop searching once this number of results have been kept, or 0 to
+ * get all the results
+ * @source_errors: (out) (allow-none) (element-type Grl.MediaSource GLib.Error):
+ * a location for a #GHashTable with the error reported by each failing source,
+ * or %NULL
+ * @error: a #GError, or @NULL
+ *
+ * Search for @text in all the sources specified in @sources, like
+ * grl_multiple_search_sync(), but tolerating failures: results from the
+ * sources that succeeded are returned even if other sources failed.
+ *
+ * Every result is passed to @filter, and only those for which it returns
+ * %TRUE are kept. As soon as @limit results have been kept, the searches
+ * still running are cancelled and the results obtained so far returned.
+ *
+ * If @source_errors is not %NULL, it is set to a #GHashTable mapping each
+ * failing #GrlMediaSource to its #GError. Use g_hash_table_unref() to free it.
+ *
+ * This method is synchronous.
+ *
+ * Returns: (element-type Grl.Media) (transfer full): a list with #GrlMedia elements
+ *
+ * Since: 0.1.21
+ */
+GList *
+grl_multiple_search_sync_full (const GList *sources,
+                               const gchar *text,
+                               const GList *keys,
+                               guint count,
+                               GrlMetadataResolutionFlags flags,
+                               GrlMultipleFilterFunc filter,
+                               gpointer filter_data,
+                               guint limit,
+                               GHashTable **source_errors,
+                               GError **error)
+{
+  struct MultipleSyncData *msd;
+  GList *result;
+
+  msd = g_slice_new0 (struct MultipleSyncData);
+  msd->filter = filter;
+  msd->filter_data = filter_data;
+  msd->limit = limit;
+  if (source_errors) {
+    msd->source_errors =
+      g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                             NULL, (GDestroyNotify) g_error_free);
+  }
+
+  grl_multiple_search_full (sources,
+                            text,
+                            keys,
+                            count,
+                            flags,
+                            multiple_sync_source_error_cb,
+                            multiple_sync_result_cb,
+                            msd);
+
+  grl_wait_for_async_operation_complete (&msd->ds);
+
+  if (msd->ds.error) {
+    if (error) {
+      *error = msd->ds.error;
+    } else {
+      g_error_free (msd->ds.error);
+    }
+  }
+
+  if (source_errors) {
+    *source_errors = msd->source_errors;
+  }
+
+  result = (GList *) msd->ds.data;
+  g_slice_free (struct MultipleSyncData, msd);
+
+  return result;
+}
+
 /**
  * grl_multiple_get_media_from_uri:
  * @uri: A URI that can be used to identify a media resource
@@ -726,3 +2062,105 @@ grl_multiple_get_media_from_uri (const gchar *uri,
     callback (NULL, 0, NULL, user_data, NULL);
   }
 }
+
+/**
+ * grl_multiple_get_media_from_uri_parallel:
+ * @uri: A URI that can be used to identify a media resource
+ * @keys: (element-type GrlKeyID): List of metadata keys we want to obtain.
+ * @max_sources: the maximum number of sources to try, or 0 for all
+ * @hedge_delay: milliseconds to wait before trying the next source, or 0 to
+ * try all of them at once
+ * @cache: how the answers of grl_media_source_test_media_from_uri() are cached
+ * @flags: the operation flags
+ * @callback: (scope notified): the user defined callback
+ * @user_data: the user data to pass to the user callback
+ *
+ * Like grl_multiple_get_media_from_uri(), but instead of committing to the
+ * first source that claims it can handle @uri, up to @max_sources of them
+ * (in rank order) are tried.
+ *
+ * If @hedge_delay is 0, all those sources are asked at the same time.
+ * Otherwise, the next one is only asked if the previous ones did not answer
+ * within @hedge_delay milliseconds, or as soon as they all failed.
+ *
+ * The first successful answer is relayed to @callback, whose @source
+ * parameter tells which source won, and the rest of requests are cancelled.
+ * If all of them fail, the last error is relayed.
+ *
+ * Testing whether a source can handle @uri is synchronous. With @cache other
+ * than %GRL_MULTIPLE_PROBE_CACHE_NONE, a source which can handle @uri is
+ * assumed to handle any URI sharing the same scheme or prefix, until sources
+ * are added or removed. Negative answers are never cached: if the guess is
+ * wrong, that source just fails and the next candidate is tried.
+ *
+ * This method is asynchronous.
+ *
+ * Returns: the operation identifier, or 0 if no source can handle @uri
+ *
+ * Since: 0.1.21
+ */
+guint
+grl_multiple_get_media_from_uri_parallel (const gchar *uri,
+                                          const GList *keys,
+                                          guint max_sources,
+                                          guint hedge_delay,
+                                          GrlMultipleProbeCache cache,
+                                          GrlMetadataResolutionFlags flags,
+                                          GrlMediaSourceMetadataCb callback,
+                                          gpointer user_data)
+{
+  GrlPluginRegistrySnapshot *snapshot;
+  const GList *sources, *iter;
+  GList *candidates = NULL;
+  guint n_candidates = 0;
+  struct MediaFromUriParallelData *mfupd;
+
+  g_return_val_if_fail (uri != NULL, 0);
+  g_return_val_if_fail (keys != NULL, 0);
+  g_return_val_if_fail (callback != NULL, 0);
+
+  snapshot =
+    grl_plugin_registry_get_snapshot (grl_plugin_registry_get_default ());
+  sources =
+    grl_plugin_registry_snapshot_get_sources_by_operations (snapshot,
+                                                            GRL_OP_MEDIA_FROM_URI);
+
+  /* Collect the best ranked sources that know how to deal with 'uri' */
+  for (iter = sources;
+       iter && (max_sources == 0 || n_candidates < max_sources);
+       iter = g_list_next (iter)) {
+    GrlMediaSource *source = GRL_MEDIA_SOURCE (iter->data);
+    if (probe_test_media_from_uri (source, uri, cache)) {
+      candidates = g_list_prepend (candidates, source);
+      n_candidates++;
+    }
+  }
+
+  /* No source knows how to deal with 'uri', invoke user callback
+     with NULL GrlMedia */
+  if (!candidates) {
+    grl_plugin_registry_snapshot_unref (snapshot);
+    callback (NULL, 0, NULL, user_data, NULL);
+    return 0;
+  }
+
+  mfupd = g_slice_new0 (struct MediaFromUriParallelData);
+  mfupd->snapshot = snapshot;
+  mfupd->operation_id = grl_operation_generate_id ();
+  mfupd->uri = g_strdup (uri);
+  mfupd->keys = g_list_copy ((GList *) keys);
+  mfupd->flags = flags;
+  mfupd->candidates = g_list_reverse (candidates);
+  mfupd->hedge_delay = hedge_delay;
+  mfupd->user_callback = callback;
+  mfupd->user_data = user_data;
+
+  grl_operation_set_private_data (mfupd->operation_id,
+                                  mfupd,
+                                  (GrlOperationCancelCb) media_from_uri_parallel_cancel_cb,
+                                  (GDestroyNotify) free_media_from_uri_parallel_data);
+
+  media_from_uri_parallel_launch (mfupd);
+
+  return mfupd->operation_id;
+}
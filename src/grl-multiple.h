@@ -31,6 +31,52 @@
 
 #include "grl-media-source.h"
 
+/**
+ * GrlMultipleProbeCache:
+ * @GRL_MULTIPLE_PROBE_CACHE_NONE: do not cache probe results
+ * @GRL_MULTIPLE_PROBE_CACHE_SCHEME: cache positive probe results by URI
+ * scheme
+ * @GRL_MULTIPLE_PROBE_CACHE_PREFIX: cache positive probe results by URI
+ * scheme and authority (e.g. "http://www.example.com")
+ *
+ * How grl_multiple_get_media_from_uri_parallel() caches the answers of
+ * grl_media_source_test_media_from_uri().
+ */
+typedef enum {
+  GRL_MULTIPLE_PROBE_CACHE_NONE,
+  GRL_MULTIPLE_PROBE_CACHE_SCHEME,
+  GRL_MULTIPLE_PROBE_CACHE_PREFIX
+} GrlMultipleProbeCache;
+
+/**
+ * GrlMultipleScoreFunc:
+ * @source: the source which provided @media
+ * @media: a result
+ * @user_data: user data passed to grl_multiple_search_merged()
+ *
+ * Prototype for the functions used to rank merged results. Results with a
+ * higher score are relayed first.
+ *
+ * Returns: the score of @media
+ */
+typedef gdouble (*GrlMultipleScoreFunc) (GrlMediaSource *source,
+                                         GrlMedia *media,
+                                         gpointer user_data);
+
+/**
+ * GrlMultipleFilterFunc:
+ * @source: the source which provided @media
+ * @media: a result
+ * @user_data: user data passed to grl_multiple_search_sync_full()
+ *
+ * Prototype for the functions used to select which results are kept.
+ *
+ * Returns: %TRUE if @media must be kept
+ */
+typedef gboolean (*GrlMultipleFilterFunc) (GrlMediaSource *source,
+                                           GrlMedia *media,
+                                           gpointer user_data);
+
 guint grl_multiple_search (const GList *sources,
 			   const gchar *text,
 			   const GList *keys,
@@ -39,6 +85,50 @@ guint grl_multiple_search (const GList *sources,
 			   GrlMediaSourceResultCb callback,
 			   gpointer user_data);
 
+guint grl_multiple_search_merged (const GList *sources,
+                                  const gchar *text,
+                                  const GList *keys,
+                                  const GList *identity_keys,
+                                  guint count,
+                                  guint window,
+                                  GrlMetadataResolutionFlags flags,
+                                  GrlMultipleScoreFunc score_func,
+                                  gpointer score_data,
+                                  GrlMediaSourceResultCb callback,
+                                  gpointer user_data);
+
+gdouble grl_multiple_score_by_rank (GrlMediaSource *source,
+                                    GrlMedia *media,
+                                    gpointer user_data);
+
+gdouble grl_multiple_score_by_key (GrlMediaSource *source,
+                                   GrlMedia *media,
+                                   gpointer user_data);
+
+guint grl_multiple_browse (const GList *sources,
+                           const GList *keys,
+                           guint count,
+                           guint max_concurrent,
+                           GrlMetadataResolutionFlags flags,
+                           GrlMediaSourceResultCb callback,
+                           gpointer user_data);
+
+guint grl_multiple_query (const GList *sources,
+                          const gchar *query,
+                          const GList *keys,
+                          guint count,
+                          guint max_concurrent,
+                          GrlMetadataResolutionFlags flags,
+                          GrlMediaSourceResultCb callback,
+                          gpointer user_data);
+
+guint grl_multiple_metadata (const GList *sources,
+                             const GList *keys,
+                             guint max_concurrent,
+                             GrlMetadataResolutionFlags flags,
+                             GrlMediaSourceResultCb callback,
+                             gpointer user_data);
+
 GList *grl_multiple_search_sync (const GList *sources,
                                  const gchar *text,
                                  const GList *keys,
@@ -46,6 +136,17 @@ GList *grl_multiple_search_sync (const GList *sources,
                                  GrlMetadataResolutionFlags flags,
                                  GError **error);
 
+GList *grl_multiple_search_sync_full (const GList *sources,
+                                      const gchar *text,
+                                      const GList *keys,
+                                      guint count,
+                                      GrlMetadataResolutionFlags flags,
+                                      GrlMultipleFilterFunc filter,
+                                      gpointer filter_data,
+                                      guint limit,
+                                      GHashTable **source_errors,
+                                      GError **error);
+
 G_GNUC_DEPRECATED void grl_multiple_cancel (guint search_id);
 
 void grl_multiple_get_media_from_uri (const gchar *uri,
@@ -54,4 +155,13 @@ void grl_multiple_get_media_from_uri (const gchar *uri,
 				      GrlMediaSourceMetadataCb callback,
 				      gpointer user_data);
 
+guint grl_multiple_get_media_from_uri_parallel (const gchar *uri,
+                                                const GList *keys,
+                                                guint max_sources,
+                                                guint hedge_delay,
+                                                GrlMultipleProbeCache cache,
+                                                GrlMetadataResolutionFlags flags,
+                                                GrlMediaSourceMetadataCb callback,
+                                                gpointer user_data);
+
 #endif
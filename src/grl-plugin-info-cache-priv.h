@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Contact: Iago Toral Quiroga <itoral@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef _GRL_PLUGIN_INFO_CACHE_PRIV_H_
+#define _GRL_PLUGIN_INFO_CACHE_PRIV_H_
+
+#include <grl-plugin-registry.h>
+
+#define GRL_PLUGIN_INFO_SUFFIX "xml"
+
+typedef struct _GrlPluginInfoCache GrlPluginInfoCache;
+
+GHashTable *
+grl_plugin_info_cache_read (const gchar *path,
+                            GrlPluginInfoCache **cache);
+
+void
+grl_plugin_info_cache_add (GrlPluginInfoCache *cache,
+                           const GrlPluginInfo *info);
+
+void
+grl_plugin_info_cache_write (GrlPluginInfoCache *cache);
+
+void
+grl_plugin_info_free (GrlPluginInfo *info);
+
+#endif /* _GRL_PLUGIN_INFO_CACHE_PRIV_H_ */
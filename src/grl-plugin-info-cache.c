@@ -0,0 +1,545 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Contact: Iago Toral Quiroga <itoral@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * Binary cache of the plugin information files of a directory, so they do
+ * not have to be parsed on each start. It is mapped in memory and laid out
+ * as:
+ *
+ *   header
+ *   files:   one struct cache_file per information file in the directory
+ *   entries: one struct cache_entry per valid information file
+ *   pairs:   the optional information of all the entries
+ *   strings: NUL-terminated
+ *
+ * Offsets are relative to the start of the file, which is written in the
+ * host byte order. The cache is valid as long as the modification time of
+ * the directory and the names and sizes of its information files do not
+ * change. It does not need to hold all of them: the ones skipped when it was
+ * written, for instance because of GRL_PLUGIN_LIST, are added when they are
+ * parsed later.
+ */
+
+#include "grl-plugin-info-cache-priv.h"
+#include "grl-log.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#define GRL_LOG_DOMAIN_DEFAULT  plugin_registry_log_domain
+GRL_LOG_DOMAIN_EXTERN(plugin_registry_log_domain);
+
+#define CACHE_MAGIC "GRLPINF1"
+#define CACHE_BYTE_ORDER 0x01020304
+
+struct cache_header {
+  gchar magic[8];
+  guint32 byte_order;
+  guint32 size;
+  gint64 dir_mtime;
+  guint32 n_files;
+  guint32 files;
+  guint32 n_entries;
+  guint32 entries;
+};
+
+struct cache_file {
+  guint64 size;
+  guint32 name;
+  guint32 padding;
+};
+
+struct cache_entry {
+  guint32 id;
+  guint32 filename;
+  guint32 n_pairs;
+  guint32 pairs;
+};
+
+struct cache_pair {
+  guint32 key;
+  guint32 value;
+};
+
+/* Information files of a directory, sorted by name */
+struct listing {
+  gint64 mtime;
+  GPtrArray *names;
+  GArray *sizes;
+};
+
+/* Cache to write once the information files have been parsed */
+struct _GrlPluginInfoCache {
+  gchar *cache_path;
+  struct listing *listing;
+  GHashTable *infos;            /* identifier -> owned #GrlPluginInfo */
+  gboolean changed;             /* whether it has to be written */
+};
+
+static GrlPluginInfo *
+copy_plugin_info (const GrlPluginInfo *info)
+{
+  GrlPluginInfo *copy;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  copy = g_new0 (GrlPluginInfo, 1);
+  copy->id = g_strdup (info->id);
+  copy->filename = g_strdup (info->filename);
+  copy->optional_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
+  if (info->optional_info) {
+    g_hash_table_iter_init (&iter, info->optional_info);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+      g_hash_table_insert (copy->optional_info, g_strdup (key), g_strdup (value));
+    }
+  }
+
+  return copy;
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static void
+free_listing (struct listing *listing)
+{
+  g_ptr_array_free (listing->names, TRUE);
+  g_array_free (listing->sizes, TRUE);
+  g_slice_free (struct listing, listing);
+}
+
+static struct listing *
+list_directory (const gchar *path)
+{
+  struct listing *listing;
+  struct stat st;
+  const gchar *entry;
+  gchar *file;
+  guint64 size;
+  GDir *dir;
+  guint i;
+
+  if (g_stat (path, &st) != 0) {
+    return NULL;
+  }
+
+  dir = g_dir_open (path, 0, NULL);
+  if (!dir) {
+    return NULL;
+  }
+
+  listing = g_slice_new (struct listing);
+  listing->mtime = st.st_mtime;
+  listing->names = g_ptr_array_new_with_free_func (g_free);
+  listing->sizes = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+  while ((entry = g_dir_read_name (dir)) != NULL) {
+    if (g_strrstr (entry, "." GRL_PLUGIN_INFO_SUFFIX)) {
+      g_ptr_array_add (listing->names, g_strdup (entry));
+    }
+  }
+  g_dir_close (dir);
+
+  g_ptr_array_sort (listing->names, compare_names);
+
+  for (i = 0; i < listing->names->len; i++) {
+    file = g_build_filename (path, g_ptr_array_index (listing->names, i), NULL);
+    size = g_stat (file, &st) == 0? st.st_size: 0;
+    g_array_append_val (listing->sizes, size);
+    g_free (file);
+  }
+
+  return listing;
+}
+
+static gchar *
+get_cache_path (const gchar *path)
+{
+  gchar *checksum;
+  gchar *cache_path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, path, -1);
+  cache_path = g_build_filename (g_get_user_cache_dir (),
+                                 "grilo",
+                                 "plugin-info",
+                                 checksum,
+                                 NULL);
+  g_free (checksum);
+
+  return cache_path;
+}
+
+/* Returns the string at @offset, or NULL if it is out of bounds */
+static const gchar *
+get_string (const gchar *data,
+            gsize size,
+            guint32 offset)
+{
+  if (offset >= size || !memchr (data + offset, '\0', size - offset)) {
+    return NULL;
+  }
+
+  return data + offset;
+}
+
+static gboolean
+check_table (const struct cache_header *header,
+             guint32 offset,
+             guint32 n,
+             gsize element_size)
+{
+  return offset % sizeof (guint32) == 0 &&
+    offset + (guint64) n * element_size <= header->size;
+}
+
+static GHashTable *
+read_cache (const gchar *cache_path,
+            struct listing *listing)
+{
+  GMappedFile *mapped;
+  GHashTable *infos = NULL;
+  GrlPluginInfo *info;
+  const struct cache_header *header;
+  const struct cache_file *files;
+  const struct cache_entry *entries;
+  const struct cache_pair *pairs;
+  const gchar *data;
+  const gchar *id;
+  const gchar *filename;
+  const gchar *key;
+  const gchar *value;
+  gsize size;
+  guint i, j;
+
+  mapped = g_mapped_file_new (cache_path, FALSE, NULL);
+  if (!mapped) {
+    return NULL;
+  }
+
+  data = g_mapped_file_get_contents (mapped);
+  size = g_mapped_file_get_length (mapped);
+  header = (const struct cache_header *) data;
+
+  if (size < sizeof (struct cache_header) ||
+      memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->byte_order != CACHE_BYTE_ORDER ||
+      header->size != size ||
+      header->dir_mtime != listing->mtime ||
+      header->n_files != listing->names->len ||
+      header->files % sizeof (guint64) != 0 ||
+      !check_table (header, header->files, header->n_files,
+                    sizeof (struct cache_file)) ||
+      !check_table (header, header->entries, header->n_entries,
+                    sizeof (struct cache_entry))) {
+    goto out;
+  }
+
+  /* Same information files, of the same size */
+  files = (const struct cache_file *) (data + header->files);
+  for (i = 0; i < header->n_files; i++) {
+    filename = get_string (data, size, files[i].name);
+    if (!filename ||
+        strcmp (filename, g_ptr_array_index (listing->names, i)) != 0 ||
+        files[i].size != g_array_index (listing->sizes, guint64, i)) {
+      goto out;
+    }
+  }
+
+  infos = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                 NULL, (GDestroyNotify) grl_plugin_info_free);
+
+  entries = (const struct cache_entry *) (data + header->entries);
+  for (i = 0; i < header->n_entries; i++) {
+    id = get_string (data, size, entries[i].id);
+    filename = get_string (data, size, entries[i].filename);
+    if (!id || !filename ||
+        !check_table (header, entries[i].pairs, entries[i].n_pairs,
+                      sizeof (struct cache_pair))) {
+      goto corrupted;
+    }
+
+    info = g_new0 (GrlPluginInfo, 1);
+    info->id = g_strdup (id);
+    info->filename = g_strdup (filename);
+    info->optional_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, g_free);
+    g_hash_table_insert (infos, info->id, info);
+
+    pairs = (const struct cache_pair *) (data + entries[i].pairs);
+    for (j = 0; j < entries[i].n_pairs; j++) {
+      key = get_string (data, size, pairs[j].key);
+      value = get_string (data, size, pairs[j].value);
+      if (!key || !value) {
+        goto corrupted;
+      }
+      g_hash_table_insert (info->optional_info, g_strdup (key), g_strdup (value));
+    }
+  }
+
+  goto out;
+
+ corrupted:
+  GRL_WARNING ("Plugin information cache '%s' is corrupted", cache_path);
+  g_hash_table_unref (infos);
+  infos = NULL;
+
+ out:
+  g_mapped_file_unref (mapped);
+  return infos;
+}
+
+static guint32
+add_string (GString *strings,
+            const gchar *str)
+{
+  guint32 offset = strings->len;
+
+  g_string_append_len (strings, str, strlen (str) + 1);
+
+  return offset;
+}
+
+static void
+write_cache (const gchar *cache_path,
+             struct listing *listing,
+             GHashTable *infos)
+{
+  struct cache_header header;
+  struct cache_file file;
+  struct cache_entry entry;
+  struct cache_pair pair;
+  GArray *files;
+  GArray *entries;
+  GArray *pairs;
+  GString *strings;
+  GByteArray *data;
+  GHashTableIter iter;
+  GHashTableIter info_iter;
+  GrlPluginInfo *info;
+  gpointer key;
+  gpointer value;
+  guint32 strings_offset;
+  guint32 pairs_offset;
+  GError *error = NULL;
+  gchar *dir;
+  guint i;
+
+  /* String offsets are relative to the strings block until the layout is
+     known */
+  strings = g_string_new (NULL);
+
+  files = g_array_new (FALSE, TRUE, sizeof (struct cache_file));
+  for (i = 0; i < listing->names->len; i++) {
+    memset (&file, 0, sizeof (file));
+    file.size = g_array_index (listing->sizes, guint64, i);
+    file.name = add_string (strings, g_ptr_array_index (listing->names, i));
+    g_array_append_val (files, file);
+  }
+
+  entries = g_array_new (FALSE, TRUE, sizeof (struct cache_entry));
+  pairs = g_array_new (FALSE, TRUE, sizeof (struct cache_pair));
+  g_hash_table_iter_init (&iter, infos);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info)) {
+    entry.id = add_string (strings, info->id);
+    entry.filename = add_string (strings, info->filename);
+    entry.n_pairs = 0;
+    entry.pairs = pairs->len;
+
+    g_hash_table_iter_init (&info_iter, info->optional_info);
+    while (g_hash_table_iter_next (&info_iter, &key, &value)) {
+      pair.key = add_string (strings, key);
+      pair.value = add_string (strings, value);
+      g_array_append_val (pairs, pair);
+      entry.n_pairs++;
+    }
+
+    g_array_append_val (entries, entry);
+  }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CACHE_MAGIC, sizeof (header.magic));
+  header.byte_order = CACHE_BYTE_ORDER;
+  header.dir_mtime = listing->mtime;
+  header.n_files = files->len;
+  header.files = sizeof (struct cache_header);
+  header.n_entries = entries->len;
+  header.entries = header.files + files->len * sizeof (struct cache_file);
+  pairs_offset = header.entries + entries->len * sizeof (struct cache_entry);
+  strings_offset = pairs_offset + pairs->len * sizeof (struct cache_pair);
+  header.size = strings_offset + strings->len;
+
+  for (i = 0; i < files->len; i++) {
+    g_array_index (files, struct cache_file, i).name += strings_offset;
+  }
+  for (i = 0; i < entries->len; i++) {
+    g_array_index (entries, struct cache_entry, i).id += strings_offset;
+    g_array_index (entries, struct cache_entry, i).filename += strings_offset;
+    g_array_index (entries, struct cache_entry, i).pairs =
+      pairs_offset +
+      g_array_index (entries, struct cache_entry, i).pairs * sizeof (struct cache_pair);
+  }
+  for (i = 0; i < pairs->len; i++) {
+    g_array_index (pairs, struct cache_pair, i).key += strings_offset;
+    g_array_index (pairs, struct cache_pair, i).value += strings_offset;
+  }
+
+  data = g_byte_array_sized_new (header.size);
+  g_byte_array_append (data, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (data, (const guint8 *) files->data,
+                       files->len * sizeof (struct cache_file));
+  g_byte_array_append (data, (const guint8 *) entries->data,
+                       entries->len * sizeof (struct cache_entry));
+  g_byte_array_append (data, (const guint8 *) pairs->data,
+                       pairs->len * sizeof (struct cache_pair));
+  g_byte_array_append (data, (const guint8 *) strings->str, strings->len);
+
+  dir = g_path_get_dirname (cache_path);
+  g_mkdir_with_parents (dir, 0700);
+  if (!g_file_set_contents (cache_path, (const gchar *) data->data, data->len,
+                            &error)) {
+    GRL_DEBUG ("Could not write plugin information cache '%s': %s",
+               cache_path, error->message);
+    g_error_free (error);
+  }
+  g_free (dir);
+
+  g_byte_array_free (data, TRUE);
+  g_string_free (strings, TRUE);
+  g_array_free (pairs, TRUE);
+  g_array_free (entries, TRUE);
+  g_array_free (files, TRUE);
+}
+
+/*
+ * grl_plugin_info_cache_read:
+ * @path: a plugin directory
+ * @cache: (out): location for the cache to write, or NULL
+ *
+ * Gets the information of the plugins in @path from the cache, if it is
+ * still valid, and sets @cache unless @path can not be read.
+ *
+ * The caller parses the information files not found in the cache, maybe in
+ * worker threads. It adds what it parsed with grl_plugin_info_cache_add(),
+ * and calls grl_plugin_info_cache_write(). Files not added are parsed again
+ * the next time.
+ *
+ * Returns: a table of identifier -> #GrlPluginInfo, owning the information,
+ * or NULL if the cache is not valid; steal the entries to keep them.
+ */
+GHashTable *
+grl_plugin_info_cache_read (const gchar *path,
+                            GrlPluginInfoCache **cache)
+{
+  struct listing *listing;
+  GHashTableIter iter;
+  GrlPluginInfo *info;
+  GHashTable *infos;
+  gchar *cache_path;
+
+  *cache = NULL;
+
+  listing = list_directory (path);
+  if (!listing) {
+    return NULL;
+  }
+
+  cache_path = get_cache_path (path);
+  infos = read_cache (cache_path, listing);
+
+  *cache = g_slice_new (GrlPluginInfoCache);
+  (*cache)->cache_path = cache_path;
+  (*cache)->listing = listing;
+  (*cache)->infos = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                           (GDestroyNotify) grl_plugin_info_free);
+  (*cache)->changed = !infos;
+
+  if (infos) {
+    GRL_DEBUG ("Using cached information of plugins in '%s'", path);
+    /* Kept in case more are added */
+    g_hash_table_iter_init (&iter, infos);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info)) {
+      info = copy_plugin_info (info);
+      g_hash_table_insert ((*cache)->infos, info->id, info);
+    }
+  }
+
+  return infos;
+}
+
+/*
+ * grl_plugin_info_cache_add:
+ * @cache: a cache returned by grl_plugin_info_cache_read()
+ * @info: the information parsed from a file of its directory
+ *
+ * Adds a copy of @info to @cache, if it does not have it yet.
+ */
+void
+grl_plugin_info_cache_add (GrlPluginInfoCache *cache,
+                           const GrlPluginInfo *info)
+{
+  GrlPluginInfo *copy;
+
+  if (g_hash_table_lookup (cache->infos, info->id)) {
+    return;
+  }
+
+  copy = copy_plugin_info (info);
+  g_hash_table_insert (cache->infos, copy->id, copy);
+  cache->changed = TRUE;
+}
+
+/*
+ * grl_plugin_info_cache_write:
+ * @cache: a cache returned by grl_plugin_info_cache_read()
+ *
+ * Writes @cache for the next time, as it was listed when it was read, if
+ * it was not valid or information was added. Then frees it.
+ */
+void
+grl_plugin_info_cache_write (GrlPluginInfoCache *cache)
+{
+  if (cache->changed) {
+    write_cache (cache->cache_path, cache->listing, cache->infos);
+  }
+
+  g_hash_table_unref (cache->infos);
+  free_listing (cache->listing);
+  g_free (cache->cache_path);
+  g_slice_free (GrlPluginInfoCache, cache);
+}
+
+void
+grl_plugin_info_free (GrlPluginInfo *info)
+{
+  g_free (info->id);
+  g_free (info->filename);
+  if (info->optional_info) {
+    g_hash_table_unref (info->optional_info);
+  }
+  g_free (info);
+}
@@ -40,9 +40,11 @@
 
 #include "grl-plugin-registry.h"
 #include "grl-plugin-registry-priv.h"
+#include "grl-plugin-info-cache-priv.h"
 #include "grl-media-plugin-priv.h"
 #include "grl-log.h"
 #include "grl-error.h"
+#include "grl-marshal.h"
 
 #include <string.h>
 #include <gmodule.h>
@@ -53,10 +55,14 @@ GRL_LOG_DOMAIN(plugin_registry_log_domain);
 
 #define XML_ROOT_ELEMENT_NAME "plugin"
 
-#define GRL_PLUGIN_INFO_SUFFIX "xml"
-
 #define GRL_PLUGIN_INFO_MODULE "module"
 
+#define GRL_PLUGIN_INFO_PREWARM_HOSTS "prewarm-hosts"
+
+#define GRL_PLUGIN_INFO_SOURCES "sources"
+
+#define GRL_PLUGIN_INFO_OPERATIONS "operations"
+
 #define GRL_PLUGIN_REGISTRY_GET_PRIVATE(object)                 \
   (G_TYPE_INSTANCE_GET_PRIVATE((object),                        \
                                GRL_TYPE_PLUGIN_REGISTRY,        \
@@ -73,10 +79,30 @@ struct _GrlPluginRegistryPrivate {
   GSList *plugins_dir;
   GSList *allowed_plugins;
   gboolean all_plugin_info_loaded;
+  guint load_threads;
+  GHashTable *load_times;
+  gboolean lazy_loading;
+  GHashTable *lazy_plugins;
+  GHashTable *ops_index;
+  GHashTable *keys_index[GRL_SOURCE_KEYS_WRITABLE + 1];
+  GMutex *snapshot_lock;
+  GrlPluginRegistrySnapshot *snapshot;
+};
+
+struct _GrlPluginRegistrySnapshot {
+  volatile gint refcount;
+  GHashTable *sources;
+  GHashTable *ops_index;
+  GHashTable *related_keys;
+  GList *relations;
+  GMutex *lock;                 /* protects combined_index */
+  GHashTable *combined_index;
 };
 
 static void grl_plugin_registry_setup_ranks (GrlPluginRegistry *registry);
 
+static void grl_plugin_registry_setup_load_threads (GrlPluginRegistry *registry);
+
 static GList *grl_plugin_registry_load_plugin_info_directory (GrlPluginRegistry *registry,
                                                               const gchar *path,
                                                               GError **error);
@@ -92,6 +118,7 @@ static void grl_plugin_registry_load_plugin_info_all (GrlPluginRegistry *registr
 enum {
   SIG_SOURCE_ADDED,
   SIG_SOURCE_REMOVED,
+  SIG_PREWARM_HOSTS,
   SIG_LAST
 };
 static gint registry_signals[SIG_LAST];
@@ -136,11 +163,40 @@ grl_plugin_registry_class_init (GrlPluginRegistryClass *klass)
 		 NULL,
 		 g_cclosure_marshal_VOID__OBJECT,
 		 G_TYPE_NONE, 1, GRL_TYPE_MEDIA_PLUGIN);
+
+  /**
+   * GrlPluginRegistry::prewarm-hosts:
+   * @registry: the registry
+   * @plugin_id: the identifier of the plugin just loaded
+   * @hosts: (array zero-terminated=1): the hosts the plugin connects to
+   *
+   * Signals the hosts that a plugin just loaded is going to connect to, so
+   * their connections can be set up before the first operation. They come
+   * from the "prewarm-hosts" key of the plugin configuration or, if not
+   * set, of the plugin information file, as a comma-separated list.
+   *
+   * Web-backed plugins can connect grl_net_wc_prewarm() to it from their
+   * init function, as it is emitted right after it.
+   *
+   * Since: 0.1.21
+   */
+  registry_signals[SIG_PREWARM_HOSTS] =
+    g_signal_new("prewarm-hosts",
+		 G_TYPE_FROM_CLASS(klass),
+		 G_SIGNAL_RUN_LAST,
+		 0,
+		 NULL,
+		 NULL,
+		 grl_marshal_VOID__STRING_BOXED,
+		 G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_STRV);
 }
 
 static void
 grl_plugin_registry_init (GrlPluginRegistry *registry)
 {
+  GrlSupportedOps op;
+  guint i;
+
   registry->priv = GRL_PLUGIN_REGISTRY_GET_PRIVATE (registry);
 
   registry->priv->configs =
@@ -155,8 +211,29 @@ grl_plugin_registry_init (GrlPluginRegistry *registry)
     g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, NULL);
   registry->priv->system_keys =
     g_param_spec_pool_new (FALSE);
+  registry->priv->load_times =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  registry->priv->lazy_plugins =
+    g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
+  registry->priv->ops_index =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           NULL, (GDestroyNotify) g_queue_free);
+  /* All the sources, by rank, and the ones supporting each operation */
+  g_hash_table_insert (registry->priv->ops_index,
+                       GUINT_TO_POINTER (GRL_OP_NONE), g_queue_new ());
+  for (op = GRL_OP_METADATA; op <= GRL_OP_NOTIFY_CHANGE; op <<= 1) {
+    g_hash_table_insert (registry->priv->ops_index,
+                         GUINT_TO_POINTER (op), g_queue_new ());
+  }
+  for (i = 0; i < G_N_ELEMENTS (registry->priv->keys_index); i++) {
+    registry->priv->keys_index[i] =
+      g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                             NULL, (GDestroyNotify) g_queue_free);
+  }
+  registry->priv->snapshot_lock = g_mutex_new ();
 
   grl_plugin_registry_setup_ranks (registry);
+  grl_plugin_registry_setup_load_threads (registry);
 }
 
 /* ================ Utitilies ================ */
@@ -225,6 +302,63 @@ grl_plugin_registry_setup_ranks (GrlPluginRegistry *registry)
   g_strfreev (rank_specs);
 }
 
+static void
+grl_plugin_registry_setup_load_threads (GrlPluginRegistry *registry)
+{
+  const gchar *threads_env;
+  gchar *tmp;
+  guint threads;
+
+  threads_env = g_getenv (GRL_PLUGIN_LOAD_THREADS_VAR);
+  if (!threads_env) {
+    return;
+  }
+
+  threads = (guint) g_ascii_strtoull (threads_env, &tmp, 10);
+  if (*tmp != '\0') {
+    GRL_WARNING ("Incorrect number of plugin loading threads: '%s'. Skipping...",
+                 threads_env);
+    return;
+  }
+
+  registry->priv->load_threads = threads;
+}
+
+/* Adds @seconds to the load time of @plugin_id */
+static void
+add_load_time (GrlPluginRegistry *registry,
+               const gchar *plugin_id,
+               gdouble seconds)
+{
+  gdouble *load_time;
+
+  load_time = g_hash_table_lookup (registry->priv->load_times, plugin_id);
+  if (!load_time) {
+    load_time = g_new0 (gdouble, 1);
+    g_hash_table_insert (registry->priv->load_times,
+                         g_strdup (plugin_id),
+                         load_time);
+  }
+
+  *load_time += seconds * 1000.0;
+}
+
+/* Plugins are initialized by rank, highest first, and then by identifier,
+   so the order does not depend on the directories or the threads */
+static gint
+compare_plugin_infos (gconstpointer a,
+                      gconstpointer b)
+{
+  const GrlPluginInfo *info_a = a;
+  const GrlPluginInfo *info_b = b;
+
+  if (info_a->rank != info_b->rank) {
+    return (info_a->rank < info_b->rank) - (info_a->rank > info_b->rank);
+  }
+
+  return g_strcmp0 (info_a->id, info_b->id);
+}
+
 static gint
 compare_by_rank (gconstpointer a,
                  gconstpointer b) {
@@ -237,6 +371,187 @@ compare_by_rank (gconstpointer a,
   return (rank_a < rank_b) - (rank_a > rank_b);
 }
 
+static gboolean
+source_supports_operations (GrlMediaPlugin *source,
+                            GrlSupportedOps ops)
+{
+  GrlSupportedOps source_ops;
+
+  source_ops =
+    grl_metadata_source_supported_operations (GRL_METADATA_SOURCE (source));
+
+  return (source_ops & ops) == ops;
+}
+
+static const GList *
+get_source_keys (GrlMediaPlugin *source,
+                 GrlSourceKeys keys)
+{
+  switch (keys) {
+  case GRL_SOURCE_KEYS_SLOW:
+    return grl_metadata_source_slow_keys (GRL_METADATA_SOURCE (source));
+  case GRL_SOURCE_KEYS_WRITABLE:
+    return grl_metadata_source_writable_keys (GRL_METADATA_SOURCE (source));
+  default:
+    return grl_metadata_source_supported_keys (GRL_METADATA_SOURCE (source));
+  }
+}
+
+/* Returns the sources supporting @ops, by rank. The index of each set of
+   operations is built the first time it is requested, and then kept up to
+   date as sources come and go */
+static GQueue *
+get_ops_index (GrlPluginRegistry *registry,
+               GrlSupportedOps ops)
+{
+  GQueue *all_sources;
+  GQueue *sources;
+  GList *l;
+
+  sources = g_hash_table_lookup (registry->priv->ops_index,
+                                 GUINT_TO_POINTER (ops));
+  if (sources) {
+    return sources;
+  }
+
+  all_sources = g_hash_table_lookup (registry->priv->ops_index,
+                                     GUINT_TO_POINTER (GRL_OP_NONE));
+  sources = g_queue_new ();
+  for (l = all_sources->head; l; l = g_list_next (l)) {
+    if (source_supports_operations (l->data, ops)) {
+      g_queue_push_tail (sources, l->data);
+    }
+  }
+  g_mutex_lock (registry->priv->snapshot_lock);
+  g_hash_table_insert (registry->priv->ops_index,
+                       GUINT_TO_POINTER (ops), sources);
+  g_mutex_unlock (registry->priv->snapshot_lock);
+
+  return sources;
+}
+
+static void
+index_source (GrlPluginRegistry *registry,
+              GrlMediaPlugin *source)
+{
+  GHashTableIter iter;
+  gpointer ops;
+  GQueue *sources;
+  const GList *key;
+  guint i;
+
+  g_hash_table_iter_init (&iter, registry->priv->ops_index);
+  while (g_hash_table_iter_next (&iter, &ops, (gpointer *) &sources)) {
+    if (source_supports_operations (source, GPOINTER_TO_UINT (ops))) {
+      g_queue_insert_sorted (sources, source,
+                             (GCompareDataFunc) compare_by_rank, NULL);
+    }
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (registry->priv->keys_index); i++) {
+    for (key = get_source_keys (source, i); key; key = g_list_next (key)) {
+      sources = g_hash_table_lookup (registry->priv->keys_index[i], key->data);
+      if (!sources) {
+        sources = g_queue_new ();
+        g_hash_table_insert (registry->priv->keys_index[i], key->data, sources);
+      }
+      if (!g_queue_find (sources, source)) {
+        g_queue_insert_sorted (sources, source,
+                               (GCompareDataFunc) compare_by_rank, NULL);
+      }
+    }
+  }
+}
+
+static void
+unindex_source (GrlPluginRegistry *registry,
+                GrlMediaPlugin *source)
+{
+  GHashTableIter iter;
+  GQueue *sources;
+  guint i;
+
+  g_hash_table_iter_init (&iter, registry->priv->ops_index);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &sources)) {
+    g_queue_remove (sources, source);
+  }
+
+  /* The keys of the source might have changed since it was indexed */
+  for (i = 0; i < G_N_ELEMENTS (registry->priv->keys_index); i++) {
+    g_hash_table_iter_init (&iter, registry->priv->keys_index[i]);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &sources)) {
+      g_queue_remove (sources, source);
+      if (g_queue_is_empty (sources)) {
+        g_hash_table_iter_remove (&iter);
+      }
+    }
+  }
+}
+
+/* Builds a snapshot of the current state. Must be called with the snapshot
+   lock held */
+static GrlPluginRegistrySnapshot *
+snapshot_new (GrlPluginRegistry *registry)
+{
+  GrlPluginRegistrySnapshot *snapshot;
+  GHashTable *relations;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GList *copy;
+
+  snapshot = g_slice_new0 (GrlPluginRegistrySnapshot);
+  snapshot->refcount = 1;
+  snapshot->lock = g_mutex_new ();
+
+  snapshot->sources =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  g_hash_table_iter_init (&iter, registry->priv->sources);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    g_hash_table_insert (snapshot->sources,
+                         g_strdup (key), g_object_ref (value));
+  }
+
+  snapshot->ops_index =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           NULL, (GDestroyNotify) g_list_free);
+  g_hash_table_iter_init (&iter, registry->priv->ops_index);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    g_hash_table_insert (snapshot->ops_index,
+                         key, g_list_copy (((GQueue *) value)->head));
+  }
+
+  /* Related keys share their list, and relating two keys changes it in
+     place, so each list is copied once */
+  snapshot->related_keys =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, NULL);
+  relations = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_hash_table_iter_init (&iter, registry->priv->related_keys);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    copy = g_hash_table_lookup (relations, value);
+    if (!copy) {
+      copy = g_list_copy (value);
+      g_hash_table_insert (relations, value, copy);
+      snapshot->relations = g_list_prepend (snapshot->relations, copy);
+    }
+    g_hash_table_insert (snapshot->related_keys, key, copy);
+  }
+  g_hash_table_destroy (relations);
+
+  return snapshot;
+}
+
+/* Drops the current snapshot after a change; the next one is built when it
+   is requested. Must be called with the snapshot lock held */
+static void
+invalidate_snapshot (GrlPluginRegistry *registry)
+{
+  if (registry->priv->snapshot) {
+    grl_plugin_registry_snapshot_unref (registry->priv->snapshot);
+    registry->priv->snapshot = NULL;
+  }
+}
+
 static GHashTable *
 get_info_from_plugin_xml (const gchar *xml_path)
 {
@@ -287,10 +602,11 @@ get_info_from_plugin_xml (const gchar *xml_path)
   return hash_table;
 }
 
+/* Builds the information of @plugin_id from @file; it does not use the
+   registry, so it can run in any thread */
 static GrlPluginInfo *
-grl_plugin_registry_load_plugin_info (GrlPluginRegistry *registry,
-                                      const gchar* plugin_id,
-                                      const gchar *file)
+create_plugin_info (const gchar *plugin_id,
+                    const gchar *file)
 {
   GHashTable *info;
   GrlPluginInfo *plugin_info;
@@ -327,24 +643,62 @@ grl_plugin_registry_load_plugin_info (GrlPluginRegistry *registry,
   plugin_info->filename = library_filename;
   plugin_info->optional_info = info;
 
+  return plugin_info;
+}
+
+static GrlPluginInfo *
+grl_plugin_registry_load_plugin_info (GrlPluginRegistry *registry,
+                                      const gchar* plugin_id,
+                                      const gchar *file)
+{
+  GrlPluginInfo *plugin_info;
+
+  plugin_info = create_plugin_info (plugin_id, file);
+  if (!plugin_info) {
+    return NULL;
+  }
+
   /* Set rank */
   set_plugin_rank (registry, plugin_info);
 
   return plugin_info;
 }
 
+/* Plugin whose information and module are being loaded, maybe in a worker
+   thread */
+struct plugin_load {
+  gchar *id;
+  gchar *info_file;             /* NULL if the information was registered */
+  GrlPluginInfo *info;
+  GModule *module;
+  GrlPluginDescriptor *plugin;
+  GrlPluginInfoCache *cache;    /* to add the information to, if parsed */
+  gdouble elapsed;              /* seconds spent in the worker */
+};
+
+static void
+free_plugin_load (struct plugin_load *load)
+{
+  g_free (load->id);
+  g_free (load->info_file);
+  g_slice_free (struct plugin_load, load);
+}
+
+/* Lists the plugin information files in @path not loaded yet, in directory
+   order. Identifiers in @pending, if any, are skipped too, and the new ones
+   are added to it */
 static GList *
-grl_plugin_registry_load_plugin_info_directory (GrlPluginRegistry *registry,
-                                                const gchar *path,
-                                                GError **error)
+list_plugin_info_files (GrlPluginRegistry *registry,
+                        const gchar *path,
+                        GHashTable *pending,
+                        GError **error)
 {
   GDir *dir;
-  GrlPluginInfo *plugin_info;
+  struct plugin_load *load;
   const gchar *entry;
-  gchar *file;
   gchar *id;
   gchar *suffix;
-  GList *loaded_infos = NULL;
+  GList *loads = NULL;
 
   dir = g_dir_open (path, 0, NULL);
   if (!dir) {
@@ -358,14 +712,13 @@ grl_plugin_registry_load_plugin_info_directory (GrlPluginRegistry *registry,
 
   while ((entry = g_dir_read_name (dir)) != NULL) {
     if ((suffix = g_strrstr (entry, "." GRL_PLUGIN_INFO_SUFFIX)) != NULL) {
-      file = g_build_filename (path, entry, NULL);
       id = g_strndup (entry, suffix - entry);
       /* Skip plugin info if it is already loaded */
-      if (g_hash_table_lookup (registry->priv->plugin_infos, id)) {
+      if (g_hash_table_lookup (registry->priv->plugin_infos, id) ||
+          (pending && g_hash_table_lookup (pending, id))) {
         GRL_DEBUG ("Information about '%s' plugin already loaded; skipping",
                    id);
         g_free (id);
-        g_free (file);
         continue;
       }
       /* Check if plugin is allowed or not */
@@ -374,20 +727,112 @@ grl_plugin_registry_load_plugin_info_directory (GrlPluginRegistry *registry,
                                 id,
                                 (GCompareFunc) g_strcmp0)) {
         GRL_DEBUG ("'%s' plugin not allowed; skipping", id);
+        g_free (id);
         continue;
       }
-      plugin_info = grl_plugin_registry_load_plugin_info (registry, id, file);
-      g_free (id);
-      g_free (file);
 
+      load = g_slice_new0 (struct plugin_load);
+      load->id = id;
+      load->info_file = g_build_filename (path, entry, NULL);
+      loads = g_list_prepend (loads, load);
+
+      if (pending) {
+        g_hash_table_insert (pending, load->id, load);
+      }
+    }
+  }
+
+  g_dir_close (dir);
+  return g_list_reverse (loads);
+}
+
+/* Fills the information of @loads, files in @path, from the plugin
+   information cache. Returns the cached information not used, to be freed.
+   @loads are set to add what they parse to the returned @cache, to be
+   written afterwards */
+static GHashTable *
+get_cached_plugin_infos (GList *loads,
+                         const gchar *path,
+                         GrlPluginInfoCache **cache)
+{
+  struct plugin_load *load;
+  GHashTable *cached_infos;
+
+  *cache = NULL;
+
+  if (!loads) {
+    return NULL;
+  }
+
+  cached_infos = grl_plugin_info_cache_read (path, cache);
+
+  for (; loads; loads = g_list_next (loads)) {
+    load = loads->data;
+    load->cache = *cache;
+    if (cached_infos) {
+      load->info = g_hash_table_lookup (cached_infos, load->id);
+      if (load->info) {
+        g_hash_table_steal (cached_infos, load->id);
+      }
+    }
+  }
+
+  return cached_infos;
+}
+
+static GList *
+grl_plugin_registry_load_plugin_info_directory (GrlPluginRegistry *registry,
+                                                const gchar *path,
+                                                GError **error)
+{
+  GrlPluginInfo *plugin_info;
+  GrlPluginInfoCache *cache;
+  struct plugin_load *load;
+  GHashTable *cached_infos;
+  GTimer *timer;
+  GList *loads;
+  GList *l;
+  GList *loaded_infos = NULL;
+
+  loads = list_plugin_info_files (registry, path, NULL, error);
+  cached_infos = get_cached_plugin_infos (loads, path, &cache);
+
+  timer = g_timer_new ();
+  for (l = loads; l; l = g_list_next (l)) {
+    load = l->data;
+
+    g_timer_start (timer);
+    plugin_info = load->info;
+    if (plugin_info) {
+      set_plugin_rank (registry, plugin_info);
+    } else {
+      plugin_info = grl_plugin_registry_load_plugin_info (registry,
+                                                          load->id,
+                                                          load->info_file);
+      if (plugin_info && load->cache) {
+        grl_plugin_info_cache_add (load->cache, plugin_info);
+      }
+    }
+    add_load_time (registry, load->id, g_timer_elapsed (timer, NULL));
+
+    if (plugin_info) {
       g_hash_table_insert (registry->priv->plugin_infos,
                            plugin_info->id,
                            plugin_info);
       loaded_infos = g_list_append (loaded_infos, plugin_info);
     }
+    free_plugin_load (load);
+  }
+  g_timer_destroy (timer);
+  g_list_free (loads);
+
+  if (cached_infos) {
+    g_hash_table_unref (cached_infos);
+  }
+  if (cache) {
+    grl_plugin_info_cache_write (cache);
   }
 
-  g_dir_close (dir);
   return loaded_infos;
 }
 
@@ -408,6 +853,172 @@ grl_plugin_registry_load_plugin_info_all (GrlPluginRegistry *registry)
   }
 }
 
+static const struct {
+  const gchar *name;
+  GrlSupportedOps op;
+} operation_names[] = {
+  { "metadata", GRL_OP_METADATA },
+  { "resolve", GRL_OP_RESOLVE },
+  { "browse", GRL_OP_BROWSE },
+  { "search", GRL_OP_SEARCH },
+  { "query", GRL_OP_QUERY },
+  { "store", GRL_OP_STORE },
+  { "store-parent", GRL_OP_STORE_PARENT },
+  { "remove", GRL_OP_REMOVE },
+  { "set-metadata", GRL_OP_SET_METADATA },
+  { "media-from-uri", GRL_OP_MEDIA_FROM_URI },
+  { "notify-change", GRL_OP_NOTIFY_CHANGE },
+};
+
+/* Returns the tokens of a list in the plugin information, or NULL */
+static gchar **
+get_info_list (const GrlPluginInfo *info,
+               const gchar *key)
+{
+  const gchar *value;
+
+  if (!info->optional_info) {
+    return NULL;
+  }
+
+  value = g_hash_table_lookup (info->optional_info, key);
+  if (!value) {
+    return NULL;
+  }
+
+  return g_strsplit_set (value, ", \t\n", -1);
+}
+
+/* Returns the operations the sources of a plugin declare in its information,
+   or GRL_OP_NONE if they are not known */
+static GrlSupportedOps
+get_declared_operations (const GrlPluginInfo *info)
+{
+  GrlSupportedOps ops = GRL_OP_NONE;
+  gchar **names;
+  guint i, j;
+
+  names = get_info_list (info, GRL_PLUGIN_INFO_OPERATIONS);
+  if (!names) {
+    return GRL_OP_NONE;
+  }
+
+  for (i = 0; names[i]; i++) {
+    for (j = 0; j < G_N_ELEMENTS (operation_names); j++) {
+      if (g_strcmp0 (names[i], operation_names[j].name) == 0) {
+        ops |= operation_names[j].op;
+        break;
+      }
+    }
+  }
+  g_strfreev (names);
+
+  return ops;
+}
+
+static gboolean
+declares_source (const GrlPluginInfo *info,
+                 const gchar *source_id)
+{
+  gboolean found = FALSE;
+  gchar **sources;
+  guint i;
+
+  sources = get_info_list (info, GRL_PLUGIN_INFO_SOURCES);
+  if (!sources) {
+    return FALSE;
+  }
+
+  for (i = 0; sources[i] && !found; i++) {
+    found = g_strcmp0 (sources[i], source_id) == 0;
+  }
+  g_strfreev (sources);
+
+  return found;
+}
+
+/* Keeps the plugins declaring their sources in @plugin_info_list for later,
+   and returns the ones to load now. Sets @deferred if any was kept */
+static GList *
+defer_lazy_plugins (GrlPluginRegistry *registry,
+                    GList *plugin_info_list,
+                    gboolean *deferred)
+{
+  GrlPluginInfo *pinfo;
+  GList *to_load = NULL;
+  GList *l;
+
+  *deferred = FALSE;
+
+  for (l = plugin_info_list; l; l = g_list_next (l)) {
+    pinfo = (GrlPluginInfo *) l->data;
+    if (pinfo->optional_info &&
+        g_hash_table_lookup (pinfo->optional_info, GRL_PLUGIN_INFO_SOURCES) &&
+        !g_hash_table_lookup (registry->priv->plugins, pinfo->id)) {
+      GRL_DEBUG ("Deferring the load of '%s' plugin until it is used", pinfo->id);
+      g_hash_table_insert (registry->priv->lazy_plugins, pinfo->id, pinfo);
+      *deferred = TRUE;
+    } else {
+      to_load = g_list_prepend (to_load, pinfo);
+    }
+  }
+
+  g_list_free (plugin_info_list);
+
+  return g_list_reverse (to_load);
+}
+
+static void
+load_lazy_plugin (GrlPluginRegistry *registry,
+                  GrlPluginInfo *pinfo)
+{
+  /* Whatever happens, it is not tried again */
+  g_hash_table_remove (registry->priv->lazy_plugins, pinfo->id);
+
+  GRL_DEBUG ("Loading '%s' plugin on first use", pinfo->id);
+  grl_plugin_registry_load (registry, pinfo->filename, NULL);
+}
+
+/* Gets the deferred plugins whose sources may support @ops, by rank */
+static GList *
+get_lazy_plugins (GrlPluginRegistry *registry,
+                  GrlSupportedOps ops)
+{
+  GrlSupportedOps declared_ops;
+  GHashTableIter iter;
+  GrlPluginInfo *pinfo;
+  GList *plugins = NULL;
+
+  g_hash_table_iter_init (&iter, registry->priv->lazy_plugins);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pinfo)) {
+    declared_ops = get_declared_operations (pinfo);
+    if (declared_ops == GRL_OP_NONE || (declared_ops & ops) == ops) {
+      plugins = g_list_prepend (plugins, pinfo);
+    }
+  }
+
+  return g_list_sort (plugins, compare_plugin_infos);
+}
+
+/* Loads the deferred plugins whose sources may support @ops */
+static void
+load_lazy_plugins (GrlPluginRegistry *registry,
+                   GrlSupportedOps ops)
+{
+  GList *to_load;
+  GList *l;
+
+  if (g_hash_table_size (registry->priv->lazy_plugins) == 0) {
+    return;
+  }
+
+  to_load = get_lazy_plugins (registry, ops);
+  for (l = to_load; l; l = g_list_next (l)) {
+    load_lazy_plugin (registry, l->data);
+  }
+  g_list_free (to_load);
+}
+
 static gboolean
 grl_plugin_registry_load_list (GrlPluginRegistry *registry,
                                GList *plugin_info_list)
@@ -468,24 +1079,106 @@ grl_plugin_registry_restrict_plugins (GrlPluginRegistry *registry,
  *
  * Returns: (transfer none): a new or an already created instance of the registry.
  *
- * It is NOT MT-safe
+ * It can be called from any thread, for instance to take a snapshot with
+ * grl_plugin_registry_get_snapshot(); the rest of the registry must only be
+ * used from the main thread.
  *
  * Since: 0.1.6
  */
 GrlPluginRegistry *
 grl_plugin_registry_get_default (void)
 {
-  static GrlPluginRegistry *registry = NULL;
+  static volatile gsize registry = 0;
 
-  if (!registry) {
-    registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+  /* Worker threads get it to take snapshots */
+  if (g_once_init_enter (&registry)) {
+    g_once_init_leave (&registry,
+                       (gsize) g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL));
   }
 
-  return registry;
+  return (GrlPluginRegistry *) registry;
 }
 
-/**
- * grl_plugin_registry_register_source:
+static void
+config_source_threads (GrlPluginRegistry *registry,
+                       const GrlPluginInfo *plugin,
+                       GrlMediaPlugin *source,
+                       const gchar *source_id)
+{
+  GList *configs;
+  gchar *config_source;
+  gint max_threads;
+
+  if (!plugin || !GRL_IS_METADATA_SOURCE (source)) {
+    return;
+  }
+
+  for (configs = g_hash_table_lookup (registry->priv->configs, plugin->id);
+       configs;
+       configs = g_list_next (configs)) {
+    config_source = grl_config_get_source (configs->data);
+    if (!config_source || g_strcmp0 (config_source, source_id) == 0) {
+      max_threads = grl_config_get_int (configs->data,
+                                        GRL_CONFIG_KEY_MAX_THREADS);
+      if (max_threads > 0) {
+        GRL_DEBUG ("Running '%s' operations in up to %d threads",
+                   source_id, max_threads);
+        grl_metadata_source_set_max_threads (GRL_METADATA_SOURCE (source),
+                                             max_threads);
+      }
+    }
+    g_free (config_source);
+  }
+}
+
+/* Returns the hosts to prewarm for @plugin, or NULL */
+static gchar **
+get_prewarm_hosts (GrlPluginRegistry *registry,
+                   const GrlPluginInfo *plugin)
+{
+  GList *configs;
+  GPtrArray *hosts;
+  gchar **tokens;
+  gchar *value = NULL;
+  guint i;
+
+  for (configs = g_hash_table_lookup (registry->priv->configs, plugin->id);
+       configs && !value;
+       configs = g_list_next (configs)) {
+    value = grl_config_get_string (configs->data,
+                                   GRL_CONFIG_KEY_PREWARM_HOSTS);
+  }
+
+  if (!value && plugin->optional_info) {
+    value = g_strdup (g_hash_table_lookup (plugin->optional_info,
+                                           GRL_PLUGIN_INFO_PREWARM_HOSTS));
+  }
+
+  if (!value) {
+    return NULL;
+  }
+
+  hosts = g_ptr_array_new ();
+  tokens = g_strsplit_set (value, ", \t\n", -1);
+  for (i = 0; tokens[i]; i++) {
+    if (*tokens[i]) {
+      g_ptr_array_add (hosts, g_strdup (tokens[i]));
+    }
+  }
+  g_strfreev (tokens);
+  g_free (value);
+
+  if (hosts->len == 0) {
+    g_ptr_array_free (hosts, TRUE);
+    return NULL;
+  }
+
+  g_ptr_array_add (hosts, NULL);
+  return (gchar **) g_ptr_array_free (hosts, FALSE);
+}
+
+/**
+ * grl_plugin_registry_register_source:
  * @registry: the registry instance
  * @plugin: the descriptor of the plugin which owns the source
  * @source: the source to register
@@ -503,6 +1196,7 @@ grl_plugin_registry_register_source (GrlPluginRegistry *registry,
                                      GrlMediaPlugin *source,
                                      GError **error)
 {
+  GrlMediaPlugin *old_source;
   gchar *id;
 
   g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), FALSE);
@@ -515,12 +1209,28 @@ grl_plugin_registry_register_source (GrlPluginRegistry *registry,
   g_object_ref_sink (source);
   g_object_unref (source);
 
+  g_mutex_lock (registry->priv->snapshot_lock);
+
+  old_source = g_hash_table_lookup (registry->priv->sources, id);
+  if (old_source) {
+    unindex_source (registry, old_source);
+  }
+
   /* Do not free id, since g_hash_table_insert does not copy,
      it will be freed when removed from the hash table */
   g_hash_table_insert (registry->priv->sources, id, source);
 
   grl_media_plugin_set_plugin_info (source, plugin);
 
+  /* Needs the rank, which comes with the plugin information */
+  index_source (registry, source);
+  invalidate_snapshot (registry);
+
+  g_mutex_unlock (registry->priv->snapshot_lock);
+
+  /* Sources doing blocking I/O can be configured to use worker threads */
+  config_source_threads (registry, plugin, source, id);
+
   g_signal_emit (registry, registry_signals[SIG_SOURCE_ADDED], 0, source);
 
   return TRUE;
@@ -545,6 +1255,7 @@ grl_plugin_registry_unregister_source (GrlPluginRegistry *registry,
 {
   gchar *id;
   gboolean ret = TRUE;
+  gboolean removed;
 
   g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), FALSE);
   g_return_val_if_fail (GRL_IS_MEDIA_PLUGIN (source), FALSE);
@@ -552,7 +1263,15 @@ grl_plugin_registry_unregister_source (GrlPluginRegistry *registry,
   g_object_get (source, "source-id", &id, NULL);
   GRL_DEBUG ("Unregistering source '%s'", id);
 
-  if (g_hash_table_remove (registry->priv->sources, id)) {
+  g_mutex_lock (registry->priv->snapshot_lock);
+  removed = g_hash_table_remove (registry->priv->sources, id);
+  if (removed) {
+    unindex_source (registry, source);
+    invalidate_snapshot (registry);
+  }
+  g_mutex_unlock (registry->priv->snapshot_lock);
+
+  if (removed) {
     GRL_DEBUG ("source '%s' is no longer available", id);
     g_signal_emit (registry, registry_signals[SIG_SOURCE_REMOVED], 0, source);
     g_object_unref (source);
@@ -591,32 +1310,15 @@ grl_plugin_registry_add_directory (GrlPluginRegistry *registry,
                                                 g_strdup (path));
 }
 
-/**
- * grl_plugin_registry_load:
- * @registry: the registry instance
- * @library_filename: the path to the so file
- * @error: error return location or @NULL to ignore
- *
- * Loads a module from shared object file stored in @path
- *
- * Returns: %TRUE if the module is loaded correctly
- *
- * Since: 0.1.7
- */
-gboolean
-grl_plugin_registry_load (GrlPluginRegistry *registry,
-                          const gchar *library_filename,
-                          GError **error)
+/* Opens the module of a plugin and gets its descriptor; it does not use the
+   registry, so it can run in any thread */
+static GModule *
+open_plugin_module (const gchar *library_filename,
+                    GrlPluginDescriptor **descriptor,
+                    GError **error)
 {
   GModule *module;
   GrlPluginDescriptor *plugin;
-  GrlPluginInfo *plugin_info;
-  GList *plugin_configs;
-  gchar *dirname;
-  gchar *plugin_info_filename;
-  gchar *plugin_info_fullpathname;
-
-  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), FALSE);
 
   module = g_module_open (library_filename, G_MODULE_BIND_LAZY);
   if (!module) {
@@ -625,7 +1327,7 @@ grl_plugin_registry_load (GrlPluginRegistry *registry,
                  GRL_CORE_ERROR,
                  GRL_CORE_ERROR_LOAD_PLUGIN_FAILED,
                  "Failed to load plugin at '%s'", library_filename);
-    return FALSE;
+    return NULL;
   }
 
   if (!g_module_symbol (module, "GRL_PLUGIN_DESCRIPTOR", (gpointer) &plugin)) {
@@ -635,7 +1337,7 @@ grl_plugin_registry_load (GrlPluginRegistry *registry,
                  GRL_CORE_ERROR_LOAD_PLUGIN_FAILED,
                  "'%s' is not a valid plugin file", library_filename);
     g_module_close (module);
-    return FALSE;
+    return NULL;
   }
 
   if (!plugin->plugin_init ||
@@ -646,9 +1348,29 @@ grl_plugin_registry_load (GrlPluginRegistry *registry,
                  GRL_CORE_ERROR_LOAD_PLUGIN_FAILED,
                  "'%s' is not a valid plugin file", library_filename);
     g_module_close (module);
-    return FALSE;
+    return NULL;
   }
 
+  *descriptor = plugin;
+
+  return module;
+}
+
+/* Initializes a plugin whose module was just opened, which it takes */
+static gboolean
+init_plugin_module (GrlPluginRegistry *registry,
+                    const gchar *library_filename,
+                    GModule *module,
+                    GrlPluginDescriptor *plugin,
+                    GError **error)
+{
+  GrlPluginInfo *plugin_info;
+  GList *plugin_configs;
+  gchar **prewarm_hosts;
+  gchar *dirname;
+  gchar *plugin_info_filename;
+  gchar *plugin_info_fullpathname;
+
   /* Check if plugin is already loaded */
   if (g_hash_table_lookup (registry->priv->plugins, plugin->plugin_id)) {
     GRL_WARNING ("Plugin is already loaded: '%s'", library_filename);
@@ -722,11 +1444,62 @@ grl_plugin_registry_load (GrlPluginRegistry *registry,
 
   plugin->module = module;
 
+  g_hash_table_remove (registry->priv->lazy_plugins, plugin->plugin_id);
+
   GRL_DEBUG ("Loaded plugin '%s' from '%s'", plugin->plugin_id, library_filename);
 
+  prewarm_hosts = get_prewarm_hosts (registry, plugin_info);
+  if (prewarm_hosts) {
+    g_signal_emit (registry, registry_signals[SIG_PREWARM_HOSTS], 0,
+                   plugin->plugin_id, prewarm_hosts);
+    g_strfreev (prewarm_hosts);
+  }
+
   return TRUE;
 }
 
+/**
+ * grl_plugin_registry_load:
+ * @registry: the registry instance
+ * @library_filename: the path to the so file
+ * @error: error return location or @NULL to ignore
+ *
+ * Loads a module from shared object file stored in @path
+ *
+ * Returns: %TRUE if the module is loaded correctly
+ *
+ * Since: 0.1.7
+ */
+gboolean
+grl_plugin_registry_load (GrlPluginRegistry *registry,
+                          const gchar *library_filename,
+                          GError **error)
+{
+  GModule *module;
+  GrlPluginDescriptor *plugin;
+  GTimer *timer;
+  gboolean loaded;
+
+  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), FALSE);
+
+  timer = g_timer_new ();
+
+  module = open_plugin_module (library_filename, &plugin, error);
+  if (!module) {
+    g_timer_destroy (timer);
+    return FALSE;
+  }
+
+  loaded = init_plugin_module (registry, library_filename, module, plugin,
+                               error);
+  if (loaded) {
+    add_load_time (registry, plugin->plugin_id, g_timer_elapsed (timer, NULL));
+  }
+  g_timer_destroy (timer);
+
+  return loaded;
+}
+
 /**
  * grl_plugin_registry_load_directory:
  * @registry: the registry instance
@@ -763,6 +1536,171 @@ grl_plugin_registry_load_directory (GrlPluginRegistry *registry,
   return TRUE;
 }
 
+static void
+load_plugin_in_thread (struct plugin_load *load,
+                       gpointer user_data)
+{
+  GTimer *timer;
+
+  timer = g_timer_new ();
+
+  if (!load->info) {
+    load->info = create_plugin_info (load->id, load->info_file);
+  }
+
+  if (load->info) {
+    load->module = open_plugin_module (load->info->filename,
+                                       &load->plugin,
+                                       NULL);
+  }
+
+  load->elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+}
+
+static gint
+compare_plugin_loads (gconstpointer a,
+                      gconstpointer b)
+{
+  return compare_plugin_infos (((const struct plugin_load *) a)->info,
+                               ((const struct plugin_load *) b)->info);
+}
+
+/* Reads the information and opens the modules of @loads in worker threads;
+   as plugins expect to be initialized in the main thread, that is done
+   afterwards, in rank order, once the information parsed is written to
+   @caches. Takes @loads and @caches */
+static gboolean
+grl_plugin_registry_load_parallel (GrlPluginRegistry *registry,
+                                   GList *loads,
+                                   GList *caches)
+{
+  GThreadPool *pool;
+  struct plugin_load *load;
+  GTimer *timer;
+  GList *opened = NULL;
+  GList *l;
+  gboolean loaded_one = FALSE;
+
+  /* libxml2 must be set up before it is used from several threads */
+  xmlInitParser ();
+
+  pool = g_thread_pool_new ((GFunc) load_plugin_in_thread, NULL,
+                            registry->priv->load_threads, FALSE, NULL);
+  for (l = loads; l; l = g_list_next (l)) {
+    if (pool) {
+      g_thread_pool_push (pool, l->data, NULL);
+    } else {
+      load_plugin_in_thread (l->data, NULL);
+    }
+  }
+
+  /* Wait for all of them */
+  if (pool) {
+    g_thread_pool_free (pool, FALSE, TRUE);
+  }
+
+  timer = g_timer_new ();
+  for (l = loads; l; l = g_list_next (l)) {
+    load = l->data;
+
+    if (load->info && load->info_file) {
+      set_plugin_rank (registry, load->info);
+      g_hash_table_insert (registry->priv->plugin_infos,
+                           load->info->id,
+                           load->info);
+      if (load->cache) {
+        grl_plugin_info_cache_add (load->cache, load->info);
+      }
+    } else if (!load->info) {
+      GRL_WARNING ("Invalid information file for '%s' plugin", load->id);
+    }
+
+    if (load->module) {
+      opened = g_list_prepend (opened, load);
+    }
+  }
+
+  g_list_foreach (caches, (GFunc) grl_plugin_info_cache_write, NULL);
+  g_list_free (caches);
+
+  opened = g_list_sort (opened, compare_plugin_loads);
+  for (l = opened; l; l = g_list_next (l)) {
+    load = l->data;
+
+    g_timer_start (timer);
+    if (init_plugin_module (registry, load->info->filename, load->module,
+                            load->plugin, NULL)) {
+      loaded_one = TRUE;
+      add_load_time (registry, load->info->id,
+                     load->elapsed + g_timer_elapsed (timer, NULL));
+      GRL_DEBUG ("Plugin '%s' loaded in %.3f ms",
+                 load->info->id,
+                 grl_plugin_registry_get_load_time (registry, load->info->id));
+    }
+  }
+  g_timer_destroy (timer);
+
+  g_list_free (opened);
+  g_list_foreach (loads, (GFunc) free_plugin_load, NULL);
+  g_list_free (loads);
+
+  return loaded_one;
+}
+
+/* Loads all the plugins, in worker threads as much as possible */
+static gboolean
+grl_plugin_registry_load_all_parallel (GrlPluginRegistry *registry)
+{
+  struct plugin_load *load;
+  GrlPluginInfoCache *cache;
+  GHashTable *pending;
+  GHashTable *cached_infos;
+  GSList *plugin_dir;
+  GList *dir_loads;
+  GList *infos;
+  GList *l;
+  GList *loads = NULL;
+  GList *caches = NULL;
+
+  /* Plugins whose information was already read only need their module */
+  infos = g_hash_table_get_values (registry->priv->plugin_infos);
+  for (l = infos; l; l = g_list_next (l)) {
+    load = g_slice_new0 (struct plugin_load);
+    load->info = l->data;
+    load->id = g_strdup (load->info->id);
+    loads = g_list_prepend (loads, load);
+  }
+  g_list_free (infos);
+
+  if (!registry->priv->all_plugin_info_loaded) {
+    pending = g_hash_table_new (g_str_hash, g_str_equal);
+    for (plugin_dir = registry->priv->plugins_dir;
+         plugin_dir;
+         plugin_dir = g_slist_next (plugin_dir)) {
+      dir_loads = list_plugin_info_files (registry,
+                                          plugin_dir->data,
+                                          pending,
+                                          NULL);
+      /* On a miss, the information is parsed in the worker threads and
+         cached afterwards */
+      cached_infos = get_cached_plugin_infos (dir_loads, plugin_dir->data,
+                                              &cache);
+      if (cached_infos) {
+        g_hash_table_unref (cached_infos);
+      }
+      if (cache) {
+        caches = g_list_prepend (caches, cache);
+      }
+      loads = g_list_concat (loads, dir_loads);
+    }
+    g_hash_table_unref (pending);
+    registry->priv->all_plugin_info_loaded = TRUE;
+  }
+
+  return grl_plugin_registry_load_parallel (registry, loads, caches);
+}
+
 /**
  * grl_plugin_registry_load_all:
  * @registry: the registry instance
@@ -774,6 +1712,11 @@ grl_plugin_registry_load_directory (GrlPluginRegistry *registry,
  * variable %GRL_PLUGIN_PATH and it can contain several paths separated
  * by ":"
  *
+ * Plugins are initialized by rank, highest first, and then by identifier.
+ * See grl_plugin_registry_set_load_threads() to read their information and
+ * open their modules in parallel, and grl_plugin_registry_set_lazy_loading()
+ * to load them only when they are used.
+ *
  * Returns: %FALSE% is all the configured plugin paths are invalid,
  * %TRUE% otherwise.
  *
@@ -784,20 +1727,32 @@ grl_plugin_registry_load_all (GrlPluginRegistry *registry, GError **error)
 {
   GList *all_plugin_infos;
   gboolean loaded_one;
+  gboolean deferred;
 
   g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), TRUE);
 
-  /* Preload all plugin infos */
-  if (!registry->priv->all_plugin_info_loaded) {
-    grl_plugin_registry_load_plugin_info_all (registry);
-    registry->priv->all_plugin_info_loaded = TRUE;
-  }
+  if (registry->priv->load_threads > 1 && !registry->priv->lazy_loading) {
+    loaded_one = grl_plugin_registry_load_all_parallel (registry);
+  } else {
+    /* Preload all plugin infos */
+    if (!registry->priv->all_plugin_info_loaded) {
+      grl_plugin_registry_load_plugin_info_all (registry);
+      registry->priv->all_plugin_info_loaded = TRUE;
+    }
 
-  /* Now load all plugins */
-  all_plugin_infos = g_hash_table_get_values (registry->priv->plugin_infos);
-  loaded_one = grl_plugin_registry_load_list (registry, all_plugin_infos);
+    /* Now load all plugins */
+    all_plugin_infos = g_hash_table_get_values (registry->priv->plugin_infos);
+    all_plugin_infos = g_list_sort (all_plugin_infos, compare_plugin_infos);
+    deferred = FALSE;
+    if (registry->priv->lazy_loading) {
+      all_plugin_infos = defer_lazy_plugins (registry, all_plugin_infos,
+                                             &deferred);
+    }
+    loaded_one = grl_plugin_registry_load_list (registry, all_plugin_infos);
+    loaded_one |= deferred;
 
-  g_list_free (all_plugin_infos);
+    g_list_free (all_plugin_infos);
+  }
 
   if (!loaded_one) {
     g_set_error (error,
@@ -810,6 +1765,106 @@ grl_plugin_registry_load_all (GrlPluginRegistry *registry, GError **error)
   return loaded_one;
 }
 
+/**
+ * grl_plugin_registry_set_load_threads:
+ * @registry: the registry instance
+ * @threads: number of worker threads, 0 or 1 to load everything in the main
+ * thread
+ *
+ * Sets how many threads grl_plugin_registry_load_all() uses to read the
+ * plugin information files and open the plugin modules. The plugins are
+ * always initialized in the main thread, in the same order whatever the
+ * number of threads.
+ *
+ * Threads are not used when lazy loading is enabled with
+ * grl_plugin_registry_set_lazy_loading(): grl_plugin_registry_load_all()
+ * then reads all the information in the main thread, and deferred plugins
+ * are loaded there one by one when they are used.
+ *
+ * The default value can be set with the %GRL_PLUGIN_LOAD_THREADS
+ * environment variable.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_plugin_registry_set_load_threads (GrlPluginRegistry *registry,
+                                      guint threads)
+{
+  g_return_if_fail (GRL_IS_PLUGIN_REGISTRY (registry));
+
+  registry->priv->load_threads = threads;
+}
+
+/**
+ * grl_plugin_registry_set_lazy_loading:
+ * @registry: the registry instance
+ * @lazy: %TRUE to load plugins on first use
+ *
+ * Sets whether grl_plugin_registry_load_all() defers loading the plugins
+ * until they are used. Only plugins listing their sources in a "sources"
+ * key of their information file can be deferred; the others are loaded
+ * right away.
+ *
+ * A deferred plugin is loaded when one of its sources is looked up with
+ * grl_plugin_registry_lookup_source(), or when sources are listed with
+ * grl_plugin_registry_get_sources() or
+ * grl_plugin_registry_get_sources_by_operations(). In the latter case, an
+ * "operations" key in the information file, with the names of the
+ * supported operations ("metadata", "resolve", "browse", "search", "query",
+ * "store", "store-parent", "remove", "set-metadata", "media-from-uri" and
+ * "notify-change"), avoids loading the plugins that can not match.
+ * grl_plugin_registry_get_sources() and
+ * grl_plugin_registry_peek_sources_by_key() load all the deferred plugins.
+ * grl_plugin_registry_get_deferred_sources() lists the sources they declare
+ * without loading them. Operations looking for other sources, like the
+ * resolution of additional keys or grl_multiple_get_media_from_uri_parallel(),
+ * use a snapshot and so only consider the plugins already loaded.
+ *
+ * Metadata keys registered by a plugin are not available until it is
+ * loaded. Lazy loading also disables the threads set with
+ * grl_plugin_registry_set_load_threads().
+ *
+ * Since: 0.1.21
+ */
+void
+grl_plugin_registry_set_lazy_loading (GrlPluginRegistry *registry,
+                                      gboolean lazy)
+{
+  g_return_if_fail (GRL_IS_PLUGIN_REGISTRY (registry));
+
+  registry->priv->lazy_loading = lazy;
+}
+
+/**
+ * grl_plugin_registry_get_load_time:
+ * @registry: the registry instance
+ * @plugin_id: plugin identifier
+ *
+ * Gets how long it took to load the plugin identified by @plugin_id: reading
+ * its information, opening its module and initializing it.
+ *
+ * Returns: the load time in milliseconds, or -1 if the plugin was not loaded
+ *
+ * Since: 0.1.21
+ */
+gdouble
+grl_plugin_registry_get_load_time (GrlPluginRegistry *registry,
+                                   const gchar *plugin_id)
+{
+  gdouble *load_time;
+
+  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), -1);
+  g_return_val_if_fail (plugin_id, -1);
+
+  if (!g_hash_table_lookup (registry->priv->plugins, plugin_id)) {
+    return -1;
+  }
+
+  load_time = g_hash_table_lookup (registry->priv->load_times, plugin_id);
+
+  return load_time? *load_time: 0;
+}
+
 /**
  * grl_plugin_registry_load_by_id:
  * @registry: the registry instance
@@ -873,20 +1928,41 @@ GrlMediaPlugin *
 grl_plugin_registry_lookup_source (GrlPluginRegistry *registry,
                                    const gchar *source_id)
 {
+  GrlMediaPlugin *source;
+  GHashTableIter iter;
+  GrlPluginInfo *pinfo;
+
   g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
   g_return_val_if_fail (source_id != NULL, NULL);
-  return (GrlMediaPlugin *) g_hash_table_lookup (registry->priv->sources,
-                                                 source_id);
+
+  source = g_hash_table_lookup (registry->priv->sources, source_id);
+  if (source || g_hash_table_size (registry->priv->lazy_plugins) == 0) {
+    return source;
+  }
+
+  g_hash_table_iter_init (&iter, registry->priv->lazy_plugins);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pinfo)) {
+    if (declares_source (pinfo, source_id)) {
+      load_lazy_plugin (registry, pinfo);
+      return g_hash_table_lookup (registry->priv->sources, source_id);
+    }
+  }
+
+  return NULL;
 }
 
 /**
  * grl_plugin_registry_get_sources:
  * @registry: the registry instance
- * @ranked: whether the returned list shall be returned ordered by rank
+ * @ranked: ignored, the sources are always ordered by rank
  *
  * This function will return all the available sources in the @registry.
+ * It loads all the deferred plugins first; use
+ * grl_plugin_registry_get_deferred_sources() to list their sources without
+ * loading them.
  *
- * If @ranked is %TRUE, the source list will be ordered by rank.
+ * The list is a copy of the one kept by the @registry, which is always
+ * ordered by rank, highest first, whatever the value of @ranked.
  *
  * Returns: (element-type Grl.MediaPlugin) (transfer container): a #GList of
  * available #GrlMediaPlugins<!-- -->s. The content of the list should not be
@@ -898,34 +1974,26 @@ GList *
 grl_plugin_registry_get_sources (GrlPluginRegistry *registry,
 				 gboolean ranked)
 {
-  GHashTableIter iter;
-  GList *source_list = NULL;
-  GrlMediaPlugin *current_plugin;
-
   g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
 
-  g_hash_table_iter_init (&iter, registry->priv->sources);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &current_plugin)) {
-    source_list = g_list_prepend (source_list, current_plugin);
-  }
-
-  if (ranked) {
-    source_list = g_list_sort (source_list, (GCompareFunc) compare_by_rank);
-  }
-
-  return source_list;
+  /* Sources are always indexed by rank */
+  return g_list_copy ((GList *)
+                      grl_plugin_registry_peek_sources_by_operations (registry,
+                                                                      GRL_OP_NONE));
 }
 
 /**
  * grl_plugin_registry_get_sources_by_operations:
  * @registry: the registry instance
  * @ops: a bitwise mangle of the requested operations.
- * @ranked: whether the returned list shall be returned ordered by rank
+ * @ranked: ignored, the sources are always ordered by rank
  *
  * Give an array of all the available sources in the @registry capable of
  * perform the operations requested in @ops.
  *
- * If @ranked is %TRUE, the source list will be ordered by rank.
+ * The list is a copy of the one kept by the @registry, which is always
+ * ordered by rank, highest first, whatever the value of @ranked. The
+ * operations supported by a source are read when it is registered.
  *
  * Returns: (element-type Grl.MediaPlugin) (transfer container): a #GList of
  * available #GrlMediaPlugins<!-- -->s. The content of the list should not be
@@ -938,27 +2006,376 @@ grl_plugin_registry_get_sources_by_operations (GrlPluginRegistry *registry,
                                                GrlSupportedOps ops,
                                                gboolean ranked)
 {
-  GHashTableIter iter;
-  GList *source_list = NULL;
-  GrlMediaPlugin *p;
+  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
+
+  /* Sources are always indexed by rank */
+  return g_list_copy ((GList *)
+                      grl_plugin_registry_peek_sources_by_operations (registry,
+                                                                      ops));
+}
 
+/**
+ * grl_plugin_registry_peek_sources_by_operations:
+ * @registry: the registry instance
+ * @ops: a bitwise mangle of the requested operations.
+ *
+ * Like grl_plugin_registry_get_sources_by_operations() with @ranked set to
+ * %TRUE, but the list is not copied: it is kept by the @registry, which
+ * updates it as sources are added and removed, so looking it up again is
+ * cheap.
+ *
+ * Operations supported by a source are read when it is registered.
+ *
+ * Like the rest of the registry, it must be used from the main thread, as it
+ * may load deferred plugins; see grl_plugin_registry_get_snapshot() for
+ * other threads.
+ *
+ * Returns: (element-type Grl.MediaPlugin) (transfer none): a #GList of
+ * available #GrlMediaPlugins<!-- -->s, by rank. It must not be modified or
+ * freed, and it is only valid until a source is added or removed; use
+ * g_list_copy() to keep it longer.
+ *
+ * Since: 0.1.21
+ */
+const GList *
+grl_plugin_registry_peek_sources_by_operations (GrlPluginRegistry *registry,
+                                                GrlSupportedOps ops)
+{
   g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
 
-  g_hash_table_iter_init (&iter, registry->priv->sources);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &p)) {
-    GrlSupportedOps source_ops;
-    source_ops =
-      grl_metadata_source_supported_operations (GRL_METADATA_SOURCE (p));
-    if ((source_ops & ops) == ops) {
-      source_list = g_list_prepend (source_list, p);
+  load_lazy_plugins (registry, ops);
+
+  return get_ops_index (registry, ops)->head;
+}
+
+/**
+ * grl_plugin_registry_peek_sources_by_key:
+ * @registry: the registry instance
+ * @key: a metadata key
+ * @keys: which keys of the sources to look into
+ *
+ * Gets the sources having @key in their supported, slow or writable keys,
+ * depending on @keys. Like grl_plugin_registry_peek_sources_by_operations(),
+ * the list is kept by the @registry.
+ *
+ * Keys of a source are read when it is registered. As the keys of the
+ * sources of deferred plugins are not known, all of them are loaded first;
+ * see grl_plugin_registry_set_lazy_loading().
+ *
+ * Returns: (element-type Grl.MediaPlugin) (transfer none): a #GList of
+ * #GrlMediaPlugins<!-- -->s, by rank. It must not be modified or freed, and
+ * it is only valid until a source is added or removed.
+ *
+ * Since: 0.1.21
+ */
+const GList *
+grl_plugin_registry_peek_sources_by_key (GrlPluginRegistry *registry,
+                                         GrlKeyID key,
+                                         GrlSourceKeys keys)
+{
+  GQueue *sources;
+
+  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
+  g_return_val_if_fail (keys <= GRL_SOURCE_KEYS_WRITABLE, NULL);
+
+  load_lazy_plugins (registry, GRL_OP_NONE);
+
+  sources = g_hash_table_lookup (registry->priv->keys_index[keys], key);
+
+  return sources? sources->head: NULL;
+}
+
+/**
+ * grl_plugin_registry_get_deferred_sources:
+ * @registry: the registry instance
+ * @ops: a bitwise mangle of the requested operations, or %GRL_OP_NONE for
+ * all
+ *
+ * Gets the identifiers of the sources whose plugins are deferred, as
+ * declared in their information files, without loading them. Sources of
+ * plugins not declaring their operations are always included, as they may
+ * support @ops.
+ *
+ * Once a plugin is loaded, its sources are available through
+ * grl_plugin_registry_peek_sources_by_operations() instead.
+ *
+ * Returns: (element-type utf8) (transfer full): a #GList of source
+ * identifiers, by rank of their plugins. Use g_list_foreach() with g_free()
+ * and g_list_free() when done using the list.
+ *
+ * Since: 0.1.21
+ */
+GList *
+grl_plugin_registry_get_deferred_sources (GrlPluginRegistry *registry,
+                                          GrlSupportedOps ops)
+{
+  GList *plugins;
+  GList *l;
+  GList *source_ids = NULL;
+  gchar **sources;
+  guint i;
+
+  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
+
+  plugins = get_lazy_plugins (registry, ops);
+  for (l = plugins; l; l = g_list_next (l)) {
+    sources = get_info_list (l->data, GRL_PLUGIN_INFO_SOURCES);
+    for (i = 0; sources && sources[i]; i++) {
+      if (*sources[i]) {
+        source_ids = g_list_prepend (source_ids, g_strdup (sources[i]));
+      }
     }
+    g_strfreev (sources);
   }
+  g_list_free (plugins);
+
+  return g_list_reverse (source_ids);
+}
 
-  if (ranked) {
-    source_list = g_list_sort (source_list, compare_by_rank);
+/**
+ * grl_plugin_registry_get_snapshot:
+ * @registry: the registry instance
+ *
+ * Gets an immutable view of the sources and the metadata key relations in
+ * @registry. It does not change when sources are added or removed later on,
+ * and it holds a reference on its sources, so it can be used during a whole
+ * operation. Getting it is cheap, as the same snapshot is shared until the
+ * @registry changes.
+ *
+ * The references do not keep plugins loaded: grl_plugin_registry_unload()
+ * deinitializes a plugin right away, so its sources must not be used after
+ * that, even through a snapshot taken before.
+ *
+ * Unlike the rest of the registry, this function and the snapshot can be
+ * used from any thread, like the ones running the operations of a source
+ * (see grl_metadata_source_set_max_threads()).
+ *
+ * Plugins whose load is deferred (see grl_plugin_registry_set_lazy_loading())
+ * are not part of the snapshot until they are loaded.
+ *
+ * Returns: (transfer full): a #GrlPluginRegistrySnapshot. Use
+ * grl_plugin_registry_snapshot_unref() when done with it.
+ *
+ * Since: 0.1.21
+ */
+GrlPluginRegistrySnapshot *
+grl_plugin_registry_get_snapshot (GrlPluginRegistry *registry)
+{
+  GrlPluginRegistrySnapshot *snapshot;
+
+  g_return_val_if_fail (GRL_IS_PLUGIN_REGISTRY (registry), NULL);
+
+  g_mutex_lock (registry->priv->snapshot_lock);
+  if (!registry->priv->snapshot) {
+    registry->priv->snapshot = snapshot_new (registry);
+  }
+  snapshot = grl_plugin_registry_snapshot_ref (registry->priv->snapshot);
+  g_mutex_unlock (registry->priv->snapshot_lock);
+
+  return snapshot;
+}
+
+GType
+grl_plugin_registry_snapshot_get_type (void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter (&type)) {
+    GType t =
+      g_boxed_type_register_static (g_intern_static_string ("GrlPluginRegistrySnapshot"),
+                                    (GBoxedCopyFunc) grl_plugin_registry_snapshot_ref,
+                                    (GBoxedFreeFunc) grl_plugin_registry_snapshot_unref);
+    g_once_init_leave (&type, t);
+  }
+
+  return type;
+}
+
+/**
+ * grl_plugin_registry_snapshot_ref:
+ * @snapshot: a registry snapshot
+ *
+ * Increases the reference count of @snapshot.
+ *
+ * Returns: (transfer full): @snapshot
+ *
+ * Since: 0.1.21
+ */
+GrlPluginRegistrySnapshot *
+grl_plugin_registry_snapshot_ref (GrlPluginRegistrySnapshot *snapshot)
+{
+  g_return_val_if_fail (snapshot != NULL, NULL);
+
+  g_atomic_int_inc (&snapshot->refcount);
+
+  return snapshot;
+}
+
+/**
+ * grl_plugin_registry_snapshot_unref:
+ * @snapshot: a registry snapshot
+ *
+ * Decreases the reference count of @snapshot, releasing it and its
+ * sources when it drops to zero.
+ *
+ * Since: 0.1.21
+ */
+void
+grl_plugin_registry_snapshot_unref (GrlPluginRegistrySnapshot *snapshot)
+{
+  g_return_if_fail (snapshot != NULL);
+
+  if (g_atomic_int_dec_and_test (&snapshot->refcount)) {
+    g_hash_table_destroy (snapshot->sources);
+    g_hash_table_destroy (snapshot->ops_index);
+    if (snapshot->combined_index) {
+      g_hash_table_destroy (snapshot->combined_index);
+    }
+    g_hash_table_destroy (snapshot->related_keys);
+    g_list_foreach (snapshot->relations, (GFunc) g_list_free, NULL);
+    g_list_free (snapshot->relations);
+    g_mutex_free (snapshot->lock);
+    g_slice_free (GrlPluginRegistrySnapshot, snapshot);
+  }
+}
+
+/**
+ * grl_plugin_registry_snapshot_lookup_source:
+ * @snapshot: a registry snapshot
+ * @source_id: the id of a source
+ *
+ * Like grl_plugin_registry_lookup_source(), on @snapshot.
+ *
+ * Returns: (transfer none): the source, or %NULL if it was not registered
+ * when @snapshot was taken
+ *
+ * Since: 0.1.21
+ */
+GrlMediaPlugin *
+grl_plugin_registry_snapshot_lookup_source (GrlPluginRegistrySnapshot *snapshot,
+                                            const gchar *source_id)
+{
+  g_return_val_if_fail (snapshot != NULL, NULL);
+  g_return_val_if_fail (source_id != NULL, NULL);
+
+  return g_hash_table_lookup (snapshot->sources, source_id);
+}
+
+/**
+ * grl_plugin_registry_snapshot_get_sources:
+ * @snapshot: a registry snapshot
+ *
+ * Gets all the sources in @snapshot.
+ *
+ * Returns: (element-type Grl.MediaPlugin) (transfer none): a #GList of
+ * #GrlMediaPlugins<!-- -->s, by rank. It is owned by @snapshot and must not
+ * be modified or freed.
+ *
+ * Since: 0.1.21
+ */
+const GList *
+grl_plugin_registry_snapshot_get_sources (GrlPluginRegistrySnapshot *snapshot)
+{
+  return grl_plugin_registry_snapshot_get_sources_by_operations (snapshot,
+                                                                 GRL_OP_NONE);
+}
+
+static gboolean
+snapshot_source_supports (GrlPluginRegistrySnapshot *snapshot,
+                          GrlMediaPlugin *source,
+                          GrlSupportedOps ops)
+{
+  GrlSupportedOps op;
+  GList *sources;
+
+  for (op = GRL_OP_METADATA; op <= GRL_OP_NOTIFY_CHANGE; op <<= 1) {
+    if (!(ops & op)) {
+      continue;
+    }
+    sources = g_hash_table_lookup (snapshot->ops_index, GUINT_TO_POINTER (op));
+    if (!g_list_find (sources, source)) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+ * grl_plugin_registry_snapshot_get_sources_by_operations:
+ * @snapshot: a registry snapshot
+ * @ops: a bitwise mangle of the requested operations.
+ *
+ * Like grl_plugin_registry_peek_sources_by_operations(), on @snapshot.
+ *
+ * Returns: (element-type Grl.MediaPlugin) (transfer none): a #GList of
+ * #GrlMediaPlugins<!-- -->s, by rank. It is owned by @snapshot and must not
+ * be modified or freed.
+ *
+ * Since: 0.1.21
+ */
+const GList *
+grl_plugin_registry_snapshot_get_sources_by_operations (GrlPluginRegistrySnapshot *snapshot,
+                                                        GrlSupportedOps ops)
+{
+  GList *all_sources;
+  GList *sources = NULL;
+  GList *l;
+  gpointer value;
+
+  g_return_val_if_fail (snapshot != NULL, NULL);
+
+  /* Sets of operations indexed when the snapshot was taken, which include
+     all the single operations, never change */
+  if (g_hash_table_lookup_extended (snapshot->ops_index,
+                                    GUINT_TO_POINTER (ops), NULL, &value)) {
+    return value;
+  }
+
+  g_mutex_lock (snapshot->lock);
+  if (!snapshot->combined_index) {
+    snapshot->combined_index =
+      g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                             NULL, (GDestroyNotify) g_list_free);
   }
+  if (!g_hash_table_lookup_extended (snapshot->combined_index,
+                                     GUINT_TO_POINTER (ops), NULL, &value)) {
+    all_sources = g_hash_table_lookup (snapshot->ops_index,
+                                       GUINT_TO_POINTER (GRL_OP_NONE));
+    for (l = all_sources; l; l = g_list_next (l)) {
+      if (snapshot_source_supports (snapshot, l->data, ops)) {
+        sources = g_list_prepend (sources, l->data);
+      }
+    }
+    value = g_list_reverse (sources);
+    g_hash_table_insert (snapshot->combined_index,
+                         GUINT_TO_POINTER (ops), value);
+  }
+  g_mutex_unlock (snapshot->lock);
+
+  return value;
+}
+
+/**
+ * grl_plugin_registry_snapshot_lookup_metadata_key_relation:
+ * @snapshot: a registry snapshot
+ * @key: a metadata key
+ *
+ * Like grl_plugin_registry_lookup_metadata_key_relation(), on @snapshot.
+ *
+ * Returns: (element-type GObject.ParamSpec) (transfer none): a #GList of
+ * related keys, or %NULL if @key was not registered when @snapshot was
+ * taken. It is owned by @snapshot and must not be modified or freed.
+ *
+ * Since: 0.1.21
+ */
+const GList *
+grl_plugin_registry_snapshot_lookup_metadata_key_relation (GrlPluginRegistrySnapshot *snapshot,
+                                                           GrlKeyID key)
+{
+  g_return_val_if_fail (snapshot != NULL, NULL);
 
-  return source_list;
+  return g_hash_table_lookup (snapshot->related_keys, key);
 }
 
 /**
@@ -970,6 +2387,9 @@ grl_plugin_registry_get_sources_by_operations (GrlPluginRegistry *registry,
  * Unload from memory a module identified by @plugin_id. This means call the
  * module's deinit function.
  *
+ * Its sources are unregistered first, but snapshots taken before still
+ * reference them; they must not be used once the plugin is unloaded.
+ *
  * Returns: %TRUE% on success.
  *
  * Since: 0.1.7
@@ -1001,7 +2421,7 @@ grl_plugin_registry_unload (GrlPluginRegistry *registry,
 
   /* Second, shut down any sources spawned by this plugin */
   GRL_DEBUG ("Shutting down sources spawned by '%s'", plugin_id);
-  sources = grl_plugin_registry_get_sources (registry, FALSE);
+  sources = g_hash_table_get_values (registry->priv->sources);
 
   for (sources_iter = sources; sources_iter;
       sources_iter = g_list_next (sources_iter)) {
@@ -1070,9 +2490,12 @@ grl_plugin_registry_register_metadata_key (GrlPluginRegistry *registry,
                               key,
                               GRL_TYPE_MEDIA);
     /* Each key is related with itself */
+    g_mutex_lock (registry->priv->snapshot_lock);
     g_hash_table_insert (registry->priv->related_keys,
                          key,
                          g_list_prepend (NULL, key));
+    invalidate_snapshot (registry);
+    g_mutex_unlock (registry->priv->snapshot_lock);
     return key;
   }
 }
@@ -1121,6 +2544,8 @@ grl_plugin_registry_register_metadata_key_relation (GrlPluginRegistry *registry,
   }
 
   /* Merge both relations [related(key1), related(key2)] */
+  g_mutex_lock (registry->priv->snapshot_lock);
+
   key1_partners = g_list_concat(key1_partners, key2_partners);
 
   for (key1_peer = key1_partners;
@@ -1128,6 +2553,9 @@ grl_plugin_registry_register_metadata_key_relation (GrlPluginRegistry *registry,
        key1_peer = g_list_next (key1_peer)) {
     g_hash_table_insert (registry->priv->related_keys, key1_peer->data, key1_partners);
   }
+  invalidate_snapshot (registry);
+
+  g_mutex_unlock (registry->priv->snapshot_lock);
 }
 
 /**
@@ -39,12 +39,16 @@
 #define GRL_PLUGIN_PATH_VAR "GRL_PLUGIN_PATH"
 #define GRL_PLUGIN_LIST_VAR "GRL_PLUGIN_LIST"
 #define GRL_PLUGIN_RANKS_VAR "GRL_PLUGIN_RANKS"
+#define GRL_PLUGIN_LOAD_THREADS_VAR "GRL_PLUGIN_LOAD_THREADS"
 
 /* Macros */
 
 #define GRL_TYPE_PLUGIN_REGISTRY                \
   (grl_plugin_registry_get_type ())
 
+#define GRL_TYPE_PLUGIN_REGISTRY_SNAPSHOT       \
+  (grl_plugin_registry_snapshot_get_type ())
+
 #define GRL_PLUGIN_REGISTRY(obj)                                \
   (G_TYPE_CHECK_INSTANCE_CAST ((obj),                           \
                                GRL_TYPE_PLUGIN_REGISTRY,        \
@@ -165,6 +169,33 @@ typedef enum {
   GRL_PLUGIN_RANK_HIGHEST =  64
 } GrlPluginRank;
 
+/**
+ * GrlSourceKeys:
+ * @GRL_SOURCE_KEYS_SUPPORTED: keys the source can fetch
+ * @GRL_SOURCE_KEYS_SLOW: keys that are slow to fetch
+ * @GRL_SOURCE_KEYS_WRITABLE: keys the source can write
+ *
+ * Lists of keys of a source, as in grl_metadata_source_supported_keys(),
+ * grl_metadata_source_slow_keys() and grl_metadata_source_writable_keys().
+ *
+ * Since: 0.1.21
+ */
+typedef enum {
+  GRL_SOURCE_KEYS_SUPPORTED,
+  GRL_SOURCE_KEYS_SLOW,
+  GRL_SOURCE_KEYS_WRITABLE
+} GrlSourceKeys;
+
+/**
+ * GrlPluginRegistrySnapshot:
+ *
+ * An immutable, reference counted view of a #GrlPluginRegistry, that can
+ * be used from any thread. See grl_plugin_registry_get_snapshot().
+ *
+ * Since: 0.1.21
+ */
+typedef struct _GrlPluginRegistrySnapshot GrlPluginRegistrySnapshot;
+
 /* GrlPluginRegistry object */
 
 typedef struct _GrlPluginRegistryPrivate GrlPluginRegistryPrivate;
@@ -225,6 +256,15 @@ gboolean grl_plugin_registry_load_by_id (GrlPluginRegistry *registry,
                                          const gchar *plugin_id,
                                          GError **error);
 
+void grl_plugin_registry_set_load_threads (GrlPluginRegistry *registry,
+                                           guint threads);
+
+void grl_plugin_registry_set_lazy_loading (GrlPluginRegistry *registry,
+                                           gboolean lazy);
+
+gdouble grl_plugin_registry_get_load_time (GrlPluginRegistry *registry,
+                                           const gchar *plugin_id);
+
 gboolean grl_plugin_registry_register_source (GrlPluginRegistry *registry,
                                               const GrlPluginInfo *plugin,
                                               GrlMediaPlugin *source,
@@ -244,6 +284,35 @@ GList *grl_plugin_registry_get_sources_by_operations (GrlPluginRegistry *registr
                                                                 GrlSupportedOps ops,
                                                                 gboolean ranked);
 
+const GList *grl_plugin_registry_peek_sources_by_operations (GrlPluginRegistry *registry,
+                                                             GrlSupportedOps ops);
+
+const GList *grl_plugin_registry_peek_sources_by_key (GrlPluginRegistry *registry,
+                                                      GrlKeyID key,
+                                                      GrlSourceKeys keys);
+
+GList *grl_plugin_registry_get_deferred_sources (GrlPluginRegistry *registry,
+                                                 GrlSupportedOps ops);
+
+GrlPluginRegistrySnapshot *grl_plugin_registry_get_snapshot (GrlPluginRegistry *registry);
+
+GType grl_plugin_registry_snapshot_get_type (void);
+
+GrlPluginRegistrySnapshot *grl_plugin_registry_snapshot_ref (GrlPluginRegistrySnapshot *snapshot);
+
+void grl_plugin_registry_snapshot_unref (GrlPluginRegistrySnapshot *snapshot);
+
+GrlMediaPlugin *grl_plugin_registry_snapshot_lookup_source (GrlPluginRegistrySnapshot *snapshot,
+                                                            const gchar *source_id);
+
+const GList *grl_plugin_registry_snapshot_get_sources (GrlPluginRegistrySnapshot *snapshot);
+
+const GList *grl_plugin_registry_snapshot_get_sources_by_operations (GrlPluginRegistrySnapshot *snapshot,
+                                                                     GrlSupportedOps ops);
+
+const GList *grl_plugin_registry_snapshot_lookup_metadata_key_relation (GrlPluginRegistrySnapshot *snapshot,
+                                                                        GrlKeyID key);
+
 GrlKeyID grl_plugin_registry_register_metadata_key (GrlPluginRegistry *registry,
                                                     GParamSpec *key,
                                                     GError **error);
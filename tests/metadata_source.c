@@ -22,6 +22,8 @@
 #include <grilo.h>
 #include <stdbool.h>
 
+#include "test-utils.h"
+
 static GList *sources;
 static GList *keys;
 
@@ -51,8 +53,161 @@ registry_load_error_handler (const gchar *log_domain,
   return TRUE;
 }
 
+static gboolean
+threaded_error_handler (const gchar *log_domain,
+                        GLogLevelFlags log_level,
+                        const gchar *message,
+                        gpointer user_data)
+{
+  if (CHECK_MESSAGE ("Grilo", "emitted results after finishing") ||
+      CHECK_MESSAGE ("Grilo", "returned without finishing")) {
+    return FALSE;
+  }
+
+  return registry_load_error_handler (log_domain, log_level, message,
+                                      user_data);
+}
+
+#endif
+
+/* A source browsing from worker threads, which keeps using the spec after
+   emitting its last result */
+
+#define TEST_TYPE_THREADED_SOURCE (test_threaded_source_get_type ())
+
+typedef struct {
+  GrlMediaSource parent;
+  gboolean finish;
+  volatile gint returned;
+} TestThreadedSource;
+
+typedef struct {
+  GrlMediaSourceClass parent_class;
+} TestThreadedSourceClass;
+
+static GType test_threaded_source_get_type (void);
+
+G_DEFINE_TYPE (TestThreadedSource, test_threaded_source, GRL_TYPE_MEDIA_SOURCE);
+
+static GThread *main_thread;
+
+static void
+test_threaded_source_browse (GrlMediaSource *source,
+                             GrlMediaSourceBrowseSpec *bs)
+{
+  TestThreadedSource *threaded_source = (TestThreadedSource *) source;
+  guint i;
+
+  g_assert (g_thread_self () != main_thread);
+
+  for (i = 0; threaded_source->finish && i < bs->count; i++) {
+    bs->callback (source, bs->browse_id, grl_media_new (),
+                  bs->count - i - 1, bs->user_data, NULL);
+  }
+
+  /* Give the main loop a chance to relay the last result */
+  g_usleep (G_USEC_PER_SEC / 20);
+
+  /* Still valid, until we return */
+  if (threaded_source->finish) {
+    bs->callback (source, bs->browse_id, grl_media_new (),
+                  bs->count, bs->user_data, NULL);
+  }
+
+  g_atomic_int_set (&threaded_source->returned, TRUE);
+}
+
+static void
+test_threaded_source_class_init (TestThreadedSourceClass *klass)
+{
+  GRL_MEDIA_SOURCE_CLASS (klass)->browse = test_threaded_source_browse;
+}
+
+static void
+test_threaded_source_init (TestThreadedSource *source)
+{
+}
+
+typedef struct {
+  TestThreadedSource *source;
+  GMainLoop *loop;
+  guint results;
+  guint remaining;
+} ThreadedBrowseData;
+
+static void
+threaded_browse_cb (GrlMediaSource *source,
+                    guint browse_id,
+                    GrlMedia *media,
+                    guint remaining,
+                    gpointer user_data,
+                    const GError *error)
+{
+  ThreadedBrowseData *data = (ThreadedBrowseData *) user_data;
+
+  g_assert (g_thread_self () == main_thread);
+  g_assert_no_error ((GError *) error);
+
+  if (media) {
+    data->results++;
+    g_object_unref (media);
+  }
+
+  data->remaining = remaining;
+  if (remaining == 0) {
+    /* The spec is released only after the plugin is done with it */
+    g_assert (g_atomic_int_get (&data->source->returned));
+    g_main_loop_quit (data->loop);
+  }
+}
+
+static void
+test_metadata_source_threaded (void)
+{
+  ThreadedBrowseData data = { 0 };
+  GList *keys;
+
+#if GLIB_CHECK_VERSION(2,22,0)
+  g_test_log_set_fatal_handler (threaded_error_handler, NULL);
 #endif
 
+  data.source = g_object_new (TEST_TYPE_THREADED_SOURCE,
+                              "source-id", "test-threaded-source",
+                              "max-threads", 2,
+                              NULL);
+  data.loop = g_main_loop_new (NULL, FALSE);
+  keys = g_list_prepend (NULL, GRL_METADATA_KEY_TITLE);
+
+  g_assert_cmpuint (grl_metadata_source_get_max_threads (GRL_METADATA_SOURCE (data.source)),
+                    ==, 2);
+
+  /* Results are relayed in the main thread, the late one is dropped */
+  data.source->finish = TRUE;
+  g_assert (grl_media_source_browse (GRL_MEDIA_SOURCE (data.source), NULL,
+                                     keys, 0, 5, GRL_RESOLVE_NORMAL,
+                                     threaded_browse_cb, &data));
+  g_main_loop_run (data.loop);
+  g_assert_cmpuint (data.results, ==, 5);
+
+  /* Operations left unfinished by the plugin are finished for it */
+  data.source->finish = FALSE;
+  data.source->returned = FALSE;
+  data.results = 0;
+  g_assert (grl_media_source_browse (GRL_MEDIA_SOURCE (data.source), NULL,
+                                     keys, 0, 5, GRL_RESOLVE_NORMAL,
+                                     threaded_browse_cb, &data));
+  g_main_loop_run (data.loop);
+  g_assert_cmpuint (data.results, ==, 0);
+
+  g_list_free (keys);
+  g_main_loop_unref (data.loop);
+  g_object_unref (data.source);
+
+#if GLIB_CHECK_VERSION(2,22,0)
+  g_test_log_set_fatal_handler (registry_load_error_handler, NULL);
+#endif
+}
+
 static bool
 load_metadata_sources ()
 {
@@ -158,12 +313,20 @@ test_metadata_source_writable_keys (void)
 int
 main (int argc, char **argv)
 {
+  gchar *cache_dir;
+  gint result;
+
+  /* Keep the plugin information cache out of the user's */
+  cache_dir = test_use_tmp_cache_dir ();
+
   /* initialize the gtester */
   g_test_init (&argc, &argv, NULL);
 
   /* initialize grilo */
   grl_init (&argc, &argv);
 
+  main_thread = g_thread_self ();
+
   g_assert (load_metadata_sources ());
 
   /* registry tests */
@@ -176,5 +339,13 @@ main (int argc, char **argv)
   g_test_add_func ("/metadata_source/filter_writable_keys",
 		   test_metadata_source_writable_keys);
 
-  return g_test_run ();
+  g_test_add_func ("/metadata_source/threaded",
+		   test_metadata_source_threaded);
+
+  result = g_test_run ();
+
+  test_remove_tree (cache_dir);
+  g_free (cache_dir);
+
+  return result;
 }
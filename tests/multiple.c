@@ -0,0 +1,733 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#undef G_DISABLE_ASSERT
+
+#include <string.h>
+
+#include <glib.h>
+#include <grilo.h>
+
+/* ================ Test source ================ */
+
+/* A source with items "test://item/<first>" .. "test://item/<first+total-1>",
+   answering searches synchronously from the operation idle, and browses
+   after a delay.
+
+   It also resolves any URI starting with its accepted prefix, after a delay
+   if asked to. Delayed requests finish as soon as they are cancelled */
+
+#define TEST_TYPE_SOURCE (test_source_get_type ())
+#define TEST_SOURCE(obj)                                        \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), TEST_TYPE_SOURCE, TestSource))
+
+typedef struct {
+  GrlMediaSource parent;
+  GrlPluginInfo info;
+  guint first;
+  guint total;
+  guint searches;
+  const gchar *accept;
+  gboolean fail;
+  guint delay;
+  guint probes;
+  guint cancelled;
+  GList *answers;
+} TestSource;
+
+typedef struct {
+  GrlMediaSourceClass parent_class;
+} TestSourceClass;
+
+static GType test_source_get_type (void);
+
+typedef struct {
+  TestSource *source;
+  GrlMediaSourceMediaFromUriSpec *spec;
+  guint timeout_id;
+} TestAnswer;
+
+typedef struct {
+  TestSource *source;
+  GrlMediaSourceBrowseSpec *spec;
+} TestBrowse;
+
+G_DEFINE_TYPE (TestSource, test_source, GRL_TYPE_MEDIA_SOURCE);
+
+/* Browses running at the same time, among all the test sources */
+static guint browses_running = 0;
+static guint browses_max_running = 0;
+
+static GrlMedia *
+test_source_new_media (TestSource *source,
+                       guint index)
+{
+  GrlMedia *media;
+  gchar *url;
+
+  url = g_strdup_printf ("test://item/%u", source->first + index);
+  media = grl_media_new ();
+  grl_media_set_id (media, url);
+  grl_media_set_url (media, url);
+  g_free (url);
+
+  return media;
+}
+
+/* The operation spec is freed with the last result, so the parameters are
+   passed by value */
+static void
+test_source_emit (TestSource *source,
+                  guint operation_id,
+                  guint skip,
+                  guint count,
+                  GrlMediaSourceResultCb callback,
+                  gpointer user_data)
+{
+  guint i;
+
+  count = (skip < source->total) ? MIN (count, source->total - skip) : 0;
+  if (count == 0) {
+    callback (GRL_MEDIA_SOURCE (source), operation_id, NULL, 0, user_data,
+              NULL);
+    return;
+  }
+
+  for (i = 0; i < count; i++) {
+    callback (GRL_MEDIA_SOURCE (source),
+              operation_id,
+              test_source_new_media (source, skip + i),
+              count - i - 1,
+              user_data,
+              NULL);
+  }
+}
+
+static void
+test_source_search (GrlMediaSource *source,
+                    GrlMediaSourceSearchSpec *ss)
+{
+  TestSource *test_source = TEST_SOURCE (source);
+
+  test_source->searches++;
+
+  test_source_emit (test_source, ss->search_id, ss->skip, ss->count,
+                    ss->callback, ss->user_data);
+}
+
+static gboolean
+test_source_browse_timeout (gpointer user_data)
+{
+  TestBrowse *browse = (TestBrowse *) user_data;
+  GrlMediaSourceBrowseSpec *bs = browse->spec;
+
+  browses_running--;
+  test_source_emit (browse->source, bs->browse_id, bs->skip, bs->count,
+                    bs->callback, bs->user_data);
+  g_slice_free (TestBrowse, browse);
+
+  return FALSE;
+}
+
+static void
+test_source_browse (GrlMediaSource *source,
+                    GrlMediaSourceBrowseSpec *bs)
+{
+  TestBrowse *browse;
+
+  browses_running++;
+  browses_max_running = MAX (browses_max_running, browses_running);
+
+  browse = g_slice_new (TestBrowse);
+  browse->source = TEST_SOURCE (source);
+  browse->spec = bs;
+  g_timeout_add (10, test_source_browse_timeout, browse);
+}
+
+static gboolean
+test_source_test_media_from_uri (GrlMediaSource *source,
+                                 const gchar *uri)
+{
+  TestSource *test_source = TEST_SOURCE (source);
+
+  test_source->probes++;
+
+  return g_str_has_prefix (uri, test_source->accept);
+}
+
+static void
+test_source_answer (TestSource *source,
+                    GrlMediaSourceMediaFromUriSpec *mfus)
+{
+  GrlMedia *media;
+  GError *error;
+
+  if (source->fail) {
+    error = g_error_new (GRL_CORE_ERROR,
+                         GRL_CORE_ERROR_MEDIA_FROM_URI_FAILED,
+                         "Failed to resolve '%s'", mfus->uri);
+    mfus->callback (GRL_MEDIA_SOURCE (source), mfus->media_from_uri_id,
+                    NULL, mfus->user_data, error);
+    g_error_free (error);
+    return;
+  }
+
+  media = grl_media_new ();
+  grl_media_set_url (media, mfus->uri);
+  mfus->callback (GRL_MEDIA_SOURCE (source), mfus->media_from_uri_id,
+                  media, mfus->user_data, NULL);
+}
+
+static gboolean
+test_source_answer_timeout (gpointer user_data)
+{
+  TestAnswer *answer = (TestAnswer *) user_data;
+
+  answer->source->answers = g_list_remove (answer->source->answers, answer);
+  test_source_answer (answer->source, answer->spec);
+  g_slice_free (TestAnswer, answer);
+
+  return FALSE;
+}
+
+static void
+test_source_media_from_uri (GrlMediaSource *source,
+                            GrlMediaSourceMediaFromUriSpec *mfus)
+{
+  TestSource *test_source = TEST_SOURCE (source);
+  TestAnswer *answer;
+
+  if (test_source->delay == 0) {
+    test_source_answer (test_source, mfus);
+    return;
+  }
+
+  answer = g_slice_new (TestAnswer);
+  answer->source = test_source;
+  answer->spec = mfus;
+  answer->timeout_id = g_timeout_add (test_source->delay,
+                                      test_source_answer_timeout,
+                                      answer);
+  test_source->answers = g_list_prepend (test_source->answers, answer);
+}
+
+static void
+test_source_cancel (GrlMetadataSource *source,
+                    guint operation_id)
+{
+  TestSource *test_source = TEST_SOURCE (source);
+  GList *iter;
+
+  for (iter = test_source->answers; iter; iter = g_list_next (iter)) {
+    TestAnswer *answer = (TestAnswer *) iter->data;
+
+    if (answer->spec->media_from_uri_id == operation_id) {
+      test_source->cancelled++;
+      g_source_remove (answer->timeout_id);
+      test_source_answer_timeout (answer);
+      break;
+    }
+  }
+}
+
+static void
+test_source_class_init (TestSourceClass *klass)
+{
+  GrlMetadataSourceClass *metadata_class = GRL_METADATA_SOURCE_CLASS (klass);
+  GrlMediaSourceClass *source_class = GRL_MEDIA_SOURCE_CLASS (klass);
+
+  metadata_class->cancel = test_source_cancel;
+  source_class->search = test_source_search;
+  source_class->browse = test_source_browse;
+  source_class->test_media_from_uri = test_source_test_media_from_uri;
+  source_class->media_from_uri = test_source_media_from_uri;
+}
+
+static void
+test_source_init (TestSource *source)
+{
+  source->accept = "test:";
+}
+
+static TestSource *
+test_source_new (const gchar *id,
+                 gint rank)
+{
+  TestSource *source;
+
+  source = g_object_new (TEST_TYPE_SOURCE,
+                         "source-id", id,
+                         "source-name", id,
+                         NULL);
+  source->info.id = (gchar *) "test-plugin";
+  source->info.rank = rank;
+
+  g_assert (grl_plugin_registry_register_source (grl_plugin_registry_get_default (),
+                                                 &source->info,
+                                                 GRL_MEDIA_PLUGIN (source),
+                                                 NULL));
+
+  return source;
+}
+
+static void
+test_source_free (TestSource *source)
+{
+  grl_plugin_registry_unregister_source (grl_plugin_registry_get_default (),
+                                         GRL_MEDIA_PLUGIN (source),
+                                         NULL);
+}
+
+/* ================ Fixture ================ */
+
+typedef struct {
+  GMainLoop *loop;
+  GList *sources;
+  GHashTable *urls;
+  guint results;
+  gboolean finished;
+  GrlMediaSource *winner;
+  GError *error;
+} MultipleFixture;
+
+static void
+multiple_fixture_setup (MultipleFixture *fixture,
+                        gconstpointer data)
+{
+  fixture->loop = g_main_loop_new (NULL, TRUE);
+  fixture->urls = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+multiple_fixture_teardown (MultipleFixture *fixture,
+                           gconstpointer data)
+{
+  g_list_foreach (fixture->sources, (GFunc) test_source_free, NULL);
+  g_list_free (fixture->sources);
+  g_clear_error (&fixture->error);
+  g_hash_table_unref (fixture->urls);
+  g_main_loop_unref (fixture->loop);
+}
+
+static void
+multiple_result_cb (GrlMediaSource *source,
+                    guint operation_id,
+                    GrlMedia *media,
+                    guint remaining,
+                    gpointer user_data,
+                    const GError *error)
+{
+  MultipleFixture *fixture = (MultipleFixture *) user_data;
+
+  g_assert (!fixture->finished);
+  g_assert_no_error ((GError *) error);
+
+  if (media) {
+    const gchar *url = grl_media_get_url (media);
+
+    /* Every result must be a different item */
+    g_assert (url);
+    g_assert (!g_hash_table_lookup (fixture->urls, url));
+    g_hash_table_insert (fixture->urls, g_strdup (url), GINT_TO_POINTER (1));
+    fixture->results++;
+    g_object_unref (media);
+  }
+
+  if (remaining == 0) {
+    fixture->finished = TRUE;
+    g_main_loop_quit (fixture->loop);
+  }
+}
+
+static void
+multiple_media_from_uri_cb (GrlMediaSource *source,
+                            guint operation_id,
+                            GrlMedia *media,
+                            gpointer user_data,
+                            const GError *error)
+{
+  MultipleFixture *fixture = (MultipleFixture *) user_data;
+
+  g_assert (!fixture->finished);
+  fixture->finished = TRUE;
+
+  if (media) {
+    fixture->winner = source;
+    fixture->results++;
+    g_object_unref (media);
+  }
+  if (error) {
+    fixture->error = g_error_copy (error);
+  }
+
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+multiple_media_from_uri_run (MultipleFixture *fixture,
+                             const gchar *uri,
+                             guint max_sources,
+                             guint hedge_delay,
+                             GrlMultipleProbeCache cache)
+{
+  GList *keys;
+
+  fixture->finished = FALSE;
+  fixture->winner = NULL;
+  fixture->results = 0;
+  g_clear_error (&fixture->error);
+
+  keys = g_list_prepend (NULL, GRL_METADATA_KEY_URL);
+  if (grl_multiple_get_media_from_uri_parallel (uri, keys, max_sources,
+                                                hedge_delay, cache,
+                                                GRL_RESOLVE_NORMAL,
+                                                multiple_media_from_uri_cb,
+                                                fixture)) {
+    g_main_loop_run (fixture->loop);
+  }
+  g_list_free (keys);
+
+  g_assert (fixture->finished);
+}
+
+/* Runs the main loop until the sources answered all their requests */
+static void
+multiple_wait_answers (MultipleFixture *fixture)
+{
+  GList *iter;
+
+  for (iter = fixture->sources; iter; iter = g_list_next (iter)) {
+    while (TEST_SOURCE (iter->data)->answers) {
+      g_main_context_iteration (NULL, TRUE);
+    }
+  }
+}
+
+/* ================ Tests ================ */
+
+static void
+multiple_merged_refill (MultipleFixture *fixture,
+                        gconstpointer data)
+{
+  GList *identity_keys;
+  TestSource *source_a, *source_b;
+
+  /* Items 3 to 9 are provided by both sources */
+  source_a = test_source_new ("test-source-a", 0);
+  source_a->total = 10;
+  source_b = test_source_new ("test-source-b", 0);
+  source_b->first = 3;
+  source_b->total = 10;
+  fixture->sources = g_list_append (fixture->sources, source_a);
+  fixture->sources = g_list_append (fixture->sources, source_b);
+
+  identity_keys = g_list_prepend (NULL, GRL_METADATA_KEY_URL);
+
+  g_assert (grl_multiple_search_merged (fixture->sources, "test", NULL,
+                                        identity_keys, 10, 0,
+                                        GRL_RESOLVE_NORMAL, NULL, NULL,
+                                        multiple_result_cb, fixture));
+  g_main_loop_run (fixture->loop);
+
+  /* The duplicates of the first chunk were replaced with new items */
+  g_assert (fixture->finished);
+  g_assert_cmpuint (fixture->results, ==, 10);
+  g_assert_cmpuint (g_hash_table_size (fixture->urls), ==, 10);
+  g_assert_cmpuint (source_a->searches + source_b->searches, >, 2);
+
+  g_list_free (identity_keys);
+}
+
+static void
+multiple_merged_exhausted (MultipleFixture *fixture,
+                           gconstpointer data)
+{
+  GList *identity_keys;
+  TestSource *source_a, *source_b;
+
+  /* Both sources provide the same three items */
+  source_a = test_source_new ("test-source-a", 0);
+  source_a->total = 3;
+  source_b = test_source_new ("test-source-b", 0);
+  source_b->total = 3;
+  fixture->sources = g_list_append (fixture->sources, source_a);
+  fixture->sources = g_list_append (fixture->sources, source_b);
+
+  identity_keys = g_list_prepend (NULL, GRL_METADATA_KEY_URL);
+
+  g_assert (grl_multiple_search_merged (fixture->sources, "test", NULL,
+                                        identity_keys, 10, 2,
+                                        GRL_RESOLVE_NORMAL, NULL, NULL,
+                                        multiple_result_cb, fixture));
+  g_main_loop_run (fixture->loop);
+
+  g_assert (fixture->finished);
+  g_assert_cmpuint (fixture->results, ==, 3);
+
+  g_list_free (identity_keys);
+}
+
+static void
+multiple_search_sync_no_sources (void)
+{
+  GHashTable *source_errors = NULL;
+  GError *error = NULL;
+  GList *keys, *result;
+
+  keys = g_list_prepend (NULL, GRL_METADATA_KEY_URL);
+  result = grl_multiple_search_sync_full (NULL, "test", keys, 10,
+                                          GRL_RESOLVE_NORMAL, NULL, NULL, 0,
+                                          &source_errors, &error);
+  g_list_free (keys);
+
+  g_assert (result == NULL);
+  g_assert_error (error, GRL_CORE_ERROR, GRL_CORE_ERROR_SEARCH_FAILED);
+  g_assert (source_errors);
+  g_assert_cmpuint (g_hash_table_size (source_errors), ==, 0);
+
+  g_error_free (error);
+  g_hash_table_unref (source_errors);
+}
+
+static void
+multiple_browse_concurrency (MultipleFixture *fixture,
+                             gconstpointer data)
+{
+  TestSource *source;
+  GList *keys;
+  guint i;
+
+  for (i = 0; i < 3; i++) {
+    gchar *id = g_strdup_printf ("test-source-%u", i);
+    source = test_source_new (id, 0);
+    source->first = 10 * i;
+    source->total = 2;
+    fixture->sources = g_list_append (fixture->sources, source);
+    g_free (id);
+  }
+
+  keys = g_list_prepend (NULL, GRL_METADATA_KEY_URL);
+
+  /* The limit is shared by all the sources in the operation */
+  browses_max_running = 0;
+  g_assert (grl_multiple_browse (fixture->sources, keys, 6, 1,
+                                 GRL_RESOLVE_NORMAL,
+                                 multiple_result_cb, fixture));
+  g_main_loop_run (fixture->loop);
+  g_assert (fixture->finished);
+  g_assert_cmpuint (fixture->results, ==, 6);
+  g_assert_cmpuint (browses_max_running, ==, 1);
+
+  /* And it only applies to that operation */
+  fixture->finished = FALSE;
+  fixture->results = 0;
+  g_hash_table_remove_all (fixture->urls);
+  browses_max_running = 0;
+  g_assert (grl_multiple_browse (fixture->sources, keys, 6, 0,
+                                 GRL_RESOLVE_NORMAL,
+                                 multiple_result_cb, fixture));
+  g_main_loop_run (fixture->loop);
+  g_assert (fixture->finished);
+  g_assert_cmpuint (fixture->results, ==, 6);
+  g_assert_cmpuint (browses_max_running, ==, 3);
+
+  g_list_free (keys);
+}
+
+static void
+multiple_media_from_uri_parallel (MultipleFixture *fixture,
+                                  gconstpointer data)
+{
+  TestSource *source_a, *source_b, *source_c;
+
+  source_a = test_source_new ("test-source-a", 3);
+  source_a->fail = TRUE;
+  source_b = test_source_new ("test-source-b", 2);
+  source_b->delay = 10000;
+  source_c = test_source_new ("test-source-c", 1);
+  fixture->sources = g_list_append (fixture->sources, source_a);
+  fixture->sources = g_list_append (fixture->sources, source_b);
+  fixture->sources = g_list_append (fixture->sources, source_c);
+
+  /* The failure of the best source does not prevent the others from
+     answering, and the slow one is cancelled once there is a winner */
+  multiple_media_from_uri_run (fixture, "test://item/1", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_NONE);
+  g_assert_no_error (fixture->error);
+  g_assert (fixture->winner == GRL_MEDIA_SOURCE (source_c));
+  g_assert_cmpuint (source_b->cancelled, ==, 1);
+  multiple_wait_answers (fixture);
+
+  /* Up to max_sources candidates are tried, in rank order */
+  multiple_media_from_uri_run (fixture, "test://item/1", 1, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_NONE);
+  g_assert_error (fixture->error, GRL_CORE_ERROR,
+                  GRL_CORE_ERROR_MEDIA_FROM_URI_FAILED);
+  g_assert (fixture->winner == NULL);
+
+  /* Hedged: the next candidate is tried as soon as the previous failed */
+  source_b->delay = 0;
+  multiple_media_from_uri_run (fixture, "test://item/1", 0, 10000,
+                               GRL_MULTIPLE_PROBE_CACHE_NONE);
+  g_assert_no_error (fixture->error);
+  g_assert (fixture->winner == GRL_MEDIA_SOURCE (source_b));
+
+  /* URIs nobody can handle are reported right away */
+  multiple_media_from_uri_run (fixture, "other://item/1", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_NONE);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->results, ==, 0);
+}
+
+static void
+multiple_media_from_uri_cancel (MultipleFixture *fixture,
+                                gconstpointer data)
+{
+  TestSource *source_a, *source_b;
+  guint operation_id;
+  GList *keys;
+
+  source_a = test_source_new ("test-source-a", 2);
+  source_a->delay = 10000;
+  source_b = test_source_new ("test-source-b", 1);
+  source_b->delay = 10000;
+  fixture->sources = g_list_append (fixture->sources, source_a);
+  fixture->sources = g_list_append (fixture->sources, source_b);
+
+  keys = g_list_prepend (NULL, GRL_METADATA_KEY_URL);
+  operation_id =
+    grl_multiple_get_media_from_uri_parallel ("test://item/1", keys, 0, 0,
+                                              GRL_MULTIPLE_PROBE_CACHE_NONE,
+                                              GRL_RESOLVE_NORMAL,
+                                              multiple_media_from_uri_cb,
+                                              fixture);
+  g_list_free (keys);
+  g_assert (operation_id);
+
+  /* Wait for both sources to get the request */
+  while (!source_a->answers || !source_b->answers) {
+    g_main_context_iteration (NULL, TRUE);
+  }
+
+  /* Both probes finish while being cancelled */
+  grl_operation_cancel (operation_id);
+  g_assert (fixture->finished);
+  g_assert_error (fixture->error, GRL_CORE_ERROR,
+                  GRL_CORE_ERROR_OPERATION_CANCELLED);
+  g_assert_cmpuint (source_a->cancelled, ==, 1);
+  g_assert_cmpuint (source_b->cancelled, ==, 1);
+}
+
+static void
+multiple_media_from_uri_probe_cache (MultipleFixture *fixture,
+                                     gconstpointer data)
+{
+  TestSource *source;
+
+  source = test_source_new ("test-source-a", 0);
+  source->accept = "test://a/";
+  fixture->sources = g_list_append (fixture->sources, source);
+
+  /* Positive answers are shared by URIs with the same prefix */
+  multiple_media_from_uri_run (fixture, "test://a/1", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_PREFIX);
+  g_assert (fixture->winner == GRL_MEDIA_SOURCE (source));
+  g_assert_cmpuint (source->probes, ==, 1);
+
+  multiple_media_from_uri_run (fixture, "test://a/2", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_PREFIX);
+  g_assert (fixture->winner == GRL_MEDIA_SOURCE (source));
+  g_assert_cmpuint (source->probes, ==, 1);
+
+  /* Negative answers are not cached, as other URIs with the same scheme
+     may be accepted */
+  multiple_media_from_uri_run (fixture, "test://b/1", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_PREFIX);
+  g_assert (fixture->winner == NULL);
+  g_assert_cmpuint (source->probes, ==, 2);
+
+  multiple_media_from_uri_run (fixture, "test://b/1", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_PREFIX);
+  g_assert_cmpuint (source->probes, ==, 3);
+
+  /* Without cache every request probes */
+  multiple_media_from_uri_run (fixture, "test://a/3", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_NONE);
+  g_assert (fixture->winner == GRL_MEDIA_SOURCE (source));
+  g_assert_cmpuint (source->probes, ==, 4);
+
+  /* Adding a source invalidates the cache */
+  fixture->sources = g_list_append (fixture->sources,
+                                    test_source_new ("test-source-b", 0));
+  multiple_media_from_uri_run (fixture, "test://a/4", 0, 0,
+                               GRL_MULTIPLE_PROBE_CACHE_PREFIX);
+  g_assert_cmpuint (source->probes, ==, 5);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  grl_init (&argc, &argv);
+
+  /* The registry is still empty: no plugins are loaded, and the other tests
+     unregister their sources */
+  g_test_add_func ("/multiple/search-sync/no-sources",
+                   multiple_search_sync_no_sources);
+
+  g_test_add ("/multiple/merged/refill",
+              MultipleFixture, NULL,
+              multiple_fixture_setup,
+              multiple_merged_refill,
+              multiple_fixture_teardown);
+
+  g_test_add ("/multiple/merged/exhausted",
+              MultipleFixture, NULL,
+              multiple_fixture_setup,
+              multiple_merged_exhausted,
+              multiple_fixture_teardown);
+
+  g_test_add ("/multiple/browse/concurrency",
+              MultipleFixture, NULL,
+              multiple_fixture_setup,
+              multiple_browse_concurrency,
+              multiple_fixture_teardown);
+
+  g_test_add ("/multiple/media-from-uri/parallel",
+              MultipleFixture, NULL,
+              multiple_fixture_setup,
+              multiple_media_from_uri_parallel,
+              multiple_fixture_teardown);
+
+  g_test_add ("/multiple/media-from-uri/cancel",
+              MultipleFixture, NULL,
+              multiple_fixture_setup,
+              multiple_media_from_uri_cancel,
+              multiple_fixture_teardown);
+
+  g_test_add ("/multiple/media-from-uri/probe-cache",
+              MultipleFixture, NULL,
+              multiple_fixture_setup,
+              multiple_media_from_uri_probe_cache,
+              multiple_fixture_teardown);
+
+  return g_test_run ();
+}
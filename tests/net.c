@@ -0,0 +1,1756 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#undef G_DISABLE_ASSERT
+
+#include <string.h>
+
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <grilo.h>
+#include <net/grl-net.h>
+
+#include "test-utils.h"
+
+#define BODY_SIZE (4 * 1024 * 1024)
+#define BENCHMARK_RUNS 10
+#define ETAG_BIG_SIZE (64 * 1024)
+
+/* Local HTTP stub serving large bodies.
+ *
+ *   /sized/<bytes>    response with a Content-Length
+ *   /chunked/<bytes>  chunked response, length unknown to the client
+ *   /fail/<n>/<id>    503 the first n times it is requested, then "ok"
+ *   /wait/<n>/<id>    same, with a "Retry-After: 1" header
+ *   /etag/<id>        "content" with an ETag, 304 if it matches
+ *   /etag/big<id>     same, with a 64 Kb body
+ *   /gzip/<bytes>     gzip encoded response, if the client accepts it
+ *   /slow/<ms>/<id>   "ok" after <ms> milliseconds
+ *   /fresh/<bytes>/<id> response that can be cached for an hour
+ */
+
+static gchar *body = NULL;
+
+static void
+server_cb (SoupServer *server,
+           SoupMessage *msg,
+           const char *path,
+           GHashTable *query,
+           SoupClientContext *client,
+           gpointer user_data)
+{
+  gsize size, sent, len;
+  gboolean chunked;
+  const gchar *arg;
+
+  if (g_str_has_prefix (path, "/sized/")) {
+    chunked = FALSE;
+    arg = path + strlen ("/sized/");
+  } else if (g_str_has_prefix (path, "/chunked/")) {
+    chunked = TRUE;
+    arg = path + strlen ("/chunked/");
+  } else {
+    soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
+
+  size = MIN (g_ascii_strtoull (arg, NULL, 10), BODY_SIZE);
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  soup_message_headers_set_content_type (msg->response_headers,
+                                         "application/octet-stream", NULL);
+  if (chunked)
+    soup_message_headers_set_encoding (msg->response_headers,
+                                       SOUP_ENCODING_CHUNKED);
+
+  /* Odd-sized pieces so reads never line up with the client buffers */
+  for (sent = 0; sent < size; sent += len) {
+    len = MIN (size - sent, 10007);
+    soup_message_body_append (msg->response_body, SOUP_MEMORY_STATIC,
+                              body + sent, len);
+  }
+  soup_message_body_complete (msg->response_body);
+}
+
+typedef struct {
+  SoupServer *server;
+  GMainLoop *loop;
+  GrlNetWc *wc;
+  gchar *content;
+  gsize length;
+  GError *error;
+  guint pending;
+  guint server_connections;
+  GHashTable *hits;
+  guint not_modified;
+  guint conditional;
+  GArray *order;
+  guint cancelled;
+  guint slow_running;
+  guint slow_max_running;
+  GTimer *timer;
+  GArray *slow_starts;
+  GArray *hit_times;
+  GHashTable *host_running;
+  GHashTable *host_max_running;
+  GList *tmp_dirs;
+} NetFixture;
+
+static void
+fail_cb (SoupServer *server,
+         SoupMessage *msg,
+         const char *path,
+         GHashTable *query,
+         SoupClientContext *client,
+         gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  guint failures, hits;
+  gdouble now = g_timer_elapsed (fixture->timer, NULL);
+
+  failures = (guint) g_ascii_strtoull (path + strlen ("/fail/"), NULL, 10);
+  hits = GPOINTER_TO_UINT (g_hash_table_lookup (fixture->hits, path)) + 1;
+  g_hash_table_insert (fixture->hits, g_strdup (path), GUINT_TO_POINTER (hits));
+  g_array_append_val (fixture->hit_times, now);
+
+  if (hits <= failures) {
+    soup_message_set_status (msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+    if (g_str_has_prefix (path, "/wait/"))
+      soup_message_headers_append (msg->response_headers, "Retry-After", "1");
+    return;
+  }
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  soup_message_set_response (msg, "text/plain", SOUP_MEMORY_STATIC, "ok", 2);
+}
+
+static void
+server_request_started_cb (SoupServer *server,
+                           SoupMessage *msg,
+                           SoupClientContext *client,
+                           gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  SoupSocket *socket = soup_client_context_get_socket (client);
+
+  /* One handshake per new client socket */
+  if (!g_object_get_data (G_OBJECT (socket), "test-seen")) {
+    g_object_set_data (G_OBJECT (socket), "test-seen", GINT_TO_POINTER (TRUE));
+    fixture->server_connections++;
+  }
+}
+
+static void
+etag_cb (SoupServer *server,
+         SoupMessage *msg,
+         const char *path,
+         GHashTable *query,
+         SoupClientContext *client,
+         gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  const gchar *etag;
+  guint hits;
+
+  hits = GPOINTER_TO_UINT (g_hash_table_lookup (fixture->hits, path)) + 1;
+  g_hash_table_insert (fixture->hits, g_strdup (path), GUINT_TO_POINTER (hits));
+
+  soup_message_headers_replace (msg->response_headers, "ETag", "\"v1\"");
+
+  etag = soup_message_headers_get_one (msg->request_headers, "If-None-Match");
+  if (etag)
+    fixture->conditional++;
+  if (g_strcmp0 (etag, "\"v1\"") == 0) {
+    fixture->not_modified++;
+    soup_message_set_status (msg, SOUP_STATUS_NOT_MODIFIED);
+    return;
+  }
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  if (g_str_has_prefix (path, "/etag/big"))
+    soup_message_set_response (msg, "application/octet-stream",
+                               SOUP_MEMORY_STATIC, body, ETAG_BIG_SIZE);
+  else
+    soup_message_set_response (msg, "text/plain", SOUP_MEMORY_STATIC,
+                               "content", 7);
+}
+
+static void
+fresh_cb (SoupServer *server,
+          SoupMessage *msg,
+          const char *path,
+          GHashTable *query,
+          SoupClientContext *client,
+          gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  gsize size;
+  guint hits;
+
+  hits = GPOINTER_TO_UINT (g_hash_table_lookup (fixture->hits, path)) + 1;
+  g_hash_table_insert (fixture->hits, g_strdup (path), GUINT_TO_POINTER (hits));
+
+  size = MIN (g_ascii_strtoull (path + strlen ("/fresh/"), NULL, 10),
+              BODY_SIZE);
+
+  soup_message_headers_replace (msg->response_headers, "Cache-Control",
+                                "max-age=3600");
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  soup_message_set_response (msg, "application/octet-stream",
+                             SOUP_MEMORY_STATIC, body, size);
+}
+
+static void
+gzip_cb (SoupServer *server,
+         SoupMessage *msg,
+         const char *path,
+         GHashTable *query,
+         SoupClientContext *client,
+         gpointer user_data)
+{
+  GConverter *compressor;
+  GConverterResult res;
+  const gchar *accepted;
+  gsize size, bytes_read, length;
+  gchar *out;
+
+  size = MIN (g_ascii_strtoull (path + strlen ("/gzip/"), NULL, 10), BODY_SIZE);
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+
+  accepted = soup_message_headers_get_one (msg->request_headers,
+                                           "Accept-Encoding");
+  if (!accepted || !strstr (accepted, "gzip")) {
+    soup_message_set_response (msg, "application/octet-stream",
+                               SOUP_MEMORY_STATIC, body, size);
+    return;
+  }
+
+  compressor =
+    G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+  out = g_malloc (size + 1024);
+  res = g_converter_convert (compressor, body, size, out, size + 1024,
+                             G_CONVERTER_INPUT_AT_END,
+                             &bytes_read, &length, NULL);
+  g_assert (res == G_CONVERTER_FINISHED);
+  g_object_unref (compressor);
+
+  soup_message_headers_replace (msg->response_headers,
+                                "Content-Encoding", "gzip");
+  soup_message_set_response (msg, "application/octet-stream",
+                             SOUP_MEMORY_TAKE, out, length);
+}
+
+typedef struct {
+  NetFixture *fixture;
+  SoupServer *server;
+  SoupMessage *msg;
+  gchar *host;
+} SlowResponse;
+
+static guint
+net_fixture_host_count (GHashTable *counts, const gchar *host)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (counts, host));
+}
+
+static gboolean
+slow_done_cb (gpointer user_data)
+{
+  SlowResponse *response = user_data;
+  NetFixture *fixture = response->fixture;
+  guint running;
+
+  running = net_fixture_host_count (fixture->host_running, response->host);
+  g_hash_table_insert (fixture->host_running, g_strdup (response->host),
+                       GUINT_TO_POINTER (running - 1));
+  fixture->slow_running--;
+
+  soup_message_set_status (response->msg, SOUP_STATUS_OK);
+  soup_message_set_response (response->msg, "text/plain",
+                             SOUP_MEMORY_STATIC, "ok", 2);
+  soup_server_unpause_message (response->server, response->msg);
+
+  g_free (response->host);
+  g_slice_free (SlowResponse, response);
+
+  return FALSE;
+}
+
+static void
+slow_cb (SoupServer *server,
+         SoupMessage *msg,
+         const char *path,
+         GHashTable *query,
+         SoupClientContext *client,
+         gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  SlowResponse *response;
+  const gchar *host;
+  guint delay, running;
+  gdouble start = g_timer_elapsed (fixture->timer, NULL);
+
+  delay = (guint) g_ascii_strtoull (path + strlen ("/slow/"), NULL, 10);
+
+  fixture->slow_running++;
+  fixture->slow_max_running = MAX (fixture->slow_max_running,
+                                   fixture->slow_running);
+  g_array_append_val (fixture->slow_starts, start);
+
+  /* Taken from the Host header */
+  host = soup_message_get_uri (msg)->host;
+  running = net_fixture_host_count (fixture->host_running, host) + 1;
+  g_hash_table_insert (fixture->host_running, g_strdup (host),
+                       GUINT_TO_POINTER (running));
+  if (running > net_fixture_host_count (fixture->host_max_running, host))
+    g_hash_table_insert (fixture->host_max_running, g_strdup (host),
+                         GUINT_TO_POINTER (running));
+
+  response = g_slice_new (SlowResponse);
+  response->fixture = fixture;
+  response->server = server;
+  response->msg = msg;
+  response->host = g_strdup (host);
+
+  soup_server_pause_message (server, msg);
+  g_timeout_add (delay, slow_done_cb, response);
+}
+
+static void
+net_fixture_setup (NetFixture *fixture, gconstpointer data)
+{
+  fixture->server = soup_server_new (SOUP_SERVER_PORT, 0, NULL);
+  g_assert (fixture->server);
+  soup_server_add_handler (fixture->server, NULL, server_cb, NULL, NULL);
+  soup_server_add_handler (fixture->server, "/fail", fail_cb, fixture, NULL);
+  soup_server_add_handler (fixture->server, "/wait", fail_cb, fixture, NULL);
+  soup_server_add_handler (fixture->server, "/etag", etag_cb, fixture, NULL);
+  soup_server_add_handler (fixture->server, "/gzip", gzip_cb, fixture, NULL);
+  soup_server_add_handler (fixture->server, "/slow", slow_cb, fixture, NULL);
+  soup_server_add_handler (fixture->server, "/fresh", fresh_cb, fixture, NULL);
+  fixture->hits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  fixture->order = g_array_new (FALSE, FALSE, sizeof (guint));
+  fixture->timer = g_timer_new ();
+  fixture->slow_starts = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  fixture->hit_times = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  fixture->host_running = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, NULL);
+  fixture->host_max_running = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     g_free, NULL);
+  g_signal_connect (fixture->server, "request-started",
+                    G_CALLBACK (server_request_started_cb), fixture);
+  soup_server_run_async (fixture->server);
+
+  fixture->loop = g_main_loop_new (NULL, FALSE);
+  fixture->wc = grl_net_wc_new ();
+  /* Every request must hit the server */
+  grl_net_wc_set_cache (fixture->wc, FALSE);
+}
+
+static void
+net_fixture_teardown (NetFixture *fixture, gconstpointer data)
+{
+  GList *dir;
+
+  g_free (fixture->content);
+  g_clear_error (&fixture->error);
+  g_object_unref (fixture->wc);
+  g_main_loop_unref (fixture->loop);
+  soup_server_quit (fixture->server);
+  g_object_unref (fixture->server);
+  g_hash_table_unref (fixture->hits);
+  g_array_free (fixture->order, TRUE);
+  g_timer_destroy (fixture->timer);
+  g_array_free (fixture->slow_starts, TRUE);
+  g_array_free (fixture->hit_times, TRUE);
+  g_hash_table_unref (fixture->host_running);
+  g_hash_table_unref (fixture->host_max_running);
+
+  /* The web client is gone, so nothing writes to them anymore */
+  for (dir = fixture->tmp_dirs; dir; dir = g_list_next (dir)) {
+    test_remove_tree (dir->data);
+    g_free (dir->data);
+  }
+  g_list_free (fixture->tmp_dirs);
+}
+
+/* Creates a temporary directory, removed with the fixture */
+static const gchar *
+net_fixture_tmp_dir (NetFixture *fixture)
+{
+  gchar *dir;
+
+  dir = test_make_tmp_dir ("grilo-net-test");
+  fixture->tmp_dirs = g_list_prepend (fixture->tmp_dirs, dir);
+
+  return dir;
+}
+
+static guint
+net_fixture_hits (NetFixture *fixture, const gchar *path)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (fixture->hits, path));
+}
+
+static gchar *
+net_fixture_path_url (NetFixture *fixture, const gchar *path)
+{
+  return g_strdup_printf ("http://127.0.0.1:%u%s",
+                          soup_server_get_port (fixture->server), path);
+}
+
+static gchar *
+net_fixture_url (NetFixture *fixture, const gchar *kind, gsize size)
+{
+  return g_strdup_printf ("http://127.0.0.1:%u/%s/%" G_GSIZE_FORMAT,
+                          soup_server_get_port (fixture->server),
+                          kind, size);
+}
+
+static void
+fetch_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  gchar *content = NULL;
+  gsize length = 0;
+
+  g_free (fixture->content);
+  fixture->content = NULL;
+  g_clear_error (&fixture->error);
+
+  if (grl_net_wc_request_finish (GRL_NET_WC (source), res,
+                                 &content, &length, &fixture->error)) {
+    /* Content belongs to the web client until the next request */
+    fixture->content = g_memdup (content, length);
+    fixture->length = length;
+  }
+
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+net_fixture_fetch (NetFixture *fixture, const gchar *url)
+{
+  grl_net_wc_request_async (fixture->wc, url, NULL, fetch_cb, fixture);
+  g_main_loop_run (fixture->loop);
+}
+
+static void
+fetch_many_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  GError *error = NULL;
+
+  grl_net_wc_request_finish (GRL_NET_WC (source), res, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  if (--fixture->pending == 0)
+    g_main_loop_quit (fixture->loop);
+}
+
+/* Sends a burst of different requests at once */
+static void
+net_fixture_fetch_many (NetFixture *fixture, guint n)
+{
+  gchar *url;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    url = net_fixture_url (fixture, "sized", i + 1);
+    grl_net_wc_request_async (fixture->wc, url, NULL, fetch_many_cb, fixture);
+    g_free (url);
+  }
+
+  fixture->pending = n;
+  g_main_loop_run (fixture->loop);
+}
+
+static void
+net_content (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *kind = data;
+  gsize sizes[] = { 0, 1, 32 * 1024 - 1, 32 * 1024, 32 * 1024 + 1, BODY_SIZE };
+  gchar *url;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+    url = net_fixture_url (fixture, kind, sizes[i]);
+    net_fixture_fetch (fixture, url);
+    g_free (url);
+
+    g_assert_no_error (fixture->error);
+    g_assert_cmpuint (fixture->length, ==, sizes[i]);
+    g_assert (memcmp (fixture->content, body, sizes[i]) == 0);
+  }
+}
+
+static void
+splice_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  GMemoryOutputStream *output = G_MEMORY_OUTPUT_STREAM (source);
+
+  g_output_stream_splice_finish (G_OUTPUT_STREAM (output), res,
+                                 &fixture->error);
+  g_assert_no_error (fixture->error);
+
+  fixture->length = g_memory_output_stream_get_data_size (output);
+  fixture->content = g_memdup (g_memory_output_stream_get_data (output),
+                               fixture->length);
+
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+stream_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  GOutputStream *output;
+  GInputStream *input;
+
+  input = grl_net_wc_request_stream_finish (GRL_NET_WC (source), res,
+                                            &fixture->error);
+  g_assert_no_error (fixture->error);
+  g_assert (input);
+
+  /* Read it all, without blocking the main loop serving it */
+  output = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  g_output_stream_splice_async (output, input,
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                G_PRIORITY_DEFAULT, NULL,
+                                splice_cb, fixture);
+  g_object_unref (output);
+  g_object_unref (input);
+}
+
+static void
+net_stream (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *kind = data;
+  gchar *url;
+
+  url = net_fixture_url (fixture, kind, 100 * 1000);
+  grl_net_wc_request_stream_async (fixture->wc, url, NULL, stream_cb, fixture);
+  g_main_loop_run (fixture->loop);
+  g_free (url);
+
+  g_assert_cmpuint (fixture->length, ==, 100 * 1000);
+  g_assert (memcmp (fixture->content, body, fixture->length) == 0);
+}
+
+#if GLIB_CHECK_VERSION(2,32,0)
+static void
+bytes_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  GBytes **bytes = g_object_get_data (source, "test-bytes");
+
+  *bytes = grl_net_wc_request_finish_bytes (GRL_NET_WC (source), res,
+                                            &fixture->error);
+  g_assert_no_error (fixture->error);
+
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+net_bytes (NetFixture *fixture, gconstpointer data)
+{
+  GBytes *first = NULL;
+  GBytes *second = NULL;
+  gchar *url;
+
+  url = net_fixture_url (fixture, "sized", 1000);
+  g_object_set_data (G_OBJECT (fixture->wc), "test-bytes", &first);
+  grl_net_wc_request_async (fixture->wc, url, NULL, bytes_cb, fixture);
+  g_main_loop_run (fixture->loop);
+  g_free (url);
+
+  /* The contents outlive the next request */
+  url = net_fixture_url (fixture, "sized", 2000);
+  g_object_set_data (G_OBJECT (fixture->wc), "test-bytes", &second);
+  grl_net_wc_request_async (fixture->wc, url, NULL, bytes_cb, fixture);
+  g_main_loop_run (fixture->loop);
+  g_free (url);
+
+  g_assert_cmpuint (g_bytes_get_size (first), ==, 1000);
+  g_assert (memcmp (g_bytes_get_data (first, NULL), body, 1000) == 0);
+  g_assert_cmpuint (g_bytes_get_size (second), ==, 2000);
+  g_assert (memcmp (g_bytes_get_data (second, NULL), body, 2000) == 0);
+
+  /* Even after the web client is gone */
+  g_object_unref (fixture->wc);
+  fixture->wc = grl_net_wc_new ();
+  g_assert (memcmp (g_bytes_get_data (first, NULL), body, 1000) == 0);
+
+  g_bytes_unref (first);
+  g_bytes_unref (second);
+}
+#endif
+
+static void
+net_keep_alive (NetFixture *fixture, gconstpointer data)
+{
+  guint connections, reuses;
+
+  g_object_set (fixture->wc, "max-conns-per-host", 3, NULL);
+
+  net_fixture_fetch_many (fixture, 12);
+  grl_net_wc_get_connection_stats (fixture->wc, &connections, &reuses);
+
+  g_assert_cmpuint (fixture->server_connections, >=, 1);
+  g_assert_cmpuint (fixture->server_connections, <=, 3);
+  g_assert_cmpuint (connections, ==, fixture->server_connections);
+  g_assert_cmpuint (connections + reuses, ==, 12);
+
+  /* Idle connections are reused by the next burst */
+  net_fixture_fetch_many (fixture, 12);
+  g_assert_cmpuint (fixture->server_connections, <=, 3);
+}
+
+static void
+net_no_keep_alive (NetFixture *fixture, gconstpointer data)
+{
+  guint connections, reuses;
+
+  g_object_set (fixture->wc, "keep-alive", FALSE, NULL);
+
+  net_fixture_fetch_many (fixture, 12);
+  grl_net_wc_get_connection_stats (fixture->wc, &connections, &reuses);
+
+  g_assert_cmpuint (fixture->server_connections, ==, 12);
+  g_assert_cmpuint (connections, ==, 12);
+  g_assert_cmpuint (reuses, ==, 0);
+}
+
+static void
+net_connection_properties (NetFixture *fixture, gconstpointer data)
+{
+  guint max_conns, idle_timeout;
+
+  g_object_set (fixture->wc,
+                "max-conns", 2,
+                "idle-timeout", 5,
+                NULL);
+  g_object_get (fixture->wc,
+                "max-conns", &max_conns,
+                "idle-timeout", &idle_timeout,
+                NULL);
+
+  g_assert_cmpuint (max_conns, ==, 2);
+  g_assert_cmpuint (idle_timeout, ==, 5);
+
+  grl_net_wc_set_max_conns (fixture->wc, 8);
+  grl_net_wc_set_idle_timeout (fixture->wc, 0);
+  g_object_get (fixture->wc,
+                "max-conns", &max_conns,
+                "idle-timeout", &idle_timeout,
+                NULL);
+
+  g_assert_cmpuint (max_conns, ==, 8);
+  g_assert_cmpuint (idle_timeout, ==, 0);
+}
+
+static void
+net_retry (NetFixture *fixture, gconstpointer data)
+{
+  gchar *url;
+
+  g_object_set (fixture->wc,
+                "max-attempts", 4,
+                "retry-delay", 10,
+                NULL);
+
+  url = net_fixture_path_url (fixture, "/fail/3/a");
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, 2);
+  g_assert (memcmp (fixture->content, "ok", 2) == 0);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/3/a"), ==, 4);
+}
+
+static void
+net_retry_exhausted (NetFixture *fixture, gconstpointer data)
+{
+  gchar *url;
+
+  g_object_set (fixture->wc,
+                "max-attempts", 2,
+                "retry-delay", 10,
+                NULL);
+
+  url = net_fixture_path_url (fixture, "/fail/3/b");
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_UNAVAILABLE);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/3/b"), ==, 2);
+
+  /* Not retryable */
+  grl_net_wc_set_retry_statuses (fixture->wc, NULL, 0);
+
+  url = net_fixture_path_url (fixture, "/fail/3/c");
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_UNAVAILABLE);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/3/c"), ==, 1);
+}
+
+static void
+net_retry_after (NetFixture *fixture, gconstpointer data)
+{
+  gchar *url;
+
+  g_object_set (fixture->wc,
+                "max-attempts", 2,
+                "retry-delay", 10,
+                NULL);
+
+  url = net_fixture_path_url (fixture, "/wait/1/a");
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  /* The server asked for one second, much more than retry-delay */
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/wait/1/a"), ==, 2);
+  g_assert_cmpfloat (g_array_index (fixture->hit_times, gdouble, 1) -
+                     g_array_index (fixture->hit_times, gdouble, 0), >=, 0.9);
+
+  /* Waiting longer than allowed fails right away */
+  g_object_set (fixture->wc, "max-retry-delay", 500, NULL);
+
+  url = net_fixture_path_url (fixture, "/wait/1/b");
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_UNAVAILABLE);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/wait/1/b"), ==, 1);
+}
+
+static void
+revalidate_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+  GrlNetWcResponseFlags *flags = g_object_get_data (G_OBJECT (source),
+                                                    "test-flags");
+  GHashTable *headers = NULL;
+  gchar *content = NULL;
+  gsize expected = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (source),
+                                                        "test-length"));
+  gsize length = 0;
+
+  g_clear_error (&fixture->error);
+  g_assert (grl_net_wc_request_finish_full (GRL_NET_WC (source), res,
+                                            &content, &length,
+                                            flags, &headers,
+                                            &fixture->error));
+
+  g_assert_cmpuint (length, ==, expected);
+  if (expected == 7)
+    g_assert (memcmp (content, "content", 7) == 0);
+  else
+    g_assert (memcmp (content, body, length) == 0);
+  g_assert_cmpstr (g_hash_table_lookup (headers, "ETag"), ==, "\"v1\"");
+  g_hash_table_unref (headers);
+
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+net_revalidate (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *path = data;
+  GrlNetWcResponseFlags flags;
+  const gchar *cache_dir;
+  const gchar *name;
+  gboolean validated = FALSE;
+  GDir *dir;
+  gchar *url;
+
+  cache_dir = net_fixture_tmp_dir (fixture);
+  g_object_set (fixture->wc,
+                "cache-dir", cache_dir,
+                "cache", TRUE,
+                NULL);
+  g_object_set_data (G_OBJECT (fixture->wc), "test-flags", &flags);
+  g_object_set_data (G_OBJECT (fixture->wc), "test-length",
+                     GUINT_TO_POINTER (g_str_has_prefix (path, "/etag/big")?
+                                       ETAG_BIG_SIZE: 7));
+
+  url = net_fixture_path_url (fixture, path);
+
+  grl_net_wc_request_async (fixture->wc, url, NULL, revalidate_cb, fixture);
+  g_main_loop_run (fixture->loop);
+  g_assert_cmpuint (flags, ==, GRL_NET_WC_RESPONSE_NONE);
+  g_assert_cmpuint (fixture->conditional, ==, 0);
+  g_assert_cmpuint (fixture->not_modified, ==, 0);
+
+  /* Bodies too big for memory are kept in the cache directory */
+  dir = g_dir_open (cache_dir, 0, NULL);
+  g_assert (dir);
+  while ((name = g_dir_read_name (dir)))
+    validated = validated || g_str_has_prefix (name, "validated-");
+  g_dir_close (dir);
+  g_assert (validated == g_str_has_prefix (path, "/etag/big"));
+
+  /* The server only confirms the stored copy */
+  grl_net_wc_request_async (fixture->wc, url, NULL, revalidate_cb, fixture);
+  g_main_loop_run (fixture->loop);
+  g_assert_cmpuint (net_fixture_hits (fixture, path), ==, 2);
+  g_assert_cmpuint (fixture->conditional, ==, 1);
+  g_assert_cmpuint (fixture->not_modified, ==, 1);
+  /* The disk cache may have revalidated it on its own */
+  g_assert (flags & (GRL_NET_WC_RESPONSE_REVALIDATED | GRL_NET_WC_RESPONSE_CACHED));
+
+  g_free (url);
+}
+
+static void
+net_cache_stats (NetFixture *fixture, gconstpointer data)
+{
+  guint hits, memory_hits, misses;
+  guint64 bytes;
+  gchar *url;
+
+  g_object_set (fixture->wc,
+                "cache-dir", net_fixture_tmp_dir (fixture),
+                "cache", TRUE,
+                NULL);
+
+  url = net_fixture_path_url (fixture, "/fresh/1000/s");
+
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  grl_net_wc_get_cache_stats (fixture->wc, &hits, &memory_hits, &misses, &bytes);
+  g_assert_cmpuint (hits, ==, 0);
+  g_assert_cmpuint (memory_hits, ==, 0);
+  g_assert_cmpuint (misses, ==, 1);
+  g_assert_cmpuint (bytes, ==, 0);
+
+  /* Served from memory, without reaching the server */
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, 1000);
+  g_assert (memcmp (fixture->content, body, 1000) == 0);
+  grl_net_wc_get_cache_stats (fixture->wc, &hits, &memory_hits, &misses, &bytes);
+  g_assert_cmpuint (hits, ==, 0);
+  g_assert_cmpuint (memory_hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 1);
+  g_assert_cmpuint (bytes, ==, 1000);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fresh/1000/s"), ==, 1);
+
+  g_free (url);
+}
+
+static void
+net_memory_cache (NetFixture *fixture, gconstpointer data)
+{
+  guint hits, memory_hits, misses;
+  gchar *url;
+
+  g_object_set (fixture->wc,
+                "cache-dir", net_fixture_tmp_dir (fixture),
+                "cache", TRUE,
+                NULL);
+
+  url = net_fixture_path_url (fixture, "/fresh/1000/m");
+  net_fixture_fetch (fixture, url);
+  net_fixture_fetch (fixture, url);
+  grl_net_wc_get_cache_stats (fixture->wc, NULL, &memory_hits, NULL, NULL);
+  g_assert_cmpuint (memory_hits, ==, 1);
+
+  /* Disabling the memory cache drops what it holds */
+  grl_net_wc_set_memory_cache_size (fixture->wc, 0);
+  net_fixture_fetch (fixture, url);
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, 1000);
+  grl_net_wc_get_cache_stats (fixture->wc, &hits, &memory_hits, &misses, NULL);
+  g_assert_cmpuint (memory_hits, ==, 1);
+  /* Whatever the disk cache did not have came from the server */
+  g_assert_cmpuint (hits + misses, ==, 3);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fresh/1000/m"), ==, misses);
+
+  /* And it is used again once enabled */
+  grl_net_wc_set_memory_cache_size (fixture->wc, 64);
+  net_fixture_fetch (fixture, url);
+  net_fixture_fetch (fixture, url);
+  grl_net_wc_get_cache_stats (fixture->wc, NULL, &memory_hits, NULL, NULL);
+  g_assert_cmpuint (memory_hits, ==, 2);
+
+  g_free (url);
+}
+
+static void
+net_cache_isolation (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *dir_a, *dir_b;
+  GrlNetWc *wc_a, *wc_b, *wc_c;
+  guint memory_hits, misses;
+  gchar *sibling;
+  gchar *url;
+
+  dir_a = net_fixture_tmp_dir (fixture);
+  dir_b = net_fixture_tmp_dir (fixture);
+  url = net_fixture_path_url (fixture, "/fresh/1000/i");
+
+  wc_a = fixture->wc;
+  wc_b = g_object_new (GRL_TYPE_NET_WC, "cache-dir", dir_b, NULL);
+  wc_c = g_object_new (GRL_TYPE_NET_WC, "cache-dir", dir_a, NULL);
+  g_object_set (wc_a, "cache-dir", dir_a, "cache", TRUE, NULL);
+
+  net_fixture_fetch (fixture, url);
+  net_fixture_fetch (fixture, url);
+
+  /* Neither the memory cache nor the disk cache of another directory are
+     shared, and the statistics are kept per instance */
+  fixture->wc = wc_b;
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fresh/1000/i"), ==, 2);
+  grl_net_wc_get_cache_stats (wc_b, NULL, &memory_hits, &misses, NULL);
+  g_assert_cmpuint (memory_hits, ==, 0);
+  g_assert_cmpuint (misses, ==, 1);
+
+  /* Instances using the same directory share it, not a copy of it */
+  fixture->wc = wc_c;
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, 1000);
+  sibling = g_strdup_printf ("%s-1", dir_a);
+  g_assert (!g_file_test (sibling, G_FILE_TEST_EXISTS));
+  g_free (sibling);
+
+  fixture->wc = wc_a;
+  grl_net_wc_get_cache_stats (wc_a, NULL, &memory_hits, &misses, NULL);
+  g_assert_cmpuint (memory_hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 1);
+
+  g_object_unref (wc_b);
+  g_object_unref (wc_c);
+  g_free (url);
+}
+
+typedef struct {
+  NetFixture *fixture;
+  guint id;
+} OrderedRequest;
+
+static void
+ordered_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  OrderedRequest *request = user_data;
+  NetFixture *fixture = request->fixture;
+  GError *error = NULL;
+
+  if (grl_net_wc_request_finish (GRL_NET_WC (source), res, NULL, NULL, &error)) {
+    g_array_append_val (fixture->order, request->id);
+  } else {
+    g_assert_error (error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_CANCELLED);
+    g_error_free (error);
+    fixture->cancelled++;
+  }
+
+  if (--fixture->pending == 0)
+    g_main_loop_quit (fixture->loop);
+
+  g_slice_free (OrderedRequest, request);
+}
+
+static void
+net_fixture_request_ordered (NetFixture *fixture, guint id, gint priority)
+{
+  OrderedRequest *request = g_slice_new (OrderedRequest);
+  gchar *url;
+
+  request->fixture = fixture;
+  request->id = id;
+
+  url = net_fixture_url (fixture, "sized", id);
+  grl_net_wc_request_with_priority_async (fixture->wc, url, priority, NULL,
+                                          ordered_cb, request);
+  g_free (url);
+
+  fixture->pending++;
+}
+
+static void
+net_priority (NetFixture *fixture, gconstpointer data)
+{
+  /* One request every 50 ms */
+  g_object_set (fixture->wc, "rate-limit", 20.0, NULL);
+
+  /* The first one is sent right away, the others are queued */
+  net_fixture_request_ordered (fixture, 1, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 2, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 3, G_PRIORITY_DEFAULT);
+  net_fixture_request_ordered (fixture, 4, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 5, G_PRIORITY_HIGH);
+  g_main_loop_run (fixture->loop);
+
+  g_assert_cmpuint (fixture->order->len, ==, 5);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 0), ==, 1);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 1), ==, 5);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 2), ==, 3);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 3), ==, 2);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 4), ==, 4);
+}
+
+/* Sends @n requests of @delay ms at once */
+static void
+net_fixture_fetch_slow (NetFixture *fixture, guint n, guint delay)
+{
+  gchar *url;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    url = g_strdup_printf ("http://127.0.0.1:%u/slow/%u/%u",
+                           soup_server_get_port (fixture->server), delay, i);
+    grl_net_wc_request_async (fixture->wc, url, NULL, fetch_many_cb, fixture);
+    g_free (url);
+  }
+  fixture->pending = n;
+  g_main_loop_run (fixture->loop);
+
+  g_assert_cmpuint (fixture->slow_starts->len, ==, n);
+}
+
+/* Seconds between the starts of the slow requests @a and @b, as seen by the
+   server */
+static gdouble
+net_fixture_slow_gap (NetFixture *fixture, guint a, guint b)
+{
+  return g_array_index (fixture->slow_starts, gdouble, b) -
+    g_array_index (fixture->slow_starts, gdouble, a);
+}
+
+static void
+net_rate_limit (NetFixture *fixture, gconstpointer data)
+{
+  /* One request every 100 ms, each one taking 400 ms */
+  g_object_set (fixture->wc, "rate-limit", 10.0, NULL);
+
+  net_fixture_fetch_slow (fixture, 4, 400);
+
+  /* Starts are paced, but the requests still overlap */
+  g_assert_cmpuint (fixture->slow_max_running, >, 1);
+  g_assert_cmpfloat (net_fixture_slow_gap (fixture, 0, 3), >=, 0.2);
+}
+
+static void
+net_burst (NetFixture *fixture, gconstpointer data)
+{
+  /* One request per second, but two can be sent at once */
+  g_object_set (fixture->wc,
+                "rate-limit", 1.0,
+                "burst", 2,
+                NULL);
+
+  net_fixture_fetch_slow (fixture, 3, 200);
+
+  /* The burst runs together, and the next one waits for a new token */
+  g_assert_cmpuint (fixture->slow_max_running, ==, 2);
+  g_assert_cmpfloat (net_fixture_slow_gap (fixture, 0, 2), >=, 0.5);
+}
+
+static void
+net_max_conns (NetFixture *fixture, gconstpointer data)
+{
+  /* The host would allow more */
+  g_object_set (fixture->wc,
+                "max-conns", 2,
+                "max-conns-per-host", 4,
+                NULL);
+
+  net_fixture_fetch_slow (fixture, 4, 200);
+
+  g_assert_cmpuint (fixture->slow_max_running, ==, 2);
+  g_assert_cmpuint (fixture->server_connections, <=, 2);
+}
+
+static void
+net_host_limits (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *hosts[] = { "127.0.0.1", "127.0.0.2" };
+  gchar *url;
+  guint i, j;
+
+  /* Both hosts reach the test server, listening on all the addresses */
+  grl_net_wc_set_host_limits (fixture->wc, hosts[0], 0, 1, 4);
+  grl_net_wc_set_host_limits (fixture->wc, hosts[1], 0, 1, 1);
+
+  for (i = 0; i < G_N_ELEMENTS (hosts); i++) {
+    for (j = 0; j < 4; j++) {
+      url = g_strdup_printf ("http://%s:%u/slow/200/%u", hosts[i],
+                             soup_server_get_port (fixture->server), j);
+      grl_net_wc_request_async (fixture->wc, url, NULL, fetch_many_cb, fixture);
+      g_free (url);
+    }
+  }
+  fixture->pending = 2 * 4;
+  g_main_loop_run (fixture->loop);
+
+  /* Each host gets its own limit, not the default one */
+  g_assert_cmpuint (net_fixture_host_count (fixture->host_max_running,
+                                            hosts[0]), ==, 4);
+  g_assert_cmpuint (net_fixture_host_count (fixture->host_max_running,
+                                            hosts[1]), ==, 1);
+}
+
+static void
+net_cancel_queued (NetFixture *fixture, gconstpointer data)
+{
+  g_object_set (fixture->wc, "rate-limit", 20.0, NULL);
+
+  net_fixture_request_ordered (fixture, 1, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 2, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 3, G_PRIORITY_DEFAULT);
+  net_fixture_request_ordered (fixture, 4, G_PRIORITY_DEFAULT_IDLE);
+
+  /* The first one is already sent */
+  g_assert_cmpuint (grl_net_wc_cancel_queued_requests (fixture->wc,
+                                                       G_PRIORITY_DEFAULT_IDLE),
+                    ==, 2);
+  g_main_loop_run (fixture->loop);
+
+  g_assert_cmpuint (fixture->cancelled, ==, 2);
+  g_assert_cmpuint (fixture->order->len, ==, 2);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 0), ==, 1);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 1), ==, 3);
+}
+
+static void
+net_coalesce (NetFixture *fixture, gconstpointer data)
+{
+  gchar *url;
+
+  /* Concurrent requests of the same resource share the transfer */
+  url = net_fixture_path_url (fixture, "/fail/0/s");
+  grl_net_wc_request_async (fixture->wc, url, NULL, fetch_many_cb, fixture);
+  grl_net_wc_request_async (fixture->wc, url, NULL, fetch_many_cb, fixture);
+  fixture->pending = 2;
+  g_main_loop_run (fixture->loop);
+  g_free (url);
+
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/0/s"), ==, 1);
+
+  /* Even with a different priority */
+  url = net_fixture_path_url (fixture, "/fail/0/p");
+  grl_net_wc_request_with_priority_async (fixture->wc, url, G_PRIORITY_DEFAULT,
+                                          NULL, fetch_many_cb, fixture);
+  grl_net_wc_request_with_priority_async (fixture->wc, url, G_PRIORITY_HIGH,
+                                          NULL, fetch_many_cb, fixture);
+  fixture->pending = 2;
+  g_main_loop_run (fixture->loop);
+  g_free (url);
+
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/0/p"), ==, 1);
+
+  /* A more urgent request makes the shared one overtake the queue */
+  g_object_set (fixture->wc, "rate-limit", 20.0, NULL);
+
+  net_fixture_request_ordered (fixture, 1, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 2, G_PRIORITY_LOW);
+  net_fixture_request_ordered (fixture, 3, G_PRIORITY_DEFAULT);
+  net_fixture_request_ordered (fixture, 2, G_PRIORITY_HIGH);
+  g_main_loop_run (fixture->loop);
+
+  g_assert_cmpuint (fixture->order->len, ==, 4);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 0), ==, 1);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 1), ==, 2);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 2), ==, 2);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 3), ==, 3);
+}
+
+static void
+net_coalesce_cancel (NetFixture *fixture, gconstpointer data)
+{
+  GCancellable *cancellable;
+  OrderedRequest *request;
+  gchar *url;
+  guint i;
+
+  cancellable = g_cancellable_new ();
+  url = net_fixture_path_url (fixture, "/fail/0/c");
+
+  for (i = 1; i <= 2; i++) {
+    request = g_slice_new (OrderedRequest);
+    request->fixture = fixture;
+    request->id = i;
+    grl_net_wc_request_async (fixture->wc, url, i == 1? cancellable: NULL,
+                              ordered_cb, request);
+  }
+  fixture->pending = 2;
+
+  /* The other caller still gets the shared transfer */
+  g_cancellable_cancel (cancellable);
+  g_main_loop_run (fixture->loop);
+
+  g_assert_cmpuint (fixture->cancelled, ==, 1);
+  g_assert_cmpuint (fixture->order->len, ==, 1);
+  g_assert_cmpuint (g_array_index (fixture->order, guint, 0), ==, 2);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/0/c"), ==, 1);
+
+  g_object_unref (cancellable);
+  g_free (url);
+}
+
+static void
+net_malformed (NetFixture *fixture, gconstpointer data)
+{
+  net_fixture_fetch (fixture, "not a url");
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_UNAVAILABLE);
+}
+
+static gboolean
+set_flag_cb (gpointer user_data)
+{
+  *(gboolean *) user_data = TRUE;
+  return FALSE;
+}
+
+static void
+net_record_replay (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *archive;
+  gchar *sized_url;
+  gchar *fail_url;
+  gchar *missing_url;
+  gboolean early = FALSE;
+
+  archive = net_fixture_tmp_dir (fixture);
+
+  sized_url = net_fixture_url (fixture, "sized", 1000);
+  fail_url = net_fixture_path_url (fixture, "/fail/1/r");
+  missing_url = net_fixture_url (fixture, "sized", 2000);
+
+  /* Record */
+  g_object_set (fixture->wc, "record-dir", archive, NULL);
+
+  net_fixture_fetch (fixture, sized_url);
+  g_assert_no_error (fixture->error);
+  net_fixture_fetch (fixture, fail_url);
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_UNAVAILABLE);
+  net_fixture_fetch (fixture, fail_url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/1/r"), ==, 2);
+
+  /* Replay, without reaching the server */
+  g_object_unref (fixture->wc);
+  fixture->wc = g_object_new (GRL_TYPE_NET_WC,
+                              "cache", FALSE,
+                              "replay-dir", archive,
+                              "replay-latency", 200,
+                              NULL);
+
+  /* The answer comes after a shorter timeout set up before the request */
+  g_timeout_add (100, set_flag_cb, &early);
+  net_fixture_fetch (fixture, sized_url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, 1000);
+  g_assert (memcmp (fixture->content, body, 1000) == 0);
+  g_assert (early);
+
+  /* Same responses, in the same order */
+  net_fixture_fetch (fixture, fail_url);
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_UNAVAILABLE);
+  net_fixture_fetch (fixture, fail_url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, 2);
+  g_assert_cmpuint (net_fixture_hits (fixture, "/fail/1/r"), ==, 2);
+
+  net_fixture_fetch (fixture, missing_url);
+  g_assert_error (fixture->error, GRL_NET_WC_ERROR, GRL_NET_WC_ERROR_NETWORK_ERROR);
+
+  g_free (missing_url);
+  g_free (fail_url);
+  g_free (sized_url);
+}
+
+static void
+metrics_cb (GrlNetWc *wc, GrlNetWcMetrics *metrics, gpointer user_data)
+{
+  GArray *finished = user_data;
+
+  g_array_append_vals (finished, metrics, 1);
+}
+
+static void
+net_metrics (NetFixture *fixture, gconstpointer data)
+{
+  GArray *finished;
+  GrlNetWcMetrics *m;
+  guint counts[GRL_NET_WC_HISTOGRAM_BUCKETS];
+  guint total;
+  gchar *url;
+  guint i;
+
+  finished = g_array_new (FALSE, FALSE, sizeof (GrlNetWcMetrics));
+  g_signal_connect (fixture->wc, "request-finished",
+                    G_CALLBACK (metrics_cb), finished);
+  g_object_set (fixture->wc,
+                "max-attempts", 3,
+                "retry-delay", 10,
+                NULL);
+
+  url = net_fixture_url (fixture, "sized", 1000);
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  g_assert_cmpuint (finished->len, ==, 1);
+  m = &g_array_index (finished, GrlNetWcMetrics, 0);
+  g_assert_cmpuint (m->status, ==, SOUP_STATUS_OK);
+  g_assert_cmpuint (m->bytes_in, ==, 1000);
+  g_assert_cmpuint (m->retries, ==, 0);
+  g_assert_cmpint (m->cache_status, ==, GRL_NET_WC_CACHE_NONE);
+  g_assert_cmpfloat (m->queue_wait, >=, 0);
+  g_assert_cmpfloat (m->total, >=, m->ttfb);
+  g_assert_cmpfloat (m->total, >=, m->queue_wait);
+
+  url = net_fixture_path_url (fixture, "/fail/2/m");
+  net_fixture_fetch (fixture, url);
+  g_free (url);
+
+  g_assert_cmpuint (finished->len, ==, 2);
+  m = &g_array_index (finished, GrlNetWcMetrics, 1);
+  g_assert_cmpuint (m->status, ==, SOUP_STATUS_OK);
+  g_assert_cmpuint (m->retries, ==, 2);
+  g_assert_cmpuint (m->bytes_in, >=, 2);
+
+  grl_net_wc_get_histogram (fixture->wc, GRL_NET_WC_METRIC_TOTAL, counts);
+  for (i = 0, total = 0; i < GRL_NET_WC_HISTOGRAM_BUCKETS; i++)
+    total += counts[i];
+  g_assert_cmpuint (total, ==, 2);
+
+  grl_net_wc_reset_metrics (fixture->wc);
+  grl_net_wc_get_histogram (fixture->wc, GRL_NET_WC_METRIC_TOTAL, counts);
+  for (i = 0; i < GRL_NET_WC_HISTOGRAM_BUCKETS; i++)
+    g_assert_cmpuint (counts[i], ==, 0);
+
+  g_array_free (finished, TRUE);
+}
+
+typedef struct {
+  NetFixture *fixture;
+  gchar *content;
+  gsize length;
+  gchar *path;
+} Download;
+
+static void
+download_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  Download *download = user_data;
+  GError *error = NULL;
+
+  grl_net_downloader_download_finish (GRL_NET_DOWNLOADER (source), res,
+                                      &download->content, &download->length,
+                                      &download->path, &error);
+  g_assert_no_error (error);
+
+  if (--download->fixture->pending == 0)
+    g_main_loop_quit (download->fixture->loop);
+}
+
+static void
+net_downloader (NetFixture *fixture, gconstpointer data)
+{
+  GrlNetDownloader *downloader;
+  Download downloads[3];
+  gchar *contents;
+  gsize length;
+  guint started, shared, store_hits;
+  const gchar *store_dir;
+  gchar *small_url;
+  gchar *big_url;
+  guint i;
+
+  store_dir = net_fixture_tmp_dir (fixture);
+
+  downloader = g_object_new (GRL_TYPE_NET_DOWNLOADER,
+                             "web-client", fixture->wc,
+                             "max-downloads", 1,
+                             "spool-threshold", 1000,
+                             "store-dir", store_dir,
+                             NULL);
+
+  small_url = net_fixture_url (fixture, "sized", 1000);
+  big_url = net_fixture_url (fixture, "chunked", 100 * 1000);
+
+  /* Concurrent downloads of the same payload share the transfer */
+  memset (downloads, 0, sizeof (downloads));
+  for (i = 0; i < G_N_ELEMENTS (downloads); i++) {
+    downloads[i].fixture = fixture;
+    grl_net_downloader_download_async (downloader, i == 0? small_url: big_url,
+                                       NULL, download_cb, &downloads[i]);
+  }
+  fixture->pending = G_N_ELEMENTS (downloads);
+  g_main_loop_run (fixture->loop);
+
+  grl_net_downloader_get_stats (downloader, &started, &shared, &store_hits, NULL);
+  g_assert_cmpuint (started, ==, 2);
+  g_assert_cmpuint (shared, ==, 1);
+  g_assert_cmpuint (store_hits, ==, 0);
+
+  /* Small payloads stay in memory */
+  g_assert (downloads[0].path == NULL);
+  g_assert_cmpuint (downloads[0].length, ==, 1000);
+  g_assert (memcmp (downloads[0].content, body, 1000) == 0);
+
+  /* Big ones go to the store */
+  for (i = 1; i < G_N_ELEMENTS (downloads); i++) {
+    g_assert (downloads[i].content == NULL);
+    g_assert_cmpuint (downloads[i].length, ==, 100 * 1000);
+    g_assert (g_file_get_contents (downloads[i].path, &contents, &length, NULL));
+    g_assert_cmpuint (length, ==, 100 * 1000);
+    g_assert (memcmp (contents, body, length) == 0);
+    g_free (contents);
+  }
+  g_assert_cmpstr (downloads[1].path, ==, downloads[2].path);
+
+  for (i = 0; i < G_N_ELEMENTS (downloads); i++) {
+    g_free (downloads[i].content);
+    g_free (downloads[i].path);
+  }
+
+  /* A new instance finds it in the store */
+  g_object_unref (downloader);
+  downloader = g_object_new (GRL_TYPE_NET_DOWNLOADER,
+                             "web-client", fixture->wc,
+                             "store-dir", store_dir,
+                             NULL);
+
+  memset (downloads, 0, sizeof (downloads));
+  downloads[0].fixture = fixture;
+  grl_net_downloader_download_async (downloader, big_url,
+                                     NULL, download_cb, &downloads[0]);
+  fixture->pending = 1;
+  g_main_loop_run (fixture->loop);
+
+  grl_net_downloader_get_stats (downloader, &started, NULL, &store_hits, NULL);
+  g_assert_cmpuint (started, ==, 0);
+  g_assert_cmpuint (store_hits, ==, 1);
+  g_assert (downloads[0].path);
+
+  /* Payloads are removed when the store is full */
+  grl_net_downloader_set_store_size (downloader, 0);
+  g_assert (!g_file_test (downloads[0].path, G_FILE_TEST_EXISTS));
+  g_free (downloads[0].path);
+
+  g_object_unref (downloader);
+  g_free (big_url);
+  g_free (small_url);
+}
+
+static void
+prewarm_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  NetFixture *fixture = user_data;
+
+  g_assert (grl_net_wc_prewarm_finish (GRL_NET_WC (source), res, NULL));
+  g_main_loop_quit (fixture->loop);
+}
+
+static void
+net_prewarm (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *hosts[] = { NULL, NULL };
+  guint connections, reuses;
+  guint requests, running;
+  gchar *base;
+  gchar *url;
+
+  base = net_fixture_path_url (fixture, "");
+  hosts[0] = base;
+
+  grl_net_wc_prewarm (fixture->wc, hosts, prewarm_cb, fixture);
+  g_main_loop_run (fixture->loop);
+  g_assert_cmpuint (fixture->server_connections, ==, 1);
+
+  /* It went through the host queue */
+  g_assert (grl_net_wc_get_host_stats (fixture->wc, "127.0.0.1",
+                                       &requests, NULL, NULL, &running, NULL));
+  g_assert_cmpuint (requests, ==, 1);
+  g_assert_cmpuint (running, ==, 0);
+
+  /* The first request uses the warm connection */
+  url = net_fixture_url (fixture, "sized", 1000);
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_free (url);
+
+  grl_net_wc_get_connection_stats (fixture->wc, &connections, &reuses);
+  g_assert_cmpuint (fixture->server_connections, ==, 1);
+  g_assert_cmpuint (connections, ==, 1);
+  g_assert_cmpuint (reuses, ==, 1);
+
+  g_free (base);
+}
+
+static void
+net_compression (NetFixture *fixture, gconstpointer data)
+{
+  gsize size = 1024 * 1024;
+  guint64 wire, decoded;
+  gchar *url;
+
+  url = net_fixture_url (fixture, "gzip", size);
+
+  /* Compressed on the wire, decoded for the caller */
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, size);
+  g_assert (memcmp (fixture->content, body, size) == 0);
+
+  grl_net_wc_get_transfer_stats (fixture->wc, &wire, &decoded);
+  g_assert_cmpuint (decoded, ==, size);
+  g_assert_cmpuint (wire, <, size / 10);
+
+  /* Without compression the content is sent as is */
+  grl_net_wc_set_compression (fixture->wc, FALSE);
+  net_fixture_fetch (fixture, url);
+  g_assert_no_error (fixture->error);
+  g_assert_cmpuint (fixture->length, ==, size);
+  g_assert (memcmp (fixture->content, body, size) == 0);
+
+  grl_net_wc_get_transfer_stats (fixture->wc, &wire, &decoded);
+  g_assert_cmpuint (decoded, ==, 2 * size);
+  g_assert_cmpuint (wire, >, size);
+
+  g_free (url);
+}
+
+static void
+net_benchmark (NetFixture *fixture, gconstpointer data)
+{
+  const gchar *kind = data;
+  gdouble elapsed;
+  gchar *url;
+  guint i;
+
+  url = net_fixture_url (fixture, kind, BODY_SIZE);
+
+  /* Warm up the connection and the buffer pool */
+  net_fixture_fetch (fixture, url);
+
+  g_test_timer_start ();
+  for (i = 0; i < BENCHMARK_RUNS; i++) {
+    net_fixture_fetch (fixture, url);
+    g_assert_no_error (fixture->error);
+    g_assert_cmpuint (fixture->length, ==, BODY_SIZE);
+  }
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed / BENCHMARK_RUNS,
+                           "%s %d Mb response: %.3f s",
+                           kind, BODY_SIZE / (1024 * 1024),
+                           elapsed / BENCHMARK_RUNS);
+  g_test_maximized_result (BENCHMARK_RUNS * (BODY_SIZE / (1024.0 * 1024.0)) / elapsed,
+                           "%s throughput: %.1f Mb/s", kind,
+                           BENCHMARK_RUNS * (BODY_SIZE / (1024.0 * 1024.0)) / elapsed);
+
+  g_free (url);
+}
+
+int
+main (int argc, char **argv)
+{
+  guint i;
+
+  g_test_init (&argc, &argv, NULL);
+
+  grl_init (&argc, &argv);
+
+  body = g_malloc (BODY_SIZE);
+  for (i = 0; i < BODY_SIZE; i++)
+    body[i] = 'a' + i % 26;
+
+  g_test_add ("/net/content/sized",
+              NetFixture, "sized",
+              net_fixture_setup,
+              net_content,
+              net_fixture_teardown);
+  g_test_add ("/net/content/chunked",
+              NetFixture, "chunked",
+              net_fixture_setup,
+              net_content,
+              net_fixture_teardown);
+  g_test_add ("/net/stream/sized",
+              NetFixture, "sized",
+              net_fixture_setup,
+              net_stream,
+              net_fixture_teardown);
+  g_test_add ("/net/stream/chunked",
+              NetFixture, "chunked",
+              net_fixture_setup,
+              net_stream,
+              net_fixture_teardown);
+#if GLIB_CHECK_VERSION(2,32,0)
+  g_test_add ("/net/content/bytes",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_bytes,
+              net_fixture_teardown);
+#endif
+  g_test_add ("/net/content/malformed",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_malformed,
+              net_fixture_teardown);
+  g_test_add ("/net/connections/keep-alive",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_keep_alive,
+              net_fixture_teardown);
+  g_test_add ("/net/connections/no-keep-alive",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_no_keep_alive,
+              net_fixture_teardown);
+  g_test_add ("/net/connections/properties",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_connection_properties,
+              net_fixture_teardown);
+  g_test_add ("/net/connections/max-conns",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_max_conns,
+              net_fixture_teardown);
+  g_test_add ("/net/retry/success",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_retry,
+              net_fixture_teardown);
+  g_test_add ("/net/retry/exhausted",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_retry_exhausted,
+              net_fixture_teardown);
+  g_test_add ("/net/retry/retry-after",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_retry_after,
+              net_fixture_teardown);
+  g_test_add ("/net/cache/revalidate",
+              NetFixture, "/etag/a",
+              net_fixture_setup,
+              net_revalidate,
+              net_fixture_teardown);
+  g_test_add ("/net/cache/revalidate-big",
+              NetFixture, "/etag/big",
+              net_fixture_setup,
+              net_revalidate,
+              net_fixture_teardown);
+  g_test_add ("/net/cache/stats",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_cache_stats,
+              net_fixture_teardown);
+  g_test_add ("/net/cache/memory",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_memory_cache,
+              net_fixture_teardown);
+  g_test_add ("/net/cache/isolation",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_cache_isolation,
+              net_fixture_teardown);
+  g_test_add ("/net/queue/priority",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_priority,
+              net_fixture_teardown);
+  g_test_add ("/net/queue/rate-limit",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_rate_limit,
+              net_fixture_teardown);
+  g_test_add ("/net/queue/burst",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_burst,
+              net_fixture_teardown);
+  g_test_add ("/net/queue/host-limits",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_host_limits,
+              net_fixture_teardown);
+  g_test_add ("/net/queue/cancel",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_cancel_queued,
+              net_fixture_teardown);
+  g_test_add ("/net/coalesce/shared",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_coalesce,
+              net_fixture_teardown);
+  g_test_add ("/net/coalesce/cancel",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_coalesce_cancel,
+              net_fixture_teardown);
+  g_test_add ("/net/record-replay",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_record_replay,
+              net_fixture_teardown);
+  g_test_add ("/net/metrics",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_metrics,
+              net_fixture_teardown);
+  g_test_add ("/net/downloader",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_downloader,
+              net_fixture_teardown);
+  g_test_add ("/net/prewarm",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_prewarm,
+              net_fixture_teardown);
+  g_test_add ("/net/compression",
+              NetFixture, NULL,
+              net_fixture_setup,
+              net_compression,
+              net_fixture_teardown);
+
+  if (g_test_perf ()) {
+    g_test_add ("/net/benchmark/sized",
+                NetFixture, "sized",
+                net_fixture_setup,
+                net_benchmark,
+                net_fixture_teardown);
+    g_test_add ("/net/benchmark/chunked",
+                NetFixture, "chunked",
+                net_fixture_setup,
+                net_benchmark,
+                net_fixture_teardown);
+  }
+
+  return g_test_run ();
+}
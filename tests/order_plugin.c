@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* Plugin built once per ORDER_PLUGIN_ID, recording when it is initialized
+   in the "order-test-inits" array of the registry, and whether it is in the
+   thread set as "order-test-thread". It has no sources, unless it is built
+   with ORDER_PLUGIN_SOURCE: then it registers a browsable source with that
+   identifier */
+
+#include <grilo.h>
+
+#ifdef ORDER_PLUGIN_SOURCE
+typedef struct {
+  GrlMediaSource parent;
+} OrderSource;
+
+typedef struct {
+  GrlMediaSourceClass parent_class;
+} OrderSourceClass;
+
+static GType order_source_get_type (void);
+
+G_DEFINE_TYPE (OrderSource, order_source, GRL_TYPE_MEDIA_SOURCE);
+
+static void
+order_source_browse (GrlMediaSource *source,
+                     GrlMediaSourceBrowseSpec *bs)
+{
+  bs->callback (source, bs->browse_id, NULL, 0, bs->user_data, NULL);
+}
+
+static void
+order_source_class_init (OrderSourceClass *klass)
+{
+  GRL_MEDIA_SOURCE_CLASS (klass)->browse = order_source_browse;
+}
+
+static void
+order_source_init (OrderSource *source)
+{
+}
+#endif
+
+static gboolean
+order_plugin_init (GrlPluginRegistry *registry,
+                   const GrlPluginInfo *plugin,
+                   GList *configs)
+{
+  GPtrArray *inits;
+
+  inits = g_object_get_data (G_OBJECT (registry), "order-test-inits");
+  if (!inits)
+    return FALSE;
+
+  if (g_thread_self () ==
+      g_object_get_data (G_OBJECT (registry), "order-test-thread"))
+    g_ptr_array_add (inits, ORDER_PLUGIN_ID);
+  else
+    g_ptr_array_add (inits, "wrong-thread");
+
+#ifdef ORDER_PLUGIN_SOURCE
+  return grl_plugin_registry_register_source (registry,
+                                              plugin,
+                                              g_object_new (order_source_get_type (),
+                                                            "source-id", ORDER_PLUGIN_SOURCE,
+                                                            "source-name", ORDER_PLUGIN_SOURCE,
+                                                            NULL),
+                                              NULL);
+#else
+  return TRUE;
+#endif
+}
+
+GRL_PLUGIN_REGISTER (order_plugin_init, NULL, ORDER_PLUGIN_ID);
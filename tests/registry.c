@@ -24,9 +24,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+#include <utime.h>
 
 #include <grilo.h>
 
+#include "test-utils.h"
+
+#define BENCHMARK_PLUGINS 60
+#define BENCHMARK_RUNS 20
+
+#define ORDER_PLUGINS "abcd"
+
 #define CHECK_MESSAGE(domain, error_message) \
   (g_strcmp0 (log_domain, domain) == 0 && strstr (message, error_message))
 
@@ -41,12 +51,15 @@ registry_load_error_handler (const gchar *log_domain,
       CHECK_MESSAGE ("Grilo", "Configuration not provided") ||
       CHECK_MESSAGE ("Grilo", "Missing configuration") ||
       CHECK_MESSAGE ("Grilo", "Could not open plugin directory") ||
-      CHECK_MESSAGE ("Grilo", "Could not read XML file")) {
+      CHECK_MESSAGE ("Grilo", "Could not read XML file") ||
+      CHECK_MESSAGE ("Grilo", "Failed to open module") ||
+      CHECK_MESSAGE ("Grilo", "No plugins loaded from directory")) {
     return FALSE;
   }
 
   return TRUE;
 }
+
 #endif
 
 typedef struct {
@@ -89,15 +102,155 @@ registry_load (RegistryFixture *fixture, gconstpointer data)
   g_assert_cmpint (res, ==, TRUE);
 }
 
+static void
+registry_load_time (RegistryFixture *fixture, gconstpointer data)
+{
+  GList *sources;
+  GList *sources_iter;
+  const gchar *plugin_id;
+
+  sources = grl_plugin_registry_get_sources (fixture->registry, FALSE);
+  for (sources_iter = sources; sources_iter;
+       sources_iter = g_list_next (sources_iter)) {
+    plugin_id = grl_media_plugin_get_id (GRL_MEDIA_PLUGIN (sources_iter->data));
+    g_assert_cmpfloat (grl_plugin_registry_get_load_time (fixture->registry,
+                                                          plugin_id), >=, 0);
+  }
+  g_list_free (sources);
+
+  g_assert_cmpfloat (grl_plugin_registry_get_load_time (fixture->registry,
+                                                        "not-a-plugin"), ==, -1);
+}
+
+static void
+registry_indexes (RegistryFixture *fixture, gconstpointer data)
+{
+  GList *sources;
+  GList *sources_iter;
+  const GList *indexed;
+  const GList *keys;
+  GrlMetadataSource *source;
+  GrlSupportedOps ops;
+
+  for (ops = GRL_OP_METADATA; ops <= GRL_OP_NOTIFY_CHANGE; ops <<= 1) {
+    /* Same sources, by rank */
+    sources = grl_plugin_registry_get_sources_by_operations (fixture->registry,
+                                                             ops, FALSE);
+    indexed = grl_plugin_registry_peek_sources_by_operations (fixture->registry,
+                                                              ops);
+    g_assert_cmpuint (g_list_length ((GList *) indexed), ==,
+                      g_list_length (sources));
+    for (; indexed; indexed = g_list_next (indexed)) {
+      g_assert (g_list_find (sources, indexed->data));
+      if (indexed->next) {
+        g_assert_cmpint (grl_media_plugin_get_rank (indexed->data), >=,
+                         grl_media_plugin_get_rank (indexed->next->data));
+      }
+    }
+    g_list_free (sources);
+
+    /* Looking up the index again gives the same list */
+    g_assert (grl_plugin_registry_peek_sources_by_operations (fixture->registry, ops) ==
+              grl_plugin_registry_peek_sources_by_operations (fixture->registry, ops));
+  }
+
+  sources = grl_plugin_registry_get_sources (fixture->registry, FALSE);
+  for (sources_iter = sources; sources_iter;
+       sources_iter = g_list_next (sources_iter)) {
+    source = GRL_METADATA_SOURCE (sources_iter->data);
+    for (keys = grl_metadata_source_writable_keys (source); keys;
+         keys = g_list_next (keys)) {
+      indexed = grl_plugin_registry_peek_sources_by_key (fixture->registry,
+                                                         keys->data,
+                                                         GRL_SOURCE_KEYS_WRITABLE);
+      g_assert (g_list_find ((GList *) indexed, source));
+    }
+  }
+  g_list_free (sources);
+}
+
+static gpointer
+registry_snapshot_thread (gpointer data)
+{
+  GrlPluginRegistrySnapshot *snapshot;
+  const GList *sources;
+  guint count = 0;
+
+  snapshot = grl_plugin_registry_get_snapshot (grl_plugin_registry_get_default ());
+  for (sources = grl_plugin_registry_snapshot_get_sources (snapshot); sources;
+       sources = g_list_next (sources)) {
+    g_assert (grl_plugin_registry_snapshot_lookup_source (snapshot,
+                                                          grl_media_plugin_get_id (sources->data)));
+    count++;
+  }
+  g_assert (grl_plugin_registry_snapshot_lookup_metadata_key_relation (snapshot,
+                                                                       GRL_METADATA_KEY_TITLE));
+  grl_plugin_registry_snapshot_unref (snapshot);
+
+  return GUINT_TO_POINTER (count);
+}
+
+static void
+registry_snapshot (RegistryFixture *fixture, gconstpointer data)
+{
+  GrlPluginRegistrySnapshot *snapshot;
+  GrlPluginRegistrySnapshot *other;
+  GrlSupportedOps ops;
+  const GList *sources;
+  const GList *indexed;
+  GThread *thread;
+
+  snapshot = grl_plugin_registry_get_snapshot (fixture->registry);
+
+  /* It is shared while the registry does not change */
+  other = grl_plugin_registry_get_snapshot (fixture->registry);
+  g_assert (snapshot == other);
+  grl_plugin_registry_snapshot_unref (other);
+
+  for (ops = GRL_OP_NONE; ops <= GRL_OP_NOTIFY_CHANGE; ops = ops? ops << 1: 1) {
+    sources = grl_plugin_registry_snapshot_get_sources_by_operations (snapshot,
+                                                                      ops);
+    indexed = grl_plugin_registry_peek_sources_by_operations (fixture->registry,
+                                                              ops);
+    for (; sources && indexed;
+         sources = g_list_next (sources), indexed = g_list_next (indexed)) {
+      g_assert (sources->data == indexed->data);
+    }
+    g_assert (!sources && !indexed);
+  }
+
+  /* Combined operations are computed on demand */
+  ops = GRL_OP_BROWSE | GRL_OP_SEARCH;
+  sources = grl_plugin_registry_snapshot_get_sources_by_operations (snapshot,
+                                                                    ops);
+  g_assert_cmpuint (g_list_length ((GList *) sources), ==,
+                    g_list_length ((GList *)
+                                   grl_plugin_registry_peek_sources_by_operations (fixture->registry,
+                                                                                   ops)));
+  g_assert (grl_plugin_registry_snapshot_get_sources_by_operations (snapshot, ops) ==
+            sources);
+
+  /* It can be used from other threads */
+  thread = g_thread_create (registry_snapshot_thread, NULL, TRUE, NULL);
+  g_assert (thread);
+  g_assert_cmpuint (GPOINTER_TO_UINT (g_thread_join (thread)), ==,
+                    g_list_length ((GList *)
+                                   grl_plugin_registry_snapshot_get_sources (snapshot)));
+
+  grl_plugin_registry_snapshot_unref (snapshot);
+}
+
 static void
 registry_unregister (RegistryFixture *fixture, gconstpointer data)
 {
+  GrlPluginRegistrySnapshot *snapshot;
   GList *sources = NULL;
   GList *sources_iter;
   int i;
 
   g_test_bug ("627207");
 
+  snapshot = grl_plugin_registry_get_snapshot (fixture->registry);
   sources = grl_plugin_registry_get_sources (fixture->registry, FALSE);
 
   for (sources_iter = sources, i = 0; sources_iter;
@@ -119,11 +272,370 @@ registry_unregister (RegistryFixture *fixture, gconstpointer data)
 
   /* After unregistering the sources, we don't expect any */
   g_assert_cmpint (i, ==, 0);
+
+  /* Nor in the indexes */
+  g_assert (!grl_plugin_registry_peek_sources_by_operations (fixture->registry,
+                                                             GRL_OP_NONE));
+  g_assert (!grl_plugin_registry_peek_sources_by_operations (fixture->registry,
+                                                             GRL_OP_RESOLVE));
+  g_assert (!grl_plugin_registry_peek_sources_by_key (fixture->registry,
+                                                      GRL_METADATA_KEY_TITLE,
+                                                      GRL_SOURCE_KEYS_SUPPORTED));
+
+  /* Snapshots taken before still have them */
+  g_assert (grl_plugin_registry_snapshot_get_sources (snapshot));
+  grl_plugin_registry_snapshot_unref (snapshot);
+
+  snapshot = grl_plugin_registry_get_snapshot (fixture->registry);
+  g_assert (!grl_plugin_registry_snapshot_get_sources (snapshot));
+  grl_plugin_registry_snapshot_unref (snapshot);
+}
+
+/* Loads the order test plugin declaring its source only when it is used */
+static void
+registry_lazy (void)
+{
+  GrlPluginRegistry *registry;
+  GrlMediaPlugin *source;
+  GPtrArray *inits;
+  GList *sources;
+  gchar *dir;
+  gchar *file;
+  gchar *module;
+  const gchar *xml =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<plugin>\n"
+    "  <info>\n"
+    "    <name>Lazy</name>\n"
+    "    <module>libgrlorderlazy</module>\n"
+    "    <sources>grl-order-lazy-source</sources>\n"
+    "    <operations>browse</operations>\n"
+    "  </info>\n"
+    "</plugin>\n";
+
+#if GLIB_CHECK_VERSION(2,22,0)
+  g_test_log_set_fatal_handler (registry_load_error_handler, NULL);
+#endif
+
+  dir = test_make_tmp_dir ("grilo-registry-test");
+  file = g_build_filename (dir, "grl-order-lazy.xml", NULL);
+  g_assert (g_file_set_contents (file, xml, -1, NULL));
+  g_free (file);
+
+  module = g_strdup_printf ("%s/libgrlorderlazy.%s",
+                            TEST_PLUGINS_DIR, G_MODULE_SUFFIX);
+  file = g_strdup_printf ("%s/libgrlorderlazy.%s", dir, G_MODULE_SUFFIX);
+  g_assert (symlink (module, file) == 0);
+  g_free (file);
+  g_free (module);
+
+  registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+  inits = g_ptr_array_new ();
+  g_object_set_data (G_OBJECT (registry), "order-test-inits", inits);
+  g_object_set_data (G_OBJECT (registry), "order-test-thread", g_thread_self ());
+  grl_plugin_registry_add_directory (registry, dir);
+  grl_plugin_registry_set_lazy_loading (registry, TRUE);
+
+  /* Nothing is loaded yet */
+  g_assert (grl_plugin_registry_load_all (registry, NULL));
+  g_assert_cmpuint (inits->len, ==, 0);
+
+  /* Sources not supporting the operations do not need the plugin */
+  g_list_free (grl_plugin_registry_get_sources_by_operations (registry,
+                                                              GRL_OP_STORE,
+                                                              FALSE));
+  g_assert_cmpuint (inits->len, ==, 0);
+
+  /* Declared sources are listed without loading the plugin */
+  sources = grl_plugin_registry_get_deferred_sources (registry, GRL_OP_BROWSE);
+  g_assert_cmpuint (g_list_length (sources), ==, 1);
+  g_assert_cmpstr (sources->data, ==, "grl-order-lazy-source");
+  g_list_foreach (sources, (GFunc) g_free, NULL);
+  g_list_free (sources);
+  g_assert (!grl_plugin_registry_get_deferred_sources (registry, GRL_OP_STORE));
+  g_assert_cmpuint (inits->len, ==, 0);
+
+  /* The first lookup loads it, in the calling thread */
+  source = grl_plugin_registry_lookup_source (registry, "grl-order-lazy-source");
+  g_assert (GRL_IS_MEDIA_SOURCE (source));
+  g_assert_cmpstr (grl_metadata_source_get_id (GRL_METADATA_SOURCE (source)),
+                   ==, "grl-order-lazy-source");
+  g_assert_cmpstr (grl_media_plugin_get_id (source), ==, "grl-order-lazy");
+  g_assert_cmpuint (inits->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (inits, 0), ==, "grl-order-lazy");
+
+  /* And it is not loaded again */
+  g_assert (grl_plugin_registry_lookup_source (registry,
+                                               "grl-order-lazy-source") == source);
+  sources = grl_plugin_registry_get_sources_by_operations (registry,
+                                                           GRL_OP_BROWSE,
+                                                           FALSE);
+  g_assert (g_list_find (sources, source));
+  g_list_free (sources);
+  g_assert (!grl_plugin_registry_get_deferred_sources (registry, GRL_OP_NONE));
+  g_assert_cmpuint (inits->len, ==, 1);
+
+  g_object_unref (registry);
+  g_ptr_array_free (inits, TRUE);
+
+  file = g_build_filename (dir, "grl-order-lazy.xml", NULL);
+  g_remove (file);
+  g_free (file);
+  file = g_strdup_printf ("%s/libgrlorderlazy.%s", dir, G_MODULE_SUFFIX);
+  g_remove (file);
+  g_free (file);
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+/* Loads the order test plugins with several threads: their modules are
+   opened in worker threads, but they must be initialized in the main thread
+   by rank, highest first, and then by identifier */
+static void
+registry_load_threads (void)
+{
+  GrlPluginRegistry *registry;
+  GPtrArray *inits;
+  gchar *dir;
+  gchar *file;
+  gchar *module;
+  gchar *xml;
+  const gchar *p;
+
+#if GLIB_CHECK_VERSION(2,22,0)
+  g_test_log_set_fatal_handler (registry_load_error_handler, NULL);
+#endif
+
+  dir = test_make_tmp_dir ("grilo-registry-test");
+
+  for (p = ORDER_PLUGINS; *p; p++) {
+    xml = g_strdup_printf ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                           "<plugin>\n"
+                           "  <info>\n"
+                           "    <name>Order %c</name>\n"
+                           "    <module>libgrlorder%c</module>\n"
+                           "  </info>\n"
+                           "</plugin>\n",
+                           *p, *p);
+    file = g_strdup_printf ("%s/grl-order-%c.xml", dir, *p);
+    g_assert (g_file_set_contents (file, xml, -1, NULL));
+    g_free (file);
+    g_free (xml);
+
+    module = g_strdup_printf ("%s/libgrlorder%c.%s",
+                              TEST_PLUGINS_DIR, *p, G_MODULE_SUFFIX);
+    file = g_strdup_printf ("%s/libgrlorder%c.%s", dir, *p, G_MODULE_SUFFIX);
+    g_assert (symlink (module, file) == 0);
+    g_free (file);
+    g_free (module);
+  }
+
+  /* Ranks are read when the registry is created */
+  g_setenv (GRL_PLUGIN_RANKS_VAR,
+            "grl-order-a:1,grl-order-b:5,grl-order-c:3,grl-order-d:5", TRUE);
+  registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+  g_unsetenv (GRL_PLUGIN_RANKS_VAR);
+
+  inits = g_ptr_array_new ();
+  g_object_set_data (G_OBJECT (registry), "order-test-inits", inits);
+  g_object_set_data (G_OBJECT (registry), "order-test-thread", g_thread_self ());
+
+  grl_plugin_registry_add_directory (registry, dir);
+  grl_plugin_registry_set_load_threads (registry, 4);
+  g_assert (grl_plugin_registry_load_all (registry, NULL));
+
+  g_assert_cmpuint (inits->len, ==, 4);
+  g_assert_cmpstr (g_ptr_array_index (inits, 0), ==, "grl-order-b");
+  g_assert_cmpstr (g_ptr_array_index (inits, 1), ==, "grl-order-d");
+  g_assert_cmpstr (g_ptr_array_index (inits, 2), ==, "grl-order-c");
+  g_assert_cmpstr (g_ptr_array_index (inits, 3), ==, "grl-order-a");
+
+  g_object_unref (registry);
+  g_ptr_array_free (inits, TRUE);
+
+  for (p = ORDER_PLUGINS; *p; p++) {
+    file = g_strdup_printf ("%s/grl-order-%c.xml", dir, *p);
+    g_remove (file);
+    g_free (file);
+    file = g_strdup_printf ("%s/libgrlorder%c.%s", dir, *p, G_MODULE_SUFFIX);
+    g_remove (file);
+    g_free (file);
+  }
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+/* Creates a directory with the information of plugins whose modules do not
+   exist, so only the information is loaded */
+static gchar *
+create_plugin_infos (void)
+{
+  gchar *dir;
+  gchar *file;
+  gchar *xml;
+  guint i;
+
+  dir = test_make_tmp_dir ("grilo-registry-test");
+
+  for (i = 0; i < BENCHMARK_PLUGINS; i++) {
+    xml = g_strdup_printf ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                           "<plugin>\n"
+                           "  <info>\n"
+                           "    <name>Benchmark %u</name>\n"
+                           "    <module>libgrlbenchmark%u</module>\n"
+                           "    <description>Benchmark plugin %u</description>\n"
+                           "    <author>Igalia S.L.</author>\n"
+                           "    <license>LGPL</license>\n"
+                           "    <site>http://www.igalia.com</site>\n"
+                           "  </info>\n"
+                           "</plugin>\n",
+                           i, i, i);
+    file = g_strdup_printf ("%s/grl-benchmark-%02u.xml", dir, i);
+    g_assert (g_file_set_contents (file, xml, -1, NULL));
+    g_free (file);
+    g_free (xml);
+  }
+
+  return dir;
+}
+
+static void
+remove_plugin_infos (gchar *dir)
+{
+  gchar *file;
+  guint i;
+
+  for (i = 0; i < BENCHMARK_PLUGINS; i++) {
+    file = g_strdup_printf ("%s/grl-benchmark-%02u.xml", dir, i);
+    g_remove (file);
+    g_free (file);
+  }
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+static gchar *
+get_info_cache_path (const gchar *dir)
+{
+  gchar *checksum;
+  gchar *path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, dir, -1);
+  path = g_build_filename (g_get_user_cache_dir (), "grilo", "plugin-info",
+                           checksum, NULL);
+  g_free (checksum);
+
+  return path;
+}
+
+/* A cache written while only some plugins are allowed gets the others once
+   they are read, and is then left alone */
+static void
+registry_info_cache_restricted (void)
+{
+  GrlPluginRegistry *registry;
+  gchar *allowed[] = { "grl-benchmark-00", NULL };
+  struct utimbuf times;
+  struct stat st;
+  goffset size;
+  gchar *cache;
+  gchar *dir;
+
+#if GLIB_CHECK_VERSION(2,22,0)
+  g_test_log_set_fatal_handler (registry_load_error_handler, NULL);
+#endif
+
+  dir = create_plugin_infos ();
+  cache = get_info_cache_path (dir);
+
+  registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+  grl_plugin_registry_restrict_plugins (registry, allowed);
+  grl_plugin_registry_load_directory (registry, dir, NULL);
+  g_object_unref (registry);
+
+  g_assert (g_stat (cache, &st) == 0);
+  size = st.st_size;
+
+  /* The missing plugins are added */
+  registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+  grl_plugin_registry_load_directory (registry, dir, NULL);
+  g_object_unref (registry);
+
+  g_assert (g_stat (cache, &st) == 0);
+  g_assert_cmpint (st.st_size, >, size);
+
+  /* Nothing is missing anymore */
+  times.actime = times.modtime = 1;
+  g_assert (g_utime (cache, &times) == 0);
+
+  registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+  grl_plugin_registry_load_directory (registry, dir, NULL);
+  g_object_unref (registry);
+
+  g_assert (g_stat (cache, &st) == 0);
+  g_assert_cmpint (st.st_mtime, ==, 1);
+
+  g_free (cache);
+  remove_plugin_infos (dir);
+}
+
+/* Time to read the plugin information in a fresh registry, with and without
+   a valid cache */
+static void
+registry_info_cache_benchmark (void)
+{
+  GrlPluginRegistry *registry;
+  struct utimbuf times;
+  gdouble parsed = 0;
+  gdouble cached = 0;
+  gchar *dir;
+  guint i;
+
+#if GLIB_CHECK_VERSION(2,22,0)
+  g_test_log_set_fatal_handler (registry_load_error_handler, NULL);
+#endif
+
+  dir = create_plugin_infos ();
+
+  for (i = 0; i < BENCHMARK_RUNS; i++) {
+    /* A new modification time makes the cache stale */
+    times.actime = times.modtime = i + 1;
+    g_assert (g_utime (dir, &times) == 0);
+
+    registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+    g_test_timer_start ();
+    grl_plugin_registry_load_directory (registry, dir, NULL);
+    parsed += g_test_timer_elapsed ();
+    g_object_unref (registry);
+
+    registry = g_object_new (GRL_TYPE_PLUGIN_REGISTRY, NULL);
+    g_test_timer_start ();
+    grl_plugin_registry_load_directory (registry, dir, NULL);
+    cached += g_test_timer_elapsed ();
+    g_object_unref (registry);
+  }
+
+  g_test_minimized_result (parsed / BENCHMARK_RUNS,
+                           "%d plugins, parsed: %.3f ms",
+                           BENCHMARK_PLUGINS,
+                           parsed * 1000 / BENCHMARK_RUNS);
+  g_test_minimized_result (cached / BENCHMARK_RUNS,
+                           "%d plugins, cached: %.3f ms",
+                           BENCHMARK_PLUGINS,
+                           cached * 1000 / BENCHMARK_RUNS);
+
+  remove_plugin_infos (dir);
 }
 
 int
 main (int argc, char **argv)
 {
+  gchar *cache_dir;
+  gint result;
+
+  /* Keep the plugin information cache out of the user's */
+  cache_dir = test_use_tmp_cache_dir ();
+
   g_test_init (&argc, &argv, NULL);
 
   g_test_bug_base ("http://bugs.gnome.org/%s");
@@ -139,11 +651,46 @@ main (int argc, char **argv)
               registry_load,
               registry_fixture_teardown);
 
+  g_test_add ("/registry/load-time",
+              RegistryFixture, NULL,
+              registry_fixture_setup,
+              registry_load_time,
+              registry_fixture_teardown);
+
+  g_test_add ("/registry/indexes",
+              RegistryFixture, NULL,
+              registry_fixture_setup,
+              registry_indexes,
+              registry_fixture_teardown);
+
+  g_test_add ("/registry/snapshot",
+              RegistryFixture, NULL,
+              registry_fixture_setup,
+              registry_snapshot,
+              registry_fixture_teardown);
+
   g_test_add ("/registry/unregister",
               RegistryFixture, NULL,
               registry_fixture_setup,
               registry_unregister,
               registry_fixture_teardown);
 
-  return g_test_run ();
+  g_test_add_func ("/registry/lazy", registry_lazy);
+
+  g_test_add_func ("/registry/load-threads", registry_load_threads);
+
+  g_test_add_func ("/registry/info-cache-restricted",
+                   registry_info_cache_restricted);
+
+  if (g_test_perf ()) {
+    g_test_add_func ("/registry/benchmark/info-cache",
+                     registry_info_cache_benchmark);
+  }
+
+  result = g_test_run ();
+
+  test_remove_tree (cache_dir);
+  g_free (cache_dir);
+
+  return result;
 }
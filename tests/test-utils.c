@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* Helpers shared by the test programs */
+
+#undef G_DISABLE_ASSERT
+
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "test-utils.h"
+
+/* Creates a new directory in the temporary directory, named after @prefix */
+gchar *
+test_make_tmp_dir (const gchar *prefix)
+{
+  gchar *name;
+  gchar *dir;
+
+  name = g_strdup_printf ("%s-XXXXXX", prefix);
+  dir = g_build_filename (g_get_tmp_dir (), name, NULL);
+  g_free (name);
+
+#if GLIB_CHECK_VERSION(2,30,0)
+  g_assert (g_mkdtemp (dir));
+#else
+  g_assert (mkdtemp (dir));
+#endif
+
+  return dir;
+}
+
+/* Removes @path and everything below it */
+void
+test_remove_tree (const gchar *path)
+{
+  const gchar *name;
+  gchar *child;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (!dir) {
+    g_remove (path);
+    return;
+  }
+
+  while ((name = g_dir_read_name (dir))) {
+    child = g_build_filename (path, name, NULL);
+    test_remove_tree (child);
+    g_free (child);
+  }
+  g_dir_close (dir);
+
+  g_rmdir (path);
+}
+
+/* Keeps the caches written by the tests out of the user's: points
+   XDG_CACHE_HOME to a new temporary directory, returned to be removed at the
+   end. GLib reads it only once, so this must be called before anything else */
+gchar *
+test_use_tmp_cache_dir (void)
+{
+  gchar *dir;
+
+  dir = test_make_tmp_dir ("grilo-test-cache");
+  g_setenv ("XDG_CACHE_HOME", dir, TRUE);
+
+  return dir;
+}